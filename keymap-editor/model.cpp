@@ -25,6 +25,7 @@
 #include <fcitx-utils/unixfd.h>
 #include <fcntl.h>
 #include <iterator>
+#include <sys/stat.h>
 #include <utility>
 
 namespace fcitx::unikey {
@@ -184,9 +185,21 @@ void KeymapModel::load() {
 }
 
 void KeymapModel::save() {
-    StandardPaths::global().safeSave(StandardPathsType::PkgConfig,
-                                     "unikey/keymap.txt",
-                                     [this](int fd) { return saveToFd(fd); });
+    if (StandardPaths::global().safeSave(
+            StandardPathsType::PkgConfig, "unikey/keymap.txt",
+            [this](int fd) { return saveToFd(fd); })) {
+        // Compiled copy next to it, so unikey reads the map at once instead
+        // of parsing the text.
+        auto path = StandardPaths::global().locate(
+            StandardPathsType::PkgConfig, "unikey/keymap.txt",
+            StandardPathsMode::User);
+        struct stat src;
+        if (!path.empty() && stat(path.c_str(), &src) == 0) {
+            int keyMap[256];
+            UkBuildKeyMap(list_, keyMap);
+            UkWriteKeyMapCache((path.string() + ".bin").c_str(), src, keyMap);
+        }
+    }
     setNeedSave(false);
 }
 
@@ -16,22 +16,24 @@
 #include <QDialog>
 #include <QFileDialog>
 #include <QItemSelectionModel>
+#include <QLineEdit>
 #include <QMessageBox>
 #include <QObject>
 #include <QPushButton>
 #include <QWidget>
 #include <Qt>
+#include <cstdio>
 #include <fcitx-utils/fs.h>
 #include <fcitx-utils/i18n.h>
 #include <fcitx-utils/standardpaths.h>
 #include <fcitxqtconfiguiwidget.h>
 #include <memory>
+#include <utility>
 
 namespace fcitx::unikey {
 
 MacroEditor::MacroEditor(QWidget *parent)
-    : FcitxQtConfigUIWidget(parent), table_(std::make_unique<CMacroTable>()),
-      model_(new MacroModel(this)) {
+    : FcitxQtConfigUIWidget(parent), model_(new MacroModel(this)) {
     setupUi(this);
 
     connect(addButton, &QPushButton::clicked, this, &MacroEditor::addWord);
@@ -43,7 +45,8 @@ MacroEditor::MacroEditor(QWidget *parent)
             &MacroEditor::importMacro);
     connect(exportButton, &QPushButton::clicked, this,
             &MacroEditor::exportMacro);
-    table_->init();
+    connect(filterEdit, &QLineEdit::textChanged, model_,
+            &MacroModel::setFilter);
     macroTableView->horizontalHeader()->setStretchLastSection(true);
     macroTableView->verticalHeader()->setVisible(false);
     macroTableView->setModel(model_);
@@ -82,7 +85,7 @@ void MacroEditor::addWord() {
     connect(dialog, &QDialog::accepted, this, &MacroEditor::addWordAccepted);
 }
 
-QString MacroEditor::getData(CMacroTable *table, int i, bool iskey) {
+QString MacroEditor::getData(const CMacroTable *table, int i, bool iskey) {
 
     char key[MAX_MACRO_KEY_LEN * 3];
     char value[MAX_MACRO_TEXT_LEN * 3];
@@ -126,17 +129,26 @@ void MacroEditor::addWordAccepted() {
 void MacroEditor::load() {
     auto path = StandardPaths::global().locate(StandardPathsType::PkgConfig,
                                                "unikey/macro");
-    table_->loadFromFile(path.string().c_str());
-    model_->load(table_.get());
+    auto table = std::make_shared<CMacroTable>();
+    table->init();
+    // the compiled copy maps the table instead of parsing it
+    table->loadFromFile(path.string().c_str(), true);
+    model_->load(std::move(table));
 }
 
 void MacroEditor::save() {
-    model_->save(table_.get());
+    // Streamed from the model, the loaded table is not rebuilt.
     StandardPaths::global().safeSave(StandardPathsType::PkgConfig,
                                      "unikey/macro", [this](int fd) -> bool {
                                          UnixFD unixFD(fd);
                                          auto f = fs::openFD(unixFD, "wb");
-                                         return table_->writeToFp(f.release());
+                                         if (!f) {
+                                             return false;
+                                         }
+                                         bool ok = model_->save(f.get());
+                                         return std::fclose(f.release()) ==
+                                                    0 &&
+                                                ok;
                                      });
 }
 
@@ -156,7 +168,11 @@ void MacroEditor::importFileSelected() {
         return;
     }
     QString file = dialog->selectedFiles()[0];
-    table_->loadFromFile(file.toUtf8().constData());
+    auto table = std::make_shared<CMacroTable>();
+    table->init();
+    if (table->loadFromFile(file.toUtf8().constData())) {
+        model_->load(std::move(table), true);
+    }
 }
 
 void MacroEditor::exportMacro() {
@@ -175,7 +191,11 @@ void MacroEditor::exportFileSelected() {
         return;
     }
     QString file = dialog->selectedFiles()[0];
-    table_->writeToFile(file.toUtf8().constData());
+    auto *f = std::fopen(file.toUtf8().constData(), "w");
+    if (f) {
+        model_->write(f);
+        std::fclose(f);
+    }
 }
 
 } // namespace fcitx::unikey
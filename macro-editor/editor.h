@@ -28,7 +28,7 @@ public:
     QString title() override;
     QString icon() override;
 
-    static QString getData(CMacroTable *table, int i, bool iskey);
+    static QString getData(const CMacroTable *table, int i, bool iskey);
 private Q_SLOTS:
     void addWord();
     void deleteWord();
@@ -41,7 +41,6 @@ private Q_SLOTS:
     void exportFileSelected();
 
 private:
-    std::unique_ptr<CMacroTable> table_;
     MacroModel *model_;
 };
 } // namespace fcitx::unikey
@@ -7,24 +7,69 @@
 #include <QApplication>
 
 #include "editor.h"
+#include "keycons.h"
 #include "model.h"
 #include "vnconv.h"
 #include <QAbstractTableModel>
+#include <QByteArray>
+#include <QChar>
 #include <QObject>
 #include <QString>
+#include <QThread>
 #include <QVariant>
 #include <Qt>
+#include <algorithm>
+#include <cstdio>
 #include <fcitx-utils/i18n.h>
+#include <memory>
 #include <utility>
 
 namespace fcitx::unikey {
 
-using ItemType = std::pair<QString, QString>;
+namespace {
+
+// rows given to the view at a time
+constexpr int fetchBatch = 1000;
+
+// Case folded, without tone and other marks, đ as d: "Việt" finds "viet".
+QString foldForSearch(const QString &str) {
+    QString decomposed =
+        str.normalized(QString::NormalizationForm_D).toCaseFolded();
+    QString folded;
+    folded.reserve(decomposed.size());
+    for (QChar c : decomposed) {
+        if (c.category() == QChar::Mark_NonSpacing) {
+            continue;
+        }
+        folded.append(c == QChar(0x0111) ? QChar(u'd') : c);
+    }
+    return folded;
+}
+
+QString foldForSearch(const QString &key, const QString &text) {
+    return foldForSearch(key + QChar(u' ') + text);
+}
+
+// UTF-8 of a key or text of the table, false if it does not convert.
+bool toUtf8(const StdVnChar *p, char *out, int size) {
+    if (!p) {
+        return false;
+    }
+    int inLen = -1;
+    return VnConvert(CONV_CHARSET_VNSTANDARD, CONV_CHARSET_UNIUTF8,
+                     (UKBYTE *)p, (UKBYTE *)out, &inLen, &size) == 0;
+}
+
+} // namespace
 
 MacroModel::MacroModel(QObject *parent)
     : QAbstractTableModel(parent), needSave_(false) {}
 
-MacroModel::~MacroModel() {}
+MacroModel::~MacroModel() {
+    if (indexThread_) {
+        indexThread_->wait();
+    }
+}
 
 QVariant MacroModel::headerData(int section, Qt::Orientation orientation,
                                 int role) const {
@@ -39,57 +84,92 @@ QVariant MacroModel::headerData(int section, Qt::Orientation orientation,
     return {};
 }
 
-int MacroModel::rowCount(const QModelIndex & /*parent*/) const {
-    return list_.count();
+int MacroModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : fetched_;
 }
 
 int MacroModel::columnCount(const QModelIndex & /*parent*/) const { return 2; }
 
 QVariant MacroModel::data(const QModelIndex &index, int role) const {
-    do {
-        if (role == Qt::DisplayRole && index.row() < list_.count()) {
-            if (index.column() == 0) {
-                return list_[index.row()].first;
-            }
-            if (index.column() == 1) {
-                return list_[index.row()].second;
-            }
-        }
-    } while (0);
-    return QVariant();
+    if (role != Qt::DisplayRole || index.row() >= fetched_ ||
+        index.column() > 1) {
+        return QVariant();
+    }
+    const int id = matches_[index.row()];
+    if (id < 0) {
+        const auto &item = added_[-1 - id];
+        return index.column() == 0 ? item.first : item.second;
+    }
+    return MacroEditor::getData(table_.get(), id, index.column() == 0);
 }
 
-void MacroModel::addItem(const QString &macro, const QString &word) {
-    if (keyset_.contains(macro)) {
+bool MacroModel::canFetchMore(const QModelIndex &parent) const {
+    return !parent.isValid() && fetched_ < static_cast<int>(matches_.size());
+}
+
+void MacroModel::fetchMore(const QModelIndex &parent) {
+    if (!canFetchMore(parent)) {
         return;
     }
-    beginInsertRows(QModelIndex(), list_.size(), list_.size());
-    list_.append(std::pair<QString, QString>(macro, word));
-    keyset_.insert(macro);
+    const int count =
+        std::min(fetchBatch, static_cast<int>(matches_.size()) - fetched_);
+    beginInsertRows(QModelIndex(), fetched_, fetched_ + count - 1);
+    fetched_ += count;
     endInsertRows();
+}
+
+void MacroModel::addItem(const QString &macro, const QString &word) {
+    if (containsKey(macro)) {
+        return;
+    }
+    const int id = -1 - static_cast<int>(added_.size());
+    added_.emplace_back(macro, word);
+    addedKeys_.insert(macro, id);
+    entries_.push_back(id);
+    if (matches(id)) {
+        // only shown once the view has the rows before it
+        const bool shown = fetched_ == static_cast<int>(matches_.size());
+        if (shown) {
+            beginInsertRows(QModelIndex(), fetched_, fetched_);
+        }
+        matches_.push_back(id);
+        if (shown) {
+            fetched_++;
+            endInsertRows();
+        }
+    }
     setNeedSave(true);
 }
 
 void MacroModel::deleteItem(int row) {
-    if (row >= list_.count()) {
+    if (row < 0 || row >= fetched_) {
         return;
     }
-    std::pair<QString, QString> item = list_.at(row);
-    QString key = item.first;
+    const int id = matches_[row];
     beginRemoveRows(QModelIndex(), row, row);
-    list_.removeAt(row);
-    keyset_.remove(key);
+    matches_.erase(matches_.begin() + row);
+    fetched_--;
     endRemoveRows();
+    entries_.erase(std::find(entries_.begin(), entries_.end(), id));
+    if (id < 0) {
+        addedKeys_.remove(added_[-1 - id].first);
+    } else {
+        deleted_[id] = true;
+    }
     setNeedSave(true);
 }
 
 void MacroModel::deleteAllItem() {
-    if (list_.count()) {
+    if (!entries_.empty()) {
         setNeedSave(true);
     }
     beginResetModel();
-    list_.clear();
-    keyset_.clear();
+    entries_.clear();
+    matches_.clear();
+    fetched_ = 0;
+    added_.clear();
+    addedKeys_.clear();
+    deleted_.assign(deleted_.size(), true);
     endResetModel();
 }
 
@@ -102,26 +182,141 @@ void MacroModel::setNeedSave(bool needSave) {
 
 bool MacroModel::needSave() const { return needSave_; }
 
-void MacroModel::load(CMacroTable *table) {
+void MacroModel::load(std::shared_ptr<const CMacroTable> table,
+                      bool changed) {
+    if (indexThread_) {
+        indexThread_->wait();
+    }
     beginResetModel();
-    list_.clear();
-    keyset_.clear();
-    for (int i = 0; i < table->getCount(); i++) {
-        QString key = MacroEditor::getData(table, i, true);
-        QString value = MacroEditor::getData(table, i, false);
-        list_.append(std::pair<QString, QString>(key, value));
-        keyset_.insert(key);
+    table_ = std::move(table);
+    const int count = table_ ? table_->getCount() : 0;
+    added_.clear();
+    addedKeys_.clear();
+    deleted_.assign(count, false);
+    entries_.resize(count);
+    for (int i = 0; i < count; i++) {
+        entries_[i] = i;
     }
     endResetModel();
+    buildIndex();
+    applyFilter();
+    setNeedSave(changed);
+}
+
+void MacroModel::buildIndex() {
+    const auto generation = ++indexGeneration_;
+    index_.reset();
+    pendingIndex_ = std::make_shared<MacroSearchIndex>();
+    indexThread_.reset(
+        QThread::create([table = table_, index = pendingIndex_]() {
+            const int count = table ? table->getCount() : 0;
+            index->folded.reserve(count);
+            index->keys.reserve(count);
+            for (int i = 0; i < count; i++) {
+                auto key = MacroEditor::getData(table.get(), i, true);
+                auto text = MacroEditor::getData(table.get(), i, false);
+                index->folded.push_back(foldForSearch(key, text));
+                index->keys.insert(key, i);
+            }
+        }));
+    connect(indexThread_.get(), &QThread::finished, this,
+            [this, generation]() {
+                if (generation == indexGeneration_ && !index_) {
+                    index_ = pendingIndex_;
+                }
+            });
+    indexThread_->start();
+}
+
+const MacroSearchIndex &MacroModel::index() {
+    if (!index_) {
+        indexThread_->wait();
+        index_ = pendingIndex_;
+    }
+    return *index_;
+}
+
+bool MacroModel::containsKey(const QString &key) {
+    if (addedKeys_.contains(key)) {
+        return true;
+    }
+    if (!table_) {
+        return false;
+    }
+    auto iter = index().keys.constFind(key);
+    return iter != index().keys.constEnd() && !deleted_[*iter];
+}
+
+bool MacroModel::matches(int id) const {
+    if (filter_.isEmpty()) {
+        return true;
+    }
+    if (id < 0) {
+        const auto &item = added_[-1 - id];
+        return foldForSearch(item.first, item.second).contains(filter_);
+    }
+    return index_->folded[id].contains(filter_);
+}
+
+void MacroModel::setFilter(const QString &filter) {
+    auto folded = foldForSearch(filter.trimmed());
+    if (folded == filter_) {
+        return;
+    }
+    filter_ = std::move(folded);
+    applyFilter();
+}
+
+void MacroModel::applyFilter() {
+    if (!filter_.isEmpty() && table_) {
+        index();
+    }
+    beginResetModel();
+    matches_.clear();
+    for (int id : entries_) {
+        if (matches(id)) {
+            matches_.push_back(id);
+        }
+    }
+    fetched_ = std::min(fetchBatch, static_cast<int>(matches_.size()));
+    endResetModel();
+}
+
+bool MacroModel::write(FILE *f) const {
+    if (!f) {
+        return false;
+    }
+    CMacroTable::writeHeader(f);
+    char key[MAX_MACRO_KEY_LEN * 3];
+    char text[MAX_MACRO_TEXT_LEN * 3];
+    bool first = true;
+    for (int id : entries_) {
+        QByteArray addedKey, addedText;
+        const char *pKey = key;
+        const char *pText = text;
+        if (id < 0) {
+            addedKey = added_[-1 - id].first.toUtf8();
+            addedText = added_[-1 - id].second.toUtf8();
+            pKey = addedKey.constData();
+            pText = addedText.constData();
+        } else if (!toUtf8(table_->getKey(id), key, sizeof(key)) ||
+                   !toUtf8(table_->getText(id), text, sizeof(text))) {
+            // a file without this macro would replace the one that has it
+            return false;
+        }
+        // no new line after the last one, like CMacroTable::writeToFp
+        std::fprintf(f, "%s%s:%s", first ? "" : "\n", pKey, pText);
+        first = false;
+    }
+    return !std::ferror(f);
 }
 
-void MacroModel::save(CMacroTable *table) {
-    table->resetContent();
-    for (const ItemType &item : list_) {
-        table->addItem(item.first.toUtf8().data(), item.second.toUtf8().data(),
-                       CONV_CHARSET_XUTF8);
+bool MacroModel::save(FILE *f) {
+    if (!write(f)) {
+        return false;
     }
     setNeedSave(false);
+    return true;
 }
 
 } // namespace fcitx::unikey
@@ -9,14 +9,31 @@
 
 #include "mactab.h"
 #include <QAbstractItemModel>
+#include <QHash>
 #include <QObject>
-#include <QSet>
 #include <QString>
+#include <QThread>
 #include <QVariant>
 #include <Qt>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
 #include <utility>
+#include <vector>
 
 namespace fcitx::unikey {
+
+// Folded key and text of every macro of a table, built on a thread so that
+// filtering a large table does not convert it on each key.
+struct MacroSearchIndex {
+    std::vector<QString> folded;
+    // the last macro of the table with each key
+    QHash<QString, int> keys;
+};
+
+// The macros of a table and the ones added since, without converting them
+// all up front: a row is converted when the view asks for it, and the view
+// gets the rows in batches as it scrolls (canFetchMore/fetchMore).
 class MacroModel : public QAbstractTableModel {
     Q_OBJECT
 public:
@@ -29,11 +46,23 @@ public:
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
     QVariant data(const QModelIndex &index,
                   int role = Qt::DisplayRole) const override;
-    void load(CMacroTable *table);
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+
+    // Show the macros of table, with changed set if they differ from the
+    // saved ones, e.g. after an import.
+    void load(std::shared_ptr<const CMacroTable> table, bool changed = false);
     void addItem(const QString &macro, const QString &word);
     void deleteItem(int row);
     void deleteAllItem();
-    void save(CMacroTable *table);
+    // Only show the macros whose key or text contains filter, ignoring case
+    // and tone marks.
+    void setFilter(const QString &filter);
+    // Stream all macros, shown or not, to f in the macro file format.
+    // False if one of them could not be written, f is then incomplete.
+    bool write(FILE *f) const;
+    // write, then the macros are the saved ones
+    bool save(FILE *f);
     bool needSave() const;
 
 Q_SIGNALS:
@@ -41,9 +70,31 @@ Q_SIGNALS:
 
 private:
     void setNeedSave(bool needSave);
+    void buildIndex();
+    // wait for the index being built, if any, and take it
+    const MacroSearchIndex &index();
+    bool containsKey(const QString &key);
+    bool matches(int id) const;
+    void applyFilter();
+
     bool needSave_;
-    QSet<QString> keyset_;
-    QList<std::pair<QString, QString>> list_;
+    std::shared_ptr<const CMacroTable> table_;
+    // A macro is the id of its entry in table_ if >= 0, else of
+    // added_[-1 - id].
+    std::vector<std::pair<QString, QString>> added_;
+    QHash<QString, int> addedKeys_;
+    std::vector<bool> deleted_;
+    // all macros in file order, the ones matching the filter, and how many of
+    // those the view has
+    std::vector<int> entries_;
+    std::vector<int> matches_;
+    int fetched_ = 0;
+    QString filter_;
+
+    std::shared_ptr<MacroSearchIndex> index_;
+    std::shared_ptr<MacroSearchIndex> pendingIndex_;
+    std::unique_ptr<QThread> indexThread_;
+    uint64_t indexGeneration_ = 0;
 };
 
 } // namespace fcitx::unikey
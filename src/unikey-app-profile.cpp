@@ -0,0 +1,79 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "unikey-app-profile.h"
+#include <string_view>
+
+namespace fcitx {
+
+namespace {
+
+UnikeyAppKind appKindFor(std::string_view prog) {
+    // Firefox is supported via internal state tracking for immediate commit
+    // mode.
+    if (prog == "firefox" || prog == "org.mozilla.firefox" ||
+        prog == "firefox-bin" || prog == "Firefox") {
+        return UnikeyAppKind::Firefox;
+    }
+    // Treat various LibreOffice frontends as unsupported for surrounding-text
+    // handling due to inconsistent surrounding snapshots.
+    if (prog == "libreoffice" || prog == "LibreOffice" ||
+        prog == "soffice" || prog == "soffice.bin" ||
+        prog == "libreoffice-writer" || prog == "org.libreoffice.LibreOffice") {
+        return UnikeyAppKind::UnsupportedSurrounding;
+    }
+    return UnikeyAppKind::Generic;
+}
+
+} // namespace
+
+UnikeyAppProfile *UnikeyAppProfiles::profile(const std::string &program) {
+    auto [iter, inserted] = profiles_.try_emplace(program);
+    if (inserted) {
+        iter->second.kind = appKindFor(program);
+    }
+    return &iter->second;
+}
+
+void UnikeyAppProfiles::setSurroundingUnreliable(UnikeyAppProfile *profile,
+                                                 bool unreliable) {
+    // The other kinds have fixed rules that nothing learned should change.
+    if (profile->kind != UnikeyAppKind::Generic ||
+        profile->surroundingUnreliable == unreliable) {
+        return;
+    }
+    profile->surroundingUnreliable = unreliable;
+    dirty_ = true;
+}
+
+void UnikeyAppProfiles::load(const RawConfig &config) {
+    for (const auto &group : config.subItems()) {
+        auto sub = config.get(group);
+        const auto *program = sub->valueByPath("Program");
+        const auto *unreliable = sub->valueByPath("SurroundingUnreliable");
+        if (!program || program->empty() || !unreliable) {
+            continue;
+        }
+        setSurroundingUnreliable(profile(*program), *unreliable == "True");
+    }
+    dirty_ = false;
+}
+
+void UnikeyAppProfiles::save(RawConfig &config) const {
+    int index = 0;
+    for (const auto &[program, profile] : profiles_) {
+        // Only what was learned, the kind comes from the name anyway.
+        if (!profile.surroundingUnreliable) {
+            continue;
+        }
+        auto sub = config.get(std::to_string(index++), true);
+        sub->setValueByPath("Program", program);
+        sub->setValueByPath("SurroundingUnreliable", "True");
+    }
+    dirty_ = false;
+}
+
+} // namespace fcitx
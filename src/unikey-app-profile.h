@@ -0,0 +1,59 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_UNIKEY_UNIKEY_APP_PROFILE_H_
+#define _FCITX5_UNIKEY_UNIKEY_APP_PROFILE_H_
+
+#include <fcitx-config/rawconfig.h>
+#include <string>
+#include <unordered_map>
+
+namespace fcitx {
+
+enum class UnikeyAppKind {
+    Generic,
+    // Immediate commit works from our own record of the last word, the
+    // surrounding text is only a backup.
+    Firefox,
+    // Surrounding text snapshots are inconsistent, never rewrite them.
+    UnsupportedSurrounding,
+};
+
+// What is known about one application.
+struct UnikeyAppProfile {
+    // From the program name.
+    UnikeyAppKind kind = UnikeyAppKind::Generic;
+    // Learned, generic apps only: a context of the app marked its surrounding
+    // text unreliable and no context has seen it recover since. New contexts
+    // start in preedit mode instead of immediate commit and only probe the
+    // surrounding text until it has been right often enough.
+    bool surroundingUnreliable = false;
+};
+
+// Profiles of the applications seen so far, keyed by program name. A
+// context looks its profile up once, when it is created, instead of
+// comparing program names on every key. The learned part is shared by all
+// contexts of a program and can be saved across restarts.
+class UnikeyAppProfiles {
+public:
+    // Never null, stays valid as long as this object.
+    UnikeyAppProfile *profile(const std::string &program);
+    void setSurroundingUnreliable(UnikeyAppProfile *profile, bool unreliable);
+
+    // Learned state, one numbered group per program.
+    void load(const RawConfig &config);
+    void save(RawConfig &config) const;
+    // Whether anything was learned since the last load() or save().
+    bool dirty() const { return dirty_; }
+
+private:
+    std::unordered_map<std::string, UnikeyAppProfile> profiles_;
+    mutable bool dirty_ = false;
+};
+
+} // namespace fcitx
+
+#endif // _FCITX5_UNIKEY_UNIKEY_APP_PROFILE_H_
@@ -44,11 +44,16 @@ FCITX_CONFIGURATION(
         this, "OutputCharset", _("Output Charset"), UkConv::XUTF8};
     Option<bool> spellCheck{this, "SpellCheck", _("Enable spell check"), true};
     Option<bool> macro{this, "Macro", _("Enable Macro"), true};
+    Option<bool> systemMacro{this, "SystemMacro",
+                             _("Use the system macros under your own"), false};
     Option<bool> process_w_at_begin{this, "ProcessWAtBegin",
                                     _("Process W at word begin"), true};
     Option<bool> autoNonVnRestore{this, "AutoNonVnRestore",
                                   _("Auto restore keys with invalid words"),
                                   true};
+    Option<bool> restoreWordList{
+        this, "RestoreWordList",
+        _("Also auto restore English words from the word list"), false};
     Option<bool> modernStyle{this, "ModernStyle",
                              _("Use oà, _uý (instead of òa, úy)"), false};
     Option<bool> freeMarking{this, "FreeMarking",
@@ -62,6 +67,18 @@ FCITX_CONFIGURATION(
                                  _("Immediate Commit Mode"), false};
     Option<bool> displayUnderline{this, "DisplayUnderline",
                                   _("Underline the preedit text"), true};
+    Option<bool> wordSuggestion{this, "WordSuggestion",
+                                _("Suggest words from the word list"), false};
+    Option<bool> rememberAppProfiles{
+        this, "RememberAppProfiles",
+        _("Remember applications with unreliable surrounding text"), false};
+    Option<bool> transitionCache{
+        this, "TransitionCache",
+        _("Replay keys from a transition table (experimental)"), false};
+    Option<int, IntConstrain> slowKeyThreshold{
+        this, "SlowKeyThreshold",
+        _("Log keys handled slower than this (ms, 0 to disable)"), 0,
+        IntConstrain(0, 10000)};
 #ifdef ENABLE_QT
     ExternalOption macroEditor{this, "MacroEditor", _("Macro Editor"),
                                "fcitx://config/addon/unikey/macro"};
@@ -0,0 +1,44 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include "unikey-dbus.h"
+#include "unikey-im.h"
+#include "unikey-latency.h"
+#include "unikey-metrics.h"
+#include <cstdint>
+#include <fcitx-utils/dbus/message.h>
+#include <string>
+#include <vector>
+
+namespace fcitx {
+
+std::vector<dbus::DictEntry<std::string, uint64_t>>
+UnikeyDBusService::metrics() {
+    std::vector<dbus::DictEntry<std::string, uint64_t>> result;
+    for (auto &[name, value] :
+         engine_->metrics().values(engine_->im()->sharedMem()->stats)) {
+        result.emplace_back(name, value);
+    }
+    return result;
+}
+
+void UnikeyDBusService::resetMetrics() {
+    engine_->metrics() = UnikeyMetrics();
+    engine_->im()->sharedMem()->stats = UkEngineStats();
+    engine_->latency().clear();
+}
+
+std::vector<dbus::DictEntry<std::string, uint64_t>>
+UnikeyDBusService::keyLatency() {
+    std::vector<dbus::DictEntry<std::string, uint64_t>> result;
+    for (auto &[name, value] : engine_->latency().values(latencyNow())) {
+        result.emplace_back(name, value);
+    }
+    return result;
+}
+
+} // namespace fcitx
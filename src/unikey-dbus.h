@@ -0,0 +1,41 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_UNIKEY_UNIKEY_DBUS_H_
+#define _FCITX5_UNIKEY_UNIKEY_DBUS_H_
+
+#include <cstdint>
+#include <fcitx-utils/dbus/message.h>
+#include <fcitx-utils/dbus/objectvtable.h>
+#include <string>
+#include <vector>
+
+namespace fcitx {
+
+class UnikeyEngine;
+
+// org.fcitx.Fcitx.Unikey1 at /unikey on the fcitx bus.
+class UnikeyDBusService : public dbus::ObjectVTable<UnikeyDBusService> {
+public:
+    explicit UnikeyDBusService(UnikeyEngine *engine) : engine_(engine) {}
+
+    std::vector<dbus::DictEntry<std::string, uint64_t>> metrics();
+    void resetMetrics();
+    // Histogram of the key handling times of the last minutes, see
+    // KeyLatencyHistogram.
+    std::vector<dbus::DictEntry<std::string, uint64_t>> keyLatency();
+
+private:
+    UnikeyEngine *engine_;
+
+    FCITX_OBJECT_VTABLE_METHOD(metrics, "Metrics", "", "a{st}");
+    FCITX_OBJECT_VTABLE_METHOD(resetMetrics, "ResetMetrics", "", "");
+    FCITX_OBJECT_VTABLE_METHOD(keyLatency, "KeyLatency", "", "a{st}");
+};
+
+} // namespace fcitx
+
+#endif // _FCITX5_UNIKEY_UNIKEY_DBUS_H_
@@ -15,17 +15,22 @@
 #include "usrkeymap.h"
 #include "unikey-utils.h"
 #include "unikey-constants.h"
+#include "unikey-latency.h"
 #include "unikey-log.h"
+#include "mactab.h"
 #include "vnconv.h"
 #include "vnlexi.h"
 #include <cassert>
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <fcitx-config/iniparser.h>
 #include <fcitx-utils/capabilityflags.h>
 #include <fcitx-utils/charutils.h>
+#include <fcitx-utils/eventdispatcher.h>
 #include <fcitx-utils/fs.h>
 #include <fcitx-utils/i18n.h>
 #include <fcitx-utils/key.h>
@@ -50,10 +55,12 @@
 #include <fcitx/userinterface.h>
 #include <fcitx/userinterfacemanager.h>
 #include <fcntl.h>
+#include <filesystem>
 #include <iterator>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 namespace fcitx {
@@ -69,6 +76,56 @@ const unsigned int Unikey_OC[] = {CONV_CHARSET_XUTF8,  CONV_CHARSET_TCVN3,
 constexpr unsigned int NUM_OUTPUTCHARSET = FCITX_ARRAY_SIZE(Unikey_OC);
 static_assert(NUM_OUTPUTCHARSET == UkConvI18NAnnotation::enumLength);
 
+// for the startup timings in the debug log
+int64_t microsecondsBetween(std::chrono::steady_clock::time_point start,
+                            std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+        .count();
+}
+
+int64_t microsecondsSince(std::chrono::steady_clock::time_point start) {
+    return microsecondsBetween(start, std::chrono::steady_clock::now());
+}
+
+// Called on the worker, a large table takes a few hundred ms.
+std::shared_ptr<const CMacroRendering>
+renderMacroTable(const std::shared_ptr<const CMacroTable> &table,
+                 int charset) {
+    if (!table) {
+        return nullptr;
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto rendering = std::make_shared<CMacroRendering>(table, charset);
+    FCITX_UNIKEY_DEBUG() << "Rendered " << table->getCount()
+                         << " macros for charset " << charset << " in "
+                         << microsecondsSince(start) << " us";
+    return rendering;
+}
+
+// The compiled copy of a word list is kept in the user's data directory,
+// which can be written even when the list is installed in a system one.
+// The copy holds the stamp of the list it was built from: a changed list,
+// or a user list found before the system one, is compiled again.
+std::string wordListCachePath(const char *name) {
+    const auto &dir =
+        StandardPaths::global().userDirectory(StandardPathsType::PkgData);
+    if (dir.empty()) {
+        return {};
+    }
+    return (dir / "unikey" / "cache" / (std::string(name) + ".bin")).string();
+}
+
+// On the worker, before the first copy is written there.
+const char *prepareWordListCache(const std::string &cachePath) {
+    if (cachePath.empty()) {
+        return nullptr;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(
+        std::filesystem::path(cachePath).parent_path(), ec);
+    return cachePath.c_str();
+}
+
 } // namespace
 
 
@@ -80,9 +137,62 @@ UnikeyEngine::UnikeyEngine(Instance *instance)
     : instance_(instance), factory_([this](InputContext &ic) {
           return new UnikeyState(this, &ic);
       }) {
+    auto start = std::chrono::steady_clock::now();
     instance_->inputContextManager().registerProperty("unikey-state",
                                                       &factory_);
 
+    eventWatchers_.emplace_back(instance_->watchEvent(
+        EventType::InputContextSurroundingTextUpdated,
+        EventWatcherPhase::PostInputMethod, [this](Event &event) {
+            auto &icEvent = static_cast<InputContextEvent &>(event);
+            auto *ic = icEvent.inputContext();
+            auto *state = ic->propertyFor(&factory_);
+            state->surroundingTextUpdated();
+        }));
+
+#ifdef ENABLE_DBUS
+    if (auto *dbusAddon = dbus()) {
+        auto *bus = dbusAddon->call<IDBusModule::bus>();
+        dbusService_ = std::make_unique<UnikeyDBusService>(this);
+        bus->addObjectVTable("/unikey", "org.fcitx.Fcitx.Unikey1",
+                             *dbusService_);
+    }
+#endif
+
+    dispatcher_.attach(&instance_->eventLoop());
+    recorder_ = UnikeyRecorder::fromEnvironment();
+    auto setupDone = std::chrono::steady_clock::now();
+    reloadConfig();
+    FCITX_UNIKEY_DEBUG() << "Created in " << microsecondsSince(start)
+                         << " us: setup "
+                         << microsecondsBetween(start, setupDone)
+                         << " us, config " << microsecondsSince(setupDone)
+                         << " us";
+}
+
+UnikeyEngine::~UnikeyEngine() {}
+
+void UnikeyEngine::finishStartup() {
+    if (started_) {
+        return;
+    }
+    started_ = true;
+    auto start = std::chrono::steady_clock::now();
+    setupActions();
+    auto actionsDone = std::chrono::steady_clock::now();
+    reloadKeymap();
+    reloadMacroTable();
+    reloadLexicon();
+    reloadRestoreWords();
+    populateConfig();
+    // The files themselves are parsed on worker_, each logs its own time.
+    FCITX_UNIKEY_DEBUG() << "First activation: menus "
+                         << microsecondsBetween(start, actionsDone)
+                         << " us, file loads queued in "
+                         << microsecondsSince(actionsDone) << " us";
+}
+
+void UnikeyEngine::setupActions() {
     auto &uiManager = instance_->userInterfaceManager();
     inputMethodAction_ = std::make_unique<SimpleAction>();
     inputMethodAction_->setIcon("document-edit");
@@ -136,6 +246,44 @@ UnikeyEngine::UnikeyEngine(Instance *instance)
                                  action);
         charsetMenu_->addAction(action);
     }
+
+    clipboardAction_ = std::make_unique<SimpleAction>();
+    clipboardAction_->setShortText(_("Convert clipboard"));
+    clipboardAction_->setIcon("edit-paste");
+    uiManager.registerAction("unikey-clipboard", clipboardAction_.get());
+    clipboardMenu_ = std::make_unique<Menu>();
+    clipboardAction_->setMenu(clipboardMenu_.get());
+    clipboardToUnicodeAction_ = std::make_unique<SimpleAction>();
+    clipboardFromUnicodeAction_ = std::make_unique<SimpleAction>();
+    for (bool toUnicode : {true, false}) {
+        auto *action = toUnicode ? clipboardToUnicodeAction_.get()
+                                 : clipboardFromUnicodeAction_.get();
+        action->setShortText(toUnicode ? _("From output charset to Unicode")
+                                       : _("From Unicode to output charset"));
+        connections_.emplace_back(action->connect<SimpleAction::Activated>(
+            [this, toUnicode](InputContext *ic) {
+                convertClipboard(ic, toUnicode);
+            }));
+        uiManager.registerAction(toUnicode ? "unikey-clipboard-to-unicode"
+                                           : "unikey-clipboard-from-unicode",
+                                 action);
+        clipboardMenu_->addAction(action);
+    }
+    // Typing the result is a separate, explicit choice: a conversion only
+    // changes the clipboard.
+    clipboardPasteAction_ = std::make_unique<SimpleAction>();
+    clipboardPasteAction_->setShortText(_("Paste converted clipboard"));
+    connections_.emplace_back(
+        clipboardPasteAction_->connect<SimpleAction::Activated>(
+            [this](InputContext *ic) {
+                if (ic && !convertedClipboard_.empty()) {
+                    ic->commitString(convertedClipboard_);
+                }
+            }));
+    uiManager.registerAction("unikey-clipboard-paste",
+                             clipboardPasteAction_.get());
+    clipboardMenu_->addAction(clipboardPasteAction_.get());
+
     spellCheckAction_ = std::make_unique<SimpleAction>();
     spellCheckAction_->setLongText(_("Spell check"));
     spellCheckAction_->setIcon("tools-check-spelling");
@@ -159,26 +307,15 @@ UnikeyEngine::UnikeyEngine(Instance *instance)
             updateMacroAction(ic);
         }));
     uiManager.registerAction("unikey-macro", macroAction_.get());
-
-    eventWatchers_.emplace_back(instance_->watchEvent(
-        EventType::InputContextSurroundingTextUpdated,
-        EventWatcherPhase::PostInputMethod, [this](Event &event) {
-            auto &icEvent = static_cast<InputContextEvent &>(event);
-            auto *ic = icEvent.inputContext();
-            auto *state = ic->propertyFor(&factory_);
-            state->mayRebuildStateFromSurroundingText_ = true;
-        }));
-
-    reloadConfig();
 }
 
-UnikeyEngine::~UnikeyEngine() {}
-
 void UnikeyEngine::activate(const InputMethodEntry & /*entry*/,
                             InputContextEvent &event) {
+    finishStartup();
     auto &statusArea = event.inputContext()->statusArea();
     statusArea.addAction(StatusGroup::InputMethod, inputMethodAction_.get());
     statusArea.addAction(StatusGroup::InputMethod, charsetAction_.get());
+    statusArea.addAction(StatusGroup::InputMethod, clipboardAction_.get());
     statusArea.addAction(StatusGroup::InputMethod, spellCheckAction_.get());
     statusArea.addAction(StatusGroup::InputMethod, macroAction_.get());
 
@@ -197,14 +334,85 @@ void UnikeyEngine::deactivate(const InputMethodEntry &entry,
         state->commit();
     }
     reset(entry, event);
+    if (unikey().checkLogLevel(LogLevel::Debug)) {
+        auto stats = im_.memoryStats();
+        FCITX_UNIKEY_DEBUG() << "Engine state: active=" << stats.activeSlots
+                             << " pooled=" << stats.pooledSlots
+                             << " bytes=" << stats.bytes;
+    }
 }
 
 void UnikeyEngine::keyEvent(const InputMethodEntry & /*entry*/,
                             KeyEvent &keyEvent) {
     auto *ic = keyEvent.inputContext();
     auto *state = ic->propertyFor(&factory_);
-    state->rebuildFromSurroundingText();
+    const auto threshold = *config_.slowKeyThreshold;
+    KeyStageTimes stages;
+    if (threshold > 0 && !keyEvent.isRelease()) {
+        state->stageTimes_ = &stages;
+    }
+    auto start = latencyNow();
+    {
+        KeyStageScope stage(state->stageTimes_, KeyStage::Surrounding);
+        state->rebuildFromSurroundingText();
+    }
     state->keyEvent(keyEvent);
+    if (!keyEvent.isRelease() && !keyEvent.filtered() &&
+        !keyEvent.key().isModifier()) {
+        state->keyPassedThrough();
+    }
+    state->stageTimes_ = nullptr;
+    if (!keyEvent.isRelease()) {
+        auto end = latencyNow();
+        uint64_t ns = end - start;
+        metrics_.addKey(ns);
+        latency_.add(ns, end);
+        if (threshold > 0 && ns >= static_cast<uint64_t>(threshold) * 1000000) {
+            logSlowKey(keyEvent, *state, ns, stages);
+        }
+    }
+}
+
+void UnikeyEngine::logSlowKey(const KeyEvent &keyEvent,
+                              const UnikeyState &state, uint64_t ns,
+                              const KeyStageTimes &stages) {
+    auto *ic = keyEvent.inputContext();
+    // What kind of key it was, never which one: this goes to the journal.
+    const auto sym = keyEvent.rawKey().sym();
+    const char *key = sym == FcitxKey_BackSpace ? "backspace"
+                      : keyEvent.key().isSimple() ? "printable"
+                      : keyEvent.key().isModifier() ? "modifier"
+                                                    : "other";
+    const auto &surrounding = ic->surroundingText();
+    std::string record = "slow key: totalUs=" + std::to_string(ns / 1000);
+    for (size_t i = 0; i < stages.ns.size(); i++) {
+        if (stages.ns[i]) {
+            record += ' ';
+            record += keyStageName(static_cast<KeyStage>(i));
+            record += "Us=" + std::to_string(stages.ns[i] / 1000);
+        }
+    }
+    record += " key=";
+    record += key;
+    record += " im=";
+    record += UkInputMethodToString(*config_.im);
+    record += " charset=";
+    record += UkConvToString(*config_.oc);
+    record += " immediateCommit=";
+    record += state.immediateCommitMode() ? "1" : "0";
+    record += " surroundingText=";
+    record += ic->capabilityFlags().test(CapabilityFlag::SurroundingText) &&
+                      *config_.surroundingText
+                  ? "1"
+                  : "0";
+    record += " surroundingUnreliable=";
+    record += state.surroundingTextUnreliable_ ? "1" : "0";
+    record += " surroundingBytes=" +
+              std::to_string(surrounding.isValid() ? surrounding.text().size()
+                                                   : 0);
+    record += " program=";
+    record += ic->program().empty() ? "-" : ic->program();
+    FCITX_UNIKEY_WARN() << record;
 }
 
 
@@ -212,6 +420,10 @@ void UnikeyEngine::keyEvent(const InputMethodEntry & /*entry*/,
 void UnikeyEngine::reset(const InputMethodEntry & /*entry*/,
                          InputContextEvent &event) {
     auto *state = event.inputContext()->propertyFor(&factory_);
+    if (recorder_) {
+        recorder_->reset(state->recordedContext_, event.inputContext(),
+                         static_cast<uint32_t>(event.type()));
+    }
     state->reset();
     if (event.type() == EventType::InputContextReset) {
         // Reset should also clear any immediate-commit rewrite history: the
@@ -235,28 +447,311 @@ void UnikeyEngine::populateConfig() {
     im_.setInputMethod(*config_.im);
     im_.setOutputCharset(Unikey_OC[static_cast<int>(*config_.oc)]);
     im_.setOptions(&ukopt);
+    im_.setTransitionCache(*config_.transitionCache);
+    renderMacros();
+    if (started_ && (macroTableLoaded_ != *config_.macro ||
+                     systemMacroLoaded_ != *config_.systemMacro)) {
+        reloadMacroTable();
+    }
+    if (started_ && lexiconLoaded_ != *config_.wordSuggestion) {
+        reloadLexicon();
+    }
+    if (started_ && restoreWordsLoaded_ != *config_.restoreWordList) {
+        reloadRestoreWords();
+    }
+    if (recorder_) {
+        RawConfig raw;
+        config_.save(raw);
+        int keyMap[256];
+        im_.sharedMem()->input.getKeyMap(keyMap);
+        recorder_->config(raw, keyMap);
+    }
 }
 
 void UnikeyEngine::reloadConfig() {
     readAsIni(config_, "conf/unikey.conf");
-    reloadKeymap();
+    // Needed by the state of every input context, even before activation.
+    reloadAppProfiles();
+    if (started_) {
+        reloadKeymap();
+        reloadMacroTable();
+        reloadLexicon();
+        reloadRestoreWords();
+    }
     populateConfig();
-    reloadMacroTable();
+}
+
+void UnikeyEngine::reloadMacroTable() {
+    auto generation = ++macroGeneration_;
+    macroTableLoaded_ = *config_.macro;
+    systemMacroLoaded_ = *config_.systemMacro;
+    // Don't keep any macro in memory while the option is off.
+    if (!macroTableLoaded_) {
+        im_.unloadMacroTable();
+        return;
+    }
+
+    // The user's file hides the system one, unless both are wanted: then
+    // the system table, with its compiled copy mapped by every session, is
+    // used for the keys the user's does not have.
+    const bool layered = *config_.systemMacro;
+    auto path = StandardPaths::global().locate(
+        StandardPathsType::PkgConfig, "unikey/macro",
+        layered ? StandardPathsMode::User : StandardPathsMode::Default);
+    std::filesystem::path systemPath;
+    if (layered) {
+        systemPath = StandardPaths::global().locate(
+            StandardPathsType::PkgConfig, "unikey/macro",
+            StandardPathsMode::System);
+    }
+    if (path.empty() && systemPath.empty()) {
+        return;
+    }
+
+    // Rendered for the charset of now, see renderMacros for a later change.
+    const int charset = Unikey_OC[static_cast<int>(*config_.oc)];
+    worker_.post([this, generation, charset, path = path.string(),
+                  systemPath = systemPath.string()]() {
+        auto load = [](const std::string &path) {
+            std::shared_ptr<CMacroTable> table;
+            if (path.empty()) {
+                return table;
+            }
+            auto start = std::chrono::steady_clock::now();
+            table = std::make_shared<CMacroTable>();
+            if (!table->loadFromFile(path.c_str(), true)) {
+                FCITX_UNIKEY_DEBUG() << "Failed to load macro file " << path;
+                table.reset();
+                return table;
+            }
+            FCITX_UNIKEY_DEBUG() << "Loaded macro file " << path << " in "
+                                 << microsecondsSince(start) << " us";
+            return table;
+        };
+        auto table = load(path);
+        auto systemTable = load(systemPath);
+        if (!table && !systemTable) {
+            return;
+        }
+        auto rendering = renderMacroTable(table, charset);
+        auto systemRendering = renderMacroTable(systemTable, charset);
+        dispatcher_.schedule([this, generation, table = std::move(table),
+                              systemTable = std::move(systemTable),
+                              rendering = std::move(rendering),
+                              systemRendering = std::move(systemRendering)]() {
+            // Option turned off or newer reload requested in the meantime.
+            if (generation != macroGeneration_) {
+                return;
+            }
+            im_.setSystemMacroTable(systemTable, systemRendering);
+            im_.setMacroTable(table, rendering);
+            // the charset may have changed since
+            renderMacros();
+        });
+    });
+}
+
+void UnikeyEngine::renderMacros() {
+    auto *mem = im_.sharedMem();
+    const int charset = mem->charsetId;
+    // the tables without a rendering for the current charset
+    auto stale = [charset](std::shared_ptr<const CMacroTable> table,
+                           const CMacroRendering *rendering) {
+        if (rendering && rendering->table() == table.get() &&
+            rendering->charset() == charset) {
+            table.reset();
+        }
+        return table;
+    };
+    auto table = stale(mem->macStore, mem->macRendering.get());
+    auto systemTable = stale(mem->sysMacStore, mem->sysMacRendering.get());
+    if (!table && !systemTable) {
+        return;
+    }
+
+    auto generation = ++macroRenderingGeneration_;
+    worker_.post([this, generation, charset, table = std::move(table),
+                  systemTable = std::move(systemTable)]() {
+        auto rendering = renderMacroTable(table, charset);
+        auto systemRendering = renderMacroTable(systemTable, charset);
+        dispatcher_.schedule([this, generation,
+                              rendering = std::move(rendering),
+                              systemRendering = std::move(systemRendering)]() {
+            // Charset changed again in the meantime.
+            if (generation != macroRenderingGeneration_) {
+                return;
+            }
+            // Dropped if made for a table replaced in the meantime.
+            im_.setMacroRendering(rendering);
+            im_.setMacroRendering(systemRendering);
+        });
+    });
+}
+
+void UnikeyEngine::convertClipboard(InputContext *ic, bool toUnicode) {
+    if (!ic) {
+        return;
+    }
+    if (!clipboard()) {
+        FCITX_UNIKEY_DEBUG() << "No clipboard addon to convert from";
+        return;
+    }
+    auto text = clipboard()->call<IClipboard::clipboard>(ic);
+    const int charset = Unikey_OC[static_cast<int>(*config_.oc)];
+    if (text.empty() || charset == CONV_CHARSET_XUTF8) {
+        return;
+    }
+    const int from = toUnicode ? charset : CONV_CHARSET_UNIUTF8;
+    const int to = toUnicode ? CONV_CHARSET_UNIUTF8 : charset;
+
+    // A large paste takes a while, only the last request is applied.
+    auto generation = ++clipboardGeneration_;
+    worker_.post([this, generation, from, to, text = std::move(text),
+                  display = ic->display()]() {
+        auto start = std::chrono::steady_clock::now();
+        std::string converted;
+        if (!convertCharsetText(text, from, to, converted)) {
+            FCITX_UNIKEY_DEBUG() << "Clipboard is not in charset " << from;
+            return;
+        }
+        FCITX_UNIKEY_DEBUG() << "Converted " << text.size()
+                             << " bytes of clipboard in "
+                             << microsecondsSince(start) << " us";
+        dispatcher_.schedule([this, generation, display,
+                              converted = std::move(converted)]() {
+            if (generation != clipboardGeneration_) {
+                return;
+            }
+            if (clipboard()) {
+                clipboard()->call<IClipboard::setClipboard>(display,
+                                                            converted);
+            }
+            convertedClipboard_ = converted;
+        });
+    });
+}
+
+void UnikeyEngine::reloadLexicon() {
+    auto generation = ++lexiconGeneration_;
+    lexiconLoaded_ = *config_.wordSuggestion;
+    if (!lexiconLoaded_) {
+        lexicon_.reset();
+        return;
+    }
+
+    auto path = StandardPaths::global().locate(StandardPathsType::PkgData,
+                                               "unikey/lexicon.txt");
+    if (path.empty()) {
+        return;
+    }
+
+    worker_.post([this, generation, path = path.string(),
+                  cachePath = wordListCachePath("lexicon.txt")]() {
+        auto start = std::chrono::steady_clock::now();
+        auto lexicon = std::make_shared<UkLexicon>();
+        if (!lexicon->loadFromFile(path.c_str(), true,
+                                   prepareWordListCache(cachePath))) {
+            FCITX_UNIKEY_DEBUG() << "Failed to load word list " << path;
+            return;
+        }
+        FCITX_UNIKEY_DEBUG() << "Loaded word list " << path << " in "
+                             << microsecondsSince(start) << " us";
+        dispatcher_.schedule(
+            [this, generation, lexicon = std::move(lexicon)]() mutable {
+                if (generation != lexiconGeneration_) {
+                    return;
+                }
+                lexicon_ = std::move(lexicon);
+            });
+    });
+}
+
+void UnikeyEngine::reloadRestoreWords() {
+    auto generation = ++restoreWordsGeneration_;
+    restoreWordsLoaded_ = *config_.restoreWordList;
+    if (!restoreWordsLoaded_) {
+        im_.setRestoreWords(nullptr);
+        return;
+    }
+
+    auto path = StandardPaths::global().locate(StandardPathsType::PkgData,
+                                               "unikey/restore-words.txt");
+    if (path.empty()) {
+        return;
+    }
+
+    worker_.post([this, generation, path = path.string(),
+                  cachePath = wordListCachePath("restore-words.txt")]() {
+        auto start = std::chrono::steady_clock::now();
+        auto words = std::make_shared<UkWordSet>();
+        if (!words->loadFromFile(path.c_str(), true,
+                                 prepareWordListCache(cachePath))) {
+            FCITX_UNIKEY_DEBUG() << "Failed to load word list " << path;
+            return;
+        }
+        FCITX_UNIKEY_DEBUG() << "Loaded word list " << path << " in "
+                             << microsecondsSince(start) << " us";
+        dispatcher_.schedule(
+            [this, generation, words = std::move(words)]() mutable {
+                if (generation != restoreWordsGeneration_) {
+                    return;
+                }
+                im_.setRestoreWords(std::move(words));
+            });
+    });
 }
 
 void UnikeyEngine::reloadKeymap() {
-    // Keymap need to be reloaded before populateConfig.
-    auto keymapFile = StandardPaths::global().open(StandardPathsType::PkgConfig,
-                                                   "unikey/keymap.txt");
-    if (keymapFile.isValid()) {
-        UkLoadKeyMap(keymapFile.fd(), im_.sharedMem()->usrKeyMap);
-        im_.sharedMem()->usrKeyMapLoaded = true;
-    } else {
+    auto generation = ++keymapGeneration_;
+    // The file is looked up here so that a missing keymap is known right
+    // away and the user IM falls back to the default one.
+    auto path = StandardPaths::global().locate(StandardPathsType::PkgConfig,
+                                               "unikey/keymap.txt");
+    if (path.empty()) {
         im_.sharedMem()->usrKeyMapLoaded = false;
+        return;
+    }
+
+    worker_.post([this, generation, path = path.string()]() {
+        auto start = std::chrono::steady_clock::now();
+        auto keyMap = std::make_shared<std::array<int, 256>>();
+        // from keymap.txt.bin unless keymap.txt changed since it was written
+        if (!UkLoadKeyMapFile(path.c_str(), keyMap->data(), true)) {
+            FCITX_UNIKEY_DEBUG() << "Failed to load keymap " << path;
+            return;
+        }
+        FCITX_UNIKEY_DEBUG() << "Loaded keymap in " << microsecondsSince(start)
+                             << " us";
+        dispatcher_.schedule([this, generation, keyMap = std::move(keyMap)]() {
+            if (generation != keymapGeneration_) {
+                return;
+            }
+            std::copy(keyMap->begin(), keyMap->end(),
+                      im_.sharedMem()->usrKeyMap);
+            im_.sharedMem()->usrKeyMapLoaded = true;
+            // The user IM needs to pick up the new keymap.
+            populateConfig();
+        });
+    });
+}
+
+void UnikeyEngine::reloadAppProfiles() {
+    if (!*config_.rememberAppProfiles) {
+        return;
     }
+    RawConfig raw;
+    readAsIni(raw, StandardPathsType::PkgData, "unikey/apps.conf");
+    appProfiles_.load(raw);
 }
 
-void UnikeyEngine::save() {}
+void UnikeyEngine::save() {
+    if (!*config_.rememberAppProfiles || !appProfiles_.dirty()) {
+        return;
+    }
+    RawConfig raw;
+    appProfiles_.save(raw);
+    safeSaveAsIni(raw, StandardPathsType::PkgData, "unikey/apps.conf");
+}
 
 std::string UnikeyEngine::subMode(const InputMethodEntry & /*entry*/,
                                   InputContext & /*inputContext*/) {
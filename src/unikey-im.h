@@ -7,9 +7,17 @@
 #ifndef _FCITX5_UNIKEY_UNIKEY_IM_H_
 #define _FCITX5_UNIKEY_UNIKEY_IM_H_
 
+#include "lexicon.h"
+#include "unikey-app-profile.h"
 #include "unikey-config.h"
+#include "unikey-latency.h"
+#include "unikey-metrics.h"
+#include "unikey-recorder.h"
+#include "unikey-worker.h"
+#include <cstdint>
 #include <fcitx-config/iniparser.h>
 #include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/eventdispatcher.h>
 #include <fcitx-utils/handlertable.h>
 #include <fcitx-utils/i18n.h>
 #include <fcitx-utils/signals.h>
@@ -24,10 +32,15 @@
 #include <fcitx/instance.h>
 #include <fcitx/inputpanel.h>
 #include <fcitx/text.h>
+#include <fcitx-module/clipboard/clipboard_public.h>
 #include <memory>
 #include <string>
 #include <unikeyinputcontext.h>
 #include <vector>
+#ifdef ENABLE_DBUS
+#include "unikey-dbus.h"
+#include <fcitx-module/dbus/dbus_public.h>
+#endif
 
 namespace fcitx {
 
@@ -50,6 +63,10 @@ public:
 
     void setSubConfig(const std::string &path,
                       const fcitx::RawConfig & /*unused*/) override {
+        // Loaded anyway on the first activation.
+        if (!started_) {
+            return;
+        }
         if (path == "macro") {
             reloadMacroTable();
         } else if (path == "keymap.txt") {
@@ -81,22 +98,55 @@ public:
                         InputContext & /*inputContext*/) override;
 
     UnikeyInputMethod *im() { return &im_; }
+    // null unless word suggestion is on and the word list is loaded
+    const std::shared_ptr<const UkLexicon> &lexicon() const {
+        return lexicon_;
+    }
+    UnikeyMetrics &metrics() { return metrics_; }
+    KeyLatencyHistogram &latency() { return latency_; }
+    UnikeyAppProfiles &appProfiles() { return appProfiles_; }
+    // null unless recording, see unikey-recorder.h
+    UnikeyRecorder *recorder() { return recorder_.get(); }
 
 private:
+    // Menus and the macro, keymap and word list files are only needed once
+    // the input method is used, so they wait for the first activation
+    // instead of slowing down the session start.
+    void finishStartup();
+    void setupActions();
     void populateConfig();
-    void reloadMacroTable() {
-        auto path = StandardPaths::global().locate(StandardPathsType::PkgConfig,
-                                                   "unikey/macro");
-
-        if (!path.empty()) {
-            im_.loadMacroTable(path.string().c_str());
-        }
-    }
+    // Macro, keymap and word list files are parsed on worker_ and swapped
+    // in on the main loop, so a large file never stalls key handling.
+    void reloadMacroTable();
+    // Renders the macro texts for the output charset on worker_ when the
+    // charset changed, see CMacroRendering. Until then a hit converts them.
+    void renderMacros();
     void reloadKeymap();
+    void reloadLexicon();
+    void reloadRestoreWords();
+    // Learned application profiles, from unikey/apps.conf in the data dir.
+    void reloadAppProfiles();
+    // Converts the clipboard between the output charset and Unicode on
+    // worker_, then adds the result to the clipboard history. Nothing is
+    // typed into ic, the "Paste converted clipboard" action does that.
+    void convertClipboard(InputContext *ic, bool toUnicode);
+    // One line with the stage times and the context of a key slower than
+    // the SlowKeyThreshold option, without the key itself.
+    void logSlowKey(const KeyEvent &keyEvent, const UnikeyState &state,
+                    uint64_t ns, const KeyStageTimes &stages);
 
     UnikeyConfig config_;
     UnikeyInputMethod im_;
+    // set by finishStartup()
+    bool started_ = false;
+    bool macroTableLoaded_ = false;
+    bool systemMacroLoaded_ = false;
+    bool lexiconLoaded_ = false;
+    bool restoreWordsLoaded_ = false;
+    std::shared_ptr<const UkLexicon> lexicon_;
     Instance *instance_;
+    // Before factory_, the states refer to their profile.
+    UnikeyAppProfiles appProfiles_;
     FactoryFor<UnikeyState> factory_;
     std::unique_ptr<SimpleAction> inputMethodAction_;
     std::vector<std::unique_ptr<SimpleAction>> inputMethodSubAction_;
@@ -104,11 +154,38 @@ private:
     std::unique_ptr<SimpleAction> charsetAction_;
     std::vector<std::unique_ptr<SimpleAction>> charsetSubAction_;
     std::unique_ptr<Menu> charsetMenu_;
+    std::unique_ptr<SimpleAction> clipboardAction_;
+    std::unique_ptr<SimpleAction> clipboardToUnicodeAction_;
+    std::unique_ptr<SimpleAction> clipboardFromUnicodeAction_;
+    std::unique_ptr<SimpleAction> clipboardPasteAction_;
+    std::unique_ptr<Menu> clipboardMenu_;
     std::unique_ptr<SimpleAction> spellCheckAction_;
     std::unique_ptr<SimpleAction> macroAction_;
     std::vector<ScopedConnection> connections_;
     std::vector<std::unique_ptr<fcitx::HandlerTableEntry<fcitx::EventHandler>>>
         eventWatchers_;
+    EventDispatcher dispatcher_;
+    // Bumped on every reload request, so that a result superseded by a
+    // newer request is dropped instead of applied.
+    uint64_t macroGeneration_ = 0;
+    uint64_t macroRenderingGeneration_ = 0;
+    uint64_t keymapGeneration_ = 0;
+    uint64_t lexiconGeneration_ = 0;
+    uint64_t restoreWordsGeneration_ = 0;
+    uint64_t clipboardGeneration_ = 0;
+    // the result of the last conversion, for clipboardPasteAction_
+    std::string convertedClipboard_;
+    UnikeyMetrics metrics_;
+    KeyLatencyHistogram latency_;
+    std::unique_ptr<UnikeyRecorder> recorder_;
+    FCITX_ADDON_DEPENDENCY_LOADER(clipboard, instance_->addonManager());
+#ifdef ENABLE_DBUS
+    FCITX_ADDON_DEPENDENCY_LOADER(dbus, instance_->addonManager());
+    std::unique_ptr<UnikeyDBusService> dbusService_;
+#endif
+    // Keep this last, its destructor waits for the running task, which may
+    // still refer to the members above.
+    UnikeyWorker worker_;
 };
 
 class UnikeyFactory : public AddonFactory {
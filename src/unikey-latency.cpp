@@ -0,0 +1,104 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include "unikey-latency.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fcitx {
+
+namespace {
+
+int bucketOf(uint64_t ns) {
+    int bucket = 0;
+    for (uint64_t us = ns / 1000;
+         us && bucket < KeyLatencyHistogram::bucketCount - 1; us >>= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+std::string bucketName(int bucket) {
+    if (bucket == KeyLatencyHistogram::bucketCount - 1) {
+        return ">=" + std::to_string(uint64_t(1) << (bucket - 1)) + "us";
+    }
+    return "<" + std::to_string(uint64_t(1) << bucket) + "us";
+}
+
+} // namespace
+
+const char *keyStageName(KeyStage stage) {
+    switch (stage) {
+    case KeyStage::Surrounding:
+        return "surrounding";
+    case KeyStage::RebuildPreedit:
+        return "rebuildPreedit";
+    case KeyStage::Engine:
+        return "engine";
+    case KeyStage::SyncState:
+        return "syncState";
+    case KeyStage::Commit:
+        return "commit";
+    case KeyStage::DeleteSurrounding:
+        return "deleteSurrounding";
+    case KeyStage::UpdateSurrounding:
+        return "updateSurrounding";
+    case KeyStage::Preedit:
+        return "preedit";
+    case KeyStage::Suggestions:
+        return "suggestions";
+    case KeyStage::Flush:
+        return "flush";
+    case KeyStage::Count:
+        break;
+    }
+    return "";
+}
+
+int64_t latencyNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void KeyLatencyHistogram::add(uint64_t ns, int64_t now) {
+    int64_t index = now / windowNs;
+    auto &window = windows_[index % windowCount];
+    if (window.index != index) {
+        window.index = index;
+        window.counts.fill(0);
+    }
+    window.counts[bucketOf(ns)]++;
+}
+
+void KeyLatencyHistogram::clear() { windows_.fill(Window()); }
+
+std::vector<std::pair<std::string, uint64_t>>
+KeyLatencyHistogram::values(int64_t now) const {
+    int64_t index = now / windowNs;
+    std::array<uint64_t, bucketCount> counts{};
+    for (const auto &window : windows_) {
+        if (window.index < 0 || window.index <= index - windowCount) {
+            continue;
+        }
+        for (int i = 0; i < bucketCount; i++) {
+            counts[i] += window.counts[i];
+        }
+    }
+    std::vector<std::pair<std::string, uint64_t>> result;
+    for (int i = 0; i < bucketCount; i++) {
+        if (counts[i]) {
+            result.emplace_back(bucketName(i), counts[i]);
+        }
+    }
+    return result;
+}
+
+} // namespace fcitx
@@ -0,0 +1,92 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_UNIKEY_UNIKEY_LATENCY_H_
+#define _FCITX5_UNIKEY_UNIKEY_LATENCY_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fcitx {
+
+// Stages of handling one key, timed for the slow key log. A stage includes
+// the ones it calls, e.g. commit includes the flush of the pending preedit.
+enum class KeyStage {
+    Surrounding,       // rebuildFromSurroundingText
+    RebuildPreedit,    // rebuildPreedit
+    Engine,            // the engine processing the key or replaying a word
+    SyncState,         // syncState
+    Commit,            // commitString
+    DeleteSurrounding, // deleteSurroundingText
+    UpdateSurrounding, // updateSurroundingText
+    Preedit,           // updatePreedit
+    Suggestions,       // updateSuggestions
+    Flush,             // flushPreeditUpdate
+    Count,
+};
+
+const char *keyStageName(KeyStage stage);
+
+int64_t latencyNow();
+
+// Time spent in each stage by the key being handled.
+struct KeyStageTimes {
+    std::array<uint64_t, static_cast<size_t>(KeyStage::Count)> ns{};
+};
+
+// Adds the time from construction to destruction to its stage. A no-op when
+// times is null, i.e. when the slow key log is off.
+class KeyStageScope {
+public:
+    KeyStageScope(KeyStageTimes *times, KeyStage stage)
+        : times_(times), stage_(stage), start_(times ? latencyNow() : 0) {}
+    KeyStageScope(const KeyStageScope &) = delete;
+    KeyStageScope &operator=(const KeyStageScope &) = delete;
+    ~KeyStageScope() {
+        if (times_) {
+            times_->ns[static_cast<size_t>(stage_)] += latencyNow() - start_;
+        }
+    }
+
+private:
+    KeyStageTimes *times_;
+    KeyStage stage_;
+    int64_t start_;
+};
+
+// Key handling times of the last few minutes, in power of two buckets from
+// 1 us up to 262 ms. Kept as a ring of one minute windows, the oldest one is
+// cleared when it comes round again, so adding a key is a few increments.
+// Read it with
+//   busctl --user call org.fcitx.Fcitx5 /unikey org.fcitx.Fcitx.Unikey1 KeyLatency
+class KeyLatencyHistogram {
+public:
+    static constexpr int bucketCount = 20; // the last one is >= 2^18 us
+    static constexpr int windowCount = 10;
+    static constexpr int64_t windowNs = 60 * int64_t(1000000000);
+
+    void add(uint64_t ns, int64_t now);
+    void clear();
+    // Counts of the windows younger than windowCount minutes, as ("<1us",
+    // count), ("<2us", count) ... (">=262144us", count), empty buckets left
+    // out.
+    std::vector<std::pair<std::string, uint64_t>> values(int64_t now) const;
+
+private:
+    struct Window {
+        int64_t index = -1;
+        std::array<uint64_t, bucketCount> counts{};
+    };
+    std::array<Window, windowCount> windows_;
+};
+
+} // namespace fcitx
+
+#endif // _FCITX5_UNIKEY_UNIKEY_LATENCY_H_
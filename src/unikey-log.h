@@ -18,5 +18,6 @@ FCITX_DECLARE_LOG_CATEGORY(unikey);
 
 // Debug log macro for unikey module
 #define FCITX_UNIKEY_DEBUG() FCITX_LOGC(::fcitx::unikey, Debug)
+#define FCITX_UNIKEY_WARN() FCITX_LOGC(::fcitx::unikey, Warn)
 
 #endif // UNIKEY_LOG_H
@@ -0,0 +1,78 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_UNIKEY_UNIKEY_METRICS_H_
+#define _FCITX5_UNIKEY_UNIKEY_METRICS_H_
+
+#include "ukengine.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fcitx {
+
+// Counters of one UnikeyEngine, summed over all of its input contexts.
+// Cheap enough to be always on; read them with
+//   busctl --user call org.fcitx.Fcitx5 /unikey org.fcitx.Fcitx.Unikey1 Metrics
+struct UnikeyMetrics {
+    uint64_t keys = 0;
+    uint64_t keyTimeNs = 0;
+    uint64_t keyTimeMaxNs = 0;
+
+    uint64_t surroundingRebuilds = 0;
+    uint64_t immediateWordRebuilds = 0;
+    uint64_t staleSurrounding = 0;
+    uint64_t markedUnreliable = 0;
+    uint64_t recoveredReliable = 0;
+    // Immediate commit: bytes of rebuilt words left in the application
+    // instead of being deleted and committed again.
+    uint64_t commitBytesSaved = 0;
+    // Rebuilds from what we committed, the client's snapshot being behind.
+    uint64_t shadowRebuilds = 0;
+
+    // Firefox immediate-commit paths: appending to the last word, rewriting
+    // its tail, or deleting and committing it again.
+    uint64_t firefoxAppends = 0;
+    uint64_t firefoxRewrites = 0;
+    uint64_t firefoxReplaces = 0;
+
+    void addKey(uint64_t ns) {
+        keys++;
+        keyTimeNs += ns;
+        keyTimeMaxNs = std::max(keyTimeMaxNs, ns);
+    }
+
+    std::vector<std::pair<std::string, uint64_t>>
+    values(const UkEngineStats &engine) const {
+        return {
+            {"keys", keys},
+            {"keyTimeAvgNs", keys ? keyTimeNs / keys : 0},
+            {"keyTimeMaxNs", keyTimeMaxNs},
+            {"surroundingRebuilds", surroundingRebuilds},
+            {"immediateWordRebuilds", immediateWordRebuilds},
+            {"staleSurrounding", staleSurrounding},
+            {"markedUnreliable", markedUnreliable},
+            {"recoveredReliable", recoveredReliable},
+            {"commitBytesSaved", commitBytesSaved},
+            {"shadowRebuilds", shadowRebuilds},
+            {"firefoxAppends", firefoxAppends},
+            {"firefoxRewrites", firefoxRewrites},
+            {"firefoxReplaces", firefoxReplaces},
+            {"macroHits", engine.macroHits},
+            {"macroMisses", engine.macroMisses},
+            {"bufferCompactions", engine.bufferCompactions},
+            {"keyBufferCompactions", engine.keyBufferCompactions},
+            {"transitionHits", engine.transitionHits},
+            {"transitionMisses", engine.transitionMisses},
+        };
+    }
+};
+
+} // namespace fcitx
+
+#endif // _FCITX5_UNIKEY_UNIKEY_METRICS_H_
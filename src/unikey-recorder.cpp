@@ -0,0 +1,436 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include "unikey-recorder.h"
+#include "inputproc.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/capabilityflags.h>
+#include <fcitx-utils/key.h>
+#include <fcitx/event.h>
+#include <fcitx/inputcontext.h>
+#include <fcitx/surroundingtext.h>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <unistd.h>
+
+namespace fcitx {
+
+namespace {
+
+constexpr char recordMagic[4] = {'U', 'K', 'R', 'C'};
+constexpr uint32_t recordVersion = 1;
+// a longer string in a record means the file is damaged
+constexpr uint32_t recordMaxString = 1 << 20;
+constexpr unsigned int maskKeepChars = 32;
+
+// Characters the engine treats alike wherever they are typed, found by
+// replaying random keys with each option: consonants that start a word on
+// their own and are in no cluster, two letters foreign to Vietnamese, and
+// the digits. A member that is a key of the input method stays out.
+const char *const substitutionClasses[] = {"blsvx", "fj", "0123456789"};
+
+char toUpperAscii(char c) { return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c; }
+
+bool isPrivate(InputContext *ic) {
+    return ic->capabilityFlags().testAny(CapabilityFlag::PasswordOrSensitive);
+}
+
+bool isUtf8Lead(char c) { return (static_cast<unsigned char>(c) & 0xC0) != 0x80; }
+
+bool isMaskBreak(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void appendConfig(const RawConfig &config, const std::string &path,
+                  std::string &out) {
+    if (!path.empty()) {
+        out += path;
+        out += '=';
+        for (char c : config.value()) {
+            if (c == '\\') {
+                out += "\\\\";
+            } else if (c == '\n') {
+                out += "\\n";
+            } else {
+                out += c;
+            }
+        }
+        out += '\n';
+    }
+    for (const auto &name : config.subItems()) {
+        appendConfig(*config.get(name), path.empty() ? name : path + "/" + name,
+                     out);
+    }
+}
+
+} // namespace
+
+UnikeyRecordWriter::UnikeyRecordWriter(FILE *file) : file_(file) {
+    std::setvbuf(file_, nullptr, _IOFBF, 64 * 1024);
+    std::fwrite(recordMagic, 1, sizeof(recordMagic), file_);
+    put32(recordVersion);
+}
+
+UnikeyRecordWriter::~UnikeyRecordWriter() { std::fclose(file_); }
+
+void UnikeyRecordWriter::put8(uint8_t value) { std::fputc(value, file_); }
+
+void UnikeyRecordWriter::put32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        put8(static_cast<uint8_t>(value >> (i * 8)));
+    }
+}
+
+void UnikeyRecordWriter::put64(uint64_t value) {
+    put32(static_cast<uint32_t>(value));
+    put32(static_cast<uint32_t>(value >> 32));
+}
+
+void UnikeyRecordWriter::putString(const std::string &value) {
+    put32(static_cast<uint32_t>(value.size()));
+    std::fwrite(value.data(), 1, value.size(), file_);
+}
+
+void UnikeyRecordWriter::write(const UnikeyRecord &record) {
+    put8(static_cast<uint8_t>(record.type));
+    put32(record.context);
+    put32(record.delayUs);
+    switch (record.type) {
+    case UnikeyRecordType::Context:
+        putString(record.text);
+        put64(record.flags);
+        break;
+    case UnikeyRecordType::Config:
+        putString(record.text);
+        break;
+    case UnikeyRecordType::Surrounding:
+        put8(record.valid);
+        put32(record.cursor);
+        put32(record.anchor);
+        putString(record.text);
+        break;
+    case UnikeyRecordType::Key:
+        put32(record.sym);
+        put32(record.states);
+        put8(record.release);
+        break;
+    case UnikeyRecordType::Reset:
+        put32(record.event);
+        break;
+    }
+}
+
+void UnikeyRecordWriter::flush() { std::fflush(file_); }
+
+UnikeyRecordReader::UnikeyRecordReader(FILE *file) : file_(file) {
+    char magic[sizeof(recordMagic)];
+    uint32_t version;
+    valid_ = std::fread(magic, 1, sizeof(magic), file_) == sizeof(magic) &&
+             std::memcmp(magic, recordMagic, sizeof(magic)) == 0 &&
+             get32(version) && version == recordVersion;
+}
+
+UnikeyRecordReader::~UnikeyRecordReader() { std::fclose(file_); }
+
+bool UnikeyRecordReader::get8(uint8_t &value) {
+    int c = std::fgetc(file_);
+    if (c == EOF) {
+        return false;
+    }
+    value = static_cast<uint8_t>(c);
+    return true;
+}
+
+bool UnikeyRecordReader::get32(uint32_t &value) {
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        uint8_t byte;
+        if (!get8(byte)) {
+            return false;
+        }
+        value |= static_cast<uint32_t>(byte) << (i * 8);
+    }
+    return true;
+}
+
+bool UnikeyRecordReader::get64(uint64_t &value) {
+    uint32_t low;
+    uint32_t high;
+    if (!get32(low) || !get32(high)) {
+        return false;
+    }
+    value = low | (static_cast<uint64_t>(high) << 32);
+    return true;
+}
+
+bool UnikeyRecordReader::getString(std::string &value) {
+    uint32_t size;
+    if (!get32(size) || size > recordMaxString) {
+        return false;
+    }
+    value.resize(size);
+    return std::fread(value.data(), 1, size, file_) == size;
+}
+
+bool UnikeyRecordReader::next(UnikeyRecord &record) {
+    if (!valid_) {
+        return false;
+    }
+    uint8_t type;
+    if (!get8(type) || !get32(record.context) || !get32(record.delayUs)) {
+        return false;
+    }
+    record.type = static_cast<UnikeyRecordType>(type);
+    uint8_t byte;
+    switch (record.type) {
+    case UnikeyRecordType::Context:
+        return getString(record.text) && get64(record.flags);
+    case UnikeyRecordType::Config:
+        return getString(record.text);
+    case UnikeyRecordType::Surrounding:
+        if (!get8(byte)) {
+            return false;
+        }
+        record.valid = byte;
+        return get32(record.cursor) && get32(record.anchor) &&
+               getString(record.text);
+    case UnikeyRecordType::Key:
+        if (!get32(record.sym) || !get32(record.states) || !get8(byte)) {
+            return false;
+        }
+        record.release = byte;
+        return true;
+    case UnikeyRecordType::Reset:
+        return get32(record.event);
+    }
+    // A type from a newer version, its size is unknown.
+    return false;
+}
+
+UnikeyKeySubstitution::UnikeyKeySubstitution() {
+    for (size_t i = 0; i < map_.size(); i++) {
+        map_[i] = i;
+    }
+}
+
+void UnikeyKeySubstitution::shuffle(const int keyMap[256], std::mt19937 &rng) {
+    for (size_t i = 0; i < map_.size(); i++) {
+        map_[i] = i;
+    }
+    for (const char *members : substitutionClasses) {
+        std::string from;
+        for (const char *p = members; *p; p++) {
+            // the capital of a letter is the same key with shift
+            if (keyMap[static_cast<unsigned char>(*p)] == vneNormal &&
+                keyMap[static_cast<unsigned char>(toUpperAscii(*p))] ==
+                    vneNormal) {
+                from += *p;
+            }
+        }
+        std::string to = from;
+        std::shuffle(to.begin(), to.end(), rng);
+        for (size_t i = 0; i < from.size(); i++) {
+            map_[static_cast<unsigned char>(from[i])] = to[i];
+            map_[static_cast<unsigned char>(toUpperAscii(from[i]))] =
+                toUpperAscii(to[i]);
+        }
+    }
+}
+
+void UnikeyKeySubstitution::apply(std::string &text) const {
+    for (char &c : text) {
+        auto byte = static_cast<unsigned char>(c);
+        if (byte < map_.size()) {
+            c = static_cast<char>(map_[byte]);
+        }
+    }
+}
+
+std::unique_ptr<UnikeyRecorder> UnikeyRecorder::fromEnvironment() {
+    const char *path = std::getenv("UNIKEY_RECORD_FILE");
+    if (!path || !*path) {
+        return nullptr;
+    }
+    // Never into an existing file, which may be readable by others or a
+    // link to somewhere else.
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+    FILE *file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        return nullptr;
+    }
+    return std::make_unique<UnikeyRecorder>(file);
+}
+
+UnikeyRecorder::UnikeyRecorder(FILE *file)
+    : writer_(file), last_(std::chrono::steady_clock::now()),
+      rng_(std::random_device()()) {}
+
+void UnikeyRecorder::write(UnikeyRecord &record) {
+    auto now = std::chrono::steady_clock::now();
+    auto us =
+        std::chrono::duration_cast<std::chrono::microseconds>(now - last_)
+            .count();
+    record.delayUs = static_cast<uint32_t>(
+        std::clamp<int64_t>(us, 0, std::numeric_limits<uint32_t>::max()));
+    last_ = now;
+    writer_.write(record);
+}
+
+void UnikeyRecorder::config(const RawConfig &config, const int keyMap[256]) {
+    substitution_.shuffle(keyMap, rng_);
+    record_.type = UnikeyRecordType::Config;
+    record_.context = 0;
+    record_.text = unikeyConfigToString(config);
+    write(record_);
+    writer_.flush();
+}
+
+void UnikeyRecorder::updateContext(UnikeyRecordedContext &context,
+                                   InputContext *ic) {
+    const uint64_t flags = ic->capabilityFlags();
+    if (context.id == 0 || context.flags != flags) {
+        if (context.id == 0) {
+            context.id = ++lastContextId_;
+        }
+        context.flags = flags;
+        record_.type = UnikeyRecordType::Context;
+        record_.context = context.id;
+        record_.text = ic->program();
+        record_.flags = flags;
+        write(record_);
+    }
+
+    if (!ic->capabilityFlags().test(CapabilityFlag::SurroundingText) ||
+        isPrivate(ic)) {
+        return;
+    }
+    const auto &st = ic->surroundingText();
+    record_.valid = st.isValid();
+    record_.cursor = record_.valid ? st.cursor() : 0;
+    record_.anchor = record_.valid ? st.anchor() : 0;
+    if (record_.valid) {
+        unikeyMaskSurroundingText(st.text(), st.cursor(), record_.text);
+        substitution_.apply(record_.text);
+    } else {
+        record_.text.clear();
+    }
+    if (record_.valid == context.surroundingValid &&
+        record_.cursor == context.cursor && record_.anchor == context.anchor &&
+        record_.text == context.surrounding) {
+        return;
+    }
+    context.surroundingValid = record_.valid;
+    context.cursor = record_.cursor;
+    context.anchor = record_.anchor;
+    context.surrounding = record_.text;
+    record_.type = UnikeyRecordType::Surrounding;
+    record_.context = context.id;
+    write(record_);
+}
+
+void UnikeyRecorder::keyEvent(UnikeyRecordedContext &context,
+                              InputContext *ic, const KeyEvent &event) {
+    if (isPrivate(ic)) {
+        return;
+    }
+    updateContext(context, ic);
+    record_.type = UnikeyRecordType::Key;
+    record_.context = context.id;
+    record_.sym = substitution_.sym(event.rawKey().sym());
+    record_.states = event.rawKey().states();
+    record_.release = event.isRelease();
+    write(record_);
+}
+
+void UnikeyRecorder::reset(UnikeyRecordedContext &context, InputContext *ic,
+                           uint32_t eventType) {
+    updateContext(context, ic);
+    record_.type = UnikeyRecordType::Reset;
+    record_.context = context.id;
+    record_.event = eventType;
+    write(record_);
+    // Focus changes are rare enough, this keeps the file usable after a
+    // crash.
+    writer_.flush();
+}
+
+void unikeyMaskSurroundingText(const std::string &text, unsigned int cursor,
+                               std::string &out) {
+    // Byte offset of the cursor and of the start of the word before it.
+    size_t cursorPos = 0;
+    for (unsigned int chars = 0; cursorPos < text.size(); cursorPos++) {
+        if (isUtf8Lead(text[cursorPos]) && chars++ == cursor) {
+            break;
+        }
+    }
+    size_t wordPos = cursorPos;
+    for (unsigned int chars = 0; wordPos > 0 && chars < maskKeepChars;) {
+        size_t prev = wordPos - 1;
+        while (prev > 0 && !isUtf8Lead(text[prev])) {
+            prev--;
+        }
+        if (isMaskBreak(text[prev])) {
+            break;
+        }
+        wordPos = prev;
+        chars++;
+    }
+
+    out.clear();
+    for (size_t i = 0; i < text.size(); i++) {
+        if (i >= wordPos && i < cursorPos) {
+            out += text[i];
+        } else if (isUtf8Lead(text[i])) {
+            out += ' ';
+        }
+    }
+}
+
+std::string unikeyConfigToString(const RawConfig &config) {
+    std::string out;
+    appendConfig(config, "", out);
+    return out;
+}
+
+void unikeyConfigFromString(const std::string &str, RawConfig &config) {
+    size_t pos = 0;
+    while (pos < str.size()) {
+        auto end = str.find('\n', pos);
+        if (end == std::string::npos) {
+            end = str.size();
+        }
+        auto equal = str.find('=', pos);
+        if (equal < end) {
+            std::string value;
+            for (size_t i = equal + 1; i < end; i++) {
+                if (str[i] == '\\' && i + 1 < end) {
+                    i++;
+                    value += str[i] == 'n' ? '\n' : str[i];
+                } else {
+                    value += str[i];
+                }
+            }
+            config.setValueByPath(str.substr(pos, equal - pos), value);
+        }
+        pos = end + 1;
+    }
+}
+
+} // namespace fcitx
@@ -0,0 +1,199 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_UNIKEY_UNIKEY_RECORDER_H_
+#define _FCITX5_UNIKEY_UNIKEY_RECORDER_H_
+
+// Recording of what reaches the key handling, so that a report of slow or
+// wrong typing in some application can be replayed offline with
+// test/replayunikey, against the same engine and config.
+//
+// Off unless $UNIKEY_RECORD_FILE names a file that does not exist yet when
+// the addon is loaded. It is created readable by the user only.
+//
+// The file is a small binary log: key syms and states, the surrounding text
+// snapshots, capability flags and program name of each input context, and
+// the options. Of the surrounding text only the word before the cursor is
+// kept, the rest is blanked out to spaces of the same length, which rebuilds
+// the same way. The typed keys and the kept word go through a
+// UnikeyKeySubstitution made for the recording. Nothing of password and
+// sensitive fields is recorded. The macro table and the word lists are not
+// recorded.
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+
+namespace fcitx {
+
+class InputContext;
+class KeyEvent;
+class RawConfig;
+
+enum class UnikeyRecordType : uint8_t {
+    // first record of a context and whenever its capability flags change
+    Context = 1,
+    Config,
+    Surrounding,
+    Key,
+    // reset, focus out and input method switch
+    Reset,
+};
+
+struct UnikeyRecord {
+    UnikeyRecordType type = UnikeyRecordType::Key;
+    // 1 for the first context recorded, 2 for the next one...; 0 for Config
+    uint32_t context = 0;
+    // microseconds since the previous record
+    uint32_t delayUs = 0;
+    // Context: program name, Config: unikeyConfigToString(),
+    // Surrounding: text with everything but the word before the cursor
+    // blanked out
+    std::string text;
+    // Context: capability flags
+    uint64_t flags = 0;
+    // Surrounding: false for an invalid snapshot, text is empty then
+    bool valid = false;
+    // Surrounding: in characters
+    uint32_t cursor = 0;
+    uint32_t anchor = 0;
+    // Key: the raw key
+    uint32_t sym = 0;
+    uint32_t states = 0;
+    bool release = false;
+    // Reset: the EventType
+    uint32_t event = 0;
+};
+
+// Little endian, independent of the host.
+class UnikeyRecordWriter {
+public:
+    // Takes the file and writes the header.
+    explicit UnikeyRecordWriter(FILE *file);
+    UnikeyRecordWriter(const UnikeyRecordWriter &) = delete;
+    UnikeyRecordWriter &operator=(const UnikeyRecordWriter &) = delete;
+    ~UnikeyRecordWriter();
+
+    void write(const UnikeyRecord &record);
+    void flush();
+
+private:
+    void put8(uint8_t value);
+    void put32(uint32_t value);
+    void put64(uint64_t value);
+    void putString(const std::string &value);
+
+    FILE *file_;
+};
+
+class UnikeyRecordReader {
+public:
+    // Takes the file and reads the header.
+    explicit UnikeyRecordReader(FILE *file);
+    UnikeyRecordReader(const UnikeyRecordReader &) = delete;
+    UnikeyRecordReader &operator=(const UnikeyRecordReader &) = delete;
+    ~UnikeyRecordReader();
+
+    // false if the file is not a recording of a version this reads
+    bool valid() const { return valid_; }
+    // false at the end, or at a record cut short by a crash
+    bool next(UnikeyRecord &record);
+
+private:
+    bool get8(uint8_t &value);
+    bool get32(uint32_t &value);
+    bool get64(uint64_t &value);
+    bool getString(std::string &value);
+
+    FILE *file_;
+    bool valid_ = false;
+};
+
+// Swaps the letters and digits that the engine tells apart by nothing but
+// their own output, so that a recording does not keep them as typed and
+// still replays the same: the output of the substituted keys is that of the
+// typed ones with the same substitution. That leaves the input method keys
+// (tone and mark keys, the keys of the key map), the word breaks, the vowels
+// and the consonants taking part in clusters or spelling rules as they are.
+// testrecorder checks it against the engine.
+class UnikeyKeySubstitution {
+public:
+    // changes nothing
+    UnikeyKeySubstitution();
+
+    // A new random substitution of the characters that keyMap, see
+    // UkInputProcessor::getKeyMap, leaves as plain characters.
+    void shuffle(const int keyMap[256], std::mt19937 &rng);
+
+    uint32_t sym(uint32_t sym) const {
+        return sym < map_.size() ? map_[sym] : sym;
+    }
+    // In place, only ASCII is ever swapped.
+    void apply(std::string &text) const;
+
+private:
+    std::array<unsigned char, 128> map_;
+};
+
+// Per context part of the recording, kept in UnikeyState.
+struct UnikeyRecordedContext {
+    uint32_t id = 0; // 0 until the context is first recorded
+    uint64_t flags = 0;
+    // last surrounding snapshot recorded
+    bool surroundingValid = false;
+    uint32_t cursor = 0;
+    uint32_t anchor = 0;
+    std::string surrounding;
+};
+
+class UnikeyRecorder {
+public:
+    // null unless $UNIKEY_RECORD_FILE is set and can be created
+    static std::unique_ptr<UnikeyRecorder> fromEnvironment();
+
+    explicit UnikeyRecorder(FILE *file);
+
+    // keyMap is the key map of the input method of config, the substitution
+    // is made again for it.
+    void config(const RawConfig &config, const int keyMap[256]);
+    // Records the key and, before it, whatever changed in the context since
+    // its last key. Keys of password and sensitive fields are left out.
+    void keyEvent(UnikeyRecordedContext &context, InputContext *ic,
+                  const KeyEvent &event);
+    void reset(UnikeyRecordedContext &context, InputContext *ic,
+               uint32_t eventType);
+
+private:
+    void write(UnikeyRecord &record);
+    void updateContext(UnikeyRecordedContext &context, InputContext *ic);
+
+    UnikeyRecordWriter writer_;
+    uint32_t lastContextId_ = 0;
+    std::chrono::steady_clock::time_point last_;
+    std::mt19937 rng_;
+    UnikeyKeySubstitution substitution_;
+    // reused for every record, recording does not allocate per key
+    UnikeyRecord record_;
+};
+
+// Sets out to text with every character but those of the word ending at
+// cursor (in characters) replaced by a space. At most 32 characters are
+// kept, more than a word the rebuild takes.
+void unikeyMaskSurroundingText(const std::string &text, unsigned int cursor,
+                               std::string &out);
+
+// One "path=value" line per value, '\\' and a new line in a value escaped as
+// "\\\\" and "\\n".
+std::string unikeyConfigToString(const RawConfig &config);
+void unikeyConfigFromString(const std::string &str, RawConfig &config);
+
+} // namespace fcitx
+
+#endif // _FCITX5_UNIKEY_UNIKEY_RECORDER_H_
@@ -14,7 +14,9 @@
 #include "usrkeymap.h"
 #include "unikey-utils.h"
 #include "unikey-constants.h"
+#include "unikey-latency.h"
 #include "unikey-log.h"
+#include "unikey-trace.h"
 #include "vnconv.h"
 #include "vnlexi.h"
 #include <cassert>
@@ -22,6 +24,8 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <iterator>
+#include <string>
 #include <fcitx-utils/capabilityflags.h>
 #include <fcitx-utils/charutils.h>
 #include <fcitx-utils/i18n.h>
@@ -32,17 +36,55 @@
 #include <fcitx-utils/misc.h>
 #include <fcitx-utils/textformatflags.h>
 #include <fcitx-utils/utf8.h>
+#include <fcitx/candidatelist.h>
 #include <fcitx/inputcontext.h>
 #include <fcitx/inputpanel.h>
 #include <fcitx/text.h>
 
-#include <iostream>
 namespace fcitx {
 
+namespace {
+
+constexpr int MaxSuggestions = 9;
+
+// Plain digits are VNI tone keys, suggestions are picked with Alt.
+const KeyList SuggestionKeys = {
+    Key(FcitxKey_1, KeyState::Alt), Key(FcitxKey_2, KeyState::Alt),
+    Key(FcitxKey_3, KeyState::Alt), Key(FcitxKey_4, KeyState::Alt),
+    Key(FcitxKey_5, KeyState::Alt), Key(FcitxKey_6, KeyState::Alt),
+    Key(FcitxKey_7, KeyState::Alt), Key(FcitxKey_8, KeyState::Alt),
+    Key(FcitxKey_9, KeyState::Alt)};
+
+class SuggestionWord : public CandidateWord {
+public:
+    SuggestionWord(UnikeyState *state, std::string word)
+        : CandidateWord(Text(word)), state_(state), word_(std::move(word)) {}
+
+    void select(InputContext * /*inputContext*/) const override {
+        state_->selectSuggestion(word_);
+    }
+
+private:
+    UnikeyState *state_;
+    std::string word_;
+};
+
+} // namespace
+
 UnikeyState::UnikeyState(UnikeyEngine *engine, InputContext *ic)
-    : engine_(engine), uic_(engine->im()), ic_(ic) {}
+    : engine_(engine), uic_(engine->im()), ic_(ic),
+      appProfile_(ic->program().empty()
+                      ? &unnamedProfile_
+                      : engine->appProfiles().profile(ic->program())) {
+    // Start in preedit mode in apps known to give bad surrounding text,
+    // instead of failing a few rebuilds to find out again.
+    surroundingTextUnreliable_ = appProfile_->surroundingUnreliable;
+}
 
 void UnikeyState::keyEvent(KeyEvent &keyEvent) {
+    if (auto *recorder = engine_->recorder()) {
+        recorder->keyEvent(recordedContext_, ic_, keyEvent);
+    }
     // Ignore all key release.
     if (keyEvent.isRelease()) {
         // Do not clear lastShiftPressed_ here.
@@ -54,7 +96,16 @@ void UnikeyState::keyEvent(KeyEvent &keyEvent) {
         // tap sequence.
         return;
     }
+    UNIKEY_TRACE_KEY("keyEvent", keyEvent.rawKey().sym(), ic_->program());
 
+    if (auto candidateList = ic_->inputPanel().candidateList()) {
+        int idx = keyEvent.key().keyListIndex(SuggestionKeys);
+        if (idx >= 0 && idx < candidateList->size()) {
+            candidateList->candidate(idx).select(ic_);
+            keyEvent.filterAndAccept();
+            return;
+        }
+    }
 
     // Snapshot whether immediate-commit is allowed for this keystroke BEFORE
     // any surrounding-text rebuild attempts. rebuildPreedit() may mark
@@ -81,9 +132,17 @@ void UnikeyState::keyEvent(KeyEvent &keyEvent) {
     }
 
     if (keyEvent.key().isSimple()) {
-        rebuildPreedit(keyEvent.rawKey().sym());
+        rebuildPreedit(keyEvent.rawKey().sym(), allowImmediateCommitForThisKey);
     }
     preedit(keyEvent, allowImmediateCommitForThisKey);
+    if (!surroundingWord_.empty()) {
+        // Nothing was committed over the rebuilt word, it is in the preedit
+        // now, so take it out of the application.
+        const auto length = static_cast<int>(surroundingWord_.length());
+        surroundingWord_.clear();
+        deleteSurroundingText(-length, length);
+        updatePreedit();
+    }
 
     // check last keyevent with shift
     if (keyEvent.rawKey().sym() >= FcitxKey_space &&
@@ -96,23 +155,20 @@ void UnikeyState::keyEvent(KeyEvent &keyEvent) {
 }
 
 bool UnikeyState::isUnsupportedSurroundingApp() const {
-    const auto prog = ic_->program();
-    // Firefox is now supported via internal state tracking for immediate commit mode.
-    // Treat various LibreOffice frontends as unsupported for surrounding-text
-    // handling due to inconsistent surrounding snapshots.
-    if (prog == "libreoffice" || prog == "LibreOffice" ||
-        prog == "soffice" || prog == "soffice.bin" ||
-        prog == "libreoffice-writer" || prog == "org.libreoffice.LibreOffice") {
-        return true;
-    }
-
-    return false;
+    return appProfile_->kind == UnikeyAppKind::UnsupportedSurrounding;
 }
 
 bool UnikeyState::isFirefox() const {
-    const auto prog = ic_->program();
-    return (prog == "firefox" || prog == "org.mozilla.firefox" ||
-            prog == "firefox-bin" || prog == "Firefox");
+    return appProfile_->kind == UnikeyAppKind::Firefox;
+}
+
+void UnikeyState::setSurroundingTextUnreliable(bool unreliable) {
+    surroundingTextUnreliable_ = unreliable;
+    if (appProfile_ == &unnamedProfile_) {
+        unnamedProfile_.surroundingUnreliable = unreliable;
+        return;
+    }
+    engine_->appProfiles().setSurroundingUnreliable(appProfile_, unreliable);
 }
 
 bool UnikeyState::immediateCommitMode() const {
@@ -163,27 +219,15 @@ bool UnikeyState::immediateCommitMode() const {
 }
 
 void UnikeyState::eraseChars(int num_chars) {
-    int i;
-    int k;
-    unsigned char c;
-    k = num_chars;
-
-    for (i = preeditStr_.length() - 1; i >= 0 && k > 0; i--) {
-        c = preeditStr_.at(i);
-
-        // count down if byte is begin byte of utf-8 char
-        if (c < (unsigned char)'\x80' || c >= (unsigned char)'\xC0') {
-            k--;
-        }
-    }
-
-    preeditStr_.erase(i + 1);
+    preeditStr_.eraseChars(num_chars);
 }
 
 void UnikeyState::reset() {
     uic_.resetBuf();
     preeditStr_.clear();
     keyStrokes_.clear();
+    // The panel may have been changed behind our back, always resend it.
+    shownPreeditValid_ = false;
     updatePreedit();
     lastShiftPressed_ = FcitxKey_None;
 
@@ -202,11 +246,14 @@ void UnikeyState::clearImmediateCommitHistory() {
     recordNextCommitAsImmediateWord_ = false;
     lastSurroundingRebuildWasStale_ = false;
     firefoxCursorOffsetFromEnd_ = 0;
-
-    // On focus change, give the new context a fresh chance. The new
-    // application (or even a different field in the same app) may
-    // provide reliable surrounding text.
-    surroundingTextUnreliable_ = false;
+    // The snapshot may still be one of the text we left.
+    surroundingShadow_.unknown(ic_->surroundingText());
+
+    // On focus change, give the new context a fresh chance, unless the app
+    // is known to give bad surrounding text: resets come on every click, and
+    // the profile keeps that until a context sees the surrounding text work
+    // again.
+    surroundingTextUnreliable_ = appProfile_->surroundingUnreliable;
     surroundingFailureCount_ = 0;
     surroundingSuccessCount_ = 0;
 }
@@ -233,6 +280,7 @@ void UnikeyState::clearImmediateCommitHistory() {
  *        This is used for applications with limited preedit support.
  */
 void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKey) {
+    UNIKEY_TRACE("preedit");
     auto sym = keyEvent.rawKey().sym();
     auto state = keyEvent.rawKey().states();
 
@@ -242,8 +290,8 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
         sym = static_cast<KeySym>(FcitxKey_0 + (sym - FcitxKey_KP_0));
     }
 
-    FCITX_INFO() << "[preedit] Processing key " << sym
-                         << " Current preedit: \"" << preeditStr_ << "\"";
+    FCITX_UNIKEY_DEBUG() << "[preedit] Processing key " << sym
+                         << " Current preedit: \"" << preeditStr_.str() << "\"";
 
     // We try to detect Press and release of two different shift.
     // The sequence we want to detect is:
@@ -291,13 +339,13 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
         return;
     }
     if (sym == FcitxKey_BackSpace) {
-        FCITX_INFO() << "[preedit] BackSpace pressed";
+        FCITX_UNIKEY_DEBUG() << "[preedit] BackSpace pressed";
         if (immediateCommitMode()) {
-            FCITX_INFO() << "[preedit] BackSpace in immediate commit mode";
-            ic_->updateSurroundingText();
+            FCITX_UNIKEY_DEBUG() << "[preedit] BackSpace in immediate commit mode";
+            updateSurroundingText();
             if (ic_->surroundingText().isValid() &&
                 !ic_->surroundingText().selectedText().empty()) {
-                FCITX_INFO() << "[preedit] Text selected, resetting";
+                FCITX_UNIKEY_DEBUG() << "[preedit] Text selected, resetting";
                 reset();
                 return;
             }
@@ -310,8 +358,8 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
             }
 
             // Default behavior: delete and clear all state
-            FCITX_INFO() << "[preedit] Deleting surrounding text (-1, 1)";
-            ic_->deleteSurroundingText(-1, 1);
+            FCITX_UNIKEY_DEBUG() << "[preedit] Deleting surrounding text (-1, 1)";
+            deleteSurroundingText(-1, 1);
 
             // After explicit deletion, we should not attempt to rewrite using
             // the last immediate word.
@@ -329,75 +377,35 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
             return;
         }
 
-        auto currentLen = utf8::lengthValidated(preeditStr_);
-        if (currentLen == utf8::INVALID_LENGTH) {
-            currentLen = 0;
-        }
+        auto currentLen = preeditStr_.length();
 
         // Loop to pop keystrokes until the number of characters decreases.
         // This implements "delete whole character" behavior instead of
         // "progressive undo" (which might just remove a tone).
+        // The engine and tempStr are left at the last replay, which is of
+        // the final keyStrokes_ unless there was none.
+        PreeditText tempStr;
+        bool replayed = false;
         do {
             keyStrokes_.pop_back();
 
-            // If we started with nothing visible (or invalid), popping one key
+            // If we started with nothing visible, popping one key
             // is enough.
             if (currentLen == 0) {
                 break;
             }
 
             // Simulate the new state to check length
-            uic_.resetBuf();
-            std::string tempStr;
-            for (auto s : keyStrokes_) {
-                uic_.filter(s);
-                // Replicate syncState logic for string construction
-                if (uic_.backspaces() > 0) {
-                    int k = uic_.backspaces();
-                    int i;
-                    for (i = tempStr.length() - 1; i >= 0 && k > 0; i--) {
-                        unsigned char c = tempStr.at(i);
-                        if (c < 0x80 || c >= 0xC0) {
-                            k--;
-                        }
-                    }
-                    tempStr.erase(i + 1);
-                }
-                if (uic_.bufChars() > 0) {
-                    if (*this->engine_->config().oc == UkConv::XUTF8) {
-                        tempStr.append(
-                            reinterpret_cast<const char *>(uic_.buf()),
-                            uic_.bufChars());
-                    } else {
-                        unsigned char buf[CONVERT_BUF_SIZE + 1];
-                        int bufSize = CONVERT_BUF_SIZE;
-                        latinToUtf(buf, uic_.buf(), uic_.bufChars(), &bufSize);
-                        tempStr.append((const char *)buf,
-                                       CONVERT_BUF_SIZE - bufSize);
-                    }
-                } else if (s != FcitxKey_Shift_L && s != FcitxKey_Shift_R &&
-                           s != FcitxKey_None) {
-                    tempStr.append(utf8::UCS4ToUTF8(s));
-                }
-            }
-
-            auto newLen = utf8::lengthValidated(tempStr);
-            if (newLen == utf8::INVALID_LENGTH) {
-                newLen = 0;
-            }
+            tempStr = replayKeyStrokes();
+            replayed = true;
 
-            if (newLen < currentLen) {
+            if (tempStr.length() < currentLen) {
                 break;
             }
 
         } while (!keyStrokes_.empty());
 
-        uic_.resetBuf();
-        preeditStr_.clear();
-        for (auto s : keyStrokes_) {
-            uic_.filter(s);
-            syncState(s);
-        }
+        preeditStr_ = replayed ? std::move(tempStr) : replayKeyStrokes();
 
         if (preeditStr_.empty()) {
             commit();
@@ -469,6 +477,8 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
             keyEvent.filterAndAccept();
             return;
         } else {
+            UNIKEY_TRACE("process");
+            KeyStageScope stage(stageTimes_, KeyStage::Engine);
             uic_.filter(sym);
             keyStrokes_.push_back(sym);
         }
@@ -478,10 +488,10 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
         syncState(sym);
 
         if (immediateCommit) {
-            FCITX_UNIKEY_DEBUG() << "[preedit] ImmediateCommit: committing \"" << preeditStr_ << "\"";
+            FCITX_UNIKEY_DEBUG() << "[preedit] ImmediateCommit: committing \"" << preeditStr_.str() << "\"";
             if (isFirefox() && !lastImmediateWord_.empty()) {
                 auto logSurrounding = [&](const char *tag) {
-                    ic_->updateSurroundingText();
+                    updateSurroundingText();
                     const auto &st = ic_->surroundingText();
                     if (!st.isValid()) {
                         FCITX_UNIKEY_DEBUG() << tag << " surrounding invalid";
@@ -498,7 +508,7 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
                 };
 
                 logSurrounding("[firefox-immediate] before");
-                const std::string fullWord = preeditStr_;
+                const std::string &fullWord = preeditStr_.str();
                 auto itLast = lastImmediateWord_.begin();
                 auto itFull = fullWord.begin();
                 const auto endLast = lastImmediateWord_.end();
@@ -544,8 +554,9 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
                         firefoxCursorOffsetFromEnd_ = 0;
                         recordNextCommitAsImmediateWord_ = false;
                         if (!suffix.empty()) {
-                            ic_->commitString(suffix);
+                            commitString(suffix);
                         }
+                        engine_->metrics().firefoxAppends++;
                         logSurrounding("[firefox-immediate] after-append");
                         reset();
                         keyEvent.filterAndAccept();
@@ -557,7 +568,7 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
                             lastImmediateWordCharCount_ - commonChars;
                         if (deleteCount > 0) {
                             logSurrounding("[firefox-immediate] before-delete");
-                            ic_->deleteSurroundingText(-static_cast<int>(deleteCount),
+                            deleteSurroundingText(-static_cast<int>(deleteCount),
                                                        static_cast<int>(deleteCount));
                             logSurrounding("[firefox-immediate] after-delete");
                         }
@@ -572,8 +583,9 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
                         firefoxCursorOffsetFromEnd_ = 0;
                         recordNextCommitAsImmediateWord_ = false;
                         if (!suffix.empty()) {
-                            ic_->commitString(suffix);
+                            commitString(suffix);
                         }
+                        engine_->metrics().firefoxRewrites++;
                         logSurrounding("[firefox-immediate] after-rewrite");
                         reset();
                         keyEvent.filterAndAccept();
@@ -582,8 +594,9 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
                 }
 
                 if (lastImmediateWordCharCount_ > 0) {
+                    engine_->metrics().firefoxReplaces++;
                     logSurrounding("[firefox-immediate] before-delete");
-                    ic_->deleteSurroundingText(-static_cast<int>(lastImmediateWordCharCount_),
+                    deleteSurroundingText(-static_cast<int>(lastImmediateWordCharCount_),
                                                static_cast<int>(lastImmediateWordCharCount_));
                     logSurrounding("[firefox-immediate] after-delete");
                 }
@@ -600,7 +613,7 @@ void UnikeyState::preedit(KeyEvent &keyEvent, bool allowImmediateCommitForThisKe
         // commit string: if need
         if (!preeditStr_.empty()) {
             if (preeditStr_.back() == sym && isWordBreakSym(sym)) {
-                FCITX_UNIKEY_DEBUG() << "[preedit] Word break symbol detected, committing \"" << preeditStr_ << "\"";
+                FCITX_UNIKEY_DEBUG() << "[preedit] Word break symbol detected, committing \"" << preeditStr_.str() << "\"";
                 // If we are in modifySurroundingText mode (even if immediateCommit is disabled),
                 // we should record this word to help detect stale surrounding text (e.g. in Firefox).
                 if (*this->engine_->config().modifySurroundingText) {
@@ -653,11 +666,11 @@ void UnikeyState::commit() {
 
         // Strip trailing word break symbols (e.g. space) to extract the actual word.
         // The surrounding text checking logic expects the "word" part to match.
-        std::string candidate = preeditStr_;
+        std::string_view candidate = preeditStr_.str();
         while (!candidate.empty()) {
             unsigned char last = static_cast<unsigned char>(candidate.back());
             if (last < 0x80 && isWordBreakSym(last)) {
-                candidate.pop_back();
+                candidate.remove_suffix(1);
             } else {
                 break;
             }
@@ -666,7 +679,7 @@ void UnikeyState::commit() {
         // Only keep a safe "word" as rewrite source.
         // - Must be valid UTF-8
         // - Must not contain word-break symbols (ASCII)
-        auto charLen = utf8::lengthValidated(candidate);
+        auto charLen = utf8::lengthValidated(candidate.begin(), candidate.end());
         bool ok = (charLen != utf8::INVALID_LENGTH);
         if (ok && !candidate.empty()) {
             for (const auto &c : candidate) {
@@ -690,60 +703,224 @@ void UnikeyState::commit() {
         }
     }
 
-    if (!preeditStr_.empty()) {
-        ic_->commitString(preeditStr_);
+    if (!surroundingWord_.empty()) {
+        size_t bytes;
+        const size_t same = preeditStr_.commonPrefix(surroundingWord_.str(), bytes);
+        const auto stale = static_cast<int>(surroundingWord_.length() - same);
+        surroundingWord_.clear();
+        if (stale > 0) {
+            deleteSurroundingText(-stale, stale);
+        }
+        if (bytes < preeditStr_.str().size()) {
+            commitString(preeditStr_.str().substr(bytes));
+        }
+        engine_->metrics().commitBytesSaved += bytes;
+    } else if (!preeditStr_.empty()) {
+        commitString(preeditStr_.str());
     }
     reset();
 }
 
-void UnikeyState::syncState(KeySym sym) {
-    // process result of ukengine
-    if (uic_.backspaces() > 0) {
-        if (static_cast<int>(preeditStr_.length()) <= uic_.backspaces()) {
-            preeditStr_.clear();
-        } else {
-            eraseChars(uic_.backspaces());
-        }
+void UnikeyState::selectSuggestion(const std::string &word) {
+    preeditStr_.assign(word);
+    commit();
+}
+
+void UnikeyState::commitString(const std::string &str) {
+    UNIKEY_TRACE("commitString");
+    KeyStageScope stage(stageTimes_, KeyStage::Commit);
+    flushPreeditUpdate();
+    surroundingShadow_.edit(ic_->surroundingText(), 0, str);
+    ic_->commitString(str);
+}
+
+void UnikeyState::deleteSurroundingText(int offset, unsigned int size) {
+    UNIKEY_TRACE("deleteSurroundingText");
+    KeyStageScope stage(stageTimes_, KeyStage::DeleteSurrounding);
+    flushPreeditUpdate();
+    if (offset == -static_cast<int>(size)) {
+        surroundingShadow_.edit(ic_->surroundingText(), size, {});
+    } else {
+        surroundingShadow_.unknown(ic_->surroundingText());
     }
+    ic_->deleteSurroundingText(offset, size);
+}
 
-    if (uic_.bufChars() > 0) {
+void UnikeyState::surroundingTextUpdated() {
+    mayRebuildStateFromSurroundingText_ = true;
+    surroundingShadow_.clientUpdated(ic_->surroundingText());
+}
+
+void UnikeyState::keyPassedThrough() {
+    surroundingShadow_.unknown(ic_->surroundingText());
+}
+
+void UnikeyState::updateSurroundingText() {
+    UNIKEY_TRACE("updateSurroundingText");
+    KeyStageScope stage(stageTimes_, KeyStage::UpdateSurrounding);
+    ic_->updateSurroundingText();
+}
+
+void UnikeyState::applyEngineOutput(PreeditText &str) {
+    const UkOutputSpan out = uic_.output();
+    if (out.backspaces > 0) {
+        str.eraseChars(out.backspaces);
+    }
+
+    if (out.size > 0) {
         if (*this->engine_->config().oc == UkConv::XUTF8) {
-            preeditStr_.append(reinterpret_cast<const char *>(uic_.buf()),
-                               uic_.bufChars());
+            str.append(std::string_view(
+                reinterpret_cast<const char *>(out.data), out.size));
         } else {
-            unsigned char buf[CONVERT_BUF_SIZE + 1];
-            int bufSize = CONVERT_BUF_SIZE;
+            // also the unicode escapes, which are plain ASCII
+            str.appendLatin(out.data, out.size);
+        }
+    }
+}
 
-            latinToUtf(buf, uic_.buf(), uic_.bufChars(), &bufSize);
-            preeditStr_.append((const char *)buf, CONVERT_BUF_SIZE - bufSize);
+PreeditText UnikeyState::replayKeyStrokes() {
+    UNIKEY_TRACE("replayKeyStrokes");
+    KeyStageScope stage(stageTimes_, KeyStage::Engine);
+    uic_.resetBuf();
+    PreeditText text;
+    unsigned int keys[64];
+    for (size_t done = 0; done < keyStrokes_.size();) {
+        size_t count = std::min(keyStrokes_.size() - done, std::size(keys));
+        std::copy_n(keyStrokes_.begin() + done, count, keys);
+        // keys the engine produced nothing for are already in its output
+        for (size_t taken = 0; taken < count;) {
+            taken += uic_.filterKeys(keys + taken, count - taken);
+            applyEngineOutput(text);
         }
-    } else if (sym != FcitxKey_Shift_L && sym != FcitxKey_Shift_R &&
-               sym != FcitxKey_None) // if ukengine not process
+        done += count;
+    }
+    return text;
+}
+
+void UnikeyState::syncState(KeySym sym) {
+    UNIKEY_TRACE("syncState");
+    KeyStageScope stage(stageTimes_, KeyStage::SyncState);
+    // process result of ukengine
+    applyEngineOutput(preeditStr_);
+
+    if (uic_.output().size == 0 && sym != FcitxKey_Shift_L &&
+        sym != FcitxKey_Shift_R &&
+        sym != FcitxKey_None) // if ukengine not process
     {
-        preeditStr_.append(utf8::UCS4ToUTF8(sym));
+        preeditStr_.appendChar(sym);
     }
     // end process result of ukengine
 }
 
 void UnikeyState::updatePreedit() {
+    UNIKEY_TRACE("updatePreedit");
+    KeyStageScope stage(stageTimes_, KeyStage::Preedit);
+    const auto useClientPreedit =
+        ic_->capabilityFlags().test(CapabilityFlag::Preedit);
+    const auto format =
+        useClientPreedit && *this->engine_->config().displayUnderline
+            ? TextFormatFlag::Underline
+            : TextFormatFlag::NoFlag;
+    // Keys like Shift or a rejected tone key leave the preedit as it was.
+    if (shownPreeditValid_ && shownClientPreedit_ == useClientPreedit &&
+        shownPreeditFormat_ == format && shownPreedit_ == preeditStr_.str()) {
+        return;
+    }
+    shownPreeditValid_ = true;
+    shownClientPreedit_ = useClientPreedit;
+    shownPreeditFormat_ = format;
+    shownPreedit_ = preeditStr_.str();
+
     auto &inputPanel = ic_->inputPanel();
 
     inputPanel.reset();
 
     if (!preeditStr_.empty()) {
-        const auto useClientPreedit =
-            ic_->capabilityFlags().test(CapabilityFlag::Preedit);
-        Text preedit(preeditStr_,
-                     useClientPreedit && *this->engine_->config().displayUnderline
-                         ? TextFormatFlag::Underline
-                         : TextFormatFlag::NoFlag);
-        preedit.setCursor(preeditStr_.size());
+        Text preedit(preeditStr_.str(), format);
+        preedit.setCursor(preeditStr_.str().size());
         if (useClientPreedit) {
             inputPanel.setClientPreedit(preedit);
         } else {
             inputPanel.setPreedit(preedit);
         }
+        updateSuggestions(inputPanel);
+    }
+
+    preeditUpdatePending_ = true;
+    if (!preeditUpdateEvent_) {
+        preeditUpdateEvent_ =
+            engine_->instance()->eventLoop().addDeferEvent(
+                [this](EventSource *) {
+                    flushPreeditUpdate();
+                    return true;
+                });
+    } else {
+        preeditUpdateEvent_->setOneShot();
+    }
+}
+
+void UnikeyState::updateSuggestions(InputPanel &inputPanel) {
+    const auto &lexicon = engine_->lexicon();
+    if (lexicon != suggestionLexicon_) {
+        suggestionLexicon_ = lexicon;
+        suggestionLetters_.clear();
+        suggestionPath_.clear();
+    }
+    if (!lexicon) {
+        return;
+    }
+    UNIKEY_TRACE("updateSuggestions");
+    KeyStageScope stage(stageTimes_, KeyStage::Suggestions);
+
+    VnLexiName letters[UK_LEXICON_MAX_PREFIX];
+    int count = uic_.currentWord(letters, UK_LEXICON_MAX_PREFIX);
+    if (count <= 0) {
+        return;
+    }
+    size_t same = 0;
+    while (same < suggestionLetters_.size() &&
+           same < static_cast<size_t>(count) &&
+           suggestionLetters_[same] == letters[same]) {
+        same++;
+    }
+    suggestionLetters_.assign(letters, letters + count);
+    suggestionPath_.resize(same);
+    int node = same ? suggestionPath_.back() : UkLexicon::Root;
+    for (int i = same; i < count; i++) {
+        node = lexicon->step(node, letters[i]);
+        suggestionPath_.push_back(node);
+    }
+    if (node < 0) {
+        return;
+    }
+
+    UkLexiconMatch matches[MaxSuggestions];
+    int found = lexicon->complete(node, letters, count, matches,
+                                  MaxSuggestions);
+    auto candidateList = std::make_unique<CommonCandidateList>();
+    for (int i = 0; i < found; i++) {
+        std::string word(matches[i].text, matches[i].textLen);
+        if (word != preeditStr_.str()) {
+            candidateList->append<SuggestionWord>(this, std::move(word));
+        }
+    }
+    if (candidateList->empty()) {
+        return;
+    }
+    candidateList->setPageSize(MaxSuggestions);
+    candidateList->setSelectionKey(SuggestionKeys);
+    candidateList->setLabels(
+        {"1. ", "2. ", "3. ", "4. ", "5. ", "6. ", "7. ", "8. ", "9. "});
+    inputPanel.setCandidateList(std::move(candidateList));
+}
+
+void UnikeyState::flushPreeditUpdate() {
+    if (!preeditUpdatePending_) {
+        return;
     }
+    UNIKEY_TRACE("flushPreeditUpdate");
+    KeyStageScope stage(stageTimes_, KeyStage::Flush);
+    preeditUpdatePending_ = false;
     ic_->updatePreedit();
     ic_->updateUserInterface(UserInterfaceComponent::InputPanel);
 }
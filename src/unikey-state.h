@@ -9,19 +9,140 @@
 
 #include <fcitx/inputcontextproperty.h>
 #include <fcitx/event.h>
+#include <fcitx/surroundingtext.h>
+#include <fcitx-utils/eventloopinterface.h>
 #include <fcitx-utils/keysym.h>
+#include <fcitx-utils/textformatflags.h>
+#include "lexicon.h"
+#include "unikey-app-profile.h"
+#include "unikey-constants.h"
+#include "unikey-latency.h"
+#include "unikey-recorder.h"
+#include "unikey-utils.h"
 #include "unikeyinputcontext.h"
+#include "vnlexi.h"
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace fcitx {
 
 class UnikeyEngine;
 class InputContext;
 
+struct RebuildItem {
+    bool isAscii;
+    unsigned char ascii;
+    VnLexiName vn;
+};
+
+// The last word before the cursor, collected without heap allocation.
+// One more item than a Vietnamese word can hold, so an over-long run can be
+// told apart from one that just fits.
+struct RebuildWord {
+    static constexpr size_t Capacity = MAX_LENGTH_VNWORD + 1;
+
+    RebuildItem items[Capacity];
+    size_t size = 0;
+
+    bool push(const RebuildItem &item) {
+        if (size == Capacity) {
+            return false;
+        }
+        items[size++] = item;
+        return true;
+    }
+};
+
+// Engine states along the word replayed last, one after each of its items.
+// Replaying is deterministic from a reset engine, so a new word only needs
+// its items past the longest prefix it shares with this one replayed.
+struct RebuildReplayCache {
+    struct Step {
+        UkEngineState engine;
+        PreeditText preedit;
+    };
+
+    RebuildWord word;
+    size_t saved = 0; // leading items of word with a saved step
+    Step steps[RebuildWord::Capacity];
+};
+
+// Keyed by what the decoding reads of the snapshot: the cursor's byte
+// offset and the bytes scanned back from it. They are kept and compared as
+// they are, so two snapshots never share an entry by chance.
+struct SurroundingRebuildCache {
+    bool valid = false;
+    size_t textSize = 0;
+    unsigned int cursor = 0;
+    unsigned int anchor = 0;
+    // text[wordEnd - window.size(), wordEnd) of the snapshot
+    std::string window;
+
+    // result of collectWordBeforeCursor on the snapshot
+    bool decoded = false;
+    RebuildWord word;
+    size_t wordBegin = 0;
+    size_t wordEnd = 0;
+
+    RebuildReplayCache replay;
+
+    // Decode the snapshot unless it is the one already cached.
+    void update(const SurroundingText &st);
+};
+
+// The end of the text before the cursor as our own commits and deletions
+// left it, for the time until the client's surrounding text shows them.
+// The client sends its snapshot some time after each change, a rebuild in
+// between would read the text from before it. Once a client has shown that
+// it does send those updates, a rebuild on a snapshot that is behind uses
+// this instead, and the client is not asked again.
+struct SurroundingShadow {
+    // bytes of the client's text before the cursor kept, a few words
+    static constexpr size_t Keep = 64;
+
+    enum class Mode {
+        // the client's snapshot is up to date as far as we know
+        Synced,
+        // snapshot is base, we changed the text since: text is right
+        Ahead,
+        // snapshot is base, the text changed in a way we do not know
+        // (a key passed on to the application, a reset)
+        Unknown,
+    };
+    Mode mode = Mode::Synced;
+    // a snapshot came that showed our changes
+    bool confirmed = false;
+
+    // the client snapshot the changes were made on
+    size_t baseHash = 0;
+    size_t baseSize = 0;
+    unsigned int baseCursor = 0;
+    unsigned int baseAnchor = 0;
+
+    std::string text;
+    // text with the cursor at its end, what a rebuild reads when Ahead
+    SurroundingText view;
+
+    // we deleted deleteChars characters before the cursor, then committed
+    // commit
+    void edit(const SurroundingText &client, unsigned int deleteChars,
+              std::string_view commit);
+    void unknown(const SurroundingText &client);
+    void clientUpdated(const SurroundingText &client);
+    // view if it is confirmed to be ahead of client, else null
+    const SurroundingText *ahead(const SurroundingText &client) const;
+
+private:
+    bool isBase(const SurroundingText &client) const;
+    void setBase(const SurroundingText &client);
+};
+
 class UnikeyState final : public InputContextProperty {
 public:
     UnikeyState(UnikeyEngine *engine, InputContext *ic);
-    ~UnikeyState() = default;
+    ~UnikeyState();
 
     void keyEvent(KeyEvent &keyEvent);
     void clearImmediateCommitHistory();
@@ -30,6 +151,8 @@ public:
     void commit();
     void syncState(KeySym sym = FcitxKey_None);
     void updatePreedit();
+    // commit a word picked from the suggestions in place of the preedit
+    void selectSuggestion(const std::string &word);
 
     bool immediateCommitMode() const;
     bool isUnsupportedSurroundingApp() const;
@@ -38,9 +161,16 @@ public:
     void reset();
 
     void rebuildFromSurroundingText();
-    size_t rebuildStateFromSurrounding(bool deleteSurrounding);
+    // The client sent a new surrounding text snapshot.
+    void surroundingTextUpdated();
+    // The key went on to the application and may have changed its text.
+    void keyPassedThrough();
+    // With keepWord, the word is left in the application for commit() to
+    // replace only the part of it that changed.
+    size_t rebuildStateFromSurrounding(bool deleteSurrounding,
+                                       bool keepWord = false);
     size_t rebuildStateFromLastImmediateWord(bool deleteSurrounding, KeySym upcomingSym);
-    void rebuildPreedit(KeySym upcomingSym);
+    void rebuildPreedit(KeySym upcomingSym, bool immediateCommit);
 
     bool mayRebuildStateFromSurroundingText_ = false;
 
@@ -68,12 +198,28 @@ public:
     static constexpr int kSurroundingRecoveryThreshold = 3;
     int surroundingSuccessCount_ = 0;
 
+    // What the recorder last wrote down for this context, if recording.
+    UnikeyRecordedContext recordedContext_;
+
+    // Where the stages of the key being handled are timed, set by the
+    // engine while the slow key log is on.
+    KeyStageTimes *stageTimes_ = nullptr;
+
 private:
+    // Set surroundingTextUnreliable_ and let the other contexts of the app
+    // know.
+    void setSurroundingTextUnreliable(bool unreliable);
+
     UnikeyEngine *engine_;
     UnikeyInputContext uic_;
     InputContext *ic_;
+    // Owned by the engine, resolved from the program name once. Without a
+    // program name it is unnamedProfile_: nothing tells two such clients
+    // apart, so what one of them does is not learned for the others.
+    UnikeyAppProfile *appProfile_;
+    UnikeyAppProfile unnamedProfile_;
     bool lastKeyWithShift_ = false;
-    std::string preeditStr_;
+    PreeditText preeditStr_;
     std::vector<KeySym> keyStrokes_;
     bool autoCommit_ = false;
     KeySym lastShiftPressed_ = FcitxKey_None;
@@ -90,6 +236,56 @@ private:
     // Example: "ăn" with offset 0 → cursor after "n"
     //          "ăn" with offset 1 → cursor after "ă"
     size_t firefoxCursorOffsetFromEnd_ = 0;
+
+    // Immediate commit: the word rebuilt from the surrounding text, still in
+    // the application before the cursor. The next commit deletes and sends
+    // only what follows the prefix it shares with the preedit, e.g. "á" for
+    // "qua" -> "quá".
+    PreeditText surroundingWord_;
+
+    // Forward to ic_, each traced as its own stage.
+    void commitString(const std::string &str);
+    void deleteSurroundingText(int offset, unsigned int size);
+    void updateSurroundingText();
+
+    // Reset the engine and preedit, then replay word into them.
+    void replayWord(const RebuildWord &word);
+
+    // Apply the engine's last result to str.
+    void applyEngineOutput(PreeditText &str);
+    // Reset the engine and feed it keyStrokes_ in batches, returns the
+    // text they produce.
+    PreeditText replayKeyStrokes();
+
+    // updatePreedit() fills the input panel right away but tells the client
+    // once per event loop iteration, so a burst of injected keys costs one
+    // preedit update. Commits and deletions send the pending one first.
+    void flushPreeditUpdate();
+    bool preeditUpdatePending_ = false;
+    std::unique_ptr<EventSource> preeditUpdateEvent_;
+    // What updatePreedit() last put in the input panel, the same preedit is
+    // not rebuilt or sent again.
+    bool shownPreeditValid_ = false;
+    bool shownClientPreedit_ = false;
+    TextFormatFlag shownPreeditFormat_ = TextFormatFlag::NoFlag;
+    std::string shownPreedit_;
+
+    // Put the words of the lexicon that start with the current word in the
+    // candidate list.
+    void updateSuggestions(InputPanel &inputPanel);
+    // The letters of the last word suggestions were made for and the trie
+    // node reached after each of them, so that typing one more letter only
+    // takes one more step.
+    std::shared_ptr<const UkLexicon> suggestionLexicon_;
+    std::vector<VnLexiName> suggestionLetters_;
+    std::vector<int> suggestionPath_;
+
+    SurroundingShadow surroundingShadow_;
+
+    // Last surrounding snapshot we decoded and the engine states of the last
+    // word replayed, created on the first rebuild.
+    std::unique_ptr<SurroundingRebuildCache> surroundingCache_;
+    SurroundingRebuildCache &surroundingCache();
 };
 
 } // namespace fcitx
@@ -9,7 +9,9 @@
 #include "unikey-state.h"
 #include "unikey-utils.h"
 #include "unikey-constants.h"
+#include "unikey-latency.h"
 #include "unikey-log.h"
+#include "unikey-trace.h"
 #include "charset.h"
 #include "inputproc.h"
 #include "vnlexi.h"
@@ -26,18 +28,9 @@ namespace fcitx {
 
 namespace {
 
-struct RebuildItem {
-    bool isAscii;
-    unsigned char ascii;
-    VnLexiName vn;
-};
-
 static bool isRebuildableAscii(unsigned char c) {
-    // Reject control characters (0-31, 127) - they break words
-    if (c < 32 || c == 127) {
-        return false;
-    }
-    return !isWordBreakSym(c);
+    // Control characters (0-31, 127) and word breaks are not part of a word
+    return UkHasCharClass(c, ukccRebuildable);
 }
 
 static bool isRebuildableUnicode(uint32_t unicode, RebuildItem &out) {
@@ -61,101 +54,292 @@ static bool isRebuildableUnicode(uint32_t unicode, RebuildItem &out) {
     return false;
 }
 
-static void replayItemsToEngine(UnikeyInputContext &uic,
-                                const std::vector<RebuildItem> &items,
-                                UnikeyState *state,
-                                std::vector<KeySym> &keyStrokes) {
-    size_t itemCount = 0;
-    for (const auto &item : items) {
-        if (item.isAscii) {
-            uic.filter(item.ascii);
-            state->syncState(static_cast<KeySym>(item.ascii));
-            keyStrokes.push_back(static_cast<KeySym>(item.ascii));
-        } else {
-            uic.rebuildChar(item.vn);
-            state->syncState();
-            // For Vietnamese chars, we don't have a single KeySym that
-            // represents it as a keystroke, but we can use the Unicode value.
-            // However, rebuildChar already updated the engine state.
-            // If we want to support BackSpace, we might need a better way.
+static bool sameItem(const RebuildItem &a, const RebuildItem &b) {
+    return a.isAscii == b.isAscii && a.ascii == b.ascii && a.vn == b.vn;
+}
+
+// Byte offset of the character index cursor in text, or std::string::npos
+// if text is shorter. Only counts UTF-8 lead bytes; the part of the text
+// actually used is validated by the backward scan. Linear in the text
+// before the cursor: the client gives the cursor in characters.
+static size_t cursorByteOffset(const std::string &text, size_t cursor) {
+    size_t chars = 0;
+    for (size_t i = 0, e = text.size(); i < e; i++) {
+        if ((static_cast<unsigned char>(text[i]) & 0xC0) != 0x80) {
+            if (chars == cursor) {
+                return i;
+            }
+            chars++;
         }
-        itemCount++;
     }
+    return chars == cursor ? text.size() : std::string::npos;
 }
 
-// Build a UTF-8 string from collected rebuild items for logging and debugging.
-static std::string itemsToUtf8(const std::vector<RebuildItem> &items) {
-    std::string result;
-    result.reserve(items.size() * 3);
-    for (const auto &item : items) {
-        if (item.isAscii) {
-            result.push_back(static_cast<char>(item.ascii));
-        } else {
-            // Map VnLexiName -> Unicode code point then to UTF-8
-            auto codepoint = UnicodeTable[static_cast<int>(item.vn)];
-            result.append(utf8::UCS4ToUTF8(codepoint));
+// Decode the character that ends at byte offset pos, moving pos to its
+// start. Returns false on invalid UTF-8.
+static bool prevChar(const std::string &text, size_t &pos, uint32_t &unicode) {
+    size_t start = pos;
+    do {
+        --start;
+    } while (start > 0 && pos - start < 4 &&
+             (static_cast<unsigned char>(text[start]) & 0xC0) == 0x80);
+
+    auto begin = text.begin() + start;
+    auto end = text.begin() + pos;
+    auto next = utf8::getNextChar(begin, end, &unicode);
+    if (unicode == utf8::INVALID_CHAR || unicode == utf8::NOT_ENOUGH_SPACE ||
+        next != end) {
+        return false;
+    }
+    pos = start;
+    return true;
+}
+
+// Collect the last contiguous "word" before the cursor by scanning backward
+// over at most MAX_LENGTH_VNWORD + 1 characters. The scan itself is bounded,
+// but finding the cursor's byte offset (cursorByteOffset) walks the text
+// from its start, so a rebuild stays linear in the text before the cursor.
+// - ASCII characters are treated as part of the word as long as they're
+//   not a word-break symbol.
+// - Non-ASCII characters must be Vietnamese letters understood by vnlexi.
+// wordEnd is the byte offset of the cursor. On success, [wordBegin, wordEnd)
+// is the byte range of the word in text. Either way, nothing before
+// scanBegin was read.
+static bool collectWordBeforeCursor(const std::string &text, size_t wordEnd,
+                                    RebuildWord &word, size_t &wordBegin,
+                                    size_t &scanBegin) {
+    // Items are found last first; reverse them in place afterwards.
+    size_t pos = wordEnd;
+    size_t scanned = 0;
+    bool inWord = true;
+    wordBegin = wordEnd;
+    scanBegin = wordEnd;
+    while (pos > 0 && scanned < RebuildWord::Capacity) {
+        uint32_t unicode = 0;
+        if (!prevChar(text, pos, unicode)) {
+            // prevChar reads at most 4 bytes back
+            scanBegin = pos > 4 ? pos - 4 : 0;
+            return false;
         }
+        scanBegin = pos;
+        scanned++;
+        if (!inWord) {
+            // keep validating the rest of the window
+            continue;
+        }
+        RebuildItem item;
+        if (!isRebuildableUnicode(unicode, item)) {
+            inWord = false;
+            continue;
+        }
+        word.push(item);
+        wordBegin = pos;
+    }
+    std::reverse(word.items, word.items + word.size);
+    return true;
+}
+
+} // namespace
+
+void SurroundingRebuildCache::update(const SurroundingText &st) {
+    const auto &text = st.text();
+    size_t end = cursorByteOffset(text, st.cursor());
+    if (valid && text.size() == textSize && st.cursor() == cursor &&
+        st.anchor() == anchor && end == wordEnd &&
+        (end == std::string::npos ||
+         text.compare(end - window.size(), window.size(), window) == 0)) {
+        return;
+    }
+    valid = true;
+    textSize = text.size();
+    cursor = st.cursor();
+    anchor = st.anchor();
+    wordEnd = end;
+    word.size = 0;
+    window.clear();
+    if (end == std::string::npos) {
+        decoded = false;
+        wordBegin = end;
+        return;
     }
-    return result;
+    size_t scanBegin;
+    decoded = collectWordBeforeCursor(text, end, word, wordBegin, scanBegin);
+    window.assign(text, scanBegin, end - scanBegin);
+}
+
+bool SurroundingShadow::isBase(const SurroundingText &client) const {
+    const auto &text = client.text();
+    return client.isValid() && client.cursor() == baseCursor &&
+           client.anchor() == baseAnchor && text.size() == baseSize &&
+           std::hash<std::string>()(text) == baseHash;
 }
 
-// Probe the last contiguous "word" before cursor, without mutating UnikeyState.
+void SurroundingShadow::setBase(const SurroundingText &client) {
+    baseHash = std::hash<std::string>()(client.text());
+    baseSize = client.text().size();
+    baseCursor = client.cursor();
+    baseAnchor = client.anchor();
+}
+
+void SurroundingShadow::edit(const SurroundingText &client,
+                             unsigned int deleteChars,
+                             std::string_view commit) {
+    if (mode == Mode::Unknown) {
+        // Stays unknown until the client catches up.
+        return;
+    }
+    if (mode == Mode::Synced) {
+        setBase(client);
+        size_t cursorPos = std::string::npos;
+        if (client.isValid() && client.cursor() == client.anchor()) {
+            cursorPos = cursorByteOffset(client.text(), client.cursor());
+        }
+        if (cursorPos == std::string::npos) {
+            mode = Mode::Unknown;
+            return;
+        }
+        size_t start = cursorPos > Keep ? cursorPos - Keep : 0;
+        while (start < cursorPos &&
+               (static_cast<unsigned char>(client.text()[start]) & 0xC0) ==
+                   0x80) {
+            start++;
+        }
+        text.assign(client.text(), start, cursorPos - start);
+        mode = Mode::Ahead;
+    }
+
+    // Deleting past what is kept leaves only what comes after, which is
+    // still the right end of the text.
+    size_t len = text.size();
+    while (deleteChars > 0 && len > 0) {
+        len--;
+        if ((static_cast<unsigned char>(text[len]) & 0xC0) != 0x80) {
+            deleteChars--;
+        }
+    }
+    text.resize(len);
+    text.append(commit);
+    if (text.size() > 2 * Keep) {
+        size_t start = text.size() - Keep;
+        while (start < text.size() &&
+               (static_cast<unsigned char>(text[start]) & 0xC0) == 0x80) {
+            start++;
+        }
+        text.erase(0, start);
+    }
+    const auto length = utf8::length(text);
+    view.setText(text, length, length);
+}
+
+void SurroundingShadow::unknown(const SurroundingText &client) {
+    if (mode != Mode::Unknown) {
+        setBase(client);
+        mode = Mode::Unknown;
+    }
+}
+
+void SurroundingShadow::clientUpdated(const SurroundingText &client) {
+    if (mode == Mode::Synced || isBase(client)) {
+        return;
+    }
+    if (mode == Mode::Ahead && client.isValid()) {
+        size_t cursorPos = cursorByteOffset(client.text(), client.cursor());
+        if (cursorPos != std::string::npos && cursorPos >= text.size() &&
+            client.text().compare(cursorPos - text.size(), text.size(),
+                                  text) == 0) {
+            confirmed = true;
+        }
+    }
+    mode = Mode::Synced;
+}
+
+const SurroundingText *
+SurroundingShadow::ahead(const SurroundingText &client) const {
+    if (confirmed && mode == Mode::Ahead && isBase(client)) {
+        return &view;
+    }
+    return nullptr;
+}
+
+// Probe the last contiguous "word" before cursor, without mutating the
+// composing state.
 // This is used to detect when surrounding text becomes reliable again while we
 // are in the "unreliable" state (where we must not rewrite/delete text).
-static size_t probeWordLengthFromSurrounding(const SurroundingText &st) {
+static size_t probeWordLengthFromSurrounding(const SurroundingText &st,
+                                             SurroundingRebuildCache &cache) {
     if (!st.isValid() || !st.selectedText().empty()) {
         return 0;
     }
 
-    const auto &text = st.text();
-    auto cursor = st.cursor();
-    auto length = utf8::lengthValidated(text);
-    if (length == utf8::INVALID_LENGTH) {
+    cache.update(st);
+    if (!cache.decoded) {
         return 0;
     }
-    if (cursor > length) {
+
+    const size_t wordLength = cache.word.size;
+    if (wordLength == 0 || wordLength > MAX_LENGTH_VNWORD) {
         return 0;
     }
+    return wordLength;
+}
 
-    // Collect last contiguous rebuildable segment before cursor.
-    size_t startCharacter = 0;
-    if (cursor >= static_cast<decltype(cursor)>(MAX_LENGTH_VNWORD + 1)) {
-        startCharacter = cursor - MAX_LENGTH_VNWORD - 1;
-    }
+UnikeyState::~UnikeyState() = default;
 
-    auto start = utf8::nextNChar(text.begin(), startCharacter);
-    auto end = utf8::nextNChar(start, cursor - startCharacter);
+SurroundingRebuildCache &UnikeyState::surroundingCache() {
+    if (!surroundingCache_) {
+        surroundingCache_ = std::make_unique<SurroundingRebuildCache>();
+    }
+    return *surroundingCache_;
+}
 
-    std::vector<RebuildItem> items;
-    items.reserve(MAX_LENGTH_VNWORD + 1);
+void UnikeyState::replayWord(const RebuildWord &word) {
+    uic_.resetBuf();
+    preeditStr_.clear();
+    keyStrokes_.clear();
 
-    auto iter = start;
-    while (iter != end) {
-        uint32_t unicode = 0;
-        auto next = utf8::getNextChar(iter, end, &unicode);
-        if (unicode == utf8::INVALID_CHAR || unicode == utf8::NOT_ENOUGH_SPACE) {
-            return 0;
+    // Continue from the longest prefix of word that was replayed before,
+    // instead of running spell check and tone placement again for it.
+    auto &replay = surroundingCache().replay;
+    size_t common = 0;
+    while (common < word.size && common < replay.saved &&
+           sameItem(word.items[common], replay.word.items[common])) {
+        common++;
+    }
+    size_t start = 0;
+    if (common > 0 && uic_.restoreState(replay.steps[common - 1].engine)) {
+        preeditStr_ = replay.steps[common - 1].preedit;
+        start = common;
+    }
+    for (size_t i = 0; i < start; i++) {
+        if (word.items[i].isAscii) {
+            keyStrokes_.push_back(static_cast<KeySym>(word.items[i].ascii));
         }
+    }
 
-        RebuildItem item;
-        bool ok = isRebuildableUnicode(unicode, item);
-        if (!ok) {
-            items.clear();
+    // For ASCII characters we need filtering, otherwise the engine won't
+    // recognize sequences like "aa" -> "â".
+    replay.saved = start;
+    for (size_t i = start; i < word.size; i++) {
+        const auto &item = word.items[i];
+        if (item.isAscii) {
+            uic_.filter(item.ascii);
+            syncState(static_cast<KeySym>(item.ascii));
+            keyStrokes_.push_back(static_cast<KeySym>(item.ascii));
         } else {
-            items.push_back(item);
+            // Vietnamese chars have no single KeySym to record as a key
+            // stroke, rebuildChar updates the engine state directly.
+            uic_.rebuildChar(item.vn);
+            syncState();
+        }
+        replay.word.items[i] = item;
+        if (replay.saved == i && uic_.saveState(replay.steps[i].engine)) {
+            replay.steps[i].preedit = preeditStr_;
+            replay.saved = i + 1;
         }
-        iter = next;
-    }
-
-    const size_t wordLength = items.size();
-    if (wordLength == 0 || wordLength > MAX_LENGTH_VNWORD) {
-        return 0;
     }
-    return wordLength;
+    replay.word.size = word.size;
 }
 
-} // namespace
-
 void UnikeyState::rebuildFromSurroundingText() {
     if (mayRebuildStateFromSurroundingText_) {
         mayRebuildStateFromSurroundingText_ = false;
@@ -200,22 +384,21 @@ void UnikeyState::rebuildFromSurroundingText() {
     // We need the character before the cursor.
     const auto &text = ic_->surroundingText().text();
     auto cursor = ic_->surroundingText().cursor();
-    auto length = utf8::lengthValidated(text);
-
-    if (length == utf8::INVALID_LENGTH) {
+    if (cursor <= 0) {
         return;
     }
-    if (cursor <= 0 || cursor > length) {
+    size_t cursorPos = cursorByteOffset(text, cursor);
+    if (cursorPos == std::string::npos) {
         return;
     }
 
     uint32_t lastCharBeforeCursor;
-    auto start = utf8::nextNChar(text.begin(), cursor - 1);
-    auto end = utf8::getNextChar(start, text.end(), &lastCharBeforeCursor);
-    if (lastCharBeforeCursor == utf8::INVALID_CHAR ||
-        lastCharBeforeCursor == utf8::NOT_ENOUGH_SPACE) {
+    size_t lastCharPos = cursorPos;
+    if (!prevChar(text, lastCharPos, lastCharBeforeCursor)) {
         return;
     }
+    auto start = text.begin() + lastCharPos;
+    auto end = text.begin() + cursorPos;
 
     const auto isValidStateCharacter = [](char c) {
         return isWordAutoCommit(c) && !charutils::isdigit(c);
@@ -260,33 +443,40 @@ void UnikeyState::rebuildFromSurroundingText() {
     }
 }
 
-size_t UnikeyState::rebuildStateFromSurrounding(bool deleteSurrounding) {
+size_t UnikeyState::rebuildStateFromSurrounding(bool deleteSurrounding,
+                                                bool keepWord) {
     // Reset transient stale marker for this attempt.
     lastSurroundingRebuildWasStale_ = false;
 
-    // Ask the frontend to refresh surrounding text so we can see what was
-    // just committed.
-    ic_->updateSurroundingText();
+    // What we committed since the client's last snapshot, if the client is
+    // known to send the update later. Otherwise ask the frontend to refresh
+    // surrounding text so we can see what was just committed.
+    const SurroundingText *shadow =
+        surroundingShadow_.ahead(ic_->surroundingText());
+    if (shadow) {
+        engine_->metrics().shadowRebuilds++;
+    } else {
+        updateSurroundingText();
+    }
+    const SurroundingText &st = shadow ? *shadow : ic_->surroundingText();
 
     // If there is an active selection, avoid rebuild/delete/recommit logic.
     // The application will typically replace the selection on commit, and
     // rebuilding would corrupt surrounding text.
-    if (ic_->surroundingText().isValid() &&
-        !ic_->surroundingText().selectedText().empty()) {
+    if (st.isValid() && !st.selectedText().empty()) {
         return 0;
     }
 
-    if (!ic_->surroundingText().isValid()) {
+    if (!st.isValid()) {
         // If surrounding text is unavailable, skip rebuild to avoid corrupting
         // text.
         return 0;
     }
 
     // Rebuild from the last word (already committed) before the cursor.
-    // We'll delete it during commit and re-commit the transformed result.
-    const auto &text = ic_->surroundingText().text();
-    auto cursor = ic_->surroundingText().cursor();
-    auto length = utf8::lengthValidated(text);
+    // It is deleted here and committed again transformed, or with keepWord
+    // commit() replaces only its changed tail.
+    const auto &text = st.text();
 
     // If we have a recent immediate-commit word but the app reports completely
     // empty surrounding text, it is very likely a stale snapshot (observed in
@@ -300,51 +490,15 @@ size_t UnikeyState::rebuildStateFromSurrounding(bool deleteSurrounding) {
         return 0;
     }
 
-    if (length == utf8::INVALID_LENGTH) {
-        return 0;
-    }
-    if (cursor > length) {
+    auto &cache = surroundingCache();
+    cache.update(st);
+    if (!cache.decoded) {
         return 0;
     }
+    const size_t wordBegin = cache.wordBegin;
+    const size_t wordEnd = cache.wordEnd;
 
-    // Collect last contiguous "word" before cursor with a length cap.
-    // - ASCII characters are treated as part of the word as long as they're
-    //   not a word-break symbol.
-    // - Non-ASCII characters must be Vietnamese letters understood by vnlexi.
-    std::vector<RebuildItem> items;
-    items.reserve(MAX_LENGTH_VNWORD + 1);
-
-    size_t startCharacter = 0;
-    if (cursor >= static_cast<decltype(cursor)>(MAX_LENGTH_VNWORD + 1)) {
-        startCharacter = cursor - MAX_LENGTH_VNWORD - 1;
-    }
-
-    auto start = utf8::nextNChar(text.begin(), startCharacter);
-    auto end = utf8::nextNChar(start, cursor - startCharacter);
-
-    auto segmentStart = start;
-    auto iter = start;
-    while (iter != end) {
-        uint32_t unicode = 0;
-        auto next = utf8::getNextChar(iter, end, &unicode);
-        if (unicode == utf8::INVALID_CHAR || unicode == utf8::NOT_ENOUGH_SPACE) {
-            return 0;
-        }
-
-        RebuildItem item;
-        bool ok = isRebuildableUnicode(unicode, item);
-
-        if (!ok) {
-            items.clear();
-            segmentStart = next;
-        } else {
-            items.push_back(item);
-        }
-        iter = next;
-    }
-
-    const size_t wordLength = items.size();
-    const std::string collectedWord = itemsToUtf8(items);
+    const size_t wordLength = cache.word.size;
     if (wordLength == 0 || wordLength > MAX_LENGTH_VNWORD) {
         return 0;
     }
@@ -354,7 +508,8 @@ size_t UnikeyState::rebuildStateFromSurrounding(bool deleteSurrounding) {
     // after commit). In that case, do NOT delete/rebuild from surrounding.
     // We'll try a safer fallback path in rebuildPreedit().
     if (deleteSurrounding && !lastImmediateWord_.empty()) {
-        const std::string wordUtf8(&*segmentStart, std::distance(segmentStart, end));
+        const std::string_view wordUtf8(text.data() + wordBegin,
+                                        wordEnd - wordBegin);
         if (wordUtf8.empty()) {
             FCITX_UNIKEY_DEBUG()
                 << "[rebuildStateFromSurrounding] Surrounding word empty while lastImmediateWord=\""
@@ -417,21 +572,18 @@ size_t UnikeyState::rebuildStateFromSurrounding(bool deleteSurrounding) {
         }
     }
 
-    // Reset local composing buffer and engine state before rebuilding.
+    // Reset local composing buffer and engine state, then rebuild them from
+    // the current word.
     FCITX_UNIKEY_DEBUG() << "[rebuildStateFromSurrounding] Resetting engine and preedit, rebuilding word";
-    uic_.resetBuf();
-    preeditStr_.clear();
-    keyStrokes_.clear();
+    replayWord(cache.word);
 
-    // Rebuild ukengine state and our composing string by replaying the
-    // current word. For ASCII characters we need filtering, otherwise the
-    // engine won't recognize sequences like "aa" -> "â".
-    replayItemsToEngine(uic_, items, this, keyStrokes_);
-
-    if (deleteSurrounding) {
+    if (deleteSurrounding && keepWord) {
+        surroundingWord_.assign(
+            std::string_view(text.data() + wordBegin, wordEnd - wordBegin));
+    } else if (deleteSurrounding) {
         FCITX_UNIKEY_DEBUG() << "[rebuildStateFromSurrounding] Deleting surrounding text: -"
                              << wordLength << " " << wordLength;
-        ic_->deleteSurroundingText(-static_cast<int>(wordLength),
+        deleteSurroundingText(-static_cast<int>(wordLength),
                                    static_cast<int>(wordLength));
     }
     return wordLength;
@@ -450,8 +602,7 @@ size_t UnikeyState::rebuildStateFromLastImmediateWord(bool deleteSurrounding, Ke
     }
 
     // Parse the last immediate word into rebuild items.
-    std::vector<RebuildItem> items;
-    items.reserve(lastImmediateWordCharCount_ + 1);
+    RebuildWord word;
 
     auto it = lastImmediateWord_.begin();
     auto end = lastImmediateWord_.end();
@@ -462,36 +613,32 @@ size_t UnikeyState::rebuildStateFromLastImmediateWord(bool deleteSurrounding, Ke
             return 0;
         }
         RebuildItem item;
-        if (!isRebuildableUnicode(unicode, item)) {
+        if (!isRebuildableUnicode(unicode, item) || !word.push(item)) {
             return 0;
         }
-        items.push_back(item);
         it = next;
     }
 
-    if (items.empty()) {
+    if (word.size == 0) {
         return 0;
     }
 
     FCITX_UNIKEY_DEBUG() << "[rebuildStateFromLastImmediateWord] Rebuilding from \""
-                         << lastImmediateWord_ << "\" items=" << items.size();
+                         << lastImmediateWord_ << "\" items=" << word.size;
 
     // Reset local composing buffer and engine state before rebuilding.
-    uic_.resetBuf();
-    preeditStr_.clear();
-    keyStrokes_.clear();
-
-    replayItemsToEngine(uic_, items, this, keyStrokes_);
+    replayWord(word);
 
     if (deleteSurrounding) {
         FCITX_UNIKEY_DEBUG()
             << "[rebuildStateFromLastImmediateWord] Deleting surrounding text: -"
             << lastImmediateWordCharCount_ << " " << lastImmediateWordCharCount_;
-        ic_->deleteSurroundingText(-static_cast<int>(lastImmediateWordCharCount_),
+        deleteSurroundingText(-static_cast<int>(lastImmediateWordCharCount_),
                                    static_cast<int>(lastImmediateWordCharCount_));
     }
 
-    return items.size();
+    engine_->metrics().immediateWordRebuilds++;
+    return word.size;
 }
 
 /**
@@ -510,12 +657,16 @@ size_t UnikeyState::rebuildStateFromLastImmediateWord(bool deleteSurrounding, Ke
  *
  * @param upcomingSym The next key symbol that will be processed, used for special handling
  *                   in VNI input method for tone/shape keys during unreliable mode.
+ * @param immediateCommit Whether the key will be committed right away, so a word
+ *                        rebuilt from surrounding text can stay in the application.
  *
  * @note This function is critical for maintaining correct Vietnamese composition state
  *       in applications that don't support proper preedit or have timing issues with
  *       surrounding text updates.
  */
-void UnikeyState::rebuildPreedit(KeySym upcomingSym) {
+void UnikeyState::rebuildPreedit(KeySym upcomingSym, bool immediateCommit) {
+    UNIKEY_TRACE("rebuildPreedit");
+    KeyStageScope stage(stageTimes_, KeyStage::RebuildPreedit);
     // Also enable this path for immediate commit.
     // NOTE: When surroundingTextUnreliable_ is true, immediateCommitMode() is
     // intentionally disabled. We still want to *probe* surrounding text to
@@ -598,8 +749,9 @@ void UnikeyState::rebuildPreedit(KeySym upcomingSym) {
             }
         }
 
-        ic_->updateSurroundingText();
-        const size_t probeLen = probeWordLengthFromSurrounding(ic_->surroundingText());
+        updateSurroundingText();
+        const size_t probeLen = probeWordLengthFromSurrounding(
+            ic_->surroundingText(), surroundingCache());
         if (probeLen > 0) {
             surroundingSuccessCount_++;
             surroundingFailureCount_ = 0;
@@ -609,7 +761,8 @@ void UnikeyState::rebuildPreedit(KeySym upcomingSym) {
             if (surroundingSuccessCount_ >= kSurroundingRecoveryThreshold) {
                 FCITX_UNIKEY_DEBUG()
                     << "[rebuildPreedit] Recovery threshold reached; clearing unreliable flag";
-                surroundingTextUnreliable_ = false;
+                setSurroundingTextUnreliable(false);
+                engine_->metrics().recoveredReliable++;
                 surroundingSuccessCount_ = 0;
             }
         } else {
@@ -620,24 +773,43 @@ void UnikeyState::rebuildPreedit(KeySym upcomingSym) {
         return;
     }
 
-    size_t wordLen = rebuildStateFromSurrounding(true);
+    // The key is committed right away, so the word can stay where it is
+    // and only its changed tail be replaced. Firefox tracks its own last
+    // word for that.
+    const bool keepWord = immediateCommit && !isFirefox();
+    size_t wordLen = rebuildStateFromSurrounding(true, keepWord);
     if (wordLen > 0) {
+        engine_->metrics().surroundingRebuilds++;
         // Successful rebuild: track success for potential recovery.
         surroundingSuccessCount_++;
         surroundingFailureCount_ = 0;  // Reset failure streak.
+        if (!surroundingTextUnreliable_ &&
+            surroundingSuccessCount_ >= kSurroundingRecoveryThreshold) {
+            // Reliable again after a focus change gave this context a fresh
+            // chance, new contexts of the app may use immediate commit too.
+            setSurroundingTextUnreliable(false);
+        }
         if (surroundingTextUnreliable_ &&
             surroundingSuccessCount_ >= kSurroundingRecoveryThreshold) {
             FCITX_UNIKEY_DEBUG()
                 << "[rebuildPreedit] Surrounding text has been reliable for "
                 << surroundingSuccessCount_
                 << " operations, recovering from unreliable state";
-            surroundingTextUnreliable_ = false;
+            setSurroundingTextUnreliable(false);
+            engine_->metrics().recoveredReliable++;
             surroundingSuccessCount_ = 0;
         }
-        updatePreedit();
+        // A kept word is not in the preedit, the key commits it.
+        if (surroundingWord_.empty()) {
+            updatePreedit();
+        }
         return;
     }
 
+    if (lastSurroundingRebuildWasStale_) {
+        engine_->metrics().staleSurrounding++;
+    }
+
     // If surrounding rebuild failed but we have a recent immediate-commit word,
     // this is likely an app (e.g. Firefox) returning stale/empty surrounding
     // right after commit. Use the last committed word as a safer rewrite
@@ -663,7 +835,8 @@ void UnikeyState::rebuildPreedit(KeySym upcomingSym) {
             if (surroundingFailureCount_ >= kSurroundingFailureThreshold) {
                 FCITX_UNIKEY_DEBUG()
                     << "[rebuildPreedit] Failure threshold reached (stale surrounding); marking unreliable";
-                surroundingTextUnreliable_ = true;
+                setSurroundingTextUnreliable(true);
+                engine_->metrics().markedUnreliable++;
             }
             updatePreedit();
             return;
@@ -680,7 +853,8 @@ void UnikeyState::rebuildPreedit(KeySym upcomingSym) {
         if (surroundingFailureCount_ >= kSurroundingFailureThreshold) {
             FCITX_UNIKEY_DEBUG()
                 << "[rebuildPreedit] Failure threshold reached; marking surrounding unreliable";
-            surroundingTextUnreliable_ = true;
+            setSurroundingTextUnreliable(true);
+            engine_->metrics().markedUnreliable++;
         }
     } else if (lastSurroundingRebuildWasStale_ && lastImmediateWord_.empty()) {
         // Staleness detected but no fallback word available. This could
@@ -695,7 +869,8 @@ void UnikeyState::rebuildPreedit(KeySym upcomingSym) {
         if (surroundingFailureCount_ >= kSurroundingFailureThreshold) {
             FCITX_UNIKEY_DEBUG()
                 << "[rebuildPreedit] Failure threshold reached; marking surrounding unreliable";
-            surroundingTextUnreliable_ = true;
+            setSurroundingTextUnreliable(true);
+            engine_->metrics().markedUnreliable++;
         }
     } else {
         FCITX_UNIKEY_DEBUG() << "[rebuildPreedit] No word rebuilt (no prior immediate word, not stale)";
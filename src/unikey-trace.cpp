@@ -0,0 +1,131 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include "unikey-trace.h"
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+
+namespace fcitx {
+
+namespace {
+
+int64_t traceNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Small sequential ids are enough to tell the threads apart in the viewer.
+int traceThreadId() {
+    static std::atomic<int> next{1};
+    thread_local int id = next++;
+    return id;
+}
+
+void appendJsonString(std::string &out, const std::string &s) {
+    out += '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// Writes the JSON array format. The closing bracket is optional for the
+// viewers, so a trace cut short by a crash still loads.
+class TraceWriter {
+public:
+    static TraceWriter &instance() {
+        static TraceWriter writer;
+        return writer;
+    }
+
+    ~TraceWriter() {
+        if (file_) {
+            std::fputs("\n]\n", file_);
+            std::fclose(file_);
+        }
+    }
+
+    void add(const char *name, int64_t start, int64_t end,
+             const std::string &args) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!file_) {
+            return;
+        }
+        // ts and dur are in microseconds.
+        std::fprintf(file_,
+                     ",\n{\"name\":\"%s\",\"cat\":\"unikey\",\"ph\":\"X\","
+                     "\"pid\":%d,\"tid\":%d,\"ts\":%" PRId64 ".%03d,"
+                     "\"dur\":%" PRId64 ".%03d",
+                     name, pid_, traceThreadId(), start / 1000,
+                     static_cast<int>(start % 1000), (end - start) / 1000,
+                     static_cast<int>((end - start) % 1000));
+        if (!args.empty()) {
+            std::fprintf(file_, ",\"args\":{%s}", args.c_str());
+        }
+        std::fputc('}', file_);
+    }
+
+private:
+    TraceWriter() : pid_(getpid()) {
+        std::string path;
+        if (const char *file = std::getenv("UNIKEY_TRACE_FILE")) {
+            path = file;
+        } else {
+            const char *dir = std::getenv("XDG_RUNTIME_DIR");
+            path = dir && *dir ? dir : "/tmp";
+            path += "/fcitx5-unikey-" + std::to_string(pid_) + ".trace.json";
+        }
+        file_ = std::fopen(path.c_str(), "w");
+        if (!file_) {
+            return;
+        }
+        std::setvbuf(file_, nullptr, _IOFBF, 64 * 1024);
+        std::fprintf(file_,
+                     "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                     "\"args\":{\"name\":\"fcitx5-unikey\"}}",
+                     pid_);
+    }
+
+    std::mutex mutex_;
+    FILE *file_ = nullptr;
+    int pid_;
+};
+
+} // namespace
+
+TraceScope::TraceScope(const char *name) : name_(name), start_(traceNow()) {}
+
+TraceScope::TraceScope(const char *name, uint32_t sym,
+                       const std::string &program)
+    : name_(name) {
+    args_ = "\"sym\":" + std::to_string(sym) + ",\"program\":";
+    appendJsonString(args_, program);
+    start_ = traceNow();
+}
+
+TraceScope::~TraceScope() {
+    TraceWriter::instance().add(name_, start_, traceNow(), args_);
+}
+
+} // namespace fcitx
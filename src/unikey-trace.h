@@ -0,0 +1,64 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_UNIKEY_UNIKEY_TRACE_H_
+#define _FCITX5_UNIKEY_UNIKEY_TRACE_H_
+
+// Per-keystroke timing of the key handling stages, written in the Chrome
+// trace event format so it can be loaded in ui.perfetto.dev or
+// chrome://tracing next to a trace of the client application.
+//
+// Only built with -DENABLE_TRACE=On. Otherwise the macros expand to nothing
+// and none of this is compiled in.
+//
+// Events go to $UNIKEY_TRACE_FILE, or to
+// $XDG_RUNTIME_DIR/fcitx5-unikey-<pid>.trace.json (/tmp if unset).
+
+#ifdef UNIKEY_ENABLE_TRACE
+
+#include <cstdint>
+#include <string>
+
+namespace fcitx {
+
+// Records one complete event from construction to destruction.
+class TraceScope {
+public:
+    explicit TraceScope(const char *name);
+    // A key event: the key sym and the client program are added as args.
+    TraceScope(const char *name, uint32_t sym, const std::string &program);
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+    ~TraceScope();
+
+private:
+    const char *name_;
+    int64_t start_;
+    std::string args_;
+};
+
+} // namespace fcitx
+
+#define UNIKEY_TRACE_CONCAT_(a, b) a##b
+#define UNIKEY_TRACE_CONCAT(a, b) UNIKEY_TRACE_CONCAT_(a, b)
+#define UNIKEY_TRACE(name)                                                     \
+    ::fcitx::TraceScope UNIKEY_TRACE_CONCAT(unikeyTrace_, __LINE__)(name)
+#define UNIKEY_TRACE_KEY(name, sym, program)                                   \
+    ::fcitx::TraceScope UNIKEY_TRACE_CONCAT(unikeyTrace_, __LINE__)(          \
+        name, sym, program)
+
+#else
+
+#define UNIKEY_TRACE(name)                                                     \
+    do {                                                                       \
+    } while (0)
+#define UNIKEY_TRACE_KEY(name, sym, program)                                   \
+    do {                                                                       \
+    } while (0)
+
+#endif // UNIKEY_ENABLE_TRACE
+
+#endif // _FCITX5_UNIKEY_UNIKEY_TRACE_H_
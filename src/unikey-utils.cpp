@@ -8,36 +8,61 @@
 #include "unikey-utils.h"
 #include "charset.h"
 #include "inputproc.h"
+#include "vnconv.h"
 #include "vnlexi.h"
-#include <unordered_map>
-#include <unordered_set>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
 
 namespace fcitx {
 
-bool isWordBreakSym(unsigned char c) { return WordBreakSyms.contains(c); }
+namespace {
 
-bool isWordAutoCommit(unsigned char c) {
-    static const std::unordered_set<unsigned char> WordAutoCommit = {
-        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'b', 'c',
-        'f', 'g', 'h', 'j', 'k', 'l', 'm', 'n', 'p', 'q', 'r', 's',
-        't', 'v', 'x', 'z', 'B', 'C', 'F', 'G', 'H', 'J', 'K', 'L',
-        'M', 'N', 'P', 'Q', 'R', 'S', 'T', 'V', 'X', 'Z'};
-    return WordAutoCommit.contains(c);
-}
+// Two-level code point -> VnLexiName table. Every Vietnamese character in
+// UnicodeTable is below U+2000 (Latin-1 Supplement, Latin Extended-A/B and
+// Latin Extended Additional), so the first level has one entry per 256 code
+// points of that range and points each one at a page, page 0 being empty.
+constexpr uint32_t VnLexiPageBits = 8;
+constexpr uint32_t VnLexiPageSize = 1 << VnLexiPageBits;
+constexpr uint32_t VnLexiPageCount = 0x2000 >> VnLexiPageBits;
+// pages used by UnicodeTable + the empty one
+constexpr size_t VnLexiPageSlots = 5;
 
-VnLexiName charToVnLexi(uint32_t ch) {
-    static const std::unordered_map<uint32_t, VnLexiName> map = []() {
-        std::unordered_map<uint32_t, VnLexiName> result;
+struct VnLexiTable {
+    uint8_t pageIndex[VnLexiPageCount] = {};
+    VnLexiName pages[VnLexiPageSlots][VnLexiPageSize];
+
+    VnLexiTable() {
+        for (auto &page : pages) {
+            std::fill(std::begin(page), std::end(page), vnl_nonVnChar);
+        }
+        size_t used = 1;
         for (int i = 0; i < vnl_lastChar; i++) {
-            result.insert({UnicodeTable[i], static_cast<VnLexiName>(i)});
+            uint32_t ch = UnicodeTable[i];
+            assert(ch < 0x2000);
+            auto &index = pageIndex[ch >> VnLexiPageBits];
+            if (!index) {
+                assert(used < VnLexiPageSlots);
+                index = used++;
+            }
+            // keep the first name of a code point, like the old lookup did
+            auto &lexi = pages[index][ch & (VnLexiPageSize - 1)];
+            if (lexi == vnl_nonVnChar) {
+                lexi = static_cast<VnLexiName>(i);
+            }
         }
-        return result;
-    }();
-
-    if (auto search = map.find(ch); search != map.end()) {
-        return search->second;
     }
-    return vnl_nonVnChar;
+};
+
+} // namespace
+
+VnLexiName charToVnLexi(uint32_t ch) {
+    static const VnLexiTable table;
+    // code points above the table all land on the empty page
+    uint32_t page = ch >> VnLexiPageBits;
+    uint8_t index = page < VnLexiPageCount ? table.pageIndex[page] : 0;
+    return table.pages[index][ch & (VnLexiPageSize - 1)];
 }
 
 bool isVnChar(uint32_t ch) { return charToVnLexi(ch) != vnl_nonVnChar; }
@@ -71,4 +96,150 @@ int latinToUtf(unsigned char *dst, const unsigned char *src, int inSize,
     return (outLeft >= 0);
 }
 
+namespace {
+
+bool isUtf8Charset(int charset) {
+    return charset == CONV_CHARSET_UNIUTF8 || charset == CONV_CHARSET_XUTF8;
+}
+
+// longest output of one input byte, as in VnFileConvert
+constexpr size_t ConvMaxExpansion = 8;
+
+} // namespace
+
+bool convertCharsetText(std::string_view text, int from, int to,
+                        std::string &out) {
+    std::string in;
+    if (isUtf8Charset(from)) {
+        in = text;
+    } else {
+        // back to bytes, only U+0000..U+00FF can be one
+        in.reserve(text.size());
+        for (size_t i = 0; i < text.size(); i++) {
+            auto ch = static_cast<unsigned char>(text[i]);
+            if (ch < 0x80) {
+                in.push_back(ch);
+            } else if ((ch == 0xC2 || ch == 0xC3) && i + 1 < text.size() &&
+                       (static_cast<unsigned char>(text[i + 1]) & 0xC0) ==
+                           0x80) {
+                i++;
+                in.push_back((ch & 0x03) << 6 |
+                             (static_cast<unsigned char>(text[i]) & 0x3F));
+            } else {
+                return false;
+            }
+        }
+    }
+
+    std::string converted(in.size() * ConvMaxExpansion + 16, '\0');
+    VnConvOptions options;
+    VnConvResetOptions(&options);
+    int inLen = in.size();
+    int outLen = converted.size();
+    if (VnConvertWithOptions(
+            from, to, &options, reinterpret_cast<UKBYTE *>(in.data()),
+            reinterpret_cast<UKBYTE *>(converted.data()), &inLen,
+            &outLen) != 0) {
+        return false;
+    }
+    converted.resize(outLen);
+
+    if (isUtf8Charset(to)) {
+        out = std::move(converted);
+        return true;
+    }
+    out.clear();
+    out.reserve(converted.size() * 2);
+    for (char c : converted) {
+        auto ch = static_cast<unsigned char>(c);
+        if (ch < 0x80) {
+            out.push_back(ch);
+        } else {
+            out.push_back(0xC0 | ch >> 6);
+            out.push_back(0x80 | (ch & 0x3F));
+        }
+    }
+    return true;
+}
+
+void PreeditText::assign(std::string_view text) {
+    clear();
+    append(text);
+}
+
+void PreeditText::append(std::string_view text) {
+    size_t offset = text_.size();
+    text_.append(text);
+    for (size_t i = offset; i < text_.size(); i++) {
+        // count begin bytes of utf-8 chars
+        auto c = static_cast<unsigned char>(text_[i]);
+        if (c < 0x80 || c >= 0xC0) {
+            starts_.push_back(i);
+        }
+    }
+}
+
+void PreeditText::appendLatin(const unsigned char *text, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        unsigned char ch = text[i];
+        starts_.push_back(text_.size());
+        if (ch < 0x80) {
+            text_.push_back(ch);
+        } else {
+            text_.push_back(0xC0 | ch >> 6);
+            text_.push_back(0x80 | (ch & 0x3F));
+        }
+    }
+}
+
+void PreeditText::appendChar(uint32_t unicode) {
+    if (unicode > 0x10FFFF || (unicode >= 0xD800 && unicode <= 0xDFFF)) {
+        return;
+    }
+    starts_.push_back(text_.size());
+    if (unicode < 0x80) {
+        text_.push_back(unicode);
+    } else if (unicode < 0x800) {
+        text_.push_back(0xC0 | unicode >> 6);
+        text_.push_back(0x80 | (unicode & 0x3F));
+    } else if (unicode < 0x10000) {
+        text_.push_back(0xE0 | unicode >> 12);
+        text_.push_back(0x80 | ((unicode >> 6) & 0x3F));
+        text_.push_back(0x80 | (unicode & 0x3F));
+    } else {
+        text_.push_back(0xF0 | unicode >> 18);
+        text_.push_back(0x80 | ((unicode >> 12) & 0x3F));
+        text_.push_back(0x80 | ((unicode >> 6) & 0x3F));
+        text_.push_back(0x80 | (unicode & 0x3F));
+    }
+}
+
+size_t PreeditText::commonPrefix(std::string_view other,
+                                 size_t &bytes) const {
+    size_t same = 0;
+    const size_t size = std::min(text_.size(), other.size());
+    while (same < size && text_[same] == other[same]) {
+        same++;
+    }
+    auto chars = static_cast<size_t>(
+        std::lower_bound(starts_.begin(), starts_.end(), same) -
+        starts_.begin());
+    // Stop before the character they differ in, not inside it.
+    if (same < text_.size() &&
+        (static_cast<unsigned char>(text_[same]) & 0xC0) == 0x80) {
+        chars--;
+    }
+    bytes = chars < starts_.size() ? starts_[chars] : text_.size();
+    return chars;
+}
+
+void PreeditText::eraseChars(size_t count) {
+    if (count >= starts_.size()) {
+        clear();
+        return;
+    }
+    text_.erase(starts_[starts_.size() - count]);
+    starts_.resize(starts_.size() - count);
+}
+
 } // namespace fcitx
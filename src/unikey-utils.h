@@ -8,14 +8,23 @@
 #ifndef UNIKEY_UTILS_H
 #define UNIKEY_UTILS_H
 
+#include <cstddef>
 #include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "inputproc.h"
 #include "vnlexi.h"
 
 namespace fcitx {
 
-bool isWordBreakSym(unsigned char c);
+inline bool isWordBreakSym(unsigned char c) {
+    return UkHasCharClass(c, ukccWordBreak);
+}
 
-bool isWordAutoCommit(unsigned char c);
+inline bool isWordAutoCommit(unsigned char c) {
+    return UkHasCharClass(c, ukccAutoCommit);
+}
 
 VnLexiName charToVnLexi(uint32_t ch);
 
@@ -26,6 +35,46 @@ bool isVnChar(uint32_t ch);
 int latinToUtf(unsigned char *dst, const unsigned char *src, int inSize,
                int *pOutSize);
 
+// Converts UTF-8 text from charset from to charset to (CONV_CHARSET_*).
+// Text in a charset other than UTF-8 holds one character per byte, the way
+// latinToUtf shows it. Returns false if text is not in charset from or the
+// conversion fails. Whole texts go through the table-driven block converter.
+bool convertCharsetText(std::string_view text, int from, int to,
+                        std::string &out);
+
+// UTF-8 preedit text that keeps the byte offset of each character, so
+// characters can be counted and erased from the end without walking it.
+class PreeditText {
+public:
+    const std::string &str() const { return text_; }
+    bool empty() const { return text_.empty(); }
+    // Number of code points.
+    size_t length() const { return starts_.size(); }
+    char back() const { return text_.back(); }
+
+    void clear() {
+        text_.clear();
+        starts_.clear();
+    }
+    void assign(std::string_view text);
+    // Appends UTF-8 text.
+    void append(std::string_view text);
+    // Appends text in a Latin-1 like single byte charset, each byte as one
+    // character, the way latinToUtf converts it.
+    void appendLatin(const unsigned char *text, size_t size);
+    // Appends one Unicode character, invalid code points are dropped.
+    void appendChar(uint32_t unicode);
+    // Erases the last count characters, or all of them.
+    void eraseChars(size_t count);
+    // Number of leading characters shared with the UTF-8 text other, and
+    // in bytes.
+    size_t commonPrefix(std::string_view other, size_t &bytes) const;
+
+private:
+    std::string text_;
+    std::vector<uint32_t> starts_;
+};
+
 } // namespace fcitx
 
 #endif // UNIKEY_UTILS_H
@@ -0,0 +1,54 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+#include "unikey-worker.h"
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace fcitx {
+
+UnikeyWorker::~UnikeyWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+        tasks_.clear();
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void UnikeyWorker::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+        if (!thread_.joinable()) {
+            thread_ = std::thread(&UnikeyWorker::run, this);
+        }
+    }
+    cond_.notify_one();
+}
+
+void UnikeyWorker::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cond_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
+        if (quit_) {
+            return;
+        }
+        auto task = std::move(tasks_.front());
+        tasks_.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+} // namespace fcitx
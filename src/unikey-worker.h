@@ -0,0 +1,43 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_UNIKEY_UNIKEY_WORKER_H_
+#define _FCITX5_UNIKEY_UNIKEY_WORKER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace fcitx {
+
+// Runs tasks in order on a single background thread, which is started on
+// the first post(). Tasks must not touch fcitx objects directly; results are
+// handed back to the main loop through an EventDispatcher.
+class UnikeyWorker {
+public:
+    UnikeyWorker() = default;
+    UnikeyWorker(const UnikeyWorker &) = delete;
+    UnikeyWorker &operator=(const UnikeyWorker &) = delete;
+    // Drops tasks that have not started yet and waits for the running one.
+    ~UnikeyWorker();
+
+    void post(std::function<void()> task);
+
+private:
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::function<void()>> tasks_;
+    bool quit_ = false;
+    std::thread thread_;
+};
+
+} // namespace fcitx
+
+#endif // _FCITX5_UNIKEY_UNIKEY_WORKER_H_
@@ -0,0 +1,199 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Charset conversion throughput benchmark.
+//
+// Measures VnConvert for every (input, output) pair of charsets in
+// CharsetIdMap, on a synthetic corpus and on optional real ones, and prints
+// the results as JSON so that runs of different releases can be compared.
+//
+// Usage: benchconv [size-kb [min-ms [corpus.utf8...]]]
+//
+// The synthetic corpus is size-kb KiB (default 1024) of Vietnamese text.
+// Each pair is converted repeatedly for at least min-ms (default 50).
+// Real corpora are UTF-8 files; each one is first converted to the input
+// charset of the pair being measured.
+
+#include "vnconv.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Corpus {
+    std::string name;
+    std::vector<UKBYTE> utf8;
+};
+
+struct Charset {
+    int id;
+    const char *name;
+};
+
+const char *const sampleText[] = {
+    "Tiếng Việt là ngôn ngữ chính thức của Việt Nam.",
+    "Hôm nay trời đẹp, chúng tôi đi dạo quanh hồ Gươm.",
+    "Người ta thường nói rằng học thầy không tày học bạn.",
+    "Những ngày cuối tuần, gia đình tôi hay về quê thăm ông bà.",
+    "Quyển sách này được viết bằng tiếng Việt và tiếng Anh.",
+    "ĐẠI HỌC QUỐC GIA HÀ NỘI – “Trường Đại học Khoa học Tự nhiên”…",
+    "Giá: 1.250.000 đồng (đã bao gồm thuế), liên hệ: info@example.vn",
+};
+
+std::vector<Charset> charsets() {
+    std::vector<Charset> result;
+    for (int i = 0; i < CharsetCount; i++) {
+        // "UTF-8" and "UTF8" are the same charset
+        bool seen = std::any_of(result.begin(), result.end(),
+                                [i](const Charset &c) {
+                                    return c.id == CharsetIdMap[i].id;
+                                });
+        if (!seen) {
+            result.push_back({CharsetIdMap[i].id, CharsetIdMap[i].name});
+        }
+    }
+    return result;
+}
+
+Corpus syntheticCorpus(size_t size) {
+    Corpus corpus{"synthetic", {}};
+    size_t i = 0;
+    while (corpus.utf8.size() < size) {
+        std::string line = sampleText[i++ % std::size(sampleText)];
+        line += (i % 4 == 0) ? '\n' : ' ';
+        corpus.utf8.insert(corpus.utf8.end(), line.begin(), line.end());
+    }
+    return corpus;
+}
+
+bool loadCorpus(const char *path, Corpus &corpus) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    corpus.name = path;
+    corpus.utf8.assign(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Returns VnConvert's result, output is resized to fit.
+int convert(int from, int to, std::vector<UKBYTE> &input,
+            std::vector<UKBYTE> &output) {
+    output.resize(input.size() * 8 + 16);
+    int inLen = input.size();
+    int outLen = output.size();
+    UKBYTE dummy = 0;
+    int ret = VnConvert(from, to, input.empty() ? &dummy : input.data(),
+                        output.data(), &inLen, &outLen);
+    if (ret == VNCONV_OUT_OF_MEMORY) {
+        output.resize(outLen);
+        inLen = input.size();
+        ret = VnConvert(from, to, input.data(), output.data(), &inLen,
+                        &outLen);
+    }
+    output.resize(std::min<size_t>(outLen, output.size()));
+    return ret;
+}
+
+std::string jsonString(const std::string &s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+void runCorpus(const Corpus &corpus, const std::vector<Charset> &sets,
+               double minSeconds, bool first) {
+    std::printf("%s    {\"name\": %s, \"utf8Bytes\": %zu, \"results\": [",
+                first ? "" : ",\n", jsonString(corpus.name).c_str(),
+                corpus.utf8.size());
+    std::vector<UKBYTE> utf8 = corpus.utf8;
+    std::vector<UKBYTE> input, output;
+    bool firstResult = true;
+    for (const auto &from : sets) {
+        int ret = convert(CONV_CHARSET_UNIUTF8, from.id, utf8, input);
+        for (const auto &to : sets) {
+            double seconds = 0;
+            int runs = 0;
+            if (ret == 0) {
+                using clock = std::chrono::steady_clock;
+                auto start = clock::now();
+                do {
+                    ret = convert(from.id, to.id, input, output);
+                    runs++;
+                    seconds =
+                        std::chrono::duration<double>(clock::now() - start)
+                            .count();
+                } while (ret == 0 && seconds < minSeconds);
+            }
+            double mbPerSec =
+                (runs && seconds > 0)
+                    ? input.size() * runs / seconds / (1024.0 * 1024.0)
+                    : 0;
+            std::printf("%s\n      {\"from\": %s, \"to\": %s, \"status\": %d, "
+                        "\"inBytes\": %zu, \"outBytes\": %zu, "
+                        "\"mbPerSec\": %.2f}",
+                        firstResult ? "" : ",",
+                        jsonString(from.name).c_str(),
+                        jsonString(to.name).c_str(), ret, input.size(),
+                        output.size(), mbPerSec);
+            firstResult = false;
+            std::fflush(stdout);
+        }
+    }
+    std::printf("\n    ]}");
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    size_t sizeKb = 1024;
+    double minSeconds = 0.05;
+    if (argc > 1) {
+        sizeKb = std::max(1, std::atoi(argv[1]));
+    }
+    if (argc > 2) {
+        minSeconds = std::max(0, std::atoi(argv[2])) / 1000.0;
+    }
+
+    std::vector<Corpus> corpora;
+    corpora.push_back(syntheticCorpus(sizeKb * 1024));
+    for (int i = 3; i < argc; i++) {
+        Corpus corpus;
+        if (!loadCorpus(argv[i], corpus)) {
+            std::fprintf(stderr, "benchconv: failed to load corpus %s\n",
+                         argv[i]);
+            return 1;
+        }
+        corpora.push_back(std::move(corpus));
+    }
+
+    auto sets = charsets();
+    std::printf("{\n  \"benchmark\": \"VnConvert\",\n  \"corpora\": [\n");
+    for (size_t i = 0; i < corpora.size(); i++) {
+        runCorpus(corpora[i], sets, minSeconds, i == 0);
+    }
+    std::printf("\n  ]\n}\n");
+    return 0;
+}
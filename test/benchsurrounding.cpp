@@ -0,0 +1,254 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Per-key cost of the surrounding text paths against the document size.
+//
+// Drives the addon through the TestFrontend like testsurroundingtext, with a
+// document of 10 B up to max-bytes (default 1 MiB) of Vietnamese text and the
+// cursor after a word at its start, middle or end, in four modes:
+//   state      SurroundingText: the word is rebuilt from the snapshot
+//   modify     ModifySurroundingText: rebuildPreedit takes the word back
+//   immediate  ImmediateCommit: the tone rewrites the committed word
+//   stale      ImmediateCommit in "firefox", typing a whole word while the
+//              snapshot is never updated
+// For the first three the snapshot is set before each key and the key timed
+// is the tone key that needs the word back; stale times every key of the
+// word.
+//
+// Usage: benchsurrounding [max-bytes [keys]]
+//
+// keys (default 200) is the number of timed keys per row. For the stages
+// inside each key, build with -DENABLE_TRACE=On and set $UNIKEY_TRACE_FILE.
+
+#include "testdir.h"
+#include "testfrontend_public.h"
+
+#include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/capabilityflags.h>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx-utils/utf8.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/inputcontext.h>
+#include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodgroup.h>
+#include <fcitx/inputmethodmanager.h>
+#include <fcitx/instance.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+enum class Mode { State, Modify, Immediate, Stale };
+
+struct ModeInfo {
+    Mode mode;
+    const char *name;
+    const char *program;
+};
+
+const ModeInfo modes[] = {
+    {Mode::State, "state", "benchapp"},
+    {Mode::Modify, "modify", "benchapp"},
+    {Mode::Immediate, "immediate", "benchapp"},
+    {Mode::Stale, "stale", "firefox"},
+};
+
+const char *const cursorNames[] = {"start", "middle", "end"};
+
+const char filler[] = "Tiếng Việt là ngôn ngữ chính thức của Việt Nam. "
+                      "Hôm nay trời đẹp, chúng tôi đi dạo quanh hồ Gươm.\n";
+
+// the word before the cursor, and the VNI keys that type it with a tone
+const char word[] = "nga";
+const char *const staleKeys[] = {"n", "g", "a", "3"};
+
+struct Bench {
+    size_t maxBytes = 1 << 20;
+    int keys = 200;
+};
+
+struct Document {
+    std::string text;
+    unsigned int cursor; // in characters, after word
+};
+
+// Roughly size bytes, with word at the given place.
+Document makeDocument(size_t size, int place) {
+    std::string text;
+    while (text.size() < size) {
+        text += filler;
+    }
+    // cut on a character boundary
+    while (size > 0 && (static_cast<unsigned char>(text[size]) & 0xC0) == 0x80) {
+        size--;
+    }
+    text.resize(size);
+
+    size_t at = place == 0 ? 0 : place == 1 ? size / 2 : size;
+    while (at > 0 && at < size &&
+           (static_cast<unsigned char>(text[at]) & 0xC0) == 0x80) {
+        at--;
+    }
+    std::string before = text.substr(0, at);
+    if (!before.empty()) {
+        before += ' ';
+    }
+    before += word;
+    std::string after = text.substr(at);
+    if (!after.empty() && after[0] != ' ') {
+        after.insert(after.begin(), ' ');
+    }
+    return {before + after,
+            static_cast<unsigned int>(utf8::length(before))};
+}
+
+void setupInputMethodGroup(Instance *instance) {
+    auto defaultGroup = instance->inputMethodManager().currentGroup();
+    defaultGroup.inputMethodList().clear();
+    defaultGroup.inputMethodList().push_back(InputMethodGroupItem("keyboard-us"));
+    defaultGroup.inputMethodList().push_back(InputMethodGroupItem("unikey"));
+    defaultGroup.setDefaultInputMethod("");
+    instance->inputMethodManager().setGroup(defaultGroup);
+}
+
+RawConfig modeConfig(Mode mode) {
+    RawConfig config;
+    config.setValueByPath("SpellCheck", "False");
+    config.setValueByPath("Macro", "False");
+    config.setValueByPath("AutoNonVnRestore", "False");
+    config.setValueByPath("InputMethod", "VNI");
+    config.setValueByPath("OutputCharset", "Unicode");
+    config.setValueByPath("SurroundingText", "True");
+    config.setValueByPath("ModifySurroundingText",
+                          mode == Mode::Modify ? "True" : "False");
+    config.setValueByPath("ImmediateCommit",
+                          mode == Mode::Immediate || mode == Mode::Stale
+                              ? "True"
+                              : "False");
+    return config;
+}
+
+void printRow(const char *mode, size_t bytes, const char *cursor,
+              std::vector<uint64_t> &times) {
+    std::sort(times.begin(), times.end());
+    uint64_t total = 0;
+    for (auto ns : times) {
+        total += ns;
+    }
+    std::printf("%-10s %9zu %-7s %6zu %9.2f %9.2f %9.2f %9.2f\n", mode, bytes,
+                cursor, times.size(), total / 1e3 / times.size(),
+                times[times.size() / 2] / 1e3,
+                times[times.size() * 99 / 100] / 1e3, times.back() / 1e3);
+}
+
+void runBench(Instance *instance, const Bench &bench) {
+    auto *unikey = instance->addonManager().addon("unikey", true);
+    FCITX_ASSERT(unikey);
+    setupInputMethodGroup(instance);
+    auto *testfrontend = instance->addonManager().addon("testfrontend");
+    FCITX_ASSERT(testfrontend);
+
+    std::printf("%-10s %9s %-7s %6s %9s %9s %9s %9s\n", "mode", "bytes",
+                "cursor", "keys", "avg us", "p50 us", "p99 us", "max us");
+    for (const auto &info : modes) {
+        auto uuid =
+            testfrontend->call<ITestFrontend::createInputContext>(info.program);
+        auto *ic = instance->inputContextManager().findByUUID(uuid);
+        FCITX_ASSERT(ic);
+        ic->setCapabilityFlags(CapabilityFlag::SurroundingText);
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("Control+space"),
+                                                    false);
+        unikey->setConfig(modeConfig(info.mode));
+
+        for (size_t size = 10; size <= bench.maxBytes; size *= 10) {
+            for (int place = 0; place < 3; place++) {
+                auto doc = makeDocument(size, place);
+                std::vector<uint64_t> times;
+                times.reserve(bench.keys);
+                while (static_cast<int>(times.size()) < bench.keys) {
+                    ic->reset();
+                    ic->surroundingText().setText(doc.text, doc.cursor,
+                                                  doc.cursor);
+                    ic->updateSurroundingText();
+                    if (info.mode != Mode::Stale) {
+                        auto start = std::chrono::steady_clock::now();
+                        testfrontend->call<ITestFrontend::keyEvent>(
+                            uuid, Key("3"), false);
+                        times.push_back(
+                            std::chrono::duration_cast<
+                                std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start)
+                                .count());
+                        continue;
+                    }
+                    for (const char *key : staleKeys) {
+                        auto start = std::chrono::steady_clock::now();
+                        testfrontend->call<ITestFrontend::keyEvent>(
+                            uuid, Key(key), false);
+                        times.push_back(
+                            std::chrono::duration_cast<
+                                std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start)
+                                .count());
+                    }
+                }
+                printRow(info.name, doc.text.size(), cursorNames[place],
+                         times);
+            }
+        }
+        testfrontend->call<ITestFrontend::destroyInputContext>(uuid);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Bench bench;
+    if (argc > 1) {
+        bench.maxBytes = std::max<long>(10, std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        bench.keys = std::max(1, std::atoi(argv[2]));
+    }
+
+    setupTestingEnvironmentPath(TESTING_BINARY_DIR, {"bin"},
+                                {TESTING_BINARY_DIR "/test"});
+
+    char arg0[] = "benchsurrounding";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,unikey";
+    char *fcitxArgv[] = {arg0, arg1, arg2};
+
+    fcitx::Log::setLogRule("default=3,unikey=3");
+
+    Instance instance(FCITX_ARRAY_SIZE(fcitxArgv), fcitxArgv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+
+    EventDispatcher dispatcher;
+    dispatcher.attach(&instance.eventLoop());
+    dispatcher.schedule([&dispatcher, &instance, &bench]() {
+        runBench(&instance, bench);
+        instance.deactivate();
+        dispatcher.schedule([&dispatcher, &instance]() {
+            dispatcher.detach();
+            instance.exit();
+        });
+    });
+    instance.exec();
+    return 0;
+}
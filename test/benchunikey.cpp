@@ -0,0 +1,224 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Keystroke latency benchmark for the Unikey engine.
+//
+// Drives UkEngine::process directly (no Fcitx instance, no TestFrontend) with
+// Telex/VNI/VIQR keystroke corpora and reports per-key latency percentiles and
+// throughput for each (input method, output charset) pair.
+//
+// Usage: benchunikey [iterations] [corpus-file]
+//
+// The corpus file, if given, replaces the built-in corpora. Each line has the
+// form "<telex|vni|viqr><TAB><keystrokes>". A '\b' in the keystrokes field is
+// replayed as a backspace.
+//
+// The first line gives the memory one input context holds while typing: its
+// engine, and the engine with its output buffer as UnikeyInputMethod pools
+// them.
+
+#include "keycons.h"
+#include "ukengine.h"
+#include "unikeyinputcontext.h"
+#include "vnconv.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Corpus {
+    UkInputMethod im;
+    const char *name;
+    std::vector<std::string> lines;
+};
+
+struct OutputCharset {
+    int id;
+    const char *name;
+};
+
+const OutputCharset outputCharsets[] = {
+    {CONV_CHARSET_XUTF8, "XUTF8"},
+    {CONV_CHARSET_TCVN3, "TCVN3"},
+    {CONV_CHARSET_VNIWIN, "VNIWIN"},
+    {CONV_CHARSET_VIQR, "VIQR"},
+    {CONV_CHARSET_UNIREF, "UNIREF"},
+};
+
+std::vector<Corpus> builtinCorpora() {
+    return {
+        {UkTelex,
+         "Telex",
+         {
+             "Tieesng Vieejt laf ngoon nguwx chinhs thuwcs cuar Vieejt Nam.",
+             "Hoom nay trowfi ddepj, chungs tooi ddi daoj quanh hoof Guwowm.",
+             "Nguwowif ta thuwowngf nois rawngf hocj thaafy khoong tafy hocj "
+             "banj.",
+             "Nhuwngx ngayf cuoois tuaafn, gia ddinhf tooi hay veef quee "
+             "thawm oong baf.",
+             "Quyeenr sachs nayf dduwowcj vieets bawngf tieesng Vieejt vaf "
+             "tieesng Anh.",
+             "Nguoiwf\b\b\bwowif Vieejt Namm\b ddaxx vaf ddang xaay duwngj.",
+         }},
+        {UkVni,
+         "VNI",
+         {
+             "Tie61ng Vie65t la2 ngo6n ngu74 chi1nh thu71c cu3a Vie65t Nam.",
+             "Ho6m nay tro72i d9e5p, chu1ng to6i d9i da5o quanh ho62 Gu7o7m.",
+             "Ngu7o72i ta thu7o72ng no1i ra82ng ho5c tha62y kho6ng ta2y ho5c "
+             "ba5n.",
+             "Nhu74ng nga2y cuo61i tua62n, gia d9i2nh to6i hay ve62 que6 "
+             "tha8m o6ng ba2.",
+             "Quye63n sa1ch na2y d9u7o75c vie61t ba82ng tie61ng Vie65t va2 "
+             "tie61ng Anh.",
+         }},
+        {UkViqr,
+         "VIQR",
+         {
+             "Tie^'ng Vie^.t la` ngo^n ngu+~ chi'nh thu+'c cu?a Vie^.t Nam",
+             "Ho^m nay tro+`i dde.p, chu'ng to^i ddi da.o quanh ho^` Gu+o+m",
+             "Ngu+o+`i ta thu+o+`ng no'i ra(`ng ho.c tha^`y kho^ng ta`y ho.c "
+             "ba.n",
+             "Nhu+~ng nga`y cuo^'i tua^`n, gia ddi`nh to^i hay ve^` que^ "
+             "tha(m o^ng ba`",
+             "Quye^?n sa'ch na`y ddu+o+.c vie^'t ba(`ng tie^'ng Vie^.t va` "
+             "tie^'ng Anh",
+         }},
+    };
+}
+
+bool loadCorpora(const char *path, std::vector<Corpus> &corpora) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    corpora = {{UkTelex, "Telex", {}}, {UkVni, "VNI", {}}, {UkViqr, "VIQR", {}}};
+    std::string line;
+    while (std::getline(in, line)) {
+        auto tab = line.find('\t');
+        if (tab == std::string::npos) {
+            continue;
+        }
+        auto im = line.substr(0, tab);
+        auto keys = line.substr(tab + 1);
+        // Allow a literal "\b" in files as backspace.
+        for (auto pos = keys.find("\\b"); pos != std::string::npos;
+             pos = keys.find("\\b", pos + 1)) {
+            keys.replace(pos, 2, 1, '\b');
+        }
+        for (auto &corpus : corpora) {
+            std::string name = corpus.name;
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            if (name == im) {
+                corpus.lines.push_back(keys);
+            }
+        }
+    }
+    std::erase_if(corpora, [](const Corpus &c) { return c.lines.empty(); });
+    return !corpora.empty();
+}
+
+uint64_t percentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto idx = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+    return sorted[idx];
+}
+
+void runOne(const Corpus &corpus, const OutputCharset &cs, int iterations) {
+    UnikeyInputMethod im;
+    im.setInputMethod(corpus.im);
+    im.setOutputCharset(cs.id);
+
+    UkEngine engine;
+    engine.setCtrlInfo(im.sharedMem());
+    engine.setCheckKbCaseFunc([](int *pShiftPressed, int *pCapsLockOn) {
+        *pShiftPressed = 0;
+        *pCapsLockOn = 0;
+    });
+
+    unsigned char buf[1024];
+    int backs;
+    int bufSize;
+    UkOutputType outType;
+
+    size_t totalKeys = 0;
+    for (const auto &line : corpus.lines) {
+        totalKeys += line.size();
+    }
+    std::vector<uint64_t> samples;
+    samples.reserve(totalKeys * iterations);
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (const auto &line : corpus.lines) {
+            engine.reset();
+            for (unsigned char ch : line) {
+                bufSize = sizeof(buf);
+                auto t0 = clock::now();
+                if (ch == '\b') {
+                    engine.processBackspace(backs, buf, bufSize, outType);
+                } else {
+                    engine.process(ch, backs, buf, bufSize, outType);
+                }
+                auto t1 = clock::now();
+                samples.push_back(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(t1 -
+                                                                         t0)
+                        .count());
+            }
+        }
+    }
+    auto elapsed =
+        std::chrono::duration<double>(clock::now() - start).count();
+
+    std::sort(samples.begin(), samples.end());
+    double keysPerSec = elapsed > 0 ? samples.size() / elapsed : 0;
+    std::printf("%-6s %-8s keys=%-8zu p50=%6lluns p99=%6lluns p999=%7lluns "
+                "max=%8lluns keys/s=%.0f\n",
+                corpus.name, cs.name, samples.size(),
+                static_cast<unsigned long long>(percentile(samples, 0.50)),
+                static_cast<unsigned long long>(percentile(samples, 0.99)),
+                static_cast<unsigned long long>(percentile(samples, 0.999)),
+                static_cast<unsigned long long>(
+                    samples.empty() ? 0 : samples.back()),
+                keysPerSec);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    int iterations = 2000;
+    if (argc > 1) {
+        iterations = std::max(1, std::atoi(argv[1]));
+    }
+
+    auto corpora = builtinCorpora();
+    if (argc > 2 && !loadCorpora(argv[2], corpora)) {
+        std::cerr << "benchunikey: failed to load corpus " << argv[2]
+                  << std::endl;
+        return 1;
+    }
+
+    std::printf("engine=%zuB slot=%zuB saved-state=%zuB\n", sizeof(UkEngine),
+                sizeof(UkEngineSlot), sizeof(UkEngineState));
+    for (const auto &corpus : corpora) {
+        for (const auto &cs : outputCharsets) {
+            runOne(corpus, cs, iterations);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,250 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Replays a recording made with $UNIKEY_RECORD_FILE (see
+// src/unikey-recorder.h) through the addon and the test frontend, and prints
+// how long each stage took.
+//
+//   replayunikey [--repeat N] recording
+//
+// Every repetition starts over with new input contexts. For the stages
+// inside each key, build with -DENABLE_TRACE=On and set $UNIKEY_TRACE_FILE
+// too.
+
+#include "testdir.h"
+#include "testfrontend_public.h"
+#include "unikey-recorder.h"
+
+#include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/capabilityflags.h>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/event.h>
+#include <fcitx/inputcontext.h>
+#include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodgroup.h>
+#include <fcitx/inputmethodmanager.h>
+#include <fcitx/instance.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+const char *const stageNames[] = {"context", "config", "surrounding", "key",
+                                  "reset"};
+constexpr size_t stageCount = FCITX_ARRAY_SIZE(stageNames);
+
+struct Replay {
+    std::vector<UnikeyRecord> records;
+    int repeat = 1;
+    // per stage, in nanoseconds
+    std::vector<uint64_t> times[stageCount];
+};
+
+void setupInputMethodGroup(Instance *instance) {
+    auto defaultGroup = instance->inputMethodManager().currentGroup();
+    defaultGroup.inputMethodList().clear();
+    defaultGroup.inputMethodList().push_back(InputMethodGroupItem("keyboard-us"));
+    defaultGroup.inputMethodList().push_back(InputMethodGroupItem("unikey"));
+    defaultGroup.setDefaultInputMethod("");
+    instance->inputMethodManager().setGroup(defaultGroup);
+}
+
+void replayOnce(Instance *instance, Replay &replay) {
+    auto *unikey = instance->addonManager().addon("unikey", true);
+    auto *testfrontend = instance->addonManager().addon("testfrontend");
+    std::unordered_map<uint32_t, ICUUID> contexts;
+
+    for (const auto &record : replay.records) {
+        InputContext *ic = nullptr;
+        auto iter = contexts.find(record.context);
+        if (iter != contexts.end()) {
+            ic = instance->inputContextManager().findByUUID(iter->second);
+        }
+        if (!ic && record.type != UnikeyRecordType::Context &&
+            record.type != UnikeyRecordType::Config) {
+            // The recording started after this context was created.
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        switch (record.type) {
+        case UnikeyRecordType::Context:
+            if (!ic) {
+                auto uuid =
+                    testfrontend->call<ITestFrontend::createInputContext>(
+                        record.text);
+                contexts[record.context] = uuid;
+                ic = instance->inputContextManager().findByUUID(uuid);
+                ic->setCapabilityFlags(
+                    CapabilityFlags(static_cast<CapabilityFlag>(record.flags)));
+                // Switch to Unikey, the trigger key never reaches the
+                // engine and so is not in the recording.
+                testfrontend->call<ITestFrontend::keyEvent>(
+                    uuid, Key("Control+space"), false);
+            } else {
+                ic->setCapabilityFlags(
+                    CapabilityFlags(static_cast<CapabilityFlag>(record.flags)));
+            }
+            break;
+        case UnikeyRecordType::Config: {
+            RawConfig config;
+            unikeyConfigFromString(record.text, config);
+            unikey->setConfig(config);
+            break;
+        }
+        case UnikeyRecordType::Surrounding:
+            if (record.valid) {
+                ic->surroundingText().setText(record.text, record.cursor,
+                                              record.anchor);
+            } else {
+                ic->surroundingText().invalidate();
+            }
+            ic->updateSurroundingText();
+            break;
+        case UnikeyRecordType::Key:
+            testfrontend->call<ITestFrontend::keyEvent>(
+                ic->uuid(),
+                Key(static_cast<KeySym>(record.sym),
+                    KeyStates(static_cast<KeyState>(record.states))),
+                record.release);
+            break;
+        case UnikeyRecordType::Reset:
+            if (record.event ==
+                static_cast<uint32_t>(EventType::InputContextReset)) {
+                ic->reset();
+            } else if (record.event ==
+                       static_cast<uint32_t>(EventType::InputContextFocusOut)) {
+                ic->focusOut();
+                ic->focusIn();
+            }
+            break;
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+        replay.times[static_cast<size_t>(record.type) - 1].push_back(ns);
+    }
+
+    for (const auto &[id, uuid] : contexts) {
+        testfrontend->call<ITestFrontend::destroyInputContext>(uuid);
+    }
+}
+
+void scheduleReplay(EventDispatcher *dispatcher, Instance *instance,
+                    Replay *replay) {
+    dispatcher->schedule([dispatcher, instance, replay]() {
+        setupInputMethodGroup(instance);
+        for (int i = 0; i < replay->repeat; i++) {
+            replayOnce(instance, *replay);
+        }
+        instance->deactivate();
+        dispatcher->schedule([dispatcher, instance]() {
+            dispatcher->detach();
+            instance->exit();
+        });
+    });
+}
+
+void printReport(const Replay &replay) {
+    uint64_t recordedUs = 0;
+    size_t keys = 0;
+    for (const auto &record : replay.records) {
+        recordedUs += record.delayUs;
+        keys += record.type == UnikeyRecordType::Key && !record.release;
+    }
+    std::printf("%zu records, %zu key presses over %.1f s as recorded, "
+                "replayed %d times\n",
+                replay.records.size(), keys, recordedUs / 1e6, replay.repeat);
+    std::printf("%-12s %8s %10s %9s %9s %9s %9s\n", "stage", "count",
+                "total ms", "avg us", "p50 us", "p99 us", "max us");
+    for (size_t i = 0; i < stageCount; i++) {
+        auto times = replay.times[i];
+        if (times.empty()) {
+            continue;
+        }
+        std::sort(times.begin(), times.end());
+        uint64_t total = 0;
+        for (auto ns : times) {
+            total += ns;
+        }
+        std::printf("%-12s %8zu %10.3f %9.2f %9.2f %9.2f %9.2f\n",
+                    stageNames[i], times.size(), total / 1e6,
+                    total / 1e3 / times.size(), times[times.size() / 2] / 1e3,
+                    times[times.size() * 99 / 100] / 1e3, times.back() / 1e3);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Replay replay;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg(argv[i]);
+        if (arg == "--repeat" && i + 1 < argc) {
+            replay.repeat = std::max(1, std::atoi(argv[i + 1]));
+            i++;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        std::fprintf(stderr, "usage: %s [--repeat N] recording\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = std::fopen(path, "rb");
+    if (!file) {
+        std::fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+    UnikeyRecordReader reader(file);
+    if (!reader.valid()) {
+        std::fprintf(stderr, "%s is not a unikey recording\n", path);
+        return 1;
+    }
+    UnikeyRecord record;
+    while (reader.next(record)) {
+        replay.records.push_back(record);
+    }
+
+    // Never record the replay, least of all over the recording.
+    unsetenv("UNIKEY_RECORD_FILE");
+    setupTestingEnvironmentPath(TESTING_BINARY_DIR, {"bin"},
+                                {TESTING_BINARY_DIR "/test"});
+
+    char arg0[] = "replayunikey";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,unikey";
+    char *fcitxArgv[] = {arg0, arg1, arg2};
+
+    fcitx::Log::setLogRule("default=3,unikey=3");
+
+    Instance instance(FCITX_ARRAY_SIZE(fcitxArgv), fcitxArgv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+
+    EventDispatcher dispatcher;
+    dispatcher.attach(&instance.eventLoop());
+    scheduleReplay(&dispatcher, &instance, &replay);
+    instance.exec();
+
+    printReport(replay);
+    return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks that the engine does not touch the heap while typing.
+//
+// Every operator new of the process is counted. Each corpus is typed once to
+// warm up (engine slot pool, preedit capacity, lazily built tables), then
+// typed again with counting on, through UnikeyInputContext the way
+// UnikeyState drives it: filter, backspacePress, restoreKeyStrokes and
+// resetBuf at word ends. Any allocation in the second pass fails the test.
+//
+// Only the engine and the charset library are covered. UnikeyState::keyEvent
+// itself, with the PreeditText, the surrounding text cache and the commit
+// diff, runs inside fcitx, which allocates for every key event on its own.
+//
+// malloc itself is not hooked, the engine and the charset library only
+// allocate through operator new (std containers, make_unique).
+
+#include "keycons.h"
+#include "mactab.h"
+#include "unikeyinputcontext.h"
+#include "vnconv.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+
+namespace {
+
+bool counting = false;
+size_t allocations = 0;
+
+void *countedAlloc(size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *countedAlignedAlloc(size_t size, std::align_val_t align) {
+    if (counting) {
+        allocations++;
+    }
+    auto alignment = static_cast<size_t>(align);
+    size = (size + alignment - 1) / alignment * alignment;
+    if (void *p = std::aligned_alloc(alignment, size ? size : alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+} // namespace
+
+void *operator new(size_t size) { return countedAlloc(size); }
+
+void *operator new[](size_t size) { return countedAlloc(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    try {
+        return countedAlloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    try {
+        return countedAlloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new(size_t size, std::align_val_t align) {
+    return countedAlignedAlloc(size, align);
+}
+
+void *operator new[](size_t size, std::align_val_t align) {
+    return countedAlignedAlloc(size, align);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+struct Corpus {
+    UkInputMethod im;
+    const char *name;
+    const char *keys; // '\b' is a backspace, '\n' a Shift+Shift restore
+};
+
+const Corpus corpora[] = {
+    {UkTelex, "Telex",
+     "Tieesng Vieejt laf ngoon nguwx chinhs thuwcs cuar Vieejt Nam. "
+     "Nguoiwf\b\b\bwowif Vieejt Namm\b ddaxx vaf ddang xaay duwngj. "
+     "Quyeenr sachs nayf dduwowcj vieets bawngf tieesng Anh\n kgs vn "
+     "Hoom nay trowfi ddepj, chungs tooi ddi daoj quanh hoof Guwowm."},
+    {UkVni, "VNI",
+     "Tie61ng Vie65t la2 ngo6n ngu74 chi1nh thu71c cu3a Vie65t Nam. "
+     "Ngu7o72i ta thu7o72ng no1i ra82ng ho5c tha62y\b\b kho6ng ta2y ho5c "
+     "ba5n\n kgs vn Nhu74ng nga2y cuo61i tua62n."},
+    {UkViqr, "VIQR",
+     "Tie^'ng Vie^.t la` ngo^n ngu+~ chi'nh thu+'c cu?a Vie^.t Nam "
+     "Quye^?n sa'ch na`y ddu+o+.c\b\b vie^'t ba(`ng tie^'ng Anh\n kgs vn"},
+};
+
+struct OutputCharset {
+    int id;
+    const char *name;
+};
+
+const OutputCharset outputCharsets[] = {
+    {CONV_CHARSET_XUTF8, "XUTF8"},
+    {CONV_CHARSET_VIQR, "VIQR"},
+    {CONV_CHARSET_TCVN3, "TCVN3"},
+    {CONV_CHARSET_VNIWIN, "VNIWIN"},
+};
+
+bool isWordEnd(char key) {
+    return key == ' ' || key == '.' || key == ',' || key == '\n';
+}
+
+// Drops count characters from the end of text, as UTF-8. For the other
+// charsets this is only roughly right, which is fine, the text is kept for
+// the appends it does and not checked.
+void eraseChars(std::string &text, int count) {
+    size_t len = text.size();
+    while (count > 0 && len > 0) {
+        len--;
+        if ((static_cast<unsigned char>(text[len]) & 0xC0) != 0x80) {
+            count--;
+        }
+    }
+    text.resize(len);
+}
+
+// Types keys, keeping the text the way the preedit does, in a string whose
+// capacity is reserved by the warm up pass.
+void type(UnikeyInputContext &uic, const char *keys, std::string &text) {
+    text.clear();
+    for (const char *p = keys; *p; p++) {
+        if (*p == '\b') {
+            uic.backspacePress();
+        } else if (*p == '\n') {
+            uic.restoreKeyStrokes();
+        } else {
+            uic.filter(static_cast<unsigned char>(*p));
+        }
+
+        eraseChars(text, uic.backspaces());
+        if (uic.bufChars() > 0) {
+            text.append(reinterpret_cast<const char *>(uic.buf()),
+                        uic.bufChars());
+        } else if (*p != '\b' && *p != '\n') {
+            text.push_back(*p);
+        }
+        if (isWordEnd(*p)) {
+            uic.resetBuf();
+        }
+    }
+    uic.resetBuf();
+}
+
+bool runOne(const Corpus &corpus, const OutputCharset &cs,
+            const std::shared_ptr<const CMacroTable> &macros) {
+    UnikeyInputMethod im;
+    im.setInputMethod(corpus.im);
+    im.setOutputCharset(cs.id);
+    UnikeyOptions options;
+    CreateDefaultUnikeyOptions(&options);
+    options.macroEnabled = 1;
+    options.autoNonVnRestore = 1;
+    im.setOptions(&options);
+    im.setMacroTable(macros);
+
+    UnikeyInputContext uic(&im);
+    std::string text;
+    type(uic, corpus.keys, text);
+
+    allocations = 0;
+    counting = true;
+    type(uic, corpus.keys, text);
+    counting = false;
+
+    if (allocations != 0) {
+        std::printf("FAIL %s -> %s: %zu allocations while typing\n",
+                    corpus.name, cs.name, allocations);
+        return false;
+    }
+    std::printf("ok   %s -> %s\n", corpus.name, cs.name);
+    return true;
+}
+
+// A macro longer than a key's usual output expands whole, still without an
+// allocation.
+bool runLongMacro() {
+    std::string longText;
+    for (int i = 0; i < 250; i++) {
+        longText += "dài ";
+    }
+    auto macros = std::make_shared<CMacroTable>();
+    macros->init();
+    macros->addItem("dl", longText.c_str(), CONV_CHARSET_UNIUTF8);
+    macros->buildIndex();
+
+    UnikeyInputMethod im;
+    im.setInputMethod(UkTelex);
+    im.setOutputCharset(CONV_CHARSET_XUTF8);
+    UnikeyOptions options;
+    CreateDefaultUnikeyOptions(&options);
+    options.macroEnabled = 1;
+    im.setOptions(&options);
+    im.setMacroTable(macros);
+
+    UnikeyInputContext uic(&im);
+    std::string text;
+    type(uic, "dl ", text);
+
+    allocations = 0;
+    counting = true;
+    type(uic, "dl ", text);
+    counting = false;
+
+    if (allocations != 0 || text != longText + " ") {
+        std::printf("FAIL long macro: %zu allocations, %zu of %zu bytes\n",
+                    allocations, text.size(), longText.size() + 1);
+        return false;
+    }
+    std::printf("ok   long macro\n");
+    return true;
+}
+
+} // namespace
+
+int main() {
+    auto macros = std::make_shared<CMacroTable>();
+    macros->init();
+    macros->addItem("kgs", "không sao", CONV_CHARSET_UNIUTF8);
+    macros->addItem("vn", "Việt Nam", CONV_CHARSET_UNIUTF8);
+    macros->buildIndex();
+
+    bool ok = true;
+    for (const auto &corpus : corpora) {
+        for (const auto &cs : outputCharsets) {
+            ok = runOne(corpus, cs, macros) && ok;
+        }
+    }
+    ok = runLongMacro() && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks convertCharsetText, used by the clipboard conversion: UTF-8 text to
+// each output charset and back, and text that is not in the charset it is
+// said to be in.
+
+#include "unikey-utils.h"
+#include "vnconv.h"
+
+#include <cstdio>
+#include <string>
+
+using namespace fcitx;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *what, const std::string &text) {
+    if (!ok) {
+        std::fprintf(stderr, "FAIL %s: %s\n", what, text.c_str());
+        failures++;
+    }
+}
+
+struct Case {
+    int charset;
+    const char *name;
+    // "Tiếng Việt" as shown in UTF-8, one character per byte
+    const char *expected;
+};
+
+const Case cases[] = {
+    {CONV_CHARSET_TCVN3, "TCVN3", "Ti\xC3\x95ng Vi\xC3\x96t"},
+    {CONV_CHARSET_VNIWIN, "VNIWIN", "Tie\xC3\xA1ng Vie\xC3\xA4t"},
+    {CONV_CHARSET_VIQR, "VIQR", "Tie^'ng Vie^.t"},
+    {CONV_CHARSET_UNIREF, "UNIREF", "Ti&#7871;ng Vi&#7879;t"},
+    {CONV_CHARSET_UNI_CSTRING, "UNI_CSTRING", "Ti\\x1EBFng Vi\\x1EC7t"},
+};
+
+} // namespace
+
+int main() {
+    const std::string text = "Tiếng Việt";
+    for (const auto &c : cases) {
+        std::string out, back;
+        check(convertCharsetText(text, CONV_CHARSET_UNIUTF8, c.charset, out) &&
+                  out == c.expected,
+              "from Unicode", c.name);
+        check(convertCharsetText(out, c.charset, CONV_CHARSET_UNIUTF8,
+                                 back) &&
+                  back == text,
+              "to Unicode", c.name);
+    }
+
+    // a single byte charset has nothing above U+00FF
+    std::string out;
+    check(!convertCharsetText(text, CONV_CHARSET_TCVN3, CONV_CHARSET_UNIUTF8,
+                              out),
+          "not in the charset", text);
+
+    // a large text converts whole
+    std::string large;
+    for (int i = 0; i < 100000; i++) {
+        large += "Tiếng Việt ";
+    }
+    std::string tcvn, back;
+    check(convertCharsetText(large, CONV_CHARSET_UNIUTF8, CONV_CHARSET_TCVN3,
+                             tcvn) &&
+              convertCharsetText(tcvn, CONV_CHARSET_TCVN3,
+                                 CONV_CHARSET_UNIUTF8, back) &&
+              back == large,
+          "large text", "Tiếng Việt x 100000");
+
+    if (failures) {
+        return 1;
+    }
+    std::printf("ok\n");
+    return 0;
+}
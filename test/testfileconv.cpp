@@ -0,0 +1,155 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks that VnFileConvert of a file larger than one conversion chunk
+// gives, byte for byte, what genConvert gives for the whole text, whatever
+// the number of threads: the chunks are cut at new lines, inside a line
+// longer than the split window, and inside a run with no space at all, in
+// UTF-8 and in VNI Windows input.
+
+#include "byteio.h"
+#include "charset.h"
+#include "testfiles.h"
+#include "vnconv.h"
+
+#include <fcitx-utils/log.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace testfiles;
+
+namespace {
+
+// see convert.cpp
+constexpr size_t chunkSize = 4 << 20;
+constexpr size_t splitWindow = 65536;
+constexpr int threadCounts[] = {1, 2, 5};
+
+const char *const words[] = {
+    "Tiếng", "Việt",  "ĐƯỜNG", "được", "người", "khuỷu", "Ưu",   "tiên",
+    "ở",     "giữa",  "nghĩa", "ẵm",   "Ặc",    "Ự",     "quả",  "nhỉ",
+    "A",     "hello", "2026,", "(x)",  "ỹ",     "Ỵ",     "ốc.",  "thuở"};
+constexpr size_t wordCount = sizeof(words) / sizeof(*words);
+
+uint32_t nextRandom(uint32_t &seed) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// Short lines up to 3 MB, then one line across the next two chunk ends,
+// which ends with a run without spaces or new lines, then short lines
+// again.
+std::string utf8Text() {
+    uint32_t seed = 3;
+    std::string text;
+    auto addWord = [&]() { text += words[nextRandom(seed) % wordCount]; };
+    while (text.size() < 3 * chunkSize / 4) {
+        addWord();
+        uint32_t r = nextRandom(seed) % 16;
+        text += r == 0 ? "\n" : r == 1 ? "\r\n" : r == 2 ? "\t" : " ";
+    }
+    text += '\n';
+    while (text.size() < 2 * chunkSize - splitWindow) {
+        addWord();
+        text += ' ';
+    }
+    while (text.size() < 2 * chunkSize + 4 * splitWindow) {
+        addWord();
+    }
+    text += '\n';
+    while (text.size() < 2 * chunkSize + chunkSize / 2) {
+        addWord();
+        text += nextRandom(seed) % 8 ? " " : "\n";
+    }
+    return text;
+}
+
+std::string genConverted(int inCharset, int outCharset,
+                         const std::string &text,
+                         const VnConvOptions &options) {
+    VnConvCharset inCs(inCharset, &options);
+    VnConvCharset outCs(outCharset, &options);
+    std::vector<UKBYTE> input(text.begin(), text.end());
+    std::vector<UKBYTE> output(text.size() * 8 + 16);
+    StringBIStream is(input.data(), input.size(), inCs.get()->elementSize());
+    StringBOStream os(output.data(), output.size());
+    genConvert(*inCs.get(), *outCs.get(), is, os, options);
+    std::string result;
+    // VnFileConvert starts UCS-2 with a byte order mark
+    if (outCharset == CONV_CHARSET_UNICODE) {
+        UKWORD sign = 0xFEFF;
+        result.append(reinterpret_cast<const char *>(&sign), sizeof(sign));
+    }
+    result.append(reinterpret_cast<const char *>(output.data()),
+                  os.getOutBytes());
+    return result;
+}
+
+struct Input {
+    const char *name;
+    int charset;
+};
+
+const Input inputs[] = {
+    {"UTF-8", CONV_CHARSET_UNIUTF8},
+    {"VNI", CONV_CHARSET_VNIWIN},
+};
+
+const Input outputs[] = {
+    {"UTF-8", CONV_CHARSET_UNIUTF8},   {"VNI", CONV_CHARSET_VNIWIN},
+    {"TCVN3", CONV_CHARSET_TCVN3},     {"UCS-2", CONV_CHARSET_UNICODE},
+    {"NCR", CONV_CHARSET_UNIREF},
+};
+
+} // namespace
+
+int main() {
+    TestDir dir("testfileconv");
+    const std::string inFile = dir.file("in.txt");
+    const std::string outFile = dir.file("out.txt");
+
+    VnConvOptions options;
+    VnConvGetOptions(&options);
+    const std::string utf8 = utf8Text();
+
+    for (const auto &in : inputs) {
+        const std::string text =
+            in.charset == CONV_CHARSET_UNIUTF8
+                ? utf8
+                : genConverted(CONV_CHARSET_UNIUTF8, in.charset, utf8, options);
+        FCITX_ASSERT(text.size() > 2 * chunkSize)
+            << in.name << " input is only " << text.size() << " bytes";
+        FCITX_ASSERT(writeFile(inFile, text));
+
+        for (const auto &out : outputs) {
+            const std::string expected =
+                genConverted(in.charset, out.charset, text, options);
+            for (int threads : threadCounts) {
+                VnConvSetFileThreads(threads);
+                int ret = VnFileConvert(in.charset, out.charset,
+                                        inFile.c_str(), outFile.c_str());
+                FCITX_ASSERT(ret == 0)
+                    << in.name << " to " << out.name << ", " << threads
+                    << " threads: returns " << ret;
+                std::string actual = readFile(outFile);
+                size_t at = 0;
+                while (at < actual.size() && at < expected.size() &&
+                       actual[at] == expected[at]) {
+                    at++;
+                }
+                FCITX_ASSERT(actual == expected)
+                    << in.name << " to " << out.name << ", " << threads
+                    << " threads: differs at byte " << at << " of "
+                    << expected.size();
+            }
+        }
+    }
+    VnConvSetFileThreads(0);
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _TEST_TESTFILES_H_
+#define _TEST_TESTFILES_H_
+
+// Files for the tests of the compiled copies and of file conversion.
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace testfiles {
+
+inline std::string &removedOnAbort() {
+    static std::string path;
+    return path;
+}
+
+// A directory of its own for the files of a test, removed with what is in
+// it when the test ends, and when a failed FCITX_ASSERT aborts it. One at a
+// time.
+class TestDir {
+public:
+    explicit TestDir(const char *name) {
+        const char *tmp = std::getenv("TMPDIR");
+        std::string templ = std::string(tmp && *tmp ? tmp : "/tmp") + "/" +
+                            name + ".XXXXXX";
+        if (!mkdtemp(templ.data())) {
+            std::perror("mkdtemp");
+            std::exit(1);
+        }
+        path_ = templ;
+        removedOnAbort() = path_;
+        std::signal(SIGABRT, [](int sig) {
+            std::error_code ec;
+            std::filesystem::remove_all(removedOnAbort(), ec);
+            std::signal(sig, SIG_DFL);
+            std::raise(sig);
+        });
+    }
+    ~TestDir() {
+        std::signal(SIGABRT, SIG_DFL);
+        removedOnAbort().clear();
+        std::error_code ec;
+        std::filesystem::remove_all(path_, ec);
+    }
+    TestDir(const TestDir &) = delete;
+    TestDir &operator=(const TestDir &) = delete;
+
+    const std::string &path() const { return path_; }
+    std::string file(const std::string &name) const {
+        return path_ + "/" + name;
+    }
+
+private:
+    std::string path_;
+};
+
+// the bytes of a file, empty if it cannot be read
+inline std::string readFile(const std::string &name) {
+    std::string bytes;
+    FILE *f = std::fopen(name.c_str(), "rb");
+    if (!f) {
+        return bytes;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) {
+        bytes.append(buf, n);
+    }
+    std::fclose(f);
+    return bytes;
+}
+
+inline bool writeFile(const std::string &name, const std::string &bytes) {
+    FILE *f = std::fopen(name.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    size_t written = std::fwrite(bytes.data(), 1, bytes.size(), f);
+    return std::fclose(f) == 0 && written == bytes.size();
+}
+
+// 0 if the file is not there; a file replaced by rename gets a new one
+inline ino_t fileInode(const std::string &name) {
+    struct stat st;
+    return stat(name.c_str(), &st) == 0 ? st.st_ino : 0;
+}
+
+} // namespace testfiles
+
+#endif // _TEST_TESTFILES_H_
@@ -10,6 +10,7 @@
  * - Keypad digit support
  * - W at word beginning
  * - Tone changes
+ * - Long runs without word break
  */
 
 #include "testdir.h"
@@ -59,6 +60,7 @@ void printCases() {
     std::cout << " 12: Multiple tone changes\n";
     std::cout << " 13: Double-typing to undo tone\n";
     std::cout << " 14: Backspace should not delete from app when preedit is not empty\n";
+    std::cout << " 15: Long run without word break stays one word\n";
 }
 
 void announceCase(int id) {
@@ -450,6 +452,30 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("space"), false);
         }
 
+        // --- Test: Long run without word break ---
+        // A run longer than the engine history must not be cut into a new
+        // word: "aa" at its end is not a Vietnamese syllable.
+        if (shouldRunCase(selCopy, 15)) {
+            announceCase(15);
+            FCITX_INFO() << "testkeyhandling: Case 15 - Long run without word break";
+            config.setValueByPath("ImmediateCommit", "False");
+            config.setValueByPath("InputMethod", "Telex");
+            config.setValueByPath("SpellCheck", "True");
+            unikey->setConfig(config);
+
+            ic->reset();
+            const std::string run(119, 'b');
+            testfrontend->call<ITestFrontend::pushCommitExpectation>(run + "aa ");
+            for (char c : run) {
+                testfrontend->call<ITestFrontend::keyEvent>(
+                    uuid, Key(std::string(1, c)), false);
+            }
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("a"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("a"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("space"), false);
+            config.setValueByPath("SpellCheck", "False");
+        }
+
         instance->deactivate();
         dispatcher->schedule([dispatcher, instance]() {
             dispatcher->detach();
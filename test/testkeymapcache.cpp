@@ -0,0 +1,98 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks that a keymap loaded through its compiled copy is the one parsed
+// from the text, and that a stale or broken copy falls back to the text.
+
+#include "inputproc.h"
+#include "testfiles.h"
+#include "usrkeymap.h"
+
+#include <fcitx-utils/log.h>
+
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace testfiles;
+
+namespace {
+
+// the map parsed from the text, without any cache
+void parse(const std::string &name, int keyMap[256]) {
+    int fd = open(name.c_str(), O_RDONLY);
+    UkLoadKeyMap(fd, keyMap);
+    close(fd);
+}
+
+bool sameMap(const int a[256], const int b[256]) {
+    return std::memcmp(a, b, 256 * sizeof(int)) == 0;
+}
+
+const char keymap[] = "; comment\n"
+                      "s = Tone1\nf = Tone2\nr = Tone3\nx = Tone4\n"
+                      "j = Tone5\nz = Tone0\na = Roof-A\nw = Hook-Bowl\n"
+                      "d = D-Mark\n[ = u+\n] = o+\n";
+
+} // namespace
+
+int main() {
+    TestDir dir("testkeymapcache");
+    const std::string file = dir.file("keymap.txt");
+    const std::string cache = file + ".bin";
+    FCITX_ASSERT(writeFile(file, keymap));
+
+    int expected[256], actual[256];
+    parse(file, expected);
+    FCITX_ASSERT(expected['s'] == vneTone1 && expected['S'] == vneTone1);
+
+    // the first load parses the text and writes the cache
+    FCITX_ASSERT(UkLoadKeyMapFile(file.c_str(), actual, true));
+    FCITX_ASSERT(sameMap(expected, actual));
+    FCITX_ASSERT(access(cache.c_str(), R_OK) == 0);
+
+    // the second load takes the map from the cache: change it there
+    struct stat src;
+    FCITX_ASSERT(stat(file.c_str(), &src) == 0);
+    int changed[256];
+    std::memcpy(changed, expected, sizeof(changed));
+    changed['q'] = vneTone3;
+    FCITX_ASSERT(UkWriteKeyMapCache(cache.c_str(), src, changed));
+    FCITX_ASSERT(UkLoadKeyMapFile(file.c_str(), actual, true) &&
+                 sameMap(changed, actual));
+    // unused without useCache
+    FCITX_ASSERT(UkLoadKeyMapFile(file.c_str(), actual) &&
+                 sameMap(expected, actual));
+
+    // a cut or invalid copy is ignored and written again
+    FCITX_ASSERT(truncate(cache.c_str(), 100) == 0);
+    FCITX_ASSERT(UkLoadKeyMapFile(file.c_str(), actual, true) &&
+                 sameMap(expected, actual));
+    changed['q'] = static_cast<int>(vneCount) + vnl_lastChar;
+    FCITX_ASSERT(UkWriteKeyMapCache(cache.c_str(), src, changed));
+    FCITX_ASSERT(UkLoadKeyMapFile(file.c_str(), actual, true) &&
+                 sameMap(expected, actual));
+    changed['q'] = vneTone3;
+    FCITX_ASSERT(UkWriteKeyMapCache(cache.c_str(), src, changed));
+
+    // a changed text makes the copy stale
+    FCITX_ASSERT(writeFile(file, "s = Tone2\n"));
+    parse(file, expected);
+    FCITX_ASSERT(UkLoadKeyMapFile(file.c_str(), actual, true) &&
+                 sameMap(expected, actual));
+    FCITX_ASSERT(actual['s'] == vneTone2);
+    // and is written again
+    FCITX_ASSERT(UkLoadKeyMapFile(file.c_str(), actual, true) &&
+                 sameMap(expected, actual));
+
+    unlink(cache.c_str());
+    unlink(file.c_str());
+    FCITX_ASSERT(!UkLoadKeyMapFile(file.c_str(), actual, true));
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks the buckets and the rolling windows of KeyLatencyHistogram, and that
+// KeyStageScope only times a stage when it is given somewhere to add it.
+
+#include "unikey-latency.h"
+
+#include <fcitx-utils/log.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+uint64_t count(const std::vector<std::pair<std::string, uint64_t>> &values,
+               const std::string &bucket) {
+    for (const auto &[name, value] : values) {
+        if (name == bucket) {
+            return value;
+        }
+    }
+    return 0;
+}
+
+constexpr int64_t minute = KeyLatencyHistogram::windowNs;
+
+} // namespace
+
+int main() {
+    KeyLatencyHistogram histogram;
+    const int64_t start = 1000 * minute;
+    histogram.add(500, start);           // 0.5 us
+    histogram.add(1000, start);          // 1 us
+    histogram.add(3500, start);          // 3 us
+    histogram.add(3999, start + 1);      // 3 us
+    histogram.add(5000000, start);       // 5 ms
+    histogram.add(600000000000, start);  // 10 minutes
+    auto values = histogram.values(start);
+    FCITX_ASSERT(count(values, "<1us") == 1) << "below 1 us";
+    FCITX_ASSERT(count(values, "<2us") == 1) << "1 us";
+    FCITX_ASSERT(count(values, "<4us") == 2) << "3 us";
+    FCITX_ASSERT(count(values, "<8192us") == 1) << "5 ms";
+    FCITX_ASSERT(count(values, ">=262144us") == 1) << "10 minutes";
+    FCITX_ASSERT(values.size() == 5) << "empty buckets left out";
+
+    // still counted until the window is windowCount minutes old, then the
+    // ring slot is taken by a new minute
+    histogram.add(1000, start + 3 * minute);
+    values = histogram.values(start + (KeyLatencyHistogram::windowCount - 1) *
+                                          minute);
+    FCITX_ASSERT(count(values, "<2us") == 2) << "windows of the last minutes";
+    values =
+        histogram.values(start + KeyLatencyHistogram::windowCount * minute);
+    FCITX_ASSERT(count(values, "<2us") == 1) << "window too old";
+    FCITX_ASSERT(count(values, "<4us") == 0) << "window too old, other bucket";
+    histogram.add(1000, start + KeyLatencyHistogram::windowCount * minute);
+    values =
+        histogram.values(start + KeyLatencyHistogram::windowCount * minute);
+    FCITX_ASSERT(count(values, "<2us") == 2) << "reused window cleared";
+    FCITX_ASSERT(count(values, "<8192us") == 0)
+        << "reused window bucket cleared";
+
+    histogram.clear();
+    FCITX_ASSERT(histogram.values(start).empty()) << "clear";
+
+    KeyStageTimes times;
+    {
+        KeyStageScope stage(&times, KeyStage::Engine);
+        KeyStageScope off(nullptr, KeyStage::Commit);
+    }
+    {
+        KeyStageScope stage(&times, KeyStage::Engine);
+    }
+    for (size_t i = 0; i < times.ns.size(); i++) {
+        if (static_cast<KeyStage>(i) != KeyStage::Engine) {
+            FCITX_ASSERT(times.ns[i] == 0) << "only the timed stage";
+        }
+        FCITX_ASSERT(*keyStageName(static_cast<KeyStage>(i))) << "stage name";
+    }
+
+    return 0;
+}
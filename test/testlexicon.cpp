@@ -0,0 +1,306 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks the suggestion word list: words are found from the root letters
+// typed so far, a typed mark or tone only keeps the words that have it,
+// the best ranked come first and a query stops after a bounded number of
+// nodes. A list mapped from its compiled file gives the same words, and a
+// compiled file whose ranges do not hold together is ignored and written
+// again from the text.
+
+#include "charset.h"
+#include "lexicon.h"
+#include "testfiles.h"
+#include "vnconv.h"
+
+#include <fcitx-utils/log.h>
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace testfiles;
+
+namespace {
+
+// the layout of the file, see lexicon.cpp
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    int64_t srcSize;
+    int64_t srcMtimeSec;
+    int64_t srcMtimeNsec;
+    uint32_t wordCount;
+    uint32_t textSize;
+    uint32_t letterCount;
+};
+
+struct Cache {
+    std::string bytes;
+
+    CacheHeader *header() {
+        return reinterpret_cast<CacheHeader *>(bytes.data());
+    }
+    UkLexiconNode *nodes() {
+        return reinterpret_cast<UkLexiconNode *>(bytes.data() +
+                                                 sizeof(CacheHeader));
+    }
+    UkLexiconWord *words() {
+        return reinterpret_cast<UkLexiconWord *>(nodes() +
+                                                 header()->nodeCount);
+    }
+    int32_t *letters() {
+        return reinterpret_cast<int32_t *>(
+            reinterpret_cast<char *>(words() + header()->wordCount) +
+            header()->textSize);
+    }
+};
+
+// the lower case letters of a UTF-8 word, the way the lexicon keys them
+std::vector<VnLexiName> letters(const char *word) {
+    std::vector<VnLexiName> result;
+    // a null-terminated input is read two bytes at a time, past the end of
+    // an empty one
+    int inLen = std::strlen(word);
+    if (inLen == 0) {
+        return result;
+    }
+    StdVnChar chars[64];
+    int outLen = sizeof(chars);
+    VnConvert(CONV_CHARSET_UNIUTF8, CONV_CHARSET_VNSTANDARD,
+              reinterpret_cast<UKBYTE *>(const_cast<char *>(word)),
+              reinterpret_cast<UKBYTE *>(chars), &inLen, &outLen);
+    for (int i = 0; i < outLen / static_cast<int>(sizeof(StdVnChar)) &&
+                    chars[i];
+         i++) {
+        if (chars[i] >= VnStdCharOffset) {
+            result.push_back(
+                static_cast<VnLexiName>((chars[i] - VnStdCharOffset) | 1));
+        }
+    }
+    return result;
+}
+
+// the words suggested for a typed prefix, best first
+std::vector<std::string> suggest(const UkLexicon &lexicon, const char *prefix,
+                                 int maxCount = 8) {
+    std::vector<VnLexiName> typed = letters(prefix);
+    int node = UkLexicon::Root;
+    for (VnLexiName letter : typed) {
+        node = lexicon.step(node, letter);
+    }
+    std::vector<UkLexiconMatch> matches(maxCount);
+    int count = lexicon.complete(node, typed.data(), typed.size(),
+                                 matches.data(), maxCount);
+    std::vector<std::string> result;
+    for (int i = 0; i < count; i++) {
+        result.emplace_back(matches[i].text, matches[i].textLen);
+    }
+    return result;
+}
+
+const char wordList[] = "# most frequent first\n"
+                        "không\n"
+                        "khi\n"
+                        "khó\n"
+                        "khoa học\n"
+                        "khoảng\n"
+                        "việt nam\n"
+                        "\n"
+                        "đường\n"
+                        "được\n";
+
+const char *const prefixes[] = {"", "k", "kh", "kho", "khô", "vi", "d",
+                                "đư", "x"};
+
+void expectSuggestions(const UkLexicon &lexicon, const char *prefix,
+                       const std::vector<std::string> &expected,
+                       int maxCount = 8) {
+    auto actual = suggest(lexicon, prefix, maxCount);
+    std::string got;
+    for (const auto &word : actual) {
+        got += " \"" + word + "\"";
+    }
+    FCITX_ASSERT(actual == expected)
+        << "\"" << prefix << "\" suggests" << (got.empty() ? " nothing" : got);
+}
+
+// Words typed with the letters only, no marks: random and long, so that
+// they share little of their paths.
+std::string randomWords(int count, int length) {
+    const char letters[] = "abcdeghiklmnopqrstuvxy";
+    uint32_t seed = 1;
+    std::string text;
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < length; j++) {
+            seed = seed * 1103515245 + 12345;
+            text += letters[(seed >> 16) % (sizeof(letters) - 1)];
+        }
+        text += '\n';
+    }
+    return text;
+}
+
+bool sameSuggestions(const UkLexicon &expected, const UkLexicon &actual) {
+    if (expected.getCount() != actual.getCount()) {
+        return false;
+    }
+    for (const char *prefix : prefixes) {
+        if (suggest(expected, prefix) != suggest(actual, prefix)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    TestDir dir("testlexicon");
+    const std::string file = dir.file("words.txt");
+    const std::string cacheName = file + ".bin";
+    FCITX_ASSERT(writeFile(file, wordList));
+
+    UkLexicon parsed;
+    FCITX_ASSERT(parsed.loadFromFile(file.c_str()));
+    FCITX_ASSERT(parsed.getCount() == 8) << parsed.getCount();
+    // no cache without useCache
+    FCITX_ASSERT(access(cacheName.c_str(), F_OK) != 0);
+
+    // in the order of the list, whatever the marks
+    expectSuggestions(parsed, "kh",
+                      {"không", "khi", "khó", "khoa học", "khoảng"});
+    expectSuggestions(parsed, "kh", {"không", "khi"}, 2);
+    expectSuggestions(parsed, "kho", {"không", "khó", "khoa học", "khoảng"});
+    expectSuggestions(parsed, "khoa", {"khoa học", "khoảng"});
+    expectSuggestions(parsed, "vietn", {"việt nam"});
+    expectSuggestions(parsed, "d", {"đường", "được"});
+    expectSuggestions(parsed, "x", {});
+    // a typed mark or tone has to be there
+    expectSuggestions(parsed, "khô", {"không"});
+    expectSuggestions(parsed, "khó", {"khó"});
+    expectSuggestions(parsed, "khò", {});
+    expectSuggestions(parsed, "khoả", {"khoảng"});
+    expectSuggestions(parsed, "khoá", {});
+    expectSuggestions(parsed, "đ", {"đường", "được"});
+    expectSuggestions(parsed, "đươ", {"đường", "được"});
+    expectSuggestions(parsed, "đượ", {"được"});
+    expectSuggestions(parsed, "vie", {"việt nam"});
+    expectSuggestions(parsed, "viê", {"việt nam"});
+    expectSuggestions(parsed, "viế", {});
+
+    // Each of these words takes nodes of its own to reach, more of them
+    // than a query looks at.
+    {
+        const std::string many = dir.file("many.txt");
+        std::string text = randomWords(2000, 8);
+        FCITX_ASSERT(writeFile(many, text));
+        UkLexicon lexicon;
+        FCITX_ASSERT(lexicon.loadFromFile(many.c_str()) &&
+                     lexicon.getCount() == 2000);
+        // visits are bounded
+        auto words = suggest(lexicon, "", 200);
+        FCITX_ASSERT(!words.empty() && words.size() < 200) << words.size();
+        // what is found is still the best of the list, in rank order
+        FCITX_ASSERT(words[0] == text.substr(0, 8)) << words[0];
+        size_t line = 0;
+        for (const auto &word : words) {
+            size_t at = text.find(word + "\n", line);
+            FCITX_ASSERT(at != std::string::npos && at % 9 == 0) << word;
+            line = at + 9;
+        }
+    }
+
+    // the list is compiled by the first load and mapped by the second,
+    // which leaves the file as it is
+    UkLexicon compiled;
+    FCITX_ASSERT(compiled.loadFromFile(file.c_str(), true) &&
+                 sameSuggestions(parsed, compiled));
+    ino_t written = fileInode(cacheName);
+    FCITX_ASSERT(written != 0);
+    // readable by whoever can read the list
+    struct stat src, cache;
+    FCITX_ASSERT(stat(file.c_str(), &src) == 0 &&
+                 stat(cacheName.c_str(), &cache) == 0);
+    FCITX_ASSERT((cache.st_mode & 0777) == (src.st_mode & 0666))
+        << std::oct << cache.st_mode;
+    UkLexicon mapped;
+    FCITX_ASSERT(mapped.loadFromFile(file.c_str(), true) &&
+                 sameSuggestions(parsed, mapped));
+    FCITX_ASSERT(fileInode(cacheName) == written);
+
+    Cache good;
+    good.bytes = readFile(cacheName);
+    FCITX_ASSERT(good.bytes.size() > sizeof(CacheHeader));
+
+    auto corrupt = [&](const char *what,
+                       const std::function<void(Cache &)> &f) {
+        Cache cache = good;
+        f(cache);
+        FCITX_ASSERT(writeFile(cacheName, cache.bytes)) << what;
+        UkLexicon lexicon;
+        FCITX_ASSERT(lexicon.loadFromFile(file.c_str(), true)) << what;
+        FCITX_ASSERT(sameSuggestions(parsed, lexicon)) << what;
+        // only a list parsed from the text writes its copy
+        FCITX_ASSERT(readFile(cacheName) == good.bytes) << what;
+    };
+
+    corrupt("children past the nodes", [](Cache &c) {
+        c.nodes()[0].firstChild = c.header()->nodeCount;
+    });
+    corrupt("too many children", [](Cache &c) {
+        c.nodes()[0].childCount = UINT16_MAX;
+    });
+    corrupt("child before its parent", [](Cache &c) {
+        for (uint32_t n = 1; n < c.header()->nodeCount; n++) {
+            if (c.nodes()[n].childCount > 0) {
+                c.nodes()[n].firstChild = n;
+                break;
+            }
+        }
+    });
+    corrupt("words past the words", [](Cache &c) {
+        for (uint32_t n = 0; n < c.header()->nodeCount; n++) {
+            if (c.nodes()[n].wordCount > 0) {
+                c.nodes()[n].firstWord = c.header()->wordCount;
+                break;
+            }
+        }
+    });
+    corrupt("text past the text", [](Cache &c) {
+        c.words()[0].text = c.header()->textSize - 1;
+    });
+    corrupt("letters past the letters", [](Cache &c) {
+        c.words()[0].letters = c.header()->letterCount;
+    });
+    corrupt("letter out of range", [](Cache &c) {
+        c.letters()[0] = TOTAL_ALPHA_VNCHARS;
+    });
+    corrupt("negative letter", [](Cache &c) {
+        c.letters()[c.header()->letterCount - 1] = -1;
+    });
+
+    // a copy kept elsewhere, e.g. for a list in a read-only directory
+    const std::string elsewhere = dir.file("elsewhere.bin");
+    unlink(cacheName.c_str());
+    UkLexicon moved;
+    FCITX_ASSERT(moved.loadFromFile(file.c_str(), true, elsewhere.c_str()) &&
+                 sameSuggestions(parsed, moved));
+    written = fileInode(elsewhere);
+    FCITX_ASSERT(written != 0 && fileInode(cacheName) == 0);
+    UkLexicon movedMapped;
+    FCITX_ASSERT(
+        movedMapped.loadFromFile(file.c_str(), true, elsewhere.c_str()) &&
+        sameSuggestions(parsed, movedMapped));
+    FCITX_ASSERT(fileInode(elsewhere) == written);
+
+    return 0;
+}
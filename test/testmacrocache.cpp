@@ -0,0 +1,187 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks that a compiled macro file whose offsets or trie do not hold
+// together is not mapped, and that the table is parsed from the text
+// instead.
+
+#include "mactab.h"
+#include "testfiles.h"
+#include "vnconv.h"
+
+#include <fcitx-utils/log.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+using namespace testfiles;
+
+namespace {
+
+// the layout of the file, see mactab.cpp
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    int64_t srcSize;
+    int64_t srcMtimeSec;
+    int64_t srcMtimeNsec;
+    uint32_t memSize;
+    uint32_t nodeCount;
+    uint32_t edgeCount;
+};
+
+struct Cache {
+    std::string bytes;
+
+    CacheHeader *header() {
+        return reinterpret_cast<CacheHeader *>(bytes.data());
+    }
+    MacroDef *table() {
+        return reinterpret_cast<MacroDef *>(bytes.data() +
+                                            sizeof(CacheHeader));
+    }
+    StdVnChar *mem() {
+        return reinterpret_cast<StdVnChar *>(table() + header()->count);
+    }
+    MacroTrieNode *nodes() {
+        return reinterpret_cast<MacroTrieNode *>(
+            reinterpret_cast<char *>(mem()) + header()->memSize);
+    }
+    MacroTrieEdge *edges() {
+        return reinterpret_cast<MacroTrieEdge *>(nodes() +
+                                                 header()->nodeCount);
+    }
+};
+
+bool sameText(const StdVnChar *a, const StdVnChar *b) {
+    if (!a || !b) {
+        return a == b;
+    }
+    for (; *a && *a == *b; a++, b++) {
+    }
+    return *a == *b;
+}
+
+// the same keys and texts, and the same lookups through the index
+bool sameTable(const CMacroTable &expected, CMacroTable &actual) {
+    if (expected.getCount() != actual.getCount()) {
+        return false;
+    }
+    for (int i = 0; i < expected.getCount(); i++) {
+        if (!sameText(expected.getKey(i), actual.getKey(i)) ||
+            !sameText(expected.getText(i), actual.getText(i))) {
+            return false;
+        }
+        StdVnChar key[MAX_MACRO_KEY_LEN];
+        const StdVnChar *k = expected.getKey(i);
+        int len = 0;
+        for (; k[len]; len++) {
+            key[len] = k[len];
+        }
+        key[len] = 0;
+        if (!sameText(actual.lookup(key), expected.getText(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    CMacroTable source;
+    source.init();
+    source.addItem("kg", "không gì", CONV_CHARSET_UNIUTF8);
+    source.addItem("hn", "Hà Nội", CONV_CHARSET_UNIUTF8);
+    source.addItem("vn", "Việt Nam", CONV_CHARSET_UNIUTF8);
+    source.addItem("hcm", "Hồ Chí Minh", CONV_CHARSET_UNIUTF8);
+    source.buildIndex();
+
+    TestDir dir("testmacrocache");
+    const std::string file = dir.file("macro");
+    const std::string cacheName = file + ".bin";
+    FCITX_ASSERT(source.writeToFile(file.c_str()));
+
+    // the first load parses the text, the second maps the cache
+    CMacroTable parsed;
+    FCITX_ASSERT(parsed.loadFromFile(file.c_str(), true) &&
+                 !parsed.isMapped());
+    CMacroTable mapped;
+    FCITX_ASSERT(mapped.loadFromFile(file.c_str(), true) &&
+                 mapped.isMapped());
+    FCITX_ASSERT(sameTable(parsed, mapped));
+
+    Cache good;
+    good.bytes = readFile(cacheName);
+    FCITX_ASSERT(good.bytes.size() > sizeof(CacheHeader));
+
+    auto corrupt = [&](const char *what,
+                       const std::function<void(Cache &)> &f) {
+        Cache cache = good;
+        f(cache);
+        FCITX_ASSERT(writeFile(cacheName, cache.bytes)) << what;
+        CMacroTable table;
+        FCITX_ASSERT(table.loadFromFile(file.c_str(), true)) << what;
+        FCITX_ASSERT(!table.isMapped()) << what;
+        FCITX_ASSERT(sameTable(parsed, table)) << what;
+        // and the text wrote a good copy again
+        CMacroTable again;
+        FCITX_ASSERT(again.loadFromFile(file.c_str(), true) &&
+                     again.isMapped())
+            << what;
+    };
+
+    corrupt("key past the memory", [](Cache &c) {
+        c.table()[0].keyOffset = c.header()->memSize;
+    });
+    corrupt("negative text", [](Cache &c) { c.table()[1].textOffset = -4; });
+    corrupt("unaligned key", [](Cache &c) { c.table()[2].keyOffset += 1; });
+    corrupt("unterminated memory", [](Cache &c) {
+        size_t n = c.header()->memSize / sizeof(StdVnChar);
+        for (size_t i = 0; i < n; i++) {
+            if (c.mem()[i] == 0) {
+                c.mem()[i] = 'a';
+            }
+        }
+    });
+    corrupt("key too long", [](Cache &c) {
+        // the terminators of the first strings, so the first key runs on
+        size_t n = c.header()->memSize / sizeof(StdVnChar);
+        for (size_t i = 0, found = 0; i < n && found < 4; i++) {
+            if (c.mem()[i] == 0) {
+                c.mem()[i] = 'a';
+                found++;
+            }
+        }
+    });
+    corrupt("node text past the memory", [](Cache &c) {
+        for (uint32_t n = 0; n + 1 < c.header()->nodeCount; n++) {
+            if (c.nodes()[n].textOffset >= 0) {
+                c.nodes()[n].textOffset = c.header()->memSize + 64;
+                break;
+            }
+        }
+    });
+    corrupt("edges past the end", [](Cache &c) {
+        c.nodes()[1].firstEdge = c.header()->edgeCount + 5;
+    });
+    corrupt("decreasing edges", [](Cache &c) {
+        c.nodes()[c.header()->nodeCount - 2].firstEdge = 0;
+    });
+    corrupt("short sentinel", [](Cache &c) {
+        c.nodes()[c.header()->nodeCount - 1].firstEdge--;
+    });
+    corrupt("child past the nodes", [](Cache &c) {
+        c.edges()[0].child = c.header()->nodeCount - 1;
+    });
+    corrupt("child back to the root", [](Cache &c) {
+        c.edges()[c.header()->edgeCount - 1].child = 0;
+    });
+
+    return 0;
+}
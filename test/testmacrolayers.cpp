@@ -0,0 +1,99 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks that the user's macros are layered over the system ones: a key of
+// the user's table wins, the system table gives the keys it lacks, with the
+// system table built in memory or mapped from its compiled file.
+
+#include "keycons.h"
+#include "mactab.h"
+#include "ukengine.h"
+#include "unikeyinputcontext.h"
+#include "testfiles.h"
+#include "vnconv.h"
+
+#include <fcitx-utils/log.h>
+
+#include <memory>
+#include <string>
+
+using namespace testfiles;
+
+namespace {
+
+// The text written at the last key of keys, a macro expansion followed by
+// the space.
+std::string type(UnikeyInputMethod &im, const char *keys) {
+    UkEngine engine;
+    engine.setCtrlInfo(im.sharedMem());
+    unsigned char buf[MAX_UK_OUTPUT];
+    int size = 0;
+    for (const char *p = keys; *p; p++) {
+        int backs = 0;
+        size = sizeof(buf);
+        UkOutputType type = UkCharOutput;
+        if (!engine.process(static_cast<unsigned char>(*p), backs, buf, size,
+                            type)) {
+            size = 0;
+        }
+    }
+    return std::string(reinterpret_cast<char *>(buf), size);
+}
+
+void check(const std::shared_ptr<const CMacroTable> &user,
+           const std::shared_ptr<const CMacroTable> &system,
+           const char *what) {
+    UnikeyInputMethod im;
+    UnikeyOptions options = im.sharedMem()->options;
+    options.macroEnabled = 1;
+    im.setOptions(&options);
+    im.setSystemMacroTable(system);
+    im.setMacroTable(user);
+
+    // small keys give small texts
+    FCITX_ASSERT(type(im, "kg ") == "không gì ") << what;
+    FCITX_ASSERT(type(im, "vn ") == "việt nam ") << what;
+    // the user's key over the system one, also after others
+    FCITX_ASSERT(type(im, "hn ") == "hà nội ") << what;
+    FCITX_ASSERT(type(im, "kg vn hn ") == "hà nội ") << what;
+    FCITX_ASSERT(type(im, "VN ") == "VIỆT NAM ") << what;
+    // without the user's, the system table alone
+    im.setMacroTable(nullptr);
+    FCITX_ASSERT(type(im, "hn ") == "hồ chí minh ") << what;
+    FCITX_ASSERT(type(im, "kg ").empty()) << what;
+    im.unloadMacroTable();
+    FCITX_ASSERT(type(im, "vn ").empty()) << what;
+}
+
+} // namespace
+
+int main() {
+    auto user = std::make_shared<CMacroTable>();
+    user->init();
+    user->addItem("kg", "không gì", CONV_CHARSET_UNIUTF8);
+    user->addItem("hn", "Hà Nội", CONV_CHARSET_UNIUTF8);
+    user->buildIndex();
+
+    auto system = std::make_shared<CMacroTable>();
+    system->init();
+    system->addItem("vn", "Việt Nam", CONV_CHARSET_UNIUTF8);
+    system->addItem("hn", "Hồ Chí Minh", CONV_CHARSET_UNIUTF8);
+    system->buildIndex();
+    check(user, system, "in memory");
+
+    // the same system table through its compiled file
+    TestDir dir("testmacrolayers");
+    std::string file = dir.file("macro");
+    FCITX_ASSERT(system->writeToFile(file.c_str()));
+    auto compiled = std::make_shared<CMacroTable>();
+    FCITX_ASSERT(compiled->loadFromFile(file.c_str(), true));
+    auto mapped = std::make_shared<CMacroTable>();
+    FCITX_ASSERT(mapped->loadFromFile(file.c_str(), true) &&
+                 mapped->isMapped());
+    check(user, mapped, "mapped");
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks that a macro hit copying the pre-rendered text gives the same output
+// as one converting the macro text on the hit.
+//
+// Both engines share the macro table, one of them without the rendering. They
+// type the macro keys in small letters, capitals and mixed case, after a word
+// break and at the start, for each output charset, and again after the
+// charset changed under the same table: first with the rendering for the old
+// charset still in place, which must not be used, then with one handed over
+// like the addon does from its worker.
+
+#include "charset.h"
+#include "keycons.h"
+#include "mactab.h"
+#include "ukengine.h"
+#include "unikeyinputcontext.h"
+#include "vnconv.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace {
+
+const char *const macros[][2] = {
+    {"kg", "không gì"},
+    {"vn", "Việt Nam"},
+    {"dc", "được"},
+    {"ng", "người Đà Nẵng"},
+    {"x", "xin chào, ĐẠI HỌC"},
+};
+
+const char *const lines[] = {
+    "kg vn dc ng x ",
+    "Kg Vn Dc Ng X ",
+    "KG VN DC NG X.",
+    "kG vN aa kg,vn;dc\nng\tx ",
+};
+
+struct Output {
+    int ret;
+    int backs;
+    int size;
+    UkOutputType type;
+    unsigned char buf[MAX_UK_OUTPUT];
+};
+
+void typeKey(UkEngine &engine, char key, Output &out) {
+    out.size = sizeof(out.buf);
+    out.backs = 0;
+    out.type = UkCharOutput;
+    out.ret = engine.process(static_cast<unsigned char>(key), out.backs,
+                             out.buf, out.size, out.type);
+}
+
+bool sameOutput(const Output &a, const Output &b) {
+    return a.ret == b.ret && a.backs == b.backs && a.size == b.size &&
+           a.type == b.type && std::memcmp(a.buf, b.buf, a.size) == 0;
+}
+
+} // namespace
+
+int main() {
+    auto table = std::make_shared<CMacroTable>();
+    table->init();
+    for (const auto &macro : macros) {
+        table->addItem(macro[0], macro[1], CONV_CHARSET_UNIUTF8);
+    }
+    table->buildIndex();
+
+    const int charsets[] = {CONV_CHARSET_XUTF8, CONV_CHARSET_TCVN3,
+                            CONV_CHARSET_VIQR, CONV_CHARSET_UNIREF,
+                            CONV_CHARSET_VNIWIN};
+
+    int failures = 0;
+    unsigned long hits = 0;
+    for (int charset : charsets) {
+        for (int changed = 0; changed < 2; changed++) {
+            UnikeyInputMethod rendered, converted;
+            for (auto *im : {&rendered, &converted}) {
+                im->setInputMethod(UkTelex);
+                im->setOutputCharset(changed ? CONV_CHARSET_VIQR : charset);
+                UnikeyOptions options = im->sharedMem()->options;
+                options.macroEnabled = 1;
+                im->setOptions(&options);
+                im->setMacroTable(table);
+            }
+            rendered.renderMacros();
+            if (changed) {
+                // the VIQR rendering stays until the new one comes
+                rendered.setOutputCharset(charset);
+                converted.setOutputCharset(charset);
+            }
+
+            UkEngine renderedEngine, convertedEngine;
+            renderedEngine.setCtrlInfo(rendered.sharedMem());
+            convertedEngine.setCtrlInfo(converted.sharedMem());
+            auto typeLines = [&](const char *stage) {
+                Output expected, actual;
+                for (const char *line : lines) {
+                    for (size_t i = 0; line[i]; i++) {
+                        typeKey(convertedEngine, line[i], expected);
+                        typeKey(renderedEngine, line[i], actual);
+                        if (!sameOutput(expected, actual) && failures++ < 10) {
+                            std::fprintf(stderr,
+                                         "FAIL charset=%d %s at %zu of %s\n",
+                                         charset, stage, i, line);
+                        }
+                    }
+                    renderedEngine.reset();
+                    convertedEngine.reset();
+                }
+            };
+            if (changed) {
+                typeLines("old rendering");
+                rendered.setMacroRendering(
+                    std::make_shared<CMacroRendering>(table, charset));
+            }
+            if (!rendered.sharedMem()->macRendering ||
+                rendered.sharedMem()->macRendering->charset() != charset) {
+                std::fprintf(stderr, "FAIL charset=%d not rendered\n",
+                             charset);
+                failures++;
+                continue;
+            }
+            typeLines(changed ? "new rendering" : "rendered");
+            hits += rendered.sharedMem()->stats.macroHits;
+        }
+    }
+
+    if (hits == 0) {
+        std::fprintf(stderr, "FAIL no macro was hit\n");
+        failures++;
+    }
+    if (failures) {
+        return 1;
+    }
+    std::printf("ok, %lu macro hits\n", hits);
+    return 0;
+}
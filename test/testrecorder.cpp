@@ -0,0 +1,233 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks that a recording reads back as written and keeps only the word
+// before the cursor of the surrounding text, and that the typed keys with the
+// recording's substitution give the same output, substituted, in the engine.
+
+#include "unikey-recorder.h"
+
+#include "inputproc.h"
+#include "keycons.h"
+#include "unikeyinputcontext.h"
+#include "vnconv.h"
+
+#include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/log.h>
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+void testMask() {
+    std::string out;
+    unikeyMaskSurroundingText("Xin chào bạn", 8, out);
+    FCITX_ASSERT(out == "    chào    ") << out;
+    // The cursor in the middle of a word keeps the part before it.
+    unikeyMaskSurroundingText("Xin chào bạn", 6, out);
+    FCITX_ASSERT(out == "    ch      ") << out;
+    // After a space, nothing is kept.
+    unikeyMaskSurroundingText("một hai", 4, out);
+    FCITX_ASSERT(out == "       ") << out;
+    unikeyMaskSurroundingText("", 0, out);
+    FCITX_ASSERT(out.empty());
+    // Only the end of a run longer than the rebuild takes.
+    const std::string run(40, 'a');
+    unikeyMaskSurroundingText(run, 40, out);
+    FCITX_ASSERT(out == std::string(8, ' ') + std::string(32, 'a')) << out;
+}
+
+// The output of keys, as UTF-8, a space ending the word.
+std::string typeKeys(UnikeyInputMethod &im, const std::string &keys) {
+    UnikeyInputContext uic(&im);
+    std::string text;
+    auto erase = [&text](int count) {
+        while (count-- > 0 && !text.empty()) {
+            do {
+                text.pop_back();
+            } while (!text.empty() &&
+                     (static_cast<unsigned char>(text.back()) & 0xC0) == 0x80);
+        }
+    };
+    for (char key : keys) {
+        if (key == '\b') {
+            uic.backspacePress();
+        } else {
+            uic.filter(static_cast<unsigned char>(key));
+        }
+        auto out = uic.output();
+        if (out.size > 0 || out.backspaces > 0) {
+            erase(out.backspaces);
+            text.append(reinterpret_cast<const char *>(out.data), out.size);
+        } else if (key == '\b') {
+            erase(1);
+        } else {
+            text += key;
+        }
+        if (key == ' ') {
+            uic.resetBuf();
+        }
+    }
+    return text;
+}
+
+void testSubstitution() {
+    const UkInputMethod ims[] = {UkTelex, UkVni,          UkSimpleTelex,
+                                 UkViqr,  UkSimpleTelex2, UkMsVi};
+    const std::string words[] = {
+        "xin chaof banj, vieetj nam laf mootj quoocs gia ddepj ",
+        "xin cha2o ba5n, vie65t nam la2 mo65t quo61c gia d9e5p ",
+        "Bos Vowj laxng lowps 12 hocj sinh, sos 0912 345 678 ",
+        "fijx ljb sbvx Xuaan Lan Baor Vaan ",
+    };
+    const char keyChars[] = "aeiouywsfrxjzd0123456789bcghklmnpqtvBLSVX \b";
+    std::mt19937 rng(1);
+    UnikeyKeySubstitution substitution;
+
+    for (auto method : ims) {
+        for (int options = 0; options < 4; options++) {
+            UnikeyInputMethod im;
+            im.setInputMethod(method);
+            im.setOutputCharset(CONV_CHARSET_XUTF8);
+            UnikeyOptions ukopt;
+            CreateDefaultUnikeyOptions(&ukopt);
+            ukopt.spellCheckEnabled = options & 1;
+            ukopt.autoNonVnRestore = options >> 1;
+            im.setOptions(&ukopt);
+            int keyMap[256];
+            im.sharedMem()->input.getKeyMap(keyMap);
+
+            for (int run = 0; run < 200; run++) {
+                substitution.shuffle(keyMap, rng);
+                for (int c = 0; c < 128; c++) {
+                    // keys of the input method and vowels stay
+                    FCITX_ASSERT(keyMap[c] == vneNormal ||
+                                 substitution.sym(c) == static_cast<uint32_t>(c));
+                    FCITX_ASSERT(std::string("aeiouyAEIOUY").find(c) ==
+                                     std::string::npos ||
+                                 substitution.sym(c) == static_cast<uint32_t>(c));
+                }
+                std::string keys;
+                if (run < 4) {
+                    keys = words[run];
+                } else {
+                    for (int i = 0; i < 60; i++) {
+                        keys += keyChars[rng() % (sizeof(keyChars) - 1)];
+                    }
+                }
+                std::string substituted = keys;
+                substitution.apply(substituted);
+                auto expected = typeKeys(im, keys);
+                substitution.apply(expected);
+                auto actual = typeKeys(im, substituted);
+                FCITX_ASSERT(actual == expected)
+                    << method << " " << options << " " << keys << ": "
+                    << actual << " " << expected;
+            }
+        }
+    }
+}
+
+void testConfig() {
+    RawConfig config;
+    config.setValueByPath("InputMethod", "Telex");
+    config.setValueByPath("Macro", "False");
+    config.setValueByPath("Group/Value", "a=b\\c\nd");
+    auto str = unikeyConfigToString(config);
+
+    RawConfig read;
+    unikeyConfigFromString(str, read);
+    FCITX_ASSERT(*read.valueByPath("InputMethod") == "Telex");
+    FCITX_ASSERT(*read.valueByPath("Macro") == "False");
+    FCITX_ASSERT(*read.valueByPath("Group/Value") == "a=b\\c\nd");
+}
+
+void testRoundTrip() {
+    std::vector<UnikeyRecord> records(5);
+    records[0].type = UnikeyRecordType::Context;
+    records[0].context = 1;
+    records[0].text = "firefox";
+    records[0].flags = 1ULL << 40 | 3;
+    records[1].type = UnikeyRecordType::Config;
+    records[1].text = "InputMethod=VNI\n";
+    records[2].type = UnikeyRecordType::Surrounding;
+    records[2].context = 1;
+    records[2].delayUs = 12345;
+    records[2].valid = true;
+    records[2].cursor = 4;
+    records[2].anchor = 2;
+    records[2].text = "    chào";
+    records[3].type = UnikeyRecordType::Key;
+    records[3].context = 1;
+    records[3].sym = 0xff08;
+    records[3].states = 1;
+    records[3].release = true;
+    records[4].type = UnikeyRecordType::Reset;
+    records[4].context = 1;
+    records[4].event = 7;
+
+    const char *path = "testrecorder.rec";
+    {
+        FILE *file = std::fopen(path, "wb");
+        FCITX_ASSERT(file);
+        UnikeyRecordWriter writer(file);
+        for (const auto &record : records) {
+            writer.write(record);
+        }
+    }
+
+    FILE *file = std::fopen(path, "rb");
+    FCITX_ASSERT(file);
+    UnikeyRecordReader reader(file);
+    FCITX_ASSERT(reader.valid());
+    UnikeyRecord record;
+    for (const auto &expected : records) {
+        FCITX_ASSERT(reader.next(record));
+        FCITX_ASSERT(record.type == expected.type);
+        FCITX_ASSERT(record.context == expected.context);
+        FCITX_ASSERT(record.delayUs == expected.delayUs);
+        switch (expected.type) {
+        case UnikeyRecordType::Context:
+            FCITX_ASSERT(record.text == expected.text);
+            FCITX_ASSERT(record.flags == expected.flags);
+            break;
+        case UnikeyRecordType::Config:
+            FCITX_ASSERT(record.text == expected.text);
+            break;
+        case UnikeyRecordType::Surrounding:
+            FCITX_ASSERT(record.valid == expected.valid);
+            FCITX_ASSERT(record.cursor == expected.cursor);
+            FCITX_ASSERT(record.anchor == expected.anchor);
+            FCITX_ASSERT(record.text == expected.text);
+            break;
+        case UnikeyRecordType::Key:
+            FCITX_ASSERT(record.sym == expected.sym);
+            FCITX_ASSERT(record.states == expected.states);
+            FCITX_ASSERT(record.release == expected.release);
+            break;
+        case UnikeyRecordType::Reset:
+            FCITX_ASSERT(record.event == expected.event);
+            break;
+        }
+    }
+    FCITX_ASSERT(!reader.next(record));
+    std::remove(path);
+}
+
+} // namespace
+
+int main() {
+    testMask();
+    testSubstitution();
+    testConfig();
+    testRoundTrip();
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks that the per-key cost does not grow with the input.
+//
+// The engine scans backward over its buffer in several places
+// (getSeqSteps, macroMatch, lastWordIsNonVn, lastWordHasVnMark) and compacts
+// it in prepareBuffer. Each pattern below is typed as one run, without
+// resetting the engine, in a short and a 32 times longer version. The
+// average cost of a key must stay within maxGrowth of the short run's: a
+// scan or a compaction that is linear in what was typed makes it grow with
+// the length instead.
+//
+// Times are the best of a few runs, so that a busy machine does not fail it.
+
+#include "keycons.h"
+#include "mactab.h"
+#include "unikeyinputcontext.h"
+#include "vnconv.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+namespace {
+
+constexpr size_t shortRun = 4096;
+constexpr size_t longRun = shortRun * 32;
+constexpr int tries = 5;
+constexpr double maxGrowth = 3.0;
+
+struct Pattern {
+    const char *name;
+    UkInputMethod im;
+    int charset;
+    const char *unit; // repeated up to the run length, '\b' is a backspace
+};
+
+const Pattern patterns[] = {
+    // one word that never ends: compactions cut it, the scans to the word
+    // start run over the whole buffer
+    {"non-breaking run", UkTelex, CONV_CHARSET_XUTF8,
+     "thuowngnghieengkhuyur"},
+    {"non-breaking run (VIQR out)", UkTelex, CONV_CHARSET_VIQR,
+     "thuowngnghieengkhuyur"},
+    {"non-breaking run (TCVN3 out)", UkTelex, CONV_CHARSET_TCVN3,
+     "truwowngf"},
+    // every key changes or takes back the tone of the same letter
+    {"repeated tone keys", UkTelex, CONV_CHARSET_XUTF8, "as"},
+    {"repeated tone keys (VNI)", UkVni, CONV_CHARSET_TCVN3, "a1"},
+    // the roof/hook of a vowel sequence flips back and forth
+    {"alternating roof and hook", UkTelex, CONV_CHARSET_XUTF8, "uowoowwo"},
+    {"alternating roof and hook (VNI)", UkVni, CONV_CHARSET_VIQR,
+     "uo76uo67"},
+    // runs that match macro keys up to their full length, then a break
+    {"macro prefix runs", UkTelex, CONV_CHARSET_XUTF8,
+     "kgkgkgkgkgkgkgkgkgkgkgkgkgkgkgkg kgkgkgkgkgkgkgk "},
+    {"macro prefix runs (VIQR out)", UkTelex, CONV_CHARSET_VIQR,
+     "kgkgkgkgkgkgkgkgkgkgkgkgkgkgkgkg kgkgkgkgkgkgkgk "},
+    // long runs of backspaces after each of them
+    {"backspace runs", UkTelex, CONV_CHARSET_XUTF8,
+     "nguwowif\b\b\b\b\b\b\b\b\b\b"},
+};
+
+std::shared_ptr<const CMacroTable> makeMacros() {
+    auto macros = std::make_shared<CMacroTable>();
+    macros->init();
+    // every prefix of the longest key, so the whole matching loop runs
+    std::string key;
+    while (key.size() + 2 < MAX_MACRO_KEY_LEN) {
+        key += "kg";
+        macros->addItem(key.c_str(), "không gì", CONV_CHARSET_UNIUTF8);
+    }
+    macros->buildIndex();
+    return macros;
+}
+
+std::string makeKeys(const char *unit, size_t count) {
+    std::string keys;
+    keys.reserve(count);
+    while (keys.size() < count) {
+        keys += unit;
+    }
+    keys.resize(count);
+    return keys;
+}
+
+// Average cost of a key in ns, typing keys in one run, the best of tries.
+double costPerKey(const Pattern &pattern, const std::string &keys,
+                  const std::shared_ptr<const CMacroTable> &macros) {
+    UnikeyInputMethod im;
+    im.setInputMethod(pattern.im);
+    im.setOutputCharset(pattern.charset);
+    UnikeyOptions options;
+    CreateDefaultUnikeyOptions(&options);
+    options.macroEnabled = 1;
+    options.spellCheckEnabled = 1;
+    options.autoNonVnRestore = 1;
+    im.setOptions(&options);
+    im.setMacroTable(macros);
+
+    double best = 0;
+    for (int i = 0; i < tries; i++) {
+        UnikeyInputContext uic(&im);
+        auto start = std::chrono::steady_clock::now();
+        for (char key : keys) {
+            if (key == '\b') {
+                uic.backspacePress();
+            } else {
+                uic.filter(static_cast<unsigned char>(key));
+            }
+        }
+        double ns = std::chrono::duration<double, std::nano>(
+                        std::chrono::steady_clock::now() - start)
+                        .count() /
+                    keys.size();
+        best = i == 0 ? ns : std::min(best, ns);
+    }
+    return best;
+}
+
+} // namespace
+
+int main() {
+    auto macros = makeMacros();
+
+    bool ok = true;
+    for (const auto &pattern : patterns) {
+        // warm up the lazily built tables before the short run is timed
+        costPerKey(pattern, makeKeys(pattern.unit, shortRun), macros);
+        double small =
+            costPerKey(pattern, makeKeys(pattern.unit, shortRun), macros);
+        double large =
+            costPerKey(pattern, makeKeys(pattern.unit, longRun), macros);
+        double growth = large / std::max(small, 1.0);
+        bool good = growth <= maxGrowth;
+        std::printf("%s %-32s %7.1f ns/key at %zu keys, %7.1f at %zu, "
+                    "x%.2f\n",
+                    good ? "ok  " : "FAIL", pattern.name, small, shortRun,
+                    large, longRun, growth);
+        ok = good && ok;
+    }
+    return ok ? 0 : 1;
+}
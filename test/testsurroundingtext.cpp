@@ -21,6 +21,8 @@
 #include <fcitx/instance.h>
 
 #include <iostream>
+#include <string>
+#include <utility>
 
 
 using namespace fcitx;
@@ -50,7 +52,7 @@ void printCases() {
     std::cout << "  8: ModifySurroundingText with cursor==0 should not crash\n";
     std::cout << "  9: Single failure should NOT mark surrounding unreliable\n";
     std::cout << " 10: Multiple consecutive failures should mark as unreliable\n";
-    std::cout << " 11: Focus change (reset) clears unreliable state\n";
+    std::cout << " 11: Focus change (reset) keeps the unreliable state\n";
     std::cout << " 12: Consecutive successes recover from unreliable\n";
     std::cout << " 13: ModifySurroundingText with Vietnamese text present\n";
     std::cout << " 14: ImmediateCommit takes precedence over ModifySurroundingText\n";
@@ -62,6 +64,8 @@ void printCases() {
     std::cout << " 20: Backspace clears immediate word history\n";
     std::cout << " 21: ModifySurroundingText rebuilds preedit when cursor moves back\n";
     std::cout << " 22: Control characters (newline, tab) are rejected from rebuild\n";
+    std::cout << " 23: Rebuild from what was committed while the snapshot lags behind\n";
+    std::cout << " 24: Unnamed clients do not share the unreliable state\n";
 }
 
 void announceCase(int id) {
@@ -104,6 +108,17 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
         // Switch to Unikey.
         testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("Control+space"), false);
 
+        // A context of its own, for the cases that leave their app marked as
+        // giving bad surrounding text.
+        auto createContext = [testfrontend, instance](const std::string &program) {
+            auto uuid = testfrontend->call<ITestFrontend::createInputContext>(program);
+            auto *ic = instance->inputContextManager().findByUUID(uuid);
+            FCITX_ASSERT(ic);
+            ic->setCapabilityFlags(CapabilityFlag::SurroundingText);
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("Control+space"), false);
+            return std::make_pair(uuid, ic);
+        };
+
         // Base config: deterministic behavior.
         RawConfig base;
         base.setValueByPath("SpellCheck", "False");
@@ -126,7 +141,8 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             ic->surroundingText().setText("nga", 3, 3);
             ic->updateSurroundingText();
 
-            testfrontend->call<ITestFrontend::pushCommitExpectation>("ngả");
+            // Only the changed tail is replaced: "a" -> "ả".
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("ả");
             // VNI: 3 = hỏi (ả).
             testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("3"), false);
         }
@@ -144,7 +160,7 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             ic->surroundingText().setText("ngả", 3, 3);
             ic->updateSurroundingText();
 
-            testfrontend->call<ITestFrontend::pushCommitExpectation>("ngá");
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("á");
             // VNI: 1 = sắc (á).
             testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("1"), false);
         }
@@ -179,7 +195,8 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             ic->surroundingText().setText("ấ", 1, 1);
             ic->updateSurroundingText();
 
-            testfrontend->call<ITestFrontend::pushCommitExpectation>("ấ ");
+            // "ấ" is already there, only the space is sent.
+            testfrontend->call<ITestFrontend::pushCommitExpectation>(" ");
             testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("space"), false);
         }
 
@@ -259,7 +276,7 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             ic->surroundingText().setText("qua", 3, 3);
             ic->updateSurroundingText();
 
-            testfrontend->call<ITestFrontend::pushCommitExpectation>("quá");
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("á");
             testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("1"), false);
         }
 
@@ -346,68 +363,82 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             cfg.setValueByPath("ModifySurroundingText", "False");
             configureUnikey(unikey, cfg);
 
-            ic->reset();
-            ic->surroundingText().setText("", 0, 0);
-            ic->updateSurroundingText();
+            // The app stays marked, keep it away from the other cases.
+            auto [caseUuid, caseIc] = createContext("testapp-case10");
+            caseIc->reset();
+            caseIc->surroundingText().setText("", 0, 0);
+            caseIc->updateSurroundingText();
 
             // First commit - starts with empty surrounding.
             testfrontend->call<ITestFrontend::pushCommitExpectation>("t");
-            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("t"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("t"), false);
 
             // Keep surrounding empty (failure 1).
             testfrontend->call<ITestFrontend::pushCommitExpectation>("to");
-            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("o"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("o"), false);
 
             // Still empty (failure 2 - threshold reached).
             testfrontend->call<ITestFrontend::pushCommitExpectation>("toi");
-            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("i"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("i"), false);
 
             // After threshold, the system should be in unreliable mode and
             // fall back to preedit. We need to press space to commit in preedit.
             // NOTE: Once in preedit mode, keystrokes don't immediately commit.
             // The 's' key will be added to preedit (building "tois" internally),
             // then we need Return or space to commit.
-            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("s"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("s"), false);
             testfrontend->call<ITestFrontend::pushCommitExpectation>("s");
-            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("Return"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("Return"), false);
+            testfrontend->call<ITestFrontend::destroyInputContext>(caseUuid);
         }
 
-        // --- Case 11: Focus change (reset) should clear unreliable state ---
-        // After an InputContextReset, the unreliable flag should be cleared,
-        // giving the new context a fresh start.
+        // --- Case 11: Focus change (reset) keeps the unreliable state ---
+        // Clients reset on every click, so after an InputContextReset the
+        // context starts from what is known of its app: still in preedit
+        // mode, only probing the surrounding text.
         if (shouldRunCase(selCopy, 11)) {
             announceCase(11);
-            FCITX_INFO() << "testsurroundingtext: Case 11 - Focus change (reset) clears unreliable state";
+            FCITX_INFO() << "testsurroundingtext: Case 11 - Focus change (reset) keeps the unreliable state";
             RawConfig cfg = base;
             cfg.setValueByPath("ImmediateCommit", "True");
             cfg.setValueByPath("ModifySurroundingText", "False");
             configureUnikey(unikey, cfg);
 
+            auto [caseUuid, caseIc] = createContext("testapp-case11");
             // First, trigger unreliable state by consecutive failures.
-            ic->reset();
-            ic->surroundingText().setText("", 0, 0);
-            ic->updateSurroundingText();
+            caseIc->reset();
+            caseIc->surroundingText().setText("", 0, 0);
+            caseIc->updateSurroundingText();
 
             testfrontend->call<ITestFrontend::pushCommitExpectation>("x");
-            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("x"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("x"), false);
 
             testfrontend->call<ITestFrontend::pushCommitExpectation>("xy");
-            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("y"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("y"), false);
 
             testfrontend->call<ITestFrontend::pushCommitExpectation>("xyz");
-            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("z"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("z"), false);
 
             // Now simulate focus change (triggers InputContextReset).
-            // This internally calls clearImmediateCommitHistory() which should
-            // reset surroundingTextUnreliable_.
-            ic->reset();
-
-            // With valid surrounding text, immediate commit should work again.
-            ic->surroundingText().setText("qua", 3, 3);
-            ic->updateSurroundingText();
-
-            testfrontend->call<ITestFrontend::pushCommitExpectation>("quá");
-            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("1"), false);
+            caseIc->reset();
+            caseIc->surroundingText().setText("qua", 3, 3);
+            caseIc->updateSurroundingText();
+
+            // Still preedit: nothing is committed before Return.
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("b"), false);
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("b");
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("Return"), false);
+
+            // A new context of the same app starts in preedit mode too.
+            auto [otherUuid, otherIc] = createContext("testapp-case11");
+            otherIc->surroundingText().setText("qua", 3, 3);
+            otherIc->updateSurroundingText();
+            testfrontend->call<ITestFrontend::keyEvent>(otherUuid, Key("b"), false);
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("b");
+            testfrontend->call<ITestFrontend::keyEvent>(otherUuid, Key("Return"), false);
+
+            testfrontend->call<ITestFrontend::destroyInputContext>(otherUuid);
+            testfrontend->call<ITestFrontend::destroyInputContext>(caseUuid);
         }
 
         // --- Case 12: Consecutive successes should recover from unreliable ---
@@ -465,7 +496,7 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             ic->surroundingText().setText("nga", 3, 3);
             ic->updateSurroundingText();
 
-            testfrontend->call<ITestFrontend::pushCommitExpectation>("ngả");
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("ả");
             testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("3"), false);
         }
 
@@ -559,8 +590,7 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             ic->updateSurroundingText();
 
             // Add tone - should rebuild and work correctly
-            testfrontend->call<ITestFrontend::pushCommitExpectation>(
-                "nghiên");
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("ên");
             // VNI: 6 adds circumflex to 'e'
             testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("6"), false);
         }
@@ -581,7 +611,7 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             ic->updateSurroundingText();
 
             // Add tone to "toi" -> "tôi"
-            testfrontend->call<ITestFrontend::pushCommitExpectation>("tôi");
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("ôi");
             testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("6"), false);
         }
 
@@ -650,7 +680,7 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             ic->updateSurroundingText();
 
             // Type 'b'
-            testfrontend->call<ITestFrontend::pushCommitExpectation>("ab");
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("b");
             testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("b"), false);
 
             // Now backspace
@@ -731,6 +761,66 @@ void scheduleEvent(EventDispatcher *dispatcher, Instance *instance,
             testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("a"), false);
         }
 
+        // --- Case 23: The client confirmed it sends updates, but its snapshot
+        // has not caught up with the last commits yet ---
+        if (shouldRunCase(selCopy, 23)) {
+            announceCase(23);
+            FCITX_INFO() << "testsurroundingtext: Case 23 - Rebuild from committed text ahead of a lagging snapshot";
+            RawConfig cfg = base;
+            cfg.setValueByPath("ImmediateCommit", "True");
+            cfg.setValueByPath("ModifySurroundingText", "False");
+            configureUnikey(unikey, cfg);
+
+            ic->reset();
+            ic->surroundingText().setText("", 0, 0);
+            ic->updateSurroundingText();
+
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("t");
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("t"), false);
+            ic->surroundingText().setText("t", 1, 1);
+            ic->updateSurroundingText();
+
+            // From here on the snapshot stays at "t".
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("o");
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("o"), false);
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("i");
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("i"), false);
+            // Only the word "toi" we committed can place the tone on 'o'.
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("ói");
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("1"), false);
+        }
+
+        // --- Case 24: Clients without a program name learn nothing for
+        // each other ---
+        if (shouldRunCase(selCopy, 24)) {
+            announceCase(24);
+            FCITX_INFO() << "testsurroundingtext: Case 24 - Unnamed clients do not share the unreliable state";
+            RawConfig cfg = base;
+            cfg.setValueByPath("ImmediateCommit", "True");
+            cfg.setValueByPath("ModifySurroundingText", "False");
+            configureUnikey(unikey, cfg);
+
+            auto [caseUuid, caseIc] = createContext("");
+            caseIc->surroundingText().setText("", 0, 0);
+            caseIc->updateSurroundingText();
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("t");
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("t"), false);
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("to");
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("o"), false);
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("toi");
+            testfrontend->call<ITestFrontend::keyEvent>(caseUuid, Key("i"), false);
+
+            // Another unnamed client still commits right away.
+            auto [otherUuid, otherIc] = createContext("");
+            otherIc->surroundingText().setText("nga", 3, 3);
+            otherIc->updateSurroundingText();
+            testfrontend->call<ITestFrontend::pushCommitExpectation>("ả");
+            testfrontend->call<ITestFrontend::keyEvent>(otherUuid, Key("3"), false);
+
+            testfrontend->call<ITestFrontend::destroyInputContext>(otherUuid);
+            testfrontend->call<ITestFrontend::destroyInputContext>(caseUuid);
+        }
+
         instance->deactivate();
         dispatcher->schedule([dispatcher, instance]() {
             dispatcher->detach();
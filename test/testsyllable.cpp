@@ -0,0 +1,162 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks the spell check of existing text: which words are valid and where
+// the tone goes, in both tone styles, from UTF-8 and from StdVnChar text.
+
+#include "charset.h"
+#include "ukengine.h"
+#include "vnconv.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *what, const std::string &text) {
+    if (!ok) {
+        std::fprintf(stderr, "FAIL %s: %s\n", what, text.c_str());
+        failures++;
+    }
+}
+
+// One word: is it valid, and the letter its tone should be on under the old
+// and the modern style (-1 without a tone).
+struct Case {
+    const char *word;
+    bool valid;
+    int oldPos;
+    int modernPos;
+};
+
+const Case cases[] = {
+    {"a", true, -1, -1},
+    {"tối", true, 1, 1},
+    {"người", true, 3, 3},
+    {"nghiêng", true, -1, -1},
+    {"nghiệp", true, 4, 4},
+    {"hòa", true, 1, 2},
+    {"hoà", true, 1, 2},
+    {"hoàn", true, 2, 2},
+    {"thủy", true, 2, 3},
+    {"quý", true, 2, 2},
+    {"qúy", true, 2, 2},
+    {"già", true, 2, 2},
+    {"gì", true, 1, 1},
+    {"giếng", true, 2, 2},
+    {"khuya", true, -1, -1},
+    {"Việt", true, 2, 2},
+    {"ĐƯỜNG", true, 2, 2},
+    // not syllables
+    {"thuong", false, -1, -1},
+    {"cas", false, -1, -1},
+    {"kan", false, -1, -1},
+    {"qu", false, -1, -1},
+    {"ng", false, -1, -1},
+    {"hello", false, -1, -1},
+    {"nghiêngg", false, -1, -1},
+    // c, ch, p, t only take sắc and nặng
+    {"các", true, 1, 1},
+    {"cạc", true, 1, 1},
+    {"càc", false, -1, -1},
+    {"thểp", false, -1, -1},
+    // two tones
+    {"tóí", false, -1, -1},
+};
+
+void testWords() {
+    for (const auto &c : cases) {
+        UkSyllable old[2], modern[2];
+        int len = std::strlen(c.word);
+        int n = UkCheckSyllablesUtf8(c.word, len, false, old, 2);
+        check(n == 1, "one word", c.word);
+        check(UkCheckSyllablesUtf8(c.word, len, true, modern, 2) == n,
+              "same words in both styles", c.word);
+        if (n != 1) {
+            continue;
+        }
+        check(old[0].start == 0 && old[0].len == len, "word bounds", c.word);
+        check(old[0].valid == c.valid, "validity", c.word);
+        if (c.valid) {
+            check(old[0].normTonePos == c.oldPos, "old style tone", c.word);
+            check(modern[0].normTonePos == c.modernPos, "modern style tone",
+                  c.word);
+        }
+    }
+
+    // the tone as written is reported too
+    UkSyllable s;
+    UkCheckSyllablesUtf8("hoà", std::strlen("hoà"), false, &s, 1);
+    check(s.tone == 2 && s.tonePos == 2 && s.normTonePos == 1,
+          "tone as written", "hoà");
+}
+
+void testSplit() {
+    const std::string text = "Xin chào, thế giới 123 ok-la!";
+    const char *words[] = {"Xin", "chào", "thế", "giới", "ok", "la"};
+    UkSyllable out[8];
+    int n = UkCheckSyllablesUtf8(text.data(), text.size(), false, out, 8);
+    check(n == 6, "word count", text);
+    for (int i = 0; i < n && i < 6; i++) {
+        check(text.compare(out[i].start, out[i].len, words[i]) == 0,
+              "word bounds", words[i]);
+    }
+
+    // a full output stops the check, the next call goes on after it
+    n = UkCheckSyllablesUtf8(text.data(), text.size(), false, out, 2);
+    check(n == 2, "stops when full", text);
+    int next = out[1].start + out[1].len;
+    n = UkCheckSyllablesUtf8(text.data() + next, text.size() - next, false,
+                             out, 8);
+    check(n == 4 && text.compare(next + out[0].start, out[0].len, "thế") == 0,
+          "goes on", text);
+
+    // broken UTF-8 only breaks words
+    const char broken[] = "ch\xE1\xBA u h\xF0\x9F\x98\x80oa";
+    n = UkCheckSyllablesUtf8(broken, sizeof(broken) - 1, false, out, 8);
+    check(n == 4, "broken UTF-8", broken);
+}
+
+void testStdVnChar() {
+    const std::string text = "Tiếng Việt, thuong";
+    std::vector<StdVnChar> chars(text.size() + 1);
+    int inLen = -1;
+    int outLen = chars.size() * sizeof(StdVnChar);
+    check(VnConvert(CONV_CHARSET_UNIUTF8, CONV_CHARSET_VNSTANDARD,
+                    (UKBYTE *)text.c_str(), (UKBYTE *)chars.data(), &inLen,
+                    &outLen) == 0,
+          "convert", text);
+    // the terminating null is converted too
+    int count = outLen / sizeof(StdVnChar) - 1;
+
+    UkSyllable out[4];
+    int n = UkCheckSyllables(chars.data(), count, true, out, 4);
+    check(n == 3, "word count", text);
+    check(n == 3 && out[0].start == 0 && out[0].len == 5 && out[0].valid &&
+              out[0].normTonePos == 2,
+          "Tiếng", text);
+    check(n == 3 && out[1].start == 6 && out[1].len == 4 && out[1].valid,
+          "Việt", text);
+    check(n == 3 && !out[2].valid, "thuong", text);
+}
+
+} // namespace
+
+int main() {
+    testWords();
+    testSplit();
+    testStdVnChar();
+    if (failures) {
+        return 1;
+    }
+    std::printf("ok\n");
+    return 0;
+}
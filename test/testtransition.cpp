@@ -0,0 +1,162 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks that an engine replaying keys from the transition table gives the
+// same output as one running the rules for every key.
+//
+// Both engines type the same text, sentences and random key runs with
+// backspaces, key restores and caps changes, twice so that the second pass
+// is mostly replayed, for each input method, output charset and spelling
+// option.
+
+#include "keycons.h"
+#include "ukengine.h"
+#include "unikeyinputcontext.h"
+#include "vnconv.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// replayed as UkEngine::processBackspace() and restoreKeyStrokes()
+constexpr char backspaceKey = '\b';
+constexpr char restoreKey = '\x01';
+
+const char *const sentences[] = {
+    "Tieesng Vieejt laf ngoon nguwx chinhs thuwcs cuar Vieejt Nam.",
+    "Nguoiwf\b\b\bwowif Vieejt Namm\b ddaxx vaf ddang xaay duwngj.",
+    "Tie61ng Vie65t la2 ngo6n ngu74 chi1nh thu71c cu3a Vie65t Nam.",
+    "Ho^m nay tro+`i dde.p, chu'ng to^i ddi da.o quanh ho^` Gu+o+m",
+    "thuowr thuwowr khuyur quyeets giuwx gif\x01 HOAF hoaf HUWOWNGF uw w ww",
+};
+
+std::vector<std::string> makeText() {
+    std::vector<std::string> text(std::begin(sentences), std::end(sentences));
+    std::mt19937 rng(39);
+    const char keys[] = "aaaeeiioouuyydddwwsfrxjqngchktpmlvbzAEOUDW123456789"
+                        "^(+'`?~.[]{}";
+    std::string line;
+    for (int i = 0; i < 3000; i++) {
+        int len = 1 + rng() % 8;
+        for (int j = 0; j < len; j++)
+            line += keys[rng() % (sizeof(keys) - 1)];
+        if (rng() % 5 == 0)
+            line += backspaceKey;
+        if (rng() % 17 == 0)
+            line += restoreKey;
+        line += ' ';
+    }
+    text.push_back(line);
+    return text;
+}
+
+struct Output {
+    int ret;
+    int backs;
+    int size;
+    UkOutputType type;
+    unsigned char buf[1024];
+};
+
+void typeKey(UkEngine &engine, char key, Output &out) {
+    out.size = sizeof(out.buf);
+    out.backs = 0;
+    out.type = UkCharOutput;
+    if (key == backspaceKey) {
+        out.ret =
+            engine.processBackspace(out.backs, out.buf, out.size, out.type);
+    } else if (key == restoreKey) {
+        out.ret =
+            engine.restoreKeyStrokes(out.backs, out.buf, out.size, out.type);
+    } else {
+        out.ret = engine.process(static_cast<unsigned char>(key), out.backs,
+                                 out.buf, out.size, out.type);
+    }
+}
+
+bool sameOutput(const Output &a, const Output &b) {
+    return a.ret == b.ret && a.backs == b.backs && a.size == b.size &&
+           a.type == b.type && std::memcmp(a.buf, b.buf, a.size) == 0;
+}
+
+} // namespace
+
+int main() {
+    const UkInputMethod inputMethods[] = {UkTelex, UkVni, UkViqr,
+                                          UkSimpleTelex2};
+    const int charsets[] = {CONV_CHARSET_XUTF8, CONV_CHARSET_TCVN3,
+                            CONV_CHARSET_VIQR, CONV_CHARSET_UNIREF};
+    const auto text = makeText();
+
+    int failures = 0;
+    unsigned long hits = 0;
+    for (auto inputMethod : inputMethods) {
+        for (int charset : charsets) {
+            for (int opt = 0; opt < 8; opt++) {
+                UnikeyInputMethod rules, table;
+                for (auto *im : {&rules, &table}) {
+                    im->setInputMethod(inputMethod);
+                    im->setOutputCharset(charset);
+                    UnikeyOptions options = im->sharedMem()->options;
+                    options.spellCheckEnabled = opt & 1;
+                    options.autoNonVnRestore = opt & 1;
+                    options.freeMarking = (opt >> 1) & 1;
+                    options.modernStyle = (opt >> 2) & 1;
+                    im->setOptions(&options);
+                }
+                table.setTransitionCache(true);
+
+                int shiftPressed = 0;
+                int capsLockOn = 0;
+                auto caps = [&](int *shift, int *capsLock) {
+                    *shift = shiftPressed;
+                    *capsLock = capsLockOn;
+                };
+                UkEngine ruleEngine, tableEngine;
+                ruleEngine.setCtrlInfo(rules.sharedMem());
+                tableEngine.setCtrlInfo(table.sharedMem());
+                ruleEngine.setCheckKbCaseFunc(caps);
+                tableEngine.setCheckKbCaseFunc(caps);
+
+                Output expected, actual;
+                for (int pass = 0; pass < 2; pass++) {
+                    for (const auto &line : text) {
+                        for (size_t i = 0; i < line.size(); i++) {
+                            capsLockOn = i % 97 == 0;
+                            typeKey(ruleEngine, line[i], expected);
+                            typeKey(tableEngine, line[i], actual);
+                            if (!sameOutput(expected, actual) &&
+                                failures++ < 10) {
+                                std::fprintf(stderr,
+                                             "FAIL im=%d charset=%d opt=%d "
+                                             "pass=%d at %zu of %s\n",
+                                             inputMethod, charset, opt, pass,
+                                             i, line.c_str());
+                            }
+                        }
+                        ruleEngine.reset();
+                        tableEngine.reset();
+                    }
+                }
+                hits += table.sharedMem()->stats.transitionHits;
+            }
+        }
+    }
+
+    if (hits == 0) {
+        std::fprintf(stderr, "FAIL no key was replayed\n");
+        failures++;
+    }
+    if (failures) {
+        return 1;
+    }
+    std::printf("ok, %lu keys replayed\n", hits);
+    return 0;
+}
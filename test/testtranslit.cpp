@@ -0,0 +1,169 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks that UkTransliterate on several threads gives, byte for byte, what
+// one UkTransliterator gives for the whole input: with short lines, where
+// the pieces are cut at new lines, and with lines too long for that, where
+// they are cut at spaces. Each input is big enough for every thread count
+// below to cut it, and goes through several input methods and options.
+
+#include "mactab.h"
+#include "testfiles.h"
+#include "translit.h"
+#include "vnconv.h"
+#include "wordset.h"
+
+#include <fcitx-utils/log.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+using namespace testfiles;
+
+namespace {
+
+// pieces are at least this big, see translit.cpp
+constexpr size_t minChunk = 256 << 10;
+constexpr unsigned int threadCounts[] = {2, 3, 8};
+constexpr size_t inputSize = minChunk * 8 + 64;
+
+struct Words {
+    const char *name;
+    UkInputMethod im;
+    const char *const *words;
+    size_t count;
+};
+
+// words, macro keys, English words and marks typed after the word
+const char *const telexWords[] = {
+    "Tieengs", "Vieetj", "nguwowif", "dduowcj", "thuowngr", "kg",
+    "hn",      "window", "HELLO",    "ddax",    "truwowngf", "aw",
+    "uow",     "tooi",   "xin",      "chaof",   "z",         "w",
+    "Tiếng",   "12,",    "(nhaf)",   "ok.",     "viet",      "jj"};
+const char *const vniWords[] = {
+    "Tie61ng", "Vie65t",  "ngu7o72i", "d9u7o75c", "thu7o7ng3", "kg",
+    "hn",      "window",  "HELLO",    "d9a4",     "tru7o7ng2", "a8",
+    "uo7",     "to6i",    "xin",      "cha2o",    "0",         "7",
+    "Tiếng",   "12,",     "(nha2)",   "ok.",      "viet",      "55"};
+
+const Words wordSets[] = {
+    {"telex", UkTelex, telexWords, sizeof(telexWords) / sizeof(*telexWords)},
+    {"vni", UkVni, vniWords, sizeof(vniWords) / sizeof(*vniWords)},
+};
+
+uint32_t nextRandom(uint32_t &seed) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// Words separated by spaces, sometimes by tabs; a new line every few
+// words, or never with longLines.
+std::string typedText(const Words &words, bool longLines) {
+    uint32_t seed = 7;
+    std::string text;
+    text.reserve(inputSize + 64);
+    int lineWords = 0;
+    while (text.size() < inputSize) {
+        text += words.words[nextRandom(seed) % words.count];
+        uint32_t r = nextRandom(seed) % 64;
+        if (!longLines && ++lineWords > 3 && r < 8) {
+            text += '\n';
+            lineWords = 0;
+        } else if (r == 63) {
+            text += '\t';
+        } else {
+            text += ' ';
+        }
+    }
+    return text;
+}
+
+struct Options {
+    const char *name;
+    int spellCheck;
+    int freeMarking;
+    int macro;
+    int restore;
+};
+
+const Options optionSets[] = {
+    {"defaults", -1, -1, -1, -1},
+    {"no spell check, macro", 0, 0, 1, 0},
+    {"restore, macro", 1, 1, 1, 1},
+};
+
+void check(const UkTranslitSettings &settings, const std::string &keys,
+           const std::string &what) {
+    std::string expected = "kept ";
+    UkTransliterator translit(settings);
+    translit.convert(keys.data(), keys.size(), expected);
+
+    for (unsigned int threads : threadCounts) {
+        std::string actual = "kept ";
+        UkTransliterate(settings, keys.data(), keys.size(), actual, threads);
+        size_t at = 0;
+        while (at < actual.size() && at < expected.size() &&
+               actual[at] == expected[at]) {
+            at++;
+        }
+        FCITX_ASSERT(actual == expected)
+            << what << ", " << threads << " threads: differs at byte " << at
+            << " of " << expected.size();
+    }
+}
+
+} // namespace
+
+int main() {
+    auto macros = std::make_shared<CMacroTable>();
+    macros->init();
+    macros->addItem("kg", "không gì", CONV_CHARSET_UNIUTF8);
+    macros->addItem("hn", "Hà Nội", CONV_CHARSET_UNIUTF8);
+    macros->buildIndex();
+
+    auto restoreWords = std::make_shared<UkWordSet>();
+    {
+        TestDir dir("testtranslit");
+        const std::string wordFile = dir.file("words.txt");
+        FCITX_ASSERT(writeFile(wordFile, "window\nhello\nok\n"));
+        FCITX_ASSERT(restoreWords->loadFromFile(wordFile.c_str()));
+    }
+
+    for (const auto &words : wordSets) {
+        for (bool longLines : {false, true}) {
+            std::string keys = typedText(words, longLines);
+            for (const auto &options : optionSets) {
+                UkTranslitSettings settings;
+                settings.im = words.im;
+                if (options.spellCheck >= 0) {
+                    settings.options.spellCheckEnabled = options.spellCheck;
+                    settings.options.freeMarking = options.freeMarking;
+                    settings.options.macroEnabled = options.macro;
+                    settings.options.autoNonVnRestore = options.restore;
+                }
+                if (options.macro > 0) {
+                    settings.macStore = macros;
+                }
+                if (options.restore > 0) {
+                    settings.restoreWords = restoreWords;
+                }
+                check(settings, keys,
+                      std::string(words.name) +
+                          (longLines ? ", long lines, " : ", short lines, ") +
+                          options.name);
+            }
+        }
+    }
+
+    // short inputs stay on one piece
+    UkTranslitSettings settings;
+    std::string out;
+    UkTransliterate(settings, "Tieengs Vieetj", 14, out, 8);
+    FCITX_ASSERT(out == "Tiếng Việt") << out;
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Checks the set of words kept as typed: every word of the file is found
+// whatever its case, words that are not in it are not, even the ones that
+// get past the bloom filter, and a set mapped from its compiled file, or
+// parsed again after the file changed, answers the same.
+
+#include "testfiles.h"
+#include "wordset.h"
+
+#include <fcitx-utils/log.h>
+
+#include <cctype>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace testfiles;
+
+namespace {
+
+bool contains(const UkWordSet &set, const std::string &word) {
+    return set.contains(word.data(), word.size());
+}
+
+// lower case ASCII words, uint32_t keeps the sequence the same everywhere
+std::vector<std::string> randomWords(int count, uint32_t seed) {
+    std::vector<std::string> words;
+    for (int i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        int len = 3 + (seed >> 16) % 8;
+        std::string word;
+        for (int j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            word += static_cast<char>('a' + (seed >> 16) % 26);
+        }
+        words.push_back(word);
+    }
+    return words;
+}
+
+const char *const fixedWords[] = {"email", "Facebook", "git", "OK",
+                                  "windows", "x"};
+
+// words are all in the set, others none of them
+void checkSet(const UkWordSet &set, const std::vector<std::string> &words,
+              const std::vector<std::string> &others, const char *what) {
+    for (const auto &word : words) {
+        FCITX_ASSERT(contains(set, word)) << what << ": " << word;
+    }
+    for (const auto &word : others) {
+        FCITX_ASSERT(!contains(set, word)) << what << ": " << word;
+    }
+
+    // case is ignored both ways
+    FCITX_ASSERT(contains(set, "EMAIL") && contains(set, "facebook") &&
+                 contains(set, "Git") && contains(set, "ok") &&
+                 contains(set, "X"))
+        << what;
+    // not null-terminated: only len chars count
+    FCITX_ASSERT(set.contains("gitlab", 3) && !set.contains("gitlab", 6))
+        << what;
+    // skipped lines
+    FCITX_ASSERT(!contains(set, "") &&
+                 !contains(set, "# words left as typed") &&
+                 !contains(set, std::string(UK_WORDSET_MAX_WORD + 1, 'a')))
+        << what;
+    FCITX_ASSERT(!contains(set, "không") && !contains(set, "vieetj")) << what;
+}
+
+} // namespace
+
+int main() {
+    TestDir dir("testwordset");
+    const std::string file = dir.file("words.txt");
+    const std::string cacheName = file + ".bin";
+
+    std::vector<std::string> words = randomWords(5000, 1);
+    for (const char *word : fixedWords) {
+        words.push_back(word);
+    }
+    // words of another seed, minus the few that happen to be in the set
+    std::set<std::string> lower;
+    for (auto word : words) {
+        for (char &c : word) {
+            c = std::tolower(static_cast<unsigned char>(c));
+        }
+        lower.insert(word);
+    }
+    std::vector<std::string> others;
+    for (const auto &word : randomWords(20000, 2)) {
+        if (!lower.count(word)) {
+            others.push_back(word);
+        }
+    }
+
+    std::string text = "# words left as typed\n\n";
+    for (const auto &word : words) {
+        text += word + "\n";
+    }
+    // duplicates, trailing spaces and a word too long to keep
+    text += "git\nGIT  \r\n";
+    text += std::string(UK_WORDSET_MAX_WORD + 1, 'a') + "\n";
+    FCITX_ASSERT(writeFile(file, text));
+
+    UkWordSet parsed;
+    FCITX_ASSERT(parsed.loadFromFile(file.c_str()));
+    // duplicates counted once
+    int count = parsed.getCount();
+    FCITX_ASSERT(count > 4900 && count <= static_cast<int>(words.size()))
+        << count;
+    // no cache without useCache
+    FCITX_ASSERT(access(cacheName.c_str(), F_OK) != 0);
+    checkSet(parsed, words, others, "parsed");
+
+    // the first load compiles the set, the second maps it as it is
+    UkWordSet compiled;
+    FCITX_ASSERT(compiled.loadFromFile(file.c_str(), true));
+    ino_t written = fileInode(cacheName);
+    FCITX_ASSERT(written != 0);
+    // readable by whoever can read the list
+    struct stat src, cache;
+    FCITX_ASSERT(stat(file.c_str(), &src) == 0 &&
+                 stat(cacheName.c_str(), &cache) == 0);
+    FCITX_ASSERT((cache.st_mode & 0777) == (src.st_mode & 0666))
+        << std::oct << cache.st_mode;
+    UkWordSet mapped;
+    FCITX_ASSERT(mapped.loadFromFile(file.c_str(), true) &&
+                 mapped.getCount() == count);
+    FCITX_ASSERT(fileInode(cacheName) == written);
+    checkSet(mapped, words, others, "mapped");
+
+    // a cut copy is ignored and written again
+    FCITX_ASSERT(truncate(cacheName.c_str(), 100) == 0);
+    UkWordSet truncated;
+    FCITX_ASSERT(truncated.loadFromFile(file.c_str(), true) &&
+                 truncated.getCount() == count);
+    checkSet(truncated, words, others, "truncated cache");
+
+    // a changed file makes the copy stale
+    FCITX_ASSERT(writeFile(file, "tiktok\n"));
+    UkWordSet changed;
+    FCITX_ASSERT(changed.loadFromFile(file.c_str(), true) &&
+                 changed.getCount() == 1);
+    FCITX_ASSERT(contains(changed, "TikTok") && !contains(changed, "git"));
+    // and is written again
+    UkWordSet remapped;
+    FCITX_ASSERT(remapped.loadFromFile(file.c_str(), true) &&
+                 contains(remapped, "tiktok") && !contains(remapped, "email"));
+
+    // a copy kept elsewhere, e.g. for a list in a read-only directory
+    const std::string elsewhere = dir.file("elsewhere.bin");
+    unlink(cacheName.c_str());
+    UkWordSet moved;
+    FCITX_ASSERT(moved.loadFromFile(file.c_str(), true, elsewhere.c_str()) &&
+                 contains(moved, "tiktok"));
+    written = fileInode(elsewhere);
+    FCITX_ASSERT(written != 0 && fileInode(cacheName) == 0);
+    UkWordSet movedMapped;
+    FCITX_ASSERT(
+        movedMapped.loadFromFile(file.c_str(), true, elsewhere.c_str()) &&
+        contains(movedMapped, "tiktok"));
+    FCITX_ASSERT(fileInode(elsewhere) == written);
+
+    unlink(file.c_str());
+    UkWordSet missing;
+    FCITX_ASSERT(!missing.loadFromFile(file.c_str(), true));
+
+    return 0;
+}
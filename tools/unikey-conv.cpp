@@ -0,0 +1,292 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Command line charset converter built on the unikey conversion library.
+//
+// Usage: unikey-conv -f FROM -t TO [options] [FILE...]
+//
+// Without FILE, stdin is converted to stdout (or to -o). Several files are
+// converted by a pool of worker threads, into -d DIR or in place with -i.
+
+#include "vnconv.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Job {
+    std::string input;  // empty for stdin
+    std::string output; // empty for stdout
+    int result = 0;
+    long long bytes = 0;
+    double seconds = 0;
+};
+
+void usage(FILE *out) {
+    std::fprintf(out,
+                 "Usage: unikey-conv -f FROM -t TO [options] [FILE...]\n"
+                 "\n"
+                 "Convert Vietnamese text between charsets.\n"
+                 "\n"
+                 "  -f, --from CHARSET    charset of the input\n"
+                 "  -t, --to CHARSET      charset of the output\n"
+                 "  -o, --output FILE     output file (one input only)\n"
+                 "  -d, --output-dir DIR  write each FILE to DIR/<name>\n"
+                 "  -i, --in-place        overwrite each FILE\n"
+                 "  -j, --jobs N          files converted at the same time\n"
+                 "                        (default: number of cores)\n"
+                 "  -l, --lower           convert to lower case\n"
+                 "  -u, --upper           convert to upper case\n"
+                 "  -r, --remove-tone     remove tone marks\n"
+                 "  -q, --quiet           don't report throughput\n"
+                 "      --list            list charset names\n"
+                 "  -h, --help            show this help\n");
+}
+
+void listCharsets() {
+    for (int i = 0; i < CharsetCount; i++) {
+        std::printf("%s\n", CharsetIdMap[i].name);
+    }
+}
+
+// Accepts a name from CharsetIdMap or a numeric CONV_CHARSET_* id.
+int parseCharset(const char *arg) {
+    int id = VnConvCharsetId(arg);
+    if (id >= 0) {
+        return id;
+    }
+    char *end;
+    long num = std::strtol(arg, &end, 10);
+    if (*arg && !*end) {
+        return static_cast<int>(num);
+    }
+    return -1;
+}
+
+std::string baseName(const std::string &path) {
+    auto slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+long long fileSize(const std::string &path) {
+    struct stat st;
+    if (path.empty() || stat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    return st.st_size;
+}
+
+double mbPerSec(long long bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    enum { OptList = 256 };
+    const option longOptions[] = {
+        {"from", required_argument, nullptr, 'f'},
+        {"to", required_argument, nullptr, 't'},
+        {"output", required_argument, nullptr, 'o'},
+        {"output-dir", required_argument, nullptr, 'd'},
+        {"in-place", no_argument, nullptr, 'i'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"lower", no_argument, nullptr, 'l'},
+        {"upper", no_argument, nullptr, 'u'},
+        {"remove-tone", no_argument, nullptr, 'r'},
+        {"quiet", no_argument, nullptr, 'q'},
+        {"list", no_argument, nullptr, OptList},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int from = -1;
+    int to = -1;
+    std::string output;
+    std::string outputDir;
+    bool inPlace = false;
+    int jobs = 0;
+    bool quiet = false;
+    VnConvOptions options;
+    VnConvResetOptions(&options);
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:t:o:d:ij:lurqh", longOptions,
+                              nullptr)) != -1) {
+        switch (opt) {
+        case 'f':
+        case 't': {
+            int id = parseCharset(optarg);
+            if (id < 0) {
+                std::fprintf(stderr, "unikey-conv: unknown charset %s\n",
+                             optarg);
+                return 1;
+            }
+            (opt == 'f' ? from : to) = id;
+            break;
+        }
+        case 'o':
+            output = optarg;
+            break;
+        case 'd':
+            outputDir = optarg;
+            break;
+        case 'i':
+            inPlace = true;
+            break;
+        case 'j':
+            jobs = std::max(1, std::atoi(optarg));
+            break;
+        case 'l':
+            options.toLower = 1;
+            break;
+        case 'u':
+            options.toUpper = 1;
+            break;
+        case 'r':
+            options.removeTone = 1;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case OptList:
+            listCharsets();
+            return 0;
+        case 'h':
+            usage(stdout);
+            return 0;
+        default:
+            usage(stderr);
+            return 1;
+        }
+    }
+
+    if (from < 0 || to < 0) {
+        usage(stderr);
+        return 1;
+    }
+
+    std::vector<Job> queue;
+    int inputs = argc - optind;
+    if (inputs == 0) {
+        if (inPlace || !outputDir.empty()) {
+            std::fprintf(stderr, "unikey-conv: -i and -d need input files\n");
+            return 1;
+        }
+        queue.emplace_back();
+        queue.back().output = output;
+    } else {
+        if (!output.empty() && inputs > 1) {
+            std::fprintf(stderr, "unikey-conv: -o takes a single input\n");
+            return 1;
+        }
+        if (inputs > 1 && !inPlace && outputDir.empty()) {
+            std::fprintf(stderr,
+                         "unikey-conv: use -d or -i with several files\n");
+            return 1;
+        }
+        for (int i = optind; i < argc; i++) {
+            Job job;
+            job.input = argv[i];
+            if (inPlace) {
+                job.output = job.input;
+            } else if (!outputDir.empty()) {
+                job.output = outputDir + "/" + baseName(job.input);
+            } else {
+                job.output = output;
+            }
+            queue.push_back(std::move(job));
+        }
+    }
+
+    VnConvSetOptions(&options);
+
+    // Only charsets with a block kernel are stateless, the others share one
+    // charset object with conversion state: convert one file at a time.
+    int inLen = 0, outLen = 0;
+    UKBYTE dummy;
+    int probe =
+        VnConvertBlock(from, to, &dummy, &dummy, &inLen, &outLen, 1);
+    if (probe == VNCONV_INVALID_CHARSET &&
+        VnConvert(from, to, &dummy, &dummy, &inLen, &outLen) ==
+            VNCONV_INVALID_CHARSET) {
+        std::fprintf(stderr, "unikey-conv: invalid charset\n");
+        return 1;
+    }
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    if (jobs == 0) {
+        jobs = cores;
+    }
+    if (probe == VNCONV_INVALID_CHARSET) {
+        jobs = 1;
+    }
+    jobs = std::min<int>(jobs, queue.size());
+    // Split the cores between files and chunks of each file.
+    VnConvSetFileThreads(std::max(1, cores / jobs));
+
+    std::atomic<size_t> next{0};
+    std::mutex reportMutex;
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next++) < queue.size()) {
+            Job &job = queue[i];
+            job.bytes = fileSize(job.input);
+            auto start = std::chrono::steady_clock::now();
+            job.result = VnFileConvert(
+                from, to, job.input.empty() ? nullptr : job.input.c_str(),
+                job.output.empty() ? nullptr : job.output.c_str());
+            job.seconds = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+
+            std::lock_guard<std::mutex> lock(reportMutex);
+            const char *name = job.input.empty() ? "<stdin>" : job.input.c_str();
+            if (job.result != 0) {
+                std::fprintf(stderr, "unikey-conv: %s: %s\n", name,
+                             VnConvErrMsg(job.result));
+            } else if (!quiet && !job.input.empty()) {
+                std::fprintf(stderr, "%s: %lld bytes, %.1f MB/s\n", name,
+                             job.bytes, mbPerSec(job.bytes, job.seconds));
+            }
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 1; i < jobs; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+
+    int failed = 0;
+    long long total = 0;
+    for (const auto &job : queue) {
+        failed += job.result != 0;
+        total += job.bytes;
+    }
+    if (!quiet && queue.size() > 1) {
+        std::fprintf(stderr, "total: %zu files, %lld bytes, %.1f MB/s\n",
+                     queue.size(), total, mbPerSec(total, elapsed));
+    }
+    return failed ? 1 : 0;
+}
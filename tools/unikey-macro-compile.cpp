@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Compiles macro files into the cache that sessions map instead of parsing.
+//
+// Usage: unikey-macro-compile FILE...
+//
+// Writes FILE.bin next to each FILE. Meant for a system wide macro file, e.g.
+// /etc/xdg/fcitx5/unikey/macro with the SystemMacro option on: run it as root
+// whenever the file changes, and every session maps the same compiled copy
+// read-only, so its pages are in memory once for all of them.
+
+#include "mactab.h"
+
+#include <cstdio>
+#include <cstring>
+
+int main(int argc, char **argv) {
+    if (argc < 2 || !std::strcmp(argv[1], "-h") ||
+        !std::strcmp(argv[1], "--help")) {
+        std::fprintf(argc < 2 ? stderr : stdout,
+                     "Usage: unikey-macro-compile FILE...\n"
+                     "\n"
+                     "Compile each macro FILE into FILE.bin.\n");
+        return argc < 2 ? 2 : 0;
+    }
+
+    int result = 0;
+    for (int i = 1; i < argc; i++) {
+        CMacroTable table;
+        // parses and writes the cache, unless it is already up to date
+        if (!table.loadFromFile(argv[i], true)) {
+            std::fprintf(stderr, "%s: cannot read\n", argv[i]);
+            result = 1;
+            continue;
+        }
+        CMacroTable compiled;
+        if (!compiled.loadFromFile(argv[i], true) || !compiled.isMapped()) {
+            std::fprintf(stderr, "%s.bin: cannot write\n", argv[i]);
+            result = 1;
+            continue;
+        }
+        std::printf("%s.bin: %d macros\n", argv[i], compiled.getCount());
+    }
+    return result;
+}
@@ -0,0 +1,411 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Block conversion for large buffers.
+//
+// genConvert goes through two virtual calls and the option checks for every
+// character. For the stateless charsets the result only depends on the input
+// bytes, so everything can be tabulated once per (input, output, options):
+//   - single-byte input: one table entry per input byte
+//   - double-byte input (VNI...): per byte, plus a pair table for
+//     base letter + combining byte
+//   - UTF-8 input: decode inline, code point -> StdVnChar index table
+// The tables are built by running the real charset objects, so the output is
+// byte-for-byte what genConvert produces. Runs of printable ASCII that map to
+// themselves are copied as a whole.
+
+#include "charset.h"
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "vnconv.h"
+
+namespace {
+
+// converters kept for reuse
+#define MAX_CACHED_CONVERTERS 8
+
+enum InputKind { SingleByteInput, DoubleByteInput, Utf8Input };
+
+//----------------------------------------------------
+// Number of leading bytes of [p, end) in 0x20..0x7E
+//----------------------------------------------------
+inline size_t printableAsciiRun(const UKBYTE *p, const UKBYTE *end) {
+    const UKBYTE *start = p;
+#if defined(__SSE2__)
+    const __m128i lo = _mm_set1_epi8(0x1F);
+    const __m128i hi = _mm_set1_epi8(0x7F);
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        // bytes >= 0x80 are negative as signed chars and fail the first test
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(ok);
+        if (mask != 0xFFFF)
+            return (p - start) + __builtin_ctz(~mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p >= 0x20 && *p < 0x7F)
+        p++;
+    return p - start;
+}
+
+//----------------------------------------------------
+class BlockConverter {
+public:
+    BlockConverter(int inCharset, int outCharset, const VnConvOptions &opt);
+
+    bool matches(int inCharset, int outCharset, const VnConvOptions &opt) const {
+        return m_inCharset == inCharset && m_outCharset == outCharset &&
+               m_toUpper == opt.toUpper && m_toLower == opt.toLower &&
+               m_removeTone == opt.removeTone;
+    }
+
+    // Returns number of input bytes consumed. Output that doesn't fit is
+    // counted in outBytes but not written; bad is set then.
+    size_t convert(const UKBYTE *in, size_t inLen, UKBYTE *out, size_t maxOut,
+                   size_t &outBytes, bool &bad, bool final);
+
+private:
+    StdVnChar applyOptions(StdVnChar stdChar) const;
+    void encode(StdVnChar stdChar, VnOutBytes &out);
+    void buildTables();
+
+    inline void emit(const VnOutBytes &c, UKBYTE *out, size_t maxOut,
+                     size_t &outBytes, bool &bad) {
+        if (!bad && outBytes + c.len <= maxOut)
+            memcpy(out + outBytes, c.b, c.len);
+        else
+            bad = true;
+        outBytes += c.len;
+    }
+
+    int m_inCharset, m_outCharset;
+    int m_toUpper, m_toLower, m_removeTone;
+    InputKind m_kind;
+    VnCharset *m_in;
+    VnCharset *m_out;
+    const VnOutBytes *m_outTable;
+
+    VnOutBytes m_vnOut[TOTAL_VNCHARS]; // output of each StdVnChar
+    VnOutBytes m_byteOut[256];         // output of each input byte on its own
+    bool m_lead[256];                 // double-byte: may start a pair
+    std::vector<UKBYTE> m_index;      // pair or code point -> StdVnChar index+1
+    bool m_asciiCopy;                 // printable ASCII maps to itself
+};
+
+//----------------------------------------------------
+BlockConverter::BlockConverter(int inCharset, int outCharset,
+                               const VnConvOptions &opt)
+    : m_inCharset(inCharset), m_outCharset(outCharset),
+      m_toUpper(opt.toUpper), m_toLower(opt.toLower),
+      m_removeTone(opt.removeTone) {
+    m_in = VnCharsetLibObj.getVnCharset(inCharset);
+    m_out = VnCharsetLibObj.getVnCharset(outCharset);
+    m_outTable = m_out->outputTable();
+    if (IS_SINGLE_BYTE_CHARSET(inCharset))
+        m_kind = SingleByteInput;
+    else if (IS_DOUBLE_BYTE_CHARSET(inCharset))
+        m_kind = DoubleByteInput;
+    else
+        m_kind = Utf8Input;
+    buildTables();
+}
+
+//----------------------------------------------------
+// Same order as genConvert
+//----------------------------------------------------
+StdVnChar BlockConverter::applyOptions(StdVnChar stdChar) const {
+    if (m_toLower)
+        stdChar = StdVnToLower(stdChar);
+    else if (m_toUpper)
+        stdChar = StdVnToUpper(stdChar);
+    if (m_removeTone)
+        stdChar = StdVnGetRoot(stdChar);
+    return stdChar;
+}
+
+//----------------------------------------------------
+void BlockConverter::encode(StdVnChar stdChar, VnOutBytes &out) {
+    if (stdChar == INVALID_STD_CHAR) {
+        out.len = 0;
+        return;
+    }
+    stdChar = applyOptions(stdChar);
+    const VnOutBytes *p = m_outTable ? VnOutTableEntry(m_outTable, stdChar)
+                                     : NULL;
+    if (p) {
+        out = *p;
+        return;
+    }
+    int outLen;
+    StringBOStream os(out.b, MAX_VN_OUT_BYTES);
+    m_out->startOutput();
+    m_out->putChar(os, stdChar, outLen);
+    out.len = (UKBYTE)os.getOutBytes();
+}
+
+//----------------------------------------------------
+void BlockConverter::buildTables() {
+    int i;
+    UKBYTE seq[3];
+    StdVnChar stdChar;
+    int bytesRead;
+
+    for (i = 0; i < TOTAL_VNCHARS; i++)
+        encode(VnStdCharOffset + i, m_vnOut[i]);
+
+    for (i = 0; i < 256; i++) {
+        seq[0] = (UKBYTE)i;
+        StringBIStream is(seq, 1, 1);
+        stdChar = 0;
+        m_in->startInput();
+        if (!m_in->nextInput(is, stdChar, bytesRead))
+            stdChar = INVALID_STD_CHAR; // incomplete UTF-8 sequence
+        encode(stdChar, m_byteOut[i]);
+        m_lead[i] = (m_kind == DoubleByteInput && stdChar != INVALID_STD_CHAR &&
+                     stdChar >= VnStdCharOffset);
+    }
+
+    if (m_kind == DoubleByteInput) {
+        m_index.assign(65536, 0);
+        for (int lo = 0; lo < 256; lo++) {
+            if (!m_lead[lo])
+                continue;
+            for (int hi = 1; hi < 256; hi++) {
+                seq[0] = (UKBYTE)lo;
+                seq[1] = (UKBYTE)hi;
+                StringBIStream is(seq, 2, 1);
+                m_in->startInput();
+                m_in->nextInput(is, stdChar, bytesRead);
+                if (bytesRead == 2)
+                    m_index[lo | (hi << 8)] =
+                        (UKBYTE)(stdChar - VnStdCharOffset + 1);
+            }
+        }
+    } else if (m_kind == Utf8Input) {
+        m_index.assign(65536, 0);
+        for (i = 0; i < 65536; i++) {
+            int len;
+            if (i < 0x80) {
+                seq[0] = (UKBYTE)i;
+                len = 1;
+            } else if (i < 0x800) {
+                seq[0] = 0xC0 | (UKBYTE)(i >> 6);
+                seq[1] = 0x80 | (UKBYTE)(i & 0x3F);
+                len = 2;
+            } else {
+                seq[0] = 0xE0 | (UKBYTE)(i >> 12);
+                seq[1] = 0x80 | (UKBYTE)((i >> 6) & 0x3F);
+                seq[2] = 0x80 | (UKBYTE)(i & 0x3F);
+                len = 3;
+            }
+            StringBIStream is(seq, len, 1);
+            m_in->startInput();
+            m_in->nextInput(is, stdChar, bytesRead);
+            if (stdChar != INVALID_STD_CHAR && stdChar >= VnStdCharOffset)
+                m_index[i] = (UKBYTE)(stdChar - VnStdCharOffset + 1);
+        }
+    }
+
+    m_asciiCopy = true;
+    for (i = 0x20; i < 0x7F && m_asciiCopy; i++) {
+        m_asciiCopy = m_byteOut[i].len == 1 && m_byteOut[i].b[0] == i;
+    }
+    // A pair made of two printable bytes would be split by the run copy.
+    if (m_asciiCopy && m_kind == DoubleByteInput) {
+        for (int lo = 0x20; lo < 0x7F && m_asciiCopy; lo++)
+            for (int hi = 0x20; hi < 0x7F && m_asciiCopy; hi++)
+                m_asciiCopy = m_index[lo | (hi << 8)] == 0;
+    }
+}
+
+//----------------------------------------------------
+size_t BlockConverter::convert(const UKBYTE *in, size_t inLen, UKBYTE *out,
+                               size_t maxOut, size_t &outBytes, bool &bad,
+                               bool final) {
+    const UKBYTE *p = in;
+    const UKBYTE *end = in + inLen;
+
+    while (p < end) {
+        if (m_asciiCopy && *p >= 0x20 && *p < 0x7F) {
+            size_t run = printableAsciiRun(p, end);
+            // the last byte of a run may start a double-byte pair
+            if (m_kind == DoubleByteInput)
+                run--;
+            if (run > 0) {
+                if (!bad && outBytes + run <= maxOut)
+                    memcpy(out + outBytes, p, run);
+                else
+                    bad = true;
+                outBytes += run;
+                p += run;
+                continue;
+            }
+        }
+
+        UKBYTE ch = *p;
+        size_t avail = end - p;
+        switch (m_kind) {
+        case SingleByteInput:
+            emit(m_byteOut[ch], out, maxOut, outBytes, bad);
+            p++;
+            break;
+
+        case DoubleByteInput:
+            if (m_lead[ch]) {
+                if (avail < 2 && !final)
+                    return p - in;
+                if (avail >= 2 && p[1] > 0) {
+                    UKBYTE idx = m_index[ch | (p[1] << 8)];
+                    if (idx) {
+                        emit(m_vnOut[idx - 1], out, maxOut, outBytes, bad);
+                        p += 2;
+                        break;
+                    }
+                }
+            }
+            emit(m_byteOut[ch], out, maxOut, outBytes, bad);
+            p++;
+            break;
+
+        case Utf8Input: {
+            if (ch < 0x80 || ((ch & 0xE0) != 0xC0 && (ch & 0xF0) != 0xE0)) {
+                // ASCII, or a byte that can't start a sequence (skipped)
+                emit(m_byteOut[ch], out, maxOut, outBytes, bad);
+                p++;
+                break;
+            }
+            size_t need = ((ch & 0xE0) == 0xC0) ? 2 : 3;
+            if (avail < need && !final &&
+                (avail < 2 || (p[1] & 0xC0) == 0x80))
+                return p - in; // wait for the rest of the sequence
+            if (avail < 2) {
+                p = end; // truncated at end of input: dropped
+                break;
+            }
+            if ((p[1] & 0xC0) != 0x80) {
+                p++; // invalid sequence: skipped
+                break;
+            }
+            if (need == 3) {
+                if (avail < 3) {
+                    p = end;
+                    break;
+                }
+                if ((p[2] & 0xC0) != 0x80) {
+                    p += 2;
+                    break;
+                }
+            }
+            UnicodeChar uniCh;
+            if (need == 2)
+                uniCh = ((ch & 0x1F) << 6) | (p[1] & 0x3F);
+            else
+                uniCh = ((ch & 0x0F) << 12) | ((p[1] & 0x3F) << 6) |
+                        (p[2] & 0x3F);
+            p += need;
+            UKBYTE idx = m_index[uniCh];
+            if (idx) {
+                emit(m_vnOut[idx - 1], out, maxOut, outBytes, bad);
+            } else {
+                // not a Vietnamese character, rare enough to go the slow way
+                VnOutBytes c;
+                encode(uniCh, c);
+                emit(c, out, maxOut, outBytes, bad);
+            }
+            break;
+        }
+        }
+    }
+    return p - in;
+}
+
+//----------------------------------------------------
+bool hasBlockKernel(int inCharset, int outCharset) {
+    bool inOk = IS_SINGLE_BYTE_CHARSET(inCharset) ||
+                IS_DOUBLE_BYTE_CHARSET(inCharset) ||
+                inCharset == CONV_CHARSET_UNIUTF8 ||
+                inCharset == CONV_CHARSET_XUTF8;
+    // VIQR output keeps state between characters, VNSTANDARD is internal
+    bool outOk = outCharset != CONV_CHARSET_VIQR &&
+                 outCharset != CONV_CHARSET_UTF8VIQR &&
+                 outCharset != CONV_CHARSET_VNSTANDARD;
+    return inOk && outOk && VnCharsetLibObj.getVnCharset(outCharset) != NULL;
+}
+
+// per thread, so that conversions in several threads need no locking
+thread_local std::vector<std::unique_ptr<BlockConverter>> ConverterCache;
+
+//----------------------------------------------------
+BlockConverter *getBlockConverter(int inCharset, int outCharset,
+                                  const VnConvOptions &opt) {
+    for (auto it = ConverterCache.begin(); it != ConverterCache.end(); ++it) {
+        if ((*it)->matches(inCharset, outCharset, opt))
+            return it->get();
+    }
+    if (!hasBlockKernel(inCharset, outCharset))
+        return NULL;
+    if (ConverterCache.size() >= MAX_CACHED_CONVERTERS)
+        ConverterCache.erase(ConverterCache.begin());
+    ConverterCache.push_back(
+        std::make_unique<BlockConverter>(inCharset, outCharset, opt));
+    return ConverterCache.back().get();
+}
+
+} // namespace
+
+//----------------------------------------------
+// Arguments:
+//       inCharset, outCharset, input, output: as in VnConvert
+//       pInLen: [in]  size of input, must not be -1
+//               [out] number of bytes left in input. These form an
+//                     incomplete character if final is 0 and should be
+//                     passed again, in front of the next block.
+//       pMaxOutLen: as in VnConvert
+//       final: non-zero if this is the last block of input
+// Returns:  0 if successful
+//           VNCONV_INVALID_CHARSET if there's no block kernel for the pair,
+//           call VnConvert instead
+//           VNCONV_OUT_OF_MEMORY if output is too small
+//----------------------------------------------
+DllExport int VnConvertBlock(int inCharset, int outCharset,
+                             const UKBYTE *input, UKBYTE *output, int *pInLen,
+                             int *pMaxOutLen, int final) {
+    return VnConvertBlockWithOptions(inCharset, outCharset,
+                                     &VnCharsetLibObj.m_options, input, output,
+                                     pInLen, pMaxOutLen, final);
+}
+
+//----------------------------------------------
+// Same as VnConvertBlock, with the options of this call, see
+// VnConvertWithOptions
+//----------------------------------------------
+DllExport int VnConvertBlockWithOptions(int inCharset, int outCharset,
+                                        const VnConvOptions *pOptions,
+                                        const UKBYTE *input, UKBYTE *output,
+                                        int *pInLen, int *pMaxOutLen,
+                                        int final) {
+    if (*pInLen < 0)
+        return VNCONV_UNKNOWN_ERROR;
+    BlockConverter *conv = getBlockConverter(inCharset, outCharset, *pOptions);
+    if (!conv)
+        return VNCONV_INVALID_CHARSET;
+
+    size_t outBytes = 0;
+    bool bad = false;
+    size_t used = conv->convert(input, *pInLen, output, *pMaxOutLen, outBytes,
+                                bad, final != 0);
+    *pInLen -= (int)used;
+    *pMaxOutLen = (int)outBytes;
+    return bad ? VNCONV_OUT_OF_MEMORY : 0;
+}
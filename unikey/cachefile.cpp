@@ -0,0 +1,80 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: LGPL-2.0-or-later
+ */
+
+#include "cachefile.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+//---------------------------------------------------------------
+void UkCacheStamp::set(const struct stat &src) {
+    srcSize = src.st_size;
+    srcMtimeSec = src.st_mtim.tv_sec;
+    srcMtimeNsec = src.st_mtim.tv_nsec;
+}
+
+//---------------------------------------------------------------
+bool UkCacheStamp::matches(const struct stat &src) const {
+    return srcSize == (int64_t)src.st_size &&
+           srcMtimeSec == (int64_t)src.st_mtim.tv_sec &&
+           srcMtimeNsec == (int64_t)src.st_mtim.tv_nsec;
+}
+
+//---------------------------------------------------------------
+bool UkMapCacheFile(const char *cacheName, size_t minSize, void *&mapping,
+                    size_t &size) {
+    int fd = open(cacheName, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)minSize ||
+        st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    mapping = p;
+    size = st.st_size;
+    return true;
+}
+
+//---------------------------------------------------------------
+bool UkWriteCacheFile(const char *cacheName, const struct stat &src,
+                      std::initializer_list<UkCachePart> parts) {
+    string tmpName = string(cacheName) + ".XXXXXX";
+    int fd = mkstemp(&tmpName[0]);
+    if (fd < 0)
+        return false;
+    fchmod(fd, src.st_mode & 0666);
+    FILE *f = fdopen(fd, "wb");
+    if (f == NULL) {
+        close(fd);
+        unlink(tmpName.c_str());
+        return false;
+    }
+
+    bool ok = true;
+    for (const UkCachePart &part : parts) {
+        if (part.size && fwrite(part.data, 1, part.size, f) != part.size) {
+            ok = false;
+            break;
+        }
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmpName.c_str(), cacheName) != 0) {
+        unlink(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
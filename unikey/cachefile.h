@@ -0,0 +1,44 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: LGPL-2.0-or-later
+ */
+
+#ifndef __UK_CACHEFILE_H
+#define __UK_CACHEFILE_H
+
+#include <initializer_list>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Compiled copies of the macro, keymap and word list files. Each starts
+// with a header of its own holding the stamp of the source file it was
+// built from, and is only used for that exact source (same size and mtime).
+struct UkCacheStamp {
+    int64_t srcSize;
+    int64_t srcMtimeSec;
+    int64_t srcMtimeNsec;
+
+    void set(const struct stat &src);
+    bool matches(const struct stat &src) const;
+};
+
+struct UkCachePart {
+    const void *data;
+    size_t size;
+};
+
+// Maps the whole of cacheName read-only. False if it cannot be opened or
+// mapped, or is smaller than minSize.
+bool UkMapCacheFile(const char *cacheName, size_t minSize, void *&mapping,
+                    size_t &size);
+
+// Writes the parts one after the other into a temporary file next to
+// cacheName and renames it over cacheName, so a reader maps either the old
+// copy or the new one. The copy can be read by whoever can read the source,
+// e.g. every user for a system wide file compiled by root.
+bool UkWriteCacheFile(const char *cacheName, const struct stat &src,
+                      std::initializer_list<UkCachePart> parts);
+
+#endif
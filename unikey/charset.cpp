@@ -13,12 +13,22 @@
 #include "charset.h"
 #include "data.h"
 
-int LoVowel['z' - 'a' + 1];
-int HiVowel['Z' - 'A' + 1];
+// a, e, i, o, u, y in either case
+static constexpr bool isVowelLetter(unsigned char c) {
+    switch (c | 0x20) {
+    case 'a':
+    case 'e':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'y':
+        return true;
+    default:
+        return false;
+    }
+}
 
-#define IS_VOWEL(x)                                                            \
-    ((x >= 'a' && x <= 'z' && LoVowel[x - 'a']) ||                             \
-     (x >= 'A' && x <= 'Z' && HiVowel[x - 'A']))
+#define IS_VOWEL(x) isVowelLetter(x)
 
 SingleByteCharset *SgCharsets[CONV_TOTAL_SINGLE_CHARSETS];
 DoubleByteCharset *DbCharsets[CONV_TOTAL_DOUBLE_CHARSETS];
@@ -30,6 +40,26 @@ DllExport CVnCharsetLib VnCharsetLibObj;
 //////////////////////////////////////////////////////
 int VnCharset::elementSize() { return 1; }
 
+//-------------------------------------------
+const VnOutBytes *VnCharset::outputTable() {
+    // putW writes in host byte order to strings but not to files
+    if (statefulOutput() || elementSize() != 1)
+        return NULL;
+    std::call_once(m_outTableOnce, [this]() {
+        auto table = std::make_unique<VnOutBytes[]>(VN_OUT_TABLE_SIZE);
+        for (int i = 0; i < VN_OUT_TABLE_SIZE; i++) {
+            StdVnChar stdChar =
+                (i < 256) ? (StdVnChar)i : VnStdCharOffset + (i - 256);
+            int outLen;
+            StringBOStream os(table[i].b, MAX_VN_OUT_BYTES);
+            putChar(os, stdChar, outLen);
+            table[i].len = (UKBYTE)os.getOutBytes();
+        }
+        m_outTable = std::move(table);
+    });
+    return m_outTable.get();
+}
+
 //-------------------------------------------
 int VnInternalCharset::nextInput(ByteInStream &is, StdVnChar &stdChar,
                                  int &bytesRead) {
@@ -53,7 +83,7 @@ int VnInternalCharset::putChar(ByteOutStream &os, StdVnChar stdChar,
 int VnInternalCharset::elementSize() { return 4; }
 
 //-------------------------------------------
-SingleByteCharset::SingleByteCharset(unsigned char *vnChars) {
+SingleByteCharset::SingleByteCharset(const unsigned char *vnChars) {
     int i;
     m_vnChars = vnChars;
     memset(m_stdMap, 0, 256 * sizeof(UKWORD));
@@ -115,15 +145,62 @@ int wideCharCompare(const void *ele1, const void *ele2) {
     return (ch1 == ch2) ? 0 : ((ch1 > ch2) ? 1 : -1);
 }
 
+/////////////////////////////////////////
+// Class: VnCodeMap
+/////////////////////////////////////////
+UKWORD VnCodeMap::EmptyPage[256];
+
+VnCodeMap::VnCodeMap() {
+    for (int i = 0; i < 256; i++)
+        m_pages[i] = EmptyPage;
+}
+
+//-------------------------------------------
+VnCodeMap::~VnCodeMap() {
+    for (int i = 0; i < 256; i++)
+        if (m_pages[i] != EmptyPage)
+            delete[] m_pages[i];
+}
+
+//-------------------------------------------
+void VnCodeMap::set(UKWORD code, int stdIndex) {
+    UKWORD *page = m_pages[code >> 8];
+    if (page == EmptyPage) {
+        page = new UKWORD[256];
+        memset(page, 0, 256 * sizeof(UKWORD));
+        m_pages[code >> 8] = page;
+    }
+    page[code & 0xFF] = stdIndex + 1;
+}
+
+//-------------------------------------------
+// When a code unit appears more than once, the map keeps the entry
+// bsearch would have found, so decoding is unchanged
+//-------------------------------------------
+void VnCodeMap::build(UKDWORD *sortedChars, int count) {
+    for (int i = 0; i < count; i++) {
+        UKDWORD key = LOWORD(sortedChars[i]);
+        UKDWORD *pChar = (UKDWORD *)bsearch(&key, sortedChars, count,
+                                            sizeof(UKDWORD), wideCharCompare);
+        set(LOWORD(key), HIWORD(*pChar));
+    }
+}
+
 //-------------------------------------------
-UnicodeCharset::UnicodeCharset(UnicodeChar *vnChars) {
+void VnCodeMap::buildFrom(const UnicodeChar *vnChars) {
     UKDWORD i;
-    m_toUnicode = vnChars;
+    UKDWORD sorted[TOTAL_VNCHARS];
     for (i = 0; i < TOTAL_VNCHARS; i++)
-        m_vnChars[i] = (i << 16) + vnChars[i]; // high word is used for index
-    qsort(m_vnChars, TOTAL_VNCHARS, sizeof(UKDWORD), wideCharCompare);
+        sorted[i] = (i << 16) + vnChars[i]; // high word is used for index
+    qsort(sorted, TOTAL_VNCHARS, sizeof(UKDWORD), wideCharCompare);
+    build(sorted, TOTAL_VNCHARS);
 }
 
+//-------------------------------------------
+UnicodeCharset::UnicodeCharset(const UnicodeChar *vnChars,
+                               const VnCodeMap &vnMap)
+    : m_vnMap(vnMap), m_toUnicode(vnChars) {}
+
 //-------------------------------------------
 int UnicodeCharset::nextInput(ByteInStream &is, StdVnChar &stdChar,
                               int &bytesRead) {
@@ -133,13 +210,7 @@ int UnicodeCharset::nextInput(ByteInStream &is, StdVnChar &stdChar,
         return 0;
     }
     bytesRead = sizeof(UnicodeChar);
-    UKDWORD key = uniCh;
-    UKDWORD *pChar = (UKDWORD *)bsearch(&key, m_vnChars, TOTAL_VNCHARS,
-                                        sizeof(UKDWORD), wideCharCompare);
-    if (pChar)
-        stdChar = VnStdCharOffset + HIWORD(*pChar);
-    else
-        stdChar = uniCh;
+    stdChar = toStdChar(uniCh);
     return 1;
 }
 
@@ -164,26 +235,57 @@ int uniCompInfoCompare(const void *ele1, const void *ele2) {
     return (ch1 == ch2) ? 0 : ((ch1 > ch2) ? 1 : -1);
 }
 
-UnicodeCompCharset::UnicodeCompCharset(UnicodeChar *uniChars,
-                                       UKDWORD *uniCompChars) {
-    int i, k;
+UnicodeCompCharset::UnicodeCompCharset(const UnicodeChar *uniChars,
+                                       const UKDWORD *uniCompChars) {
+    int i, k, totalChars;
+    UniCompCharInfo info[TOTAL_VNCHARS * 2];
     m_uniCompChars = uniCompChars;
-    m_totalChars = 0;
+    totalChars = 0;
     for (i = 0; i < TOTAL_VNCHARS; i++) {
-        m_info[i].compChar = uniCompChars[i];
-        m_info[i].stdIndex = i;
-        m_totalChars++;
+        info[i].compChar = uniCompChars[i];
+        info[i].stdIndex = i;
+        totalChars++;
     }
 
     for (k = 0, i = TOTAL_VNCHARS; k < TOTAL_VNCHARS; k++)
         if (uniChars[k] != uniCompChars[k]) {
-            m_info[i].compChar = uniChars[k];
-            m_info[i].stdIndex = k;
-            m_totalChars++;
+            info[i].compChar = uniChars[k];
+            info[i].stdIndex = k;
+            totalChars++;
             i++;
         }
 
-    qsort(m_info, m_totalChars, sizeof(UniCompCharInfo), uniCompInfoCompare);
+    qsort(info, totalChars, sizeof(UniCompCharInfo), uniCompInfoCompare);
+
+    // split the sorted table into the base map and one map per mark
+    m_markCount = 0;
+    for (i = 0; i < totalChars; i++) {
+        UniCompCharInfo *pInfo = (UniCompCharInfo *)bsearch(
+            &info[i], info, totalChars, sizeof(UniCompCharInfo),
+            uniCompInfoCompare);
+        UKWORD base = LOWORD(pInfo->compChar);
+        UKWORD mark = HIWORD(pInfo->compChar);
+        if (mark == 0) {
+            m_baseMap.set(base, pInfo->stdIndex);
+            continue;
+        }
+        for (k = 0; k < m_markCount && m_marks[k] != mark; k++)
+            ;
+        if (k == m_markCount) {
+            if (m_markCount == UNI_COMP_MAX_MARKS)
+                continue;
+            m_marks[m_markCount++] = mark;
+        }
+        m_markMaps[k].set(base, pInfo->stdIndex);
+    }
+}
+
+//---------------------------------------------
+int UnicodeCompCharset::lookupPair(UKWORD base, UKWORD mark) const {
+    for (int k = 0; k < m_markCount; k++)
+        if (m_marks[k] == mark)
+            return m_markMaps[k].lookup(base);
+    return -1;
 }
 
 //---------------------------------------------
@@ -191,34 +293,24 @@ int UnicodeCompCharset::nextInput(ByteInStream &is, StdVnChar &stdChar,
                                   int &bytesRead) {
     // read first char
 
-    UniCompCharInfo key;
-    UKWORD w;
-    if (!is.getNextW(w)) {
+    UKWORD base, w;
+    if (!is.getNextW(base)) {
         bytesRead = 0;
         return 0;
     }
-    key.compChar = w;
     bytesRead = 2;
 
-    UniCompCharInfo *pInfo =
-        (UniCompCharInfo *)bsearch(&key, m_info, m_totalChars,
-                                   sizeof(UniCompCharInfo), uniCompInfoCompare);
-    if (!pInfo)
-        stdChar = key.compChar;
+    int idx = m_baseMap.lookup(base);
+    if (idx < 0)
+        stdChar = base;
     else {
-        stdChar = pInfo->stdIndex + VnStdCharOffset;
-        if (is.peekNextW(w)) {
-            UKDWORD hi = w;
-            if (hi > 0) {
-                key.compChar += hi << 16;
-                pInfo = (UniCompCharInfo *)bsearch(&key, m_info, m_totalChars,
-                                                   sizeof(UniCompCharInfo),
-                                                   uniCompInfoCompare);
-                if (pInfo) {
-                    stdChar = pInfo->stdIndex + VnStdCharOffset;
-                    bytesRead += 2;
-                    is.getNextW(w);
-                }
+        stdChar = idx + VnStdCharOffset;
+        if (is.peekNextW(w) && w > 0) {
+            idx = lookupPair(base, w);
+            if (idx >= 0) {
+                stdChar = idx + VnStdCharOffset;
+                bytesRead += 2;
+                is.getNextW(w);
             }
         }
     }
@@ -306,13 +398,7 @@ int UnicodeUTF8Charset::nextInput(ByteInStream &is, StdVnChar &stdChar,
     }
 
     // translate to StdVnChar
-    UKDWORD key = uniCh;
-    UKDWORD *pChar = (UKDWORD *)bsearch(&key, m_vnChars, TOTAL_VNCHARS,
-                                        sizeof(UKDWORD), wideCharCompare);
-    if (pChar)
-        stdChar = VnStdCharOffset + HIWORD(*pChar);
-    else
-        stdChar = uniCh;
+    stdChar = toStdChar(uniCh);
     return 1;
 }
 
@@ -404,13 +490,7 @@ int UnicodeRefCharset::nextInput(ByteInStream &is, StdVnChar &stdChar,
     }
 
     // translate to StdVnChar
-    UKDWORD key = uniCh;
-    UKDWORD *pChar = (UKDWORD *)bsearch(&key, m_vnChars, TOTAL_VNCHARS,
-                                        sizeof(UKDWORD), wideCharCompare);
-    if (pChar)
-        stdChar = VnStdCharOffset + HIWORD(*pChar);
-    else
-        stdChar = uniCh;
+    stdChar = toStdChar(uniCh);
     return 1;
 }
 
@@ -488,9 +568,6 @@ int UnicodeHexCharset::putChar(ByteOutStream &os, StdVnChar stdChar,
 /////////////////////////////////
 // Class UnicodeCStringCharset  /
 /////////////////////////////////
-void UnicodeCStringCharset::startInput() { m_prevIsHex = 0; }
-
-//----------------------------------------
 int UnicodeCStringCharset::nextInput(ByteInStream &is, StdVnChar &stdChar,
                                      int &bytesRead) {
     unsigned char ch;
@@ -517,13 +594,7 @@ int UnicodeCStringCharset::nextInput(ByteInStream &is, StdVnChar &stdChar,
     }
 
     // translate to StdVnChar
-    UKDWORD key = uniCh;
-    UKDWORD *pChar = (UKDWORD *)bsearch(&key, m_vnChars, TOTAL_VNCHARS,
-                                        sizeof(UKDWORD), wideCharCompare);
-    if (pChar)
-        stdChar = VnStdCharOffset + HIWORD(*pChar);
-    else
-        stdChar = uniCh;
+    stdChar = toStdChar(uniCh);
     return 1;
 }
 
@@ -556,7 +627,6 @@ int UnicodeCStringCharset::putChar(ByteOutStream &os, StdVnChar stdChar,
             shifts -= 4;
         }
         ret = os.isOK();
-        m_prevIsHex = 1;
     }
     return ret;
 }
@@ -564,7 +634,8 @@ int UnicodeCStringCharset::putChar(ByteOutStream &os, StdVnChar stdChar,
 /////////////////////////////////
 // Double-byte charsets        //
 /////////////////////////////////
-DoubleByteCharset::DoubleByteCharset(UKWORD *vnChars) {
+DoubleByteCharset::DoubleByteCharset(const UKWORD *vnChars) {
+    UKDWORD sorted[TOTAL_VNCHARS];
     m_toDoubleChar = vnChars;
     memset(m_stdMap, 0, 256 * sizeof(UKWORD));
     for (int i = 0; i < TOTAL_VNCHARS; i++) {
@@ -572,10 +643,11 @@ DoubleByteCharset::DoubleByteCharset(UKWORD *vnChars) {
             m_stdMap[vnChars[i] >> 8] = 0xFFFF; // INVALID_STD_CHAR;
         else if (m_stdMap[vnChars[i]] == 0)
             m_stdMap[vnChars[i]] = i + 1;
-        m_vnChars[i] =
+        sorted[i] =
             (i << 16) + vnChars[i]; // high word is used for StdChar index
     }
-    qsort(m_vnChars, TOTAL_VNCHARS, sizeof(UKDWORD), wideCharCompare);
+    qsort(sorted, TOTAL_VNCHARS, sizeof(UKDWORD), wideCharCompare);
+    m_vnMap.build(sorted, TOTAL_VNCHARS);
 }
 
 //---------------------------------------------
@@ -598,12 +670,9 @@ int DoubleByteCharset::nextInput(ByteInStream &is, StdVnChar &stdChar,
         UKBYTE hi;
         if (is.peekNext(hi) && hi > 0) {
             // test if a double-byte character is encountered
-            UKDWORD key = MAKEWORD(ch, hi);
-            UKDWORD *pChar =
-                (UKDWORD *)bsearch(&key, m_vnChars, TOTAL_VNCHARS,
-                                   sizeof(UKDWORD), wideCharCompare);
-            if (pChar) {
-                stdChar = VnStdCharOffset + HIWORD(*pChar);
+            int idx = m_vnMap.lookup(MAKEWORD(ch, hi));
+            if (idx >= 0) {
+                stdChar = VnStdCharOffset + idx;
                 bytesRead = 2;
                 is.getNext(hi);
             }
@@ -654,18 +723,22 @@ int DoubleByteCharset::putChar(ByteOutStream &os, StdVnChar stdChar,
 // Class: VIQRCharset                      //
 /////////////////////////////////////////////
 
-unsigned char VIQRTones[] = {'\'', '`', '?', '~', '.'};
+const unsigned char VIQRTones[] = {'\'', '`', '?', '~', '.'};
 
 const char *VIQREscapes[] = {
     "://", "/", "@", "mailto:", "email:", "news:", "www", "ftp"};
 
 const int VIQREscCount = sizeof(VIQREscapes) / sizeof(char *);
 
-VIQRCharset::VIQRCharset(UKDWORD *vnChars) {
+VIQRCharset::VIQRCharset(const UKDWORD *vnChars,
+                         const VnConvOptions *options) {
     memset(m_stdMap, 0, 256 * sizeof(UKWORD));
     int i;
     UKDWORD dw;
     m_vnChars = vnChars;
+    m_options = options ? options : &VnCharsetLibObj.m_options;
+    m_escState = 0;
+    m_outEscState = 0;
     for (i = 0; i < TOTAL_VNCHARS; i++) {
         dw = m_vnChars[i];
         if (!(dw & 0xffffff00)) { // single byte
@@ -693,8 +766,7 @@ void VIQRCharset::startInput() {
     m_atWordBeginning = 1;
     m_gotTone = 0;
     m_escAll = 0;
-    if (VnCharsetLibObj.m_options.viqrEsc)
-        VnCharsetLibObj.m_VIQREscPatterns.reset();
+    m_escState = 0;
 }
 
 //---------------------------------------------------
@@ -708,8 +780,9 @@ int VIQRCharset::nextInput(ByteInStream &is, StdVnChar &stdChar,
     bytesRead = 1;
     stdChar = m_stdMap[ch1];
 
-    if (VnCharsetLibObj.m_options.viqrEsc) {
-        if (VnCharsetLibObj.m_VIQREscPatterns.foundAtNextChar(ch1) != -1) {
+    if (m_options->viqrEsc) {
+        if (VnCharsetLibObj.m_VIQREscPatterns.foundAtNextChar(m_escState,
+                                                              ch1) != -1) {
             m_escAll = 1;
         }
     }
@@ -732,7 +805,7 @@ int VIQRCharset::nextInput(ByteInStream &is, StdVnChar &stdChar,
         unsigned char ch2;
         is.peekNext(ch2);
         unsigned char upper = toupper(ch1);
-        if ((!VnCharsetLibObj.m_options.smartViqr || m_atWordBeginning) &&
+        if ((!m_options->smartViqr || m_atWordBeginning) &&
             upper == 'D' && (ch2 == 'd' || ch2 == 'D')) {
             is.getNext(ch2);
             bytesRead++;
@@ -808,7 +881,15 @@ void VIQRCharset::startOutput() {
     m_escapeHook = 0;
     m_escapeTone = 0;
     m_noOutEsc = 0;
-    VnCharsetLibObj.m_VIQROutEscPatterns.reset();
+    m_outEscState = 0;
+}
+
+//---------------------------------------------------
+// Feeds the output escape patterns, true if one of them ends at b
+//---------------------------------------------------
+bool VIQRCharset::outEscFoundAt(UKBYTE b) {
+    return VnCharsetLibObj.m_VIQROutEscPatterns.foundAtNextChar(m_outEscState,
+                                                               b) != -1;
 }
 
 //---------------------------------------------------
@@ -824,7 +905,7 @@ int VIQRCharset::putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen) {
 
         b = (UKBYTE)dw;
         ret = os.putB(b);
-        if (VnCharsetLibObj.m_VIQROutEscPatterns.foundAtNextChar(b) != -1)
+        if (outEscFoundAt(b))
             m_noOutEsc = 1;
 
         if (m_noOutEsc && (b == ' ' || b == '\t' || b == '\r' || b == '\n'))
@@ -846,7 +927,7 @@ int VIQRCharset::putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen) {
                 m_escapeTone = (index == 12 || index == 24 || index == 26);
             }
 
-            VnCharsetLibObj.m_VIQROutEscPatterns.reset();
+            m_outEscState = 0;
 
             m_escapeBowl = 0;
             m_escapeHook = 0;
@@ -862,13 +943,12 @@ int VIQRCharset::putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen) {
         if (stdChar > 255) {
             outLen = 1;
             ret = os.putB((UKBYTE)PadChar);
-            if (VnCharsetLibObj.m_VIQROutEscPatterns.foundAtNextChar(
-                    (UKBYTE)PadChar) != -1)
+            if (outEscFoundAt((UKBYTE)PadChar))
                 m_noOutEsc = 1;
         } else {
             outLen = 1;
             UKWORD index = m_stdMap[stdChar];
-            if (!VnCharsetLibObj.m_options.viqrMixed && !m_noOutEsc &&
+            if (!m_options->viqrMixed && !m_noOutEsc &&
                 (stdChar == '\\' ||
                  (index > 0 && index <= 10 && m_escapeTone) ||
                  (index == 12 && m_escapeRoof) ||
@@ -878,13 +958,12 @@ int VIQRCharset::putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen) {
                 // tone mark, needs an escape character
                 outLen++;
                 ret = os.putB('\\');
-                if (VnCharsetLibObj.m_VIQROutEscPatterns.foundAtNextChar(
-                        '\\') != -1)
+                if (outEscFoundAt('\\'))
                     m_noOutEsc = 1;
             }
             b = (UKBYTE)stdChar;
             ret = os.putB(b);
-            if (VnCharsetLibObj.m_VIQROutEscPatterns.foundAtNextChar(b) != -1)
+            if (outEscFoundAt(b))
                 m_noOutEsc = 1;
             if (m_noOutEsc && (b == ' ' || b == '\t' || b == '\r' || b == '\n'))
                 m_noOutEsc = 0;
@@ -945,41 +1024,26 @@ int UTF8VIQRCharset::putChar(ByteOutStream &os, StdVnChar stdChar,
 
 //-----------------------------------------
 CVnCharsetLib::CVnCharsetLib() {
-    unsigned char ch;
-    for (ch = 'a'; ch < 'z'; ch++)
-        LoVowel[ch - 'a'] = 0;
-    LoVowel['a' - 'a'] = 1;
-    LoVowel['e' - 'a'] = 1;
-    LoVowel['i' - 'a'] = 1;
-    LoVowel['o' - 'a'] = 1;
-    LoVowel['u' - 'a'] = 1;
-    LoVowel['y' - 'a'] = 1;
-
-    for (ch = 'A'; ch < 'Z'; ch++)
-        HiVowel[ch - 'A'] = 0;
-    HiVowel['A' - 'A'] = 1;
-    HiVowel['E' - 'A'] = 1;
-    HiVowel['I' - 'A'] = 1;
-    HiVowel['O' - 'A'] = 1;
-    HiVowel['U' - 'A'] = 1;
-    HiVowel['Y' - 'A'] = 1;
-
-    m_pUniCharset = NULL;
-    m_pUniCompCharset = NULL;
-    m_pUniUTF8 = NULL;
-    m_pUniRef = NULL;
-    m_pUniHex = NULL;
-    m_pVIQRCharObj = NULL;
-    m_pUVIQRCharObj = NULL;
-    m_pWinCP1258 = NULL;
-    m_pVnIntCharset = NULL;
+    // built up front, the tables are constant so this doesn't depend
+    // on the order of static initialization
+    m_uniMap.buildFrom(UnicodeTable);
+    m_pUniCharset = new UnicodeCharset(UnicodeTable, m_uniMap);
+    m_pUniCompCharset = new UnicodeCompCharset(UnicodeTable, UnicodeComposite);
+    m_pUniUTF8 = new UnicodeUTF8Charset(UnicodeTable, m_uniMap);
+    m_pUniRef = new UnicodeRefCharset(UnicodeTable, m_uniMap);
+    m_pUniHex = new UnicodeHexCharset(UnicodeTable, m_uniMap);
+    m_pUniCString = new UnicodeCStringCharset(UnicodeTable, m_uniMap);
+    m_pWinCP1258 = new WinCP1258Charset(WinCP1258, WinCP1258Pre);
+    m_pVIQRCharObj = new VIQRCharset(VIQRTable);
+    m_pUVIQRCharObj = new UTF8VIQRCharset(m_pUniUTF8, m_pVIQRCharObj);
+    m_pVnIntCharset = new VnInternalCharset();
 
     int i;
     for (i = 0; i < CONV_TOTAL_SINGLE_CHARSETS; i++)
-        m_sgCharsets[i] = NULL;
+        m_sgCharsets[i] = new SingleByteCharset(SingleByteTables[i]);
 
     for (i = 0; i < CONV_TOTAL_DOUBLE_CHARSETS; i++)
-        m_dbCharsets[i] = NULL;
+        m_dbCharsets[i] = new DoubleByteCharset(DoubleByteTables[i]);
 
     VnConvResetOptions(&m_options);
     m_VIQREscPatterns.init((char **)VIQREscapes, VIQREscCount);
@@ -988,111 +1052,76 @@ CVnCharsetLib::CVnCharsetLib() {
 
 //-----------------------------------------
 CVnCharsetLib::~CVnCharsetLib() {
-    if (m_pUniCharset)
-        delete m_pUniCharset;
-    if (m_pUniUTF8)
-        delete m_pUniUTF8;
-    if (m_pUniRef)
-        delete m_pUniRef;
-    if (m_pUniHex)
-        delete m_pUniHex;
-    if (m_pVIQRCharObj)
-        delete m_pVIQRCharObj;
-    if (m_pUVIQRCharObj)
-        delete m_pUVIQRCharObj;
-    if (m_pWinCP1258)
-        delete m_pWinCP1258;
-    if (m_pUniCString)
-        delete m_pUniCString;
-    if (m_pVnIntCharset)
-        delete m_pVnIntCharset;
+    delete m_pUniCharset;
+    delete m_pUniCompCharset;
+    delete m_pUniUTF8;
+    delete m_pUniRef;
+    delete m_pUniHex;
+    delete m_pUniCString;
+    delete m_pWinCP1258;
+    delete m_pUVIQRCharObj;
+    delete m_pVIQRCharObj;
+    delete m_pVnIntCharset;
 
     int i;
     for (i = 0; i < CONV_TOTAL_SINGLE_CHARSETS; i++)
-        if (m_sgCharsets[i])
-            delete m_sgCharsets[i];
+        delete m_sgCharsets[i];
 
     for (i = 0; i < CONV_TOTAL_DOUBLE_CHARSETS; i++)
-        if (m_dbCharsets[i])
-            delete m_dbCharsets[i];
+        delete m_dbCharsets[i];
 }
 
 //-----------------------------------------
 VnCharset *CVnCharsetLib::getVnCharset(int charsetIdx) {
     switch (charsetIdx) {
-
     case CONV_CHARSET_UNICODE:
-        if (m_pUniCharset == NULL)
-            m_pUniCharset = new UnicodeCharset(UnicodeTable);
         return m_pUniCharset;
     case CONV_CHARSET_UNIDECOMPOSED:
-        if (m_pUniCompCharset == NULL)
-            m_pUniCompCharset =
-                new UnicodeCompCharset(UnicodeTable, UnicodeComposite);
         return m_pUniCompCharset;
     case CONV_CHARSET_UNIUTF8:
     case CONV_CHARSET_XUTF8:
-        if (m_pUniUTF8 == NULL)
-            m_pUniUTF8 = new UnicodeUTF8Charset(UnicodeTable);
         return m_pUniUTF8;
-
     case CONV_CHARSET_UNIREF:
-        if (m_pUniRef == NULL)
-            m_pUniRef = new UnicodeRefCharset(UnicodeTable);
         return m_pUniRef;
-
     case CONV_CHARSET_UNIREF_HEX:
-        if (m_pUniHex == NULL)
-            m_pUniHex = new UnicodeHexCharset(UnicodeTable);
         return m_pUniHex;
-
     case CONV_CHARSET_UNI_CSTRING:
-        if (m_pUniCString == NULL)
-            m_pUniCString = new UnicodeCStringCharset(UnicodeTable);
         return m_pUniCString;
-
     case CONV_CHARSET_WINCP1258:
-        if (m_pWinCP1258 == NULL)
-            m_pWinCP1258 = new WinCP1258Charset(WinCP1258, WinCP1258Pre);
         return m_pWinCP1258;
-
     case CONV_CHARSET_VIQR:
-        if (m_pVIQRCharObj == NULL)
-            m_pVIQRCharObj = new VIQRCharset(VIQRTable);
         return m_pVIQRCharObj;
-
     case CONV_CHARSET_VNSTANDARD:
-        if (m_pVnIntCharset == NULL)
-            m_pVnIntCharset = new VnInternalCharset();
         return m_pVnIntCharset;
-
     case CONV_CHARSET_UTF8VIQR:
-        if (m_pUVIQRCharObj == NULL) {
-            if (m_pVIQRCharObj == NULL)
-                m_pVIQRCharObj = new VIQRCharset(VIQRTable);
-
-            if (m_pUniUTF8 == NULL)
-                m_pUniUTF8 = new UnicodeUTF8Charset(UnicodeTable);
-            m_pUVIQRCharObj = new UTF8VIQRCharset(m_pUniUTF8, m_pVIQRCharObj);
-        }
         return m_pUVIQRCharObj;
-
     default:
-        if (IS_SINGLE_BYTE_CHARSET(charsetIdx)) {
-            int i = charsetIdx - CONV_CHARSET_TCVN3;
-            if (m_sgCharsets[i] == NULL)
-                m_sgCharsets[i] = new SingleByteCharset(SingleByteTables[i]);
-            return m_sgCharsets[i];
-        } else if (IS_DOUBLE_BYTE_CHARSET(charsetIdx)) {
-            int i = charsetIdx - CONV_CHARSET_VNIWIN;
-            if (m_dbCharsets[i] == NULL)
-                m_dbCharsets[i] = new DoubleByteCharset(DoubleByteTables[i]);
-            return m_dbCharsets[i];
-        }
+        if (IS_SINGLE_BYTE_CHARSET(charsetIdx))
+            return m_sgCharsets[charsetIdx - CONV_CHARSET_TCVN3];
+        else if (IS_DOUBLE_BYTE_CHARSET(charsetIdx))
+            return m_dbCharsets[charsetIdx - CONV_CHARSET_VNIWIN];
     }
     return NULL;
 }
 
+/////////////////////////////////////////////
+// Class: VnConvCharset                    //
+/////////////////////////////////////////////
+VnConvCharset::VnConvCharset(int charsetIdx, const VnConvOptions *options) {
+    if (charsetIdx == CONV_CHARSET_VIQR) {
+        m_viqr.emplace(VIQRTable, options);
+        m_charset = &*m_viqr;
+    } else if (charsetIdx == CONV_CHARSET_UTF8VIQR) {
+        // the UTF-8 half is stateless
+        m_viqr.emplace(VIQRTable, options);
+        m_utf8Viqr.emplace((UnicodeUTF8Charset *)VnCharsetLibObj.getVnCharset(
+                               CONV_CHARSET_UNIUTF8),
+                           &*m_viqr);
+        m_charset = &*m_utf8Viqr;
+    } else
+        m_charset = VnCharsetLibObj.getVnCharset(charsetIdx);
+}
+
 //-------------------------------------------------
 DllExport void VnConvSetOptions(VnConvOptions *pOptions) {
     VnCharsetLibObj.m_options = *pOptions;
@@ -1116,9 +1145,10 @@ DllExport void VnConvResetOptions(VnConvOptions *pOptions) {
 /////////////////////////////////////////////
 // Class WinCP1258Charset
 /////////////////////////////////////////////
-WinCP1258Charset::WinCP1258Charset(UKWORD *compositeChars,
-                                   UKWORD *precomposedChars) {
-    int i, k;
+WinCP1258Charset::WinCP1258Charset(const UKWORD *compositeChars,
+                                   const UKWORD *precomposedChars) {
+    int i, k, totalChars;
+    UKDWORD sorted[TOTAL_VNCHARS * 2];
     m_toDoubleChar = compositeChars;
     memset(m_stdMap, 0, 256 * sizeof(UKWORD));
 
@@ -1129,11 +1159,11 @@ WinCP1258Charset::WinCP1258Charset(UKWORD *compositeChars,
         else if (m_stdMap[compositeChars[i]] == 0)
             m_stdMap[compositeChars[i]] = i + 1;
 
-        m_vnChars[i] = (i << 16) +
-                       compositeChars[i]; // high word is used for StdChar index
+        sorted[i] = (i << 16) +
+                    compositeChars[i]; // high word is used for StdChar index
     }
 
-    m_totalChars = TOTAL_VNCHARS;
+    totalChars = TOTAL_VNCHARS;
 
     // add precomposed chars to the table
     for (k = 0, i = TOTAL_VNCHARS; k < TOTAL_VNCHARS; k++)
@@ -1144,17 +1174,17 @@ WinCP1258Charset::WinCP1258Charset(UKWORD *compositeChars,
             else if (m_stdMap[precomposedChars[k]] == 0)
                 m_stdMap[precomposedChars[k]] = k + 1;
 
-            m_vnChars[i] = (k << 16) + precomposedChars[k];
-            m_totalChars++;
+            sorted[i] = (k << 16) + precomposedChars[k];
+            totalChars++;
             i++;
         }
 
-    qsort(m_vnChars, m_totalChars, sizeof(UKDWORD), wideCharCompare);
+    qsort(sorted, totalChars, sizeof(UKDWORD), wideCharCompare);
+    m_vnMap.build(sorted, totalChars);
 }
 
 //---------------------------------------------------------------------
-// This fuction is basically the same as that of DoubleByteCharset
-// with m_totalChars is used instead of constant TOTAL_VNCHARS
+// This fuction is exactly the same as that of DoubleByteCharset
 //---------------------------------------------------------------------
 int WinCP1258Charset::nextInput(ByteInStream &is, StdVnChar &stdChar,
                                 int &bytesRead) {
@@ -1175,12 +1205,9 @@ int WinCP1258Charset::nextInput(ByteInStream &is, StdVnChar &stdChar,
         UKBYTE hi;
         if (is.peekNext(hi) && hi > 0) {
             // test if a double-byte character is encountered
-            UKDWORD key = MAKEWORD(ch, hi);
-            UKDWORD *pChar =
-                (UKDWORD *)bsearch(&key, m_vnChars, m_totalChars,
-                                   sizeof(UKDWORD), wideCharCompare);
-            if (pChar) {
-                stdChar = VnStdCharOffset + HIWORD(*pChar);
+            int idx = m_vnMap.lookup(MAKEWORD(ch, hi));
+            if (idx >= 0) {
+                stdChar = VnStdCharOffset + idx;
                 bytesRead = 2;
                 is.getNext(hi);
             }
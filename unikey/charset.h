@@ -26,6 +26,9 @@
 #include "byteio.h"
 #include "pattern.h"
 #include "vnconv.h"
+#include <memory>
+#include <mutex>
+#include <optional>
 
 #define TOTAL_VNCHARS 213
 #define TOTAL_ALPHA_VNCHARS 186
@@ -68,6 +71,60 @@ const unsigned char PadStartQuote = '\"';
 const unsigned char PadEndQuote = '\"';
 const unsigned char PadEllipsis = '.';
 
+//--------------------------------------------------
+// Reverse lookup from a 16-bit code unit to a StdVnChar index.
+// A two-level page table: only the 256-entry pages that hold some
+// Vietnamese character are allocated, all others share an empty page,
+// so decoding one character is two table loads.
+//--------------------------------------------------
+class VnCodeMap {
+protected:
+    UKWORD *m_pages[256];
+    static UKWORD EmptyPage[256];
+
+public:
+    VnCodeMap();
+    ~VnCodeMap();
+    VnCodeMap(const VnCodeMap &) = delete;
+    VnCodeMap &operator=(const VnCodeMap &) = delete;
+
+    // build the map from a table sorted with wideCharCompare
+    // (low word: code unit, high word: StdVnChar index)
+    void build(UKDWORD *sortedChars, int count);
+    // build the map from the code units of the TOTAL_VNCHARS characters
+    void buildFrom(const UnicodeChar *vnChars);
+    void set(UKWORD code, int stdIndex);
+
+    // return the StdVnChar index of code, or -1
+    int lookup(UKWORD code) const {
+        return (int)m_pages[code >> 8][code & 0xFF] - 1;
+    }
+};
+
+//--------------------------------------------------
+// The bytes one character is written as, see VnCharset::outputTable
+//--------------------------------------------------
+// longest: "&#65535;"
+#define MAX_VN_OUT_BYTES 8
+// code points below 256, then the Vietnamese characters
+#define VN_OUT_TABLE_SIZE (256 + TOTAL_VNCHARS)
+
+struct VnOutBytes {
+    UKBYTE len;
+    UKBYTE b[MAX_VN_OUT_BYTES];
+};
+
+// the entry of stdChar in an output table, NULL if it has none
+inline const VnOutBytes *VnOutTableEntry(const VnOutBytes *table,
+                                         StdVnChar stdChar) {
+    if (stdChar < 256)
+        return &table[stdChar];
+    if (stdChar - VnStdCharOffset < TOTAL_VNCHARS)
+        return &table[256 + (stdChar - VnStdCharOffset)];
+    return NULL;
+}
+
+//--------------------------------------------------
 class DllInterface VnCharset {
 public:
     virtual void startInput() {}
@@ -89,16 +146,31 @@ public:
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen) = 0;
     virtual int elementSize();
     virtual ~VnCharset() {}
+
+    //------------------------------------------------------------------------
+    // What putChar writes for each entry of VnOutTableEntry, built with
+    // putChar on first use, so writing a character is a lookup and a copy.
+    // NULL for charsets that keep state between characters or write words.
+    //------------------------------------------------------------------------
+    const VnOutBytes *outputTable();
+
+protected:
+    // whether putChar depends on the characters put before
+    virtual bool statefulOutput() { return false; }
+
+private:
+    std::once_flag m_outTableOnce;
+    std::unique_ptr<VnOutBytes[]> m_outTable;
 };
 
 //--------------------------------------------------
 class SingleByteCharset : public VnCharset {
 protected:
     UKWORD m_stdMap[256];
-    unsigned char *m_vnChars;
+    const unsigned char *m_vnChars;
 
 public:
-    SingleByteCharset(unsigned char *vnChars);
+    SingleByteCharset(const unsigned char *vnChars);
     virtual int nextInput(ByteInStream &is, StdVnChar &stdChar, int &bytesRead);
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen);
 };
@@ -115,11 +187,18 @@ public:
 //--------------------------------------------------
 class UnicodeCharset : public VnCharset {
 protected:
-    UKDWORD m_vnChars[TOTAL_VNCHARS];
-    UnicodeChar *m_toUnicode;
+    // shared by all charsets of the same table, see CVnCharsetLib
+    const VnCodeMap &m_vnMap;
+    const UnicodeChar *m_toUnicode;
+
+    StdVnChar toStdChar(UnicodeChar uniCh) const {
+        int idx = m_vnMap.lookup(uniCh);
+        return (idx >= 0) ? VnStdCharOffset + idx : uniCh;
+    }
 
 public:
-    UnicodeCharset(UnicodeChar *vnChars);
+    // vnMap: the reverse of vnChars, see VnCodeMap::buildFrom
+    UnicodeCharset(const UnicodeChar *vnChars, const VnCodeMap &vnMap);
     virtual int nextInput(ByteInStream &is, StdVnChar &stdChar, int &bytesRead);
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen);
     virtual int elementSize();
@@ -129,11 +208,11 @@ public:
 class DoubleByteCharset : public VnCharset {
 protected:
     UKWORD m_stdMap[256];
-    UKDWORD m_vnChars[TOTAL_VNCHARS];
-    UKWORD *m_toDoubleChar;
+    VnCodeMap m_vnMap;
+    const UKWORD *m_toDoubleChar;
 
 public:
-    DoubleByteCharset(UKWORD *vnChars);
+    DoubleByteCharset(const UKWORD *vnChars);
     virtual int nextInput(ByteInStream &is, StdVnChar &stdChar, int &bytesRead);
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen);
 };
@@ -141,7 +220,8 @@ public:
 //--------------------------------------------------
 class UnicodeUTF8Charset : public UnicodeCharset {
 public:
-    UnicodeUTF8Charset(UnicodeChar *vnChars) : UnicodeCharset(vnChars) {}
+    UnicodeUTF8Charset(const UnicodeChar *vnChars, const VnCodeMap &vnMap)
+        : UnicodeCharset(vnChars, vnMap) {}
 
     virtual int nextInput(ByteInStream &is, StdVnChar &stdChar, int &bytesRead);
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen);
@@ -150,7 +230,8 @@ public:
 //--------------------------------------------------
 class UnicodeRefCharset : public UnicodeCharset {
 public:
-    UnicodeRefCharset(UnicodeChar *vnChars) : UnicodeCharset(vnChars) {}
+    UnicodeRefCharset(const UnicodeChar *vnChars, const VnCodeMap &vnMap)
+        : UnicodeCharset(vnChars, vnMap) {}
 
     virtual int nextInput(ByteInStream &is, StdVnChar &stdChar, int &bytesRead);
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen);
@@ -159,32 +240,30 @@ public:
 //--------------------------------------------------
 class UnicodeHexCharset : public UnicodeRefCharset {
 public:
-    UnicodeHexCharset(UnicodeChar *vnChars) : UnicodeRefCharset(vnChars) {}
+    UnicodeHexCharset(const UnicodeChar *vnChars, const VnCodeMap &vnMap)
+        : UnicodeRefCharset(vnChars, vnMap) {}
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen);
 };
 
 //--------------------------------------------------
 class UnicodeCStringCharset : public UnicodeCharset {
-protected:
-    int m_prevIsHex;
-
 public:
-    UnicodeCStringCharset(UnicodeChar *vnChars) : UnicodeCharset(vnChars) {}
+    UnicodeCStringCharset(const UnicodeChar *vnChars, const VnCodeMap &vnMap)
+        : UnicodeCharset(vnChars, vnMap) {}
     virtual int nextInput(ByteInStream &is, StdVnChar &stdChar, int &bytesRead);
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen);
-    virtual void startInput();
 };
 
 //--------------------------------------------------
 class WinCP1258Charset : public VnCharset {
 protected:
     UKWORD m_stdMap[256];
-    UKDWORD m_vnChars[TOTAL_VNCHARS * 2];
-    UKWORD *m_toDoubleChar;
-    int m_totalChars;
+    VnCodeMap m_vnMap;
+    const UKWORD *m_toDoubleChar;
 
 public:
-    WinCP1258Charset(UKWORD *compositeChars, UKWORD *precomposedChars);
+    WinCP1258Charset(const UKWORD *compositeChars,
+                     const UKWORD *precomposedChars);
     virtual int nextInput(ByteInStream &is, StdVnChar &stdChar, int &bytesRead);
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen);
 };
@@ -195,24 +274,42 @@ struct UniCompCharInfo {
     int stdIndex;
 };
 
+// combining marks that may follow a base character (5 tone marks)
+#define UNI_COMP_MAX_MARKS 8
+
 class UnicodeCompCharset : public VnCharset {
 protected:
-    UniCompCharInfo m_info[TOTAL_VNCHARS * 2];
-    UKDWORD *m_uniCompChars;
-    int m_totalChars;
+    VnCodeMap m_baseMap; // single code units
+    // base + combining mark pairs, one map per mark
+    UKWORD m_marks[UNI_COMP_MAX_MARKS];
+    VnCodeMap m_markMaps[UNI_COMP_MAX_MARKS];
+    int m_markCount;
+    const UKDWORD *m_uniCompChars;
+
+    int lookupPair(UKWORD base, UKWORD mark) const;
 
 public:
-    UnicodeCompCharset(UnicodeChar *uniChars, UKDWORD *uniCompChars);
+    UnicodeCompCharset(const UnicodeChar *uniChars,
+                       const UKDWORD *uniCompChars);
     virtual int nextInput(ByteInStream &is, StdVnChar &stdChar, int &bytesRead);
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen);
     virtual int elementSize();
 };
 
+//--------------------------------------------------
+// Keeps state between characters, so one object can only be used by one
+// conversion at a time, see VnConvCharset
 //--------------------------------------------------
 class VIQRCharset : public VnCharset {
 protected:
-    UKDWORD *m_vnChars;
+    const UKDWORD *m_vnChars;
     UKWORD m_stdMap[256];
+    const VnConvOptions *m_options;
+    int m_escState;    // in CVnCharsetLib::m_VIQREscPatterns
+    int m_outEscState; // in CVnCharsetLib::m_VIQROutEscPatterns
+
+    bool outEscFoundAt(UKBYTE b);
+    virtual bool statefulOutput() { return true; }
     int m_atWordBeginning;
     int m_escapeBowl;
     int m_escapeRoof;
@@ -224,7 +321,8 @@ protected:
 
 public:
     int m_suspicious;
-    VIQRCharset(UKDWORD *vnChars);
+    // options are read during the conversion, NULL for the library's
+    VIQRCharset(const UKDWORD *vnChars, const VnConvOptions *options = NULL);
     virtual void startInput();
     virtual void startOutput();
     virtual int nextInput(ByteInStream &is, StdVnChar &stdChar, int &bytesRead);
@@ -237,6 +335,7 @@ class UTF8VIQRCharset : public VnCharset {
 protected:
     VIQRCharset *m_pViqr;
     UnicodeUTF8Charset *m_pUtf;
+    virtual bool statefulOutput() { return true; }
 
 public:
     UTF8VIQRCharset(UnicodeUTF8Charset *pUtf, VIQRCharset *pViqr);
@@ -246,9 +345,15 @@ public:
     virtual int putChar(ByteOutStream &os, StdVnChar stdChar, int &outLen);
 };
 
+//--------------------------------------------------
+// All charsets are built by the constructor and never change afterwards,
+// only their output tables are filled once on first use, so getVnCharset and
+// the stateless charsets can be used from any thread.
 //--------------------------------------------------
 class DllInterface CVnCharsetLib {
 protected:
+    // UnicodeTable decoded, shared by all Unicode charsets
+    VnCodeMap m_uniMap;
     SingleByteCharset *m_sgCharsets[CONV_TOTAL_SINGLE_CHARSETS];
     DoubleByteCharset *m_dbCharsets[CONV_TOTAL_DOUBLE_CHARSETS];
     UnicodeCharset *m_pUniCharset;
@@ -263,28 +368,55 @@ protected:
     VnInternalCharset *m_pVnIntCharset;
 
 public:
+    // read-only, each VIQR charset keeps its own match state
     PatternList m_VIQREscPatterns, m_VIQROutEscPatterns;
+    // set by VnConvSetOptions, used by the calls that don't take options
     VnConvOptions m_options;
     CVnCharsetLib();
     ~CVnCharsetLib();
     VnCharset *getVnCharset(int charsetIdx);
+    // code unit to StdVnChar index of UnicodeTable
+    const VnCodeMap &unicodeMap() const { return m_uniMap; }
+};
+
+//--------------------------------------------------
+// Charset for one conversion. VIQR and UTF8VIQR keep state between
+// characters, for them the conversion gets its own object reading options;
+// all others are the shared objects of VnCharsetLibObj. Conversions in
+// different threads don't interfere then.
+//--------------------------------------------------
+class DllInterface VnConvCharset {
+public:
+    VnConvCharset(int charsetIdx, const VnConvOptions *options);
+    VnConvCharset(const VnConvCharset &) = delete;
+    VnConvCharset &operator=(const VnConvCharset &) = delete;
+
+    // NULL for an invalid charset
+    VnCharset *get() const { return m_charset; }
+
+protected:
+    VnCharset *m_charset;
+    std::optional<VIQRCharset> m_viqr;
+    std::optional<UTF8VIQRCharset> m_utf8Viqr;
 };
 
-extern unsigned char SingleByteTables[][TOTAL_VNCHARS];
-extern UKWORD DoubleByteTables[][TOTAL_VNCHARS];
-extern UnicodeChar UnicodeTable[TOTAL_VNCHARS];
-extern UKDWORD VIQRTable[TOTAL_VNCHARS];
-extern UKDWORD UnicodeComposite[TOTAL_VNCHARS];
-extern UKWORD WinCP1258[TOTAL_VNCHARS];
-extern UKWORD WinCP1258Pre[TOTAL_VNCHARS];
+// read-only, so shared between all processes using the library
+extern const unsigned char SingleByteTables[][TOTAL_VNCHARS];
+extern const UKWORD DoubleByteTables[][TOTAL_VNCHARS];
+extern const UnicodeChar UnicodeTable[TOTAL_VNCHARS];
+extern const UKDWORD VIQRTable[TOTAL_VNCHARS];
+extern const UKDWORD UnicodeComposite[TOTAL_VNCHARS];
+extern const UKWORD WinCP1258[TOTAL_VNCHARS];
+extern const UKWORD WinCP1258Pre[TOTAL_VNCHARS];
 
 extern DllInterface CVnCharsetLib VnCharsetLibObj;
 extern VnConvOptions VnConvGlobalOptions;
-extern int StdVnNoTone[TOTAL_VNCHARS];
-extern int StdVnRootChar[TOTAL_VNCHARS];
+extern const int StdVnNoTone[TOTAL_VNCHARS];
+extern const int StdVnRootChar[TOTAL_VNCHARS];
 
 DllInterface int genConvert(VnCharset &incs, VnCharset &outcs,
-                            ByteInStream &input, ByteOutStream &output);
+                            ByteInStream &input, ByteOutStream &output,
+                            const VnConvOptions &options);
 
 StdVnChar StdVnToUpper(StdVnChar ch);
 StdVnChar StdVnToLower(StdVnChar ch);
@@ -8,36 +8,55 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #if defined(_WIN32)
 #include <fcntl.h>
 #include <io.h>
+#else
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
 #endif
 
 #include "vnconv.h"
 
-int vnFileStreamConvert(int inCharset, int outCharset, FILE *inf, FILE *outf);
+int vnFileStreamConvert(int inCharset, int outCharset, FILE *inf, FILE *outf,
+                        const VnConvOptions &options);
 
 DllExport int genConvert(VnCharset &incs, VnCharset &outcs, ByteInStream &input,
-                         ByteOutStream &output) {
+                         ByteOutStream &output, const VnConvOptions &options) {
     StdVnChar stdChar;
     int bytesRead, bytesWritten;
 
     incs.startInput();
     outcs.startOutput();
+    const VnOutBytes *outTable = outcs.outputTable();
 
     int ret = 1;
     while (!input.eos()) {
         stdChar = 0;
         if (incs.nextInput(input, stdChar, bytesRead)) {
             if (stdChar != INVALID_STD_CHAR) {
-                if (VnCharsetLibObj.m_options.toLower)
+                if (options.toLower)
                     stdChar = StdVnToLower(stdChar);
-                else if (VnCharsetLibObj.m_options.toUpper)
+                else if (options.toUpper)
                     stdChar = StdVnToUpper(stdChar);
-                if (VnCharsetLibObj.m_options.removeTone)
+                if (options.removeTone)
                     stdChar = StdVnGetRoot(stdChar);
-                ret = outcs.putChar(output, stdChar, bytesWritten);
+                const VnOutBytes *out =
+                    outTable ? VnOutTableEntry(outTable, stdChar) : NULL;
+                if (out)
+                    ret = output.puts((const char *)out->b, out->len);
+                else
+                    ret = outcs.putChar(output, stdChar, bytesWritten);
             }
         } else
             break;
@@ -67,6 +86,20 @@ DllExport int genConvert(VnCharset &incs, VnCharset &outcs, ByteInStream &input,
 
 DllExport int VnConvert(int inCharset, int outCharset, UKBYTE *input,
                         UKBYTE *output, int *pInLen, int *pMaxOutLen) {
+    return VnConvertWithOptions(inCharset, outCharset,
+                                &VnCharsetLibObj.m_options, input, output,
+                                pInLen, pMaxOutLen);
+}
+
+//----------------------------------------------
+// Same as VnConvert, with the options of this call instead of the ones set
+// by VnConvSetOptions. Nothing shared is modified, so calls in different
+// threads can run at the same time.
+//----------------------------------------------
+DllExport int VnConvertWithOptions(int inCharset, int outCharset,
+                                   const VnConvOptions *pOptions,
+                                   UKBYTE *input, UKBYTE *output, int *pInLen,
+                                   int *pMaxOutLen) {
     int inLen, maxOutLen;
     int ret = -1;
 
@@ -76,16 +109,25 @@ DllExport int VnConvert(int inCharset, int outCharset, UKBYTE *input,
     if (inLen != -1 && inLen < 0) // invalid inLen
         return ret;
 
-    VnCharset *pInCharset = VnCharsetLibObj.getVnCharset(inCharset);
-    VnCharset *pOutCharset = VnCharsetLibObj.getVnCharset(outCharset);
+    VnConvCharset inCs(inCharset, pOptions);
+    VnConvCharset outCs(outCharset, pOptions);
+    VnCharset *pInCharset = inCs.get();
+    VnCharset *pOutCharset = outCs.get();
 
     if (!pInCharset || !pOutCharset)
         return VNCONV_INVALID_CHARSET;
 
+    if (inLen != -1) {
+        ret = VnConvertBlockWithOptions(inCharset, outCharset, pOptions, input,
+                                        output, pInLen, pMaxOutLen, 1);
+        if (ret != VNCONV_INVALID_CHARSET)
+            return ret;
+    }
+
     StringBIStream is(input, inLen, pInCharset->elementSize());
     StringBOStream os(output, maxOutLen);
 
-    ret = genConvert(*pInCharset, *pOutCharset, is, os);
+    ret = genConvert(*pInCharset, *pOutCharset, is, os, *pOptions);
     *pMaxOutLen = os.getOutBytes();
     *pInLen = is.left();
     return ret;
@@ -104,7 +146,7 @@ DllExport int VnFileConvert(int inCharset, int outCharset, const char *inFile,
     FILE *inf = NULL;
     FILE *outf = NULL;
     int ret = 0;
-    char tmpName[32];
+    std::string tmpName;
 
     if (inFile == NULL) {
         inf = stdin;
@@ -123,60 +165,55 @@ DllExport int VnFileConvert(int inCharset, int outCharset, const char *inFile,
         outf = stdout;
     else {
         // setup temporary output file (because real output file may be the same
-        // as input file
-        char outDir[256];
-        strcpy(outDir, outFile);
-
+        // as input file), in the same directory so that it can be renamed
 #if defined(_WIN32)
-        char *p = strrchr(outDir, '\\');
+        const char *p = strrchr(outFile, '\\');
 #else
-        char *p = strrchr(outDir, '/');
+        const char *p = strrchr(outFile, '/');
 #endif
-
-        if (p == NULL)
-            outDir[0] = 0;
-        else
-            *p = 0;
-
-        strcpy(tmpName, outDir);
-        strcat(tmpName, "XXXXXX");
-
-        if (mkstemp(tmpName) == -1) {
-            fclose(inf);
+        if (p != NULL)
+            tmpName.assign(outFile, p + 1 - outFile);
+        tmpName += ".vnconvXXXXXX";
+
+        int fd = mkstemp(&tmpName[0]);
+        if (fd == -1) {
+            if (inf != stdin)
+                fclose(inf);
             ret = VNCONV_ERR_OUTPUT_FILE;
             goto end;
         }
-        outf = fopen(tmpName, "wb");
+        outf = fdopen(fd, "wb");
 
         if (outf == NULL) {
-            fclose(inf);
+            close(fd);
+            remove(tmpName.c_str());
+            if (inf != stdin)
+                fclose(inf);
             ret = VNCONV_ERR_OUTPUT_FILE;
             goto end;
         }
     }
 
-    ret = vnFileStreamConvert(inCharset, outCharset, inf, outf);
+    ret = vnFileStreamConvert(inCharset, outCharset, inf, outf,
+                              VnCharsetLibObj.m_options);
     if (inf != stdin)
         fclose(inf);
     if (outf != stdout) {
-        fclose(outf);
+        if (fclose(outf) != 0 && ret == 0)
+            ret = VNCONV_ERR_WRITING;
 
-        // delete output file if exisits
         if (ret == 0) {
+#if defined(_WIN32)
+            // rename doesn't replace an existing file here
             remove(outFile);
-#if !defined(_WIN32)
-            char cmd[256];
-            sprintf(cmd, "mv %s %s", tmpName, outFile);
-            cmd[0] = system(cmd);
-#else
-            if (rename(tmpName, outFile) != 0) {
-                remove(tmpName);
+#endif
+            if (rename(tmpName.c_str(), outFile) != 0) {
+                remove(tmpName.c_str());
                 ret = VNCONV_ERR_OUTPUT_FILE;
                 goto end;
             }
-#endif
         } else
-            remove(tmpName);
+            remove(tmpName.c_str());
     }
 
 end:
@@ -188,14 +225,272 @@ end:
     return ret;
 }
 
+//------------------------------------------------
+// Convert a file in blocks with VnConvertBlock.
+// Returns false if the pair has no block kernel,
+// otherwise true with the result in ret
+//------------------------------------------------
+#define FILE_CONV_BLOCK_SIZE 65536
+// longest output of one input byte, see blockconv.cpp
+#define FILE_CONV_MAX_EXPANSION 8
+
+static bool vnFileBlockConvert(int inCharset, int outCharset,
+                               const VnConvOptions &options, FILE *inf,
+                               FILE *outf, int &ret) {
+    // probe with an empty block
+    int inLen = 0, outLen = 0;
+    UKBYTE dummy;
+    if (VnConvertBlockWithOptions(inCharset, outCharset, &options, &dummy,
+                                  &dummy, &inLen, &outLen,
+                                  0) == VNCONV_INVALID_CHARSET)
+        return false;
+
+    std::vector<UKBYTE> inBuf(FILE_CONV_BLOCK_SIZE);
+    std::vector<UKBYTE> outBuf(FILE_CONV_BLOCK_SIZE * FILE_CONV_MAX_EXPANSION);
+    int carry = 0;
+    int final = 0;
+    ret = 0;
+    while (!final) {
+        int n = fread(inBuf.data() + carry, 1, inBuf.size() - carry, inf);
+        if (n < (int)inBuf.size() - carry) {
+            if (ferror(inf)) {
+                ret = VNCONV_ERR_INPUT_FILE;
+                break;
+            }
+            final = 1;
+        }
+        inLen = carry + n;
+        outLen = outBuf.size();
+        ret = VnConvertBlockWithOptions(inCharset, outCharset, &options,
+                                        inBuf.data(), outBuf.data(), &inLen,
+                                        &outLen, final);
+        if (ret != 0)
+            break;
+        if (outLen > 0 &&
+            fwrite(outBuf.data(), 1, outLen, outf) != (size_t)outLen) {
+            ret = VNCONV_ERR_WRITING;
+            break;
+        }
+        // keep an incomplete character for the next block
+        memmove(inBuf.data(), inBuf.data() + carry + n - inLen, inLen);
+        carry = inLen;
+    }
+    return true;
+}
+
+#if !defined(_WIN32)
+//------------------------------------------------
+// Mapped file conversion
+//------------------------------------------------
+// Files are converted in rounds of one chunk per core. Each chunk ends at a
+// character boundary, so it can be converted on its own (final block).
+#define PAR_CONV_CHUNK_SIZE (4 << 20)
+// how far past the nominal chunk end to look for a line break
+#define PAR_CONV_SPLIT_WINDOW 65536
+
+static int FileConvThreads = 0;
+
+//------------------------------------------------
+// Returns a position in (pos, size] where the input can be split
+//------------------------------------------------
+static size_t vnSplitPoint(int inCharset, const UKBYTE *data, size_t pos,
+                           size_t size) {
+    if (pos >= size)
+        return size;
+    if (IS_SINGLE_BYTE_CHARSET(inCharset))
+        return pos;
+
+    // a line break is a complete character in all block charsets, and never
+    // starts a double-byte pair
+    size_t window = std::min(size - pos, (size_t)PAR_CONV_SPLIT_WINDOW);
+    const UKBYTE *nl = (const UKBYTE *)memchr(data + pos, '\n', window);
+    if (nl != NULL)
+        return nl + 1 - data;
+
+    if (IS_DOUBLE_BYTE_CHARSET(inCharset)) {
+        size_t end = pos + window;
+        for (; pos < end; pos++) {
+            if (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\r')
+                return pos + 1;
+        }
+        return vnSplitPoint(inCharset, data, end, size);
+    }
+
+    // UTF-8: split before any byte that is not a continuation byte
+    while (pos < size && (data[pos] & 0xC0) == 0x80)
+        pos++;
+    return pos;
+}
+
+//------------------------------------------------
+// Convert one chunk into out, growing it as needed
+//------------------------------------------------
+static int vnConvertChunk(int inCharset, int outCharset,
+                          const VnConvOptions &options, const UKBYTE *data,
+                          size_t len, std::vector<UKBYTE> &out) {
+    out.clear();
+    while (len > 0) {
+        int inLen = (int)std::min(len, (size_t)FILE_CONV_BLOCK_SIZE * 16);
+        int blockLen = inLen;
+        size_t outPos = out.size();
+        out.resize(outPos + (size_t)inLen * FILE_CONV_MAX_EXPANSION);
+        int outLen = (int)(out.size() - outPos);
+        int isLast = (size_t)inLen == len;
+        int ret = VnConvertBlockWithOptions(inCharset, outCharset, &options,
+                                            data, &out[outPos], &inLen,
+                                            &outLen, isLast);
+        if (ret != 0)
+            return ret;
+        out.resize(outPos + outLen);
+        // inLen bytes of an incomplete character are left for the next block
+        data += blockLen - inLen;
+        len -= blockLen - inLen;
+        if (inLen == blockLen)
+            return VNCONV_UNKNOWN_ERROR; // no progress
+    }
+    return 0;
+}
+
+//------------------------------------------------
+// Write all buffers with as few system calls as possible
+//------------------------------------------------
+static int vnWriteAll(int fd, std::vector<std::vector<UKBYTE>> &bufs,
+                      size_t count) {
+    std::vector<struct iovec> iov;
+    for (size_t i = 0; i < count; i++) {
+        if (!bufs[i].empty())
+            iov.push_back({bufs[i].data(), bufs[i].size()});
+    }
+    size_t first = 0;
+    while (first < iov.size()) {
+        int n = (int)std::min(iov.size() - first, (size_t)IOV_MAX);
+        ssize_t written = writev(fd, &iov[first], n);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return VNCONV_ERR_WRITING;
+        }
+        // skip what was written, possibly in the middle of a buffer
+        while (first < iov.size() && (size_t)written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            first++;
+        }
+        if (written > 0) {
+            iov[first].iov_base = (UKBYTE *)iov[first].iov_base + written;
+            iov[first].iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------
+static int vnMappedBlockConvert(int inCharset, int outCharset,
+                                const VnConvOptions &options,
+                                const UKBYTE *data, size_t size, int outFd) {
+    unsigned int threads = 1;
+    if (size > PAR_CONV_CHUNK_SIZE)
+        threads = (FileConvThreads > 0)
+                      ? FileConvThreads
+                      : std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::vector<UKBYTE>> outBufs(threads);
+    std::vector<int> rets(threads);
+    std::vector<std::thread> workers;
+    size_t pos = 0;
+    while (pos < size) {
+        size_t chunks = 0;
+        workers.clear();
+        for (; chunks < threads && pos < size; chunks++) {
+            size_t end = vnSplitPoint(inCharset, data,
+                                      pos + PAR_CONV_CHUNK_SIZE, size);
+            auto work = [=, &outBufs, &rets]() {
+                rets[chunks] =
+                    vnConvertChunk(inCharset, outCharset, options, data + pos,
+                                   end - pos, outBufs[chunks]);
+            };
+            // block converters are cached per thread, the workers don't
+            // share any state but the read-only charsets
+            if (chunks + 1 < threads)
+                workers.emplace_back(work);
+            else
+                work();
+            pos = end;
+        }
+        for (auto &worker : workers)
+            worker.join();
+        for (size_t i = 0; i < chunks; i++) {
+            if (rets[i] != 0)
+                return rets[i];
+        }
+        int ret = vnWriteAll(outFd, outBufs, chunks);
+        if (ret != 0)
+            return ret;
+    }
+    return 0;
+}
+
+//------------------------------------------------
+// Convert a regular file through a memory mapping.
+// Returns false if the file can't be mapped,
+// otherwise true with the result in ret
+//------------------------------------------------
+static bool vnMappedFileConvert(VnCharset &incs, VnCharset &outcs,
+                                int inCharset, int outCharset,
+                                const VnConvOptions &options, FILE *inf,
+                                FILE *outf, int &ret) {
+    struct stat st;
+    int inFd = fileno(inf);
+    if (inFd < 0 || fstat(inFd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_size <= 0)
+        return false;
+    // the mapping covers the whole file, from the start
+    if (lseek(inFd, 0, SEEK_CUR) != 0)
+        return false;
+
+    size_t size = st.st_size;
+    // private and writable, StringBIStream::unget writes to its buffer
+    void *map =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, inFd, 0);
+    if (map == MAP_FAILED)
+        return false;
+    madvise(map, size, MADV_SEQUENTIAL);
+    UKBYTE *data = (UKBYTE *)map;
+
+    int inLen = 0, outLen = 0;
+    UKBYTE dummy;
+    if (VnConvertBlockWithOptions(inCharset, outCharset, &options, &dummy,
+                                  &dummy, &inLen, &outLen,
+                                  1) != VNCONV_INVALID_CHARSET) {
+        ret = (fflush(outf) == 0)
+                  ? vnMappedBlockConvert(inCharset, outCharset, options, data,
+                                         size, fileno(outf))
+                  : VNCONV_ERR_WRITING;
+    } else if (size <= INT_MAX) {
+        // stateful charsets: sequential, still without read() copies
+        StringBIStream is(data, (int)size, incs.elementSize());
+        FileBOStream os;
+        os.attach(outf);
+        ret = genConvert(incs, outcs, is, os, options);
+    } else {
+        munmap(map, size);
+        return false;
+    }
+    munmap(map, size);
+    return true;
+}
+#endif
+
 //------------------------------------------------
 // Returns:
 //     0: successful
 //     errCode: if failed
 //---------------------------------------
-int vnFileStreamConvert(int inCharset, int outCharset, FILE *inf, FILE *outf) {
-    VnCharset *pInCharset = VnCharsetLibObj.getVnCharset(inCharset);
-    VnCharset *pOutCharset = VnCharsetLibObj.getVnCharset(outCharset);
+int vnFileStreamConvert(int inCharset, int outCharset, FILE *inf, FILE *outf,
+                        const VnConvOptions &options) {
+    VnConvCharset inCs(inCharset, &options);
+    VnConvCharset outCs(outCharset, &options);
+    VnCharset *pInCharset = inCs.get();
+    VnCharset *pOutCharset = outCs.get();
 
     if (!pInCharset || !pOutCharset)
         return VNCONV_INVALID_CHARSET;
@@ -205,23 +500,52 @@ int vnFileStreamConvert(int inCharset, int outCharset, FILE *inf, FILE *outf) {
         fwrite(&sign, sizeof(UKWORD), 1, outf);
     }
 
+    int ret;
+#if !defined(_WIN32)
+    if (vnMappedFileConvert(*pInCharset, *pOutCharset, inCharset, outCharset,
+                            options, inf, outf, ret))
+        return ret;
+#endif
+    if (vnFileBlockConvert(inCharset, outCharset, options, inf, outf, ret))
+        return ret;
+
     FileBIStream is;
     FileBOStream os;
 
     is.attach(inf);
     os.attach(outf);
 
-    return genConvert(*pInCharset, *pOutCharset, is, os);
+    return genConvert(*pInCharset, *pOutCharset, is, os, options);
+}
+
+//------------------------------------------------
+// Number of threads used by VnFileConvert for one file.
+// 0: one per core
+//------------------------------------------------
+DllExport void VnConvSetFileThreads(int threads) {
+#if !defined(_WIN32)
+    FileConvThreads = (threads < 0) ? 0 : threads;
+#endif
+}
+
+//------------------------------------------------
+DllExport int VnConvCharsetId(const char *name) {
+    for (int i = 0; i < CharsetCount; i++) {
+        if (strcasecmp(CharsetIdMap[i].name, name) == 0)
+            return CharsetIdMap[i].id;
+    }
+    return -1;
 }
 
+// same order as VnConvError
 const char *ErrTable[VNCONV_LAST_ERROR] = {
     "No error",
     "Unknown error",
     "Invalid charset",
     "Error opening input file",
     "Error opening output file",
-    "Error writing to output stream",
     "Not enough memory",
+    "Error writing to output stream",
 };
 
 DllExport const char *VnConvErrMsg(int errCode) {
@@ -38,16 +38,14 @@ Steps to add a 2-byte charset:
 - Double-byte characters are represented as a word in which the
   low byte is base character, high byte is tone mark (if present).
 */
-extern CharsetNameId CharsetIdMap[];
-extern const int CharsetCount;
-
-CharsetNameId CharsetIdMap[] = {{"BKHCM1", CONV_CHARSET_BKHCM1},
+const CharsetNameId CharsetIdMap[] = {{"BKHCM1", CONV_CHARSET_BKHCM1},
                                 {"BKHCM2", CONV_CHARSET_BKHCM2},
                                 {"ISC", CONV_CHARSET_ISC},
                                 {"NCR-DEC", CONV_CHARSET_UNIREF},
                                 {"NCR-HEX", CONV_CHARSET_UNIREF_HEX},
                                 {"TCVN3", CONV_CHARSET_TCVN3},
                                 {"UNI-COMP", CONV_CHARSET_UNIDECOMPOSED},
+                                {"UNI-CSTRING", CONV_CHARSET_UNI_CSTRING},
                                 {"UNICODE", CONV_CHARSET_UNICODE},
                                 {"UTF-8", CONV_CHARSET_UNIUTF8},
                                 {"UTF8", CONV_CHARSET_UNIUTF8},
@@ -59,7 +57,8 @@ CharsetNameId CharsetIdMap[] = {{"BKHCM1", CONV_CHARSET_BKHCM1},
                                 {"VNI-MAC", CONV_CHARSET_VNIMAC},
                                 {"VNI-WIN", CONV_CHARSET_VNIWIN},
                                 {"VPS", CONV_CHARSET_VPS},
-                                {"WINCP-1258", CONV_CHARSET_WINCP1258}};
+                                {"WINCP-1258", CONV_CHARSET_WINCP1258},
+                                {"XUTF8", CONV_CHARSET_XUTF8}};
 
 const int CharsetCount = sizeof(CharsetIdMap) / sizeof(CharsetNameId);
 
@@ -74,7 +73,7 @@ its code point in the charset must be set to zero.
 See TCVN3 & VPS below for examples
 */
 
-unsigned char SingleByteTables[][TOTAL_VNCHARS] =
+const unsigned char SingleByteTables[][TOTAL_VNCHARS] =
 
     // TCVN3
     {{static_cast<unsigned char>('A'),
@@ -1361,7 +1360,7 @@ unsigned char SingleByteTables[][TOTAL_VNCHARS] =
       0x00,
       0x00}};
 
-UKWORD DoubleByteTables[][TOTAL_VNCHARS] = {
+const UKWORD DoubleByteTables[][TOTAL_VNCHARS] = {
     // VNI-WIN
     {0x0041, 0x0061, 0xd941, 0xf961, 0xd841, 0xf861, 0xdb41, 0xfb61, 0xd541,
      0xf561, 0xcf41, 0xef61, // a
@@ -1509,7 +1508,7 @@ UKWORD DoubleByteTables[][TOTAL_VNCHARS] = {
      0x003f, 0x00dc, 0x00ce, 0x003f, 0x00d4, 0x00d5, 0x00d2, 0x00d3, 0x00a5,
      0x00d0, 0x00d1, 0x00f7, 0x00aa, 0x003f, 0x00dd, 0x00cf, 0x003f, 0x00d9}};
 
-UKWORD WinCP1258[TOTAL_VNCHARS] =
+const UKWORD WinCP1258[TOTAL_VNCHARS] =
     // Windows CP 1258
     {0x0041, 0x0061, 0xec41, 0xec61, 0xcc41, 0xcc61, 0xd241, 0xd261, 0xde41,
      0xde61, 0xf241, 0xf261, // a
@@ -1548,7 +1547,7 @@ UKWORD WinCP1258[TOTAL_VNCHARS] =
      0x008A, 0x008B, 0x008C, 0x008E, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095,
      0x0096, 0x0097, 0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009E, 0x009F};
 
-UKWORD WinCP1258Pre[TOTAL_VNCHARS] =
+const UKWORD WinCP1258Pre[TOTAL_VNCHARS] =
     // Windows CP1258 - with some more precomposed characters
     {0x0041, 0x0061, 0x00c1, 0x00e1, 0x00c0, 0x00e0, 0xd241, 0xd261, 0xde41,
      0xde61, 0xf241, 0xf261, // a
@@ -1587,7 +1586,7 @@ UKWORD WinCP1258Pre[TOTAL_VNCHARS] =
      0x008A, 0x008B, 0x008C, 0x008E, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095,
      0x0096, 0x0097, 0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009E, 0x009F};
 
-UnicodeChar UnicodeTable[TOTAL_VNCHARS] = {
+const UnicodeChar UnicodeTable[TOTAL_VNCHARS] = {
     0x0041, 0x0061, 0x00c1, 0x00e1, 0x00c0, 0x00e0, 0x1ea2, 0x1ea3, 0x00c3,
     0x00e3, 0x1ea0, 0x1ea1, // a
     0x00c2, 0x00e2, 0x1ea4, 0x1ea5, 0x1ea6, 0x1ea7, 0x1ea8, 0x1ea9, 0x1eaa,
@@ -1646,7 +1645,7 @@ unsigned char WesternSymbols[] =
 + 0x2b
 
 */
-UKDWORD VIQRTable[TOTAL_VNCHARS] = {
+const UKDWORD VIQRTable[TOTAL_VNCHARS] = {
     0x41,     0x61,     0x2741,   0x2761,   0x6041,   0x6061,   0x3f41,
     0x3f61,   0x7e41,   0x7e61,   0x2e41,   0x2e61, // a
     0x5e41,   0x5e61,   0x275e41, 0x275e61, 0x605e41, 0x605e61, 0x3f5e41,
@@ -1684,7 +1683,7 @@ UKDWORD VIQRTable[TOTAL_VNCHARS] = {
     0x92,     0x93,     0x94,     0x95,     0x96,     0x97,     0x98,
     0x99,     0x9A,     0x9B,     0x9C,     0x9E,     0x9F};
 
-UKDWORD UnicodeComposite[TOTAL_VNCHARS] = {
+const UKDWORD UnicodeComposite[TOTAL_VNCHARS] = {
     0x00000041, 0x00000061, 0x03010041, 0x03010061, 0x03000041, 0x03000061, // a
     0x03090041, 0x03090061, 0x03030041, 0x03030061, 0x03230041, 0x03230061, // a
 
@@ -1745,7 +1744,7 @@ UKDWORD UnicodeComposite[TOTAL_VNCHARS] = {
     0x0160, 0x2039, 0x0152, 0x017D, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022,
     0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x017E, 0x0178};
 
-int StdVnRootChar[TOTAL_VNCHARS] = {
+const int StdVnRootChar[TOTAL_VNCHARS] = {
     0,   1,   0,   1,   0,   1,   0,   1,   0,   1,   0,   1, // a [A=0]
     0,   1,   0,   1,   0,   1,   0,   1,   0,   1,   0,   1, // a^ -> a
     0,   1,   0,   1,   0,   1,   0,   1,   0,   1,   0,   1, // a( -> a
@@ -1768,7 +1767,7 @@ int StdVnRootChar[TOTAL_VNCHARS] = {
     186, 187, 188, 189, 190, 191, 192, 193, 194, 195, 196, 197, 198, 199,
     200, 201, 202, 203, 204, 205, 206, 207, 208, 209, 210, 211, 212};
 
-int StdVnNoTone[TOTAL_VNCHARS] = {
+const int StdVnNoTone[TOTAL_VNCHARS] = {
     0,   1,   0,   1,   0,   1,   0,   1,   0,   1,   0,   1,  // a [A=0]
     12,  13,  12,  13,  12,  13,  12,  13,  12,  13,  12,  13, // a^
     24,  25,  24,  25,  24,  25,  24,  25,  24,  25,  24,  25, // a(
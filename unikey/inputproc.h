@@ -8,7 +8,7 @@
 
 #include "keycons.h"
 #include "vnlexi.h"
-#include <unordered_set>
+#include <array>
 
 #if defined(_WIN32)
 #define DllExport __declspec(dllexport)
@@ -48,7 +48,7 @@ enum UkKeyEvName {
     vneCount   // just to count how many event types there are
 };
 
-enum UkCharType { ukcVn, ukcWordBreak, ukcNonVn, ukcReset };
+enum UkCharType : signed char { ukcVn, ukcWordBreak, ukcNonVn, ukcReset };
 
 struct UkKeyEvent {
     int evType;
@@ -76,7 +76,7 @@ public:
 
     UkInputMethod getIM() const { return m_im; }
 
-    void keyCodeToEvent(unsigned int keyCode, UkKeyEvent &ev);
+    inline void keyCodeToEvent(unsigned int keyCode, UkKeyEvent &ev) const;
     void keyCodeToSymbol(unsigned int keyCode, UkKeyEvent &ev);
     int setIM(UkInputMethod im);
     int setIM(int map[256]);
@@ -88,26 +88,204 @@ protected:
     static bool m_classInit;
 
     UkInputMethod m_im;
+    // built-in key map of m_im, or 0 for UkUsrIM, which uses m_keyMap.
+    // The built-in maps are static tables, switching between them only
+    // changes this pointer.
+    const int *m_builtInMap;
     int m_keyMap[256];
 
-    void useBuiltIn(UkKeyMapping *map);
+    const int *keyMap() const {
+        return m_builtInMap ? m_builtInMap : m_keyMap;
+    }
 };
 
 void UkResetKeyMap(int keyMap[256]);
-void SetupInputClassifierTable();
 
-DllInterface extern UkKeyMapping TelexMethodMapping[];
-DllInterface extern UkKeyMapping SimpleTelexMethodMapping[];
-DllInterface extern UkKeyMapping SimpleTelex2MethodMapping[];
-DllInterface extern UkKeyMapping VniMethodMapping[];
-DllInterface extern UkKeyMapping VIQRMethodMapping[];
-DllInterface extern UkKeyMapping MsViMethodMapping[];
+DllInterface extern const UkKeyMapping TelexMethodMapping[];
+DllInterface extern const UkKeyMapping SimpleTelexMethodMapping[];
+DllInterface extern const UkKeyMapping SimpleTelex2MethodMapping[];
+DllInterface extern const UkKeyMapping VniMethodMapping[];
+DllInterface extern const UkKeyMapping VIQRMethodMapping[];
+DllInterface extern const UkKeyMapping MsViMethodMapping[];
 
-extern VnLexiName IsoVnLexiMap[];
-inline VnLexiName IsoToVnLexi(unsigned int keyCode) {
+// key maps of the built-in input methods, built from the mappings above
+DllInterface extern const std::array<int, 256> TelexKeyMap;
+DllInterface extern const std::array<int, 256> SimpleTelexKeyMap;
+DllInterface extern const std::array<int, 256> SimpleTelex2KeyMap;
+DllInterface extern const std::array<int, 256> VniKeyMap;
+DllInterface extern const std::array<int, 256> VIQRKeyMap;
+DllInterface extern const std::array<int, 256> MsViKeyMap;
+
+// Telex for anything else than a built-in input method
+inline const int *UkBuiltInKeyMap(UkInputMethod im) {
+    switch (im) {
+    case UkSimpleTelex:
+        return SimpleTelexKeyMap.data();
+    case UkSimpleTelex2:
+        return SimpleTelex2KeyMap.data();
+    case UkVni:
+        return VniKeyMap.data();
+    case UkViqr:
+        return VIQRKeyMap.data();
+    case UkMsVi:
+        return MsViKeyMap.data();
+    default:
+        return TelexKeyMap.data();
+    }
+}
+
+inline constexpr VnLexiName AZLexiUpper[] = {
+    vnl_A, vnl_B, vnl_C, vnl_D, vnl_E, vnl_F, vnl_G, vnl_H, vnl_I,
+    vnl_J, vnl_K, vnl_L, vnl_M, vnl_N, vnl_O, vnl_P, vnl_Q, vnl_R,
+    vnl_S, vnl_T, vnl_U, vnl_V, vnl_W, vnl_X, vnl_Y, vnl_Z};
+
+inline constexpr VnLexiName AZLexiLower[] = {
+    vnl_a, vnl_b, vnl_c, vnl_d, vnl_e, vnl_f, vnl_g, vnl_h, vnl_i,
+    vnl_j, vnl_k, vnl_l, vnl_m, vnl_n, vnl_o, vnl_p, vnl_q, vnl_r,
+    vnl_s, vnl_t, vnl_u, vnl_v, vnl_w, vnl_x, vnl_y, vnl_z};
+
+struct UkAscVnLexi {
+    unsigned char asc;
+    VnLexiName lexi;
+};
+
+// List of western characters outside range A-Z that are
+// also Vietnamese characters
+inline constexpr UkAscVnLexi AscVnLexiList[] = {
+    {0xC0, vnl_A2}, {0xC1, vnl_A1}, {0xC2, vnl_Ar}, {0xC2, vnl_A4},
+    {0xC8, vnl_E2}, {0xC9, vnl_E1}, {0xCA, vnl_Er}, {0xCC, vnl_I2},
+    {0xCD, vnl_I1}, {0xD2, vnl_O2}, {0xD3, vnl_O1}, {0xD4, vnl_Or},
+    {0xD5, vnl_O4}, {0xD9, vnl_U2}, {0xDA, vnl_U1}, {0xDD, vnl_Y1},
+    {0xE0, vnl_a2}, {0xE1, vnl_a1}, {0xE2, vnl_ar}, {0xE3, vnl_a4},
+    {0xE8, vnl_e2}, {0xE9, vnl_e1}, {0xEA, vnl_er}, {0xEC, vnl_i2},
+    {0xED, vnl_i1}, {0xF2, vnl_o2}, {0xF3, vnl_o1}, {0xF4, vnl_or},
+    {0xF5, vnl_o4}, {0xF9, vnl_u2}, {0xFA, vnl_u1}, {0xFD, vnl_y1}};
+
+//-------------------------------------------
+constexpr std::array<VnLexiName, 256> UkBuildIsoVnLexiMap() {
+    std::array<VnLexiName, 256> map{};
+    for (auto &lexi : map)
+        lexi = vnl_nonVnChar;
+    for (const auto &entry : AscVnLexiList)
+        map[entry.asc] = entry.lexi;
+    for (int c = 0; c < 26; c++) {
+        map['a' + c] = AZLexiLower[c];
+        map['A' + c] = AZLexiUpper[c];
+    }
+    return map;
+}
+
+inline constexpr std::array<VnLexiName, 256> IsoVnLexiMap =
+    UkBuildIsoVnLexiMap();
+
+constexpr VnLexiName IsoToVnLexi(unsigned int keyCode) {
     return (keyCode >= 256) ? vnl_nonVnChar : IsoVnLexiMap[keyCode];
 }
 
-extern const std::unordered_set<unsigned char> WordBreakSyms;
+// we excluded ~, `, ^
+inline constexpr unsigned char WordBreakSymList[] = {
+    ',', ';', ':', '.', '\"', '\'', '!',  '?', ' ', '<',
+    '>', '=', '+', '-', '*',  '/',  '\\', '_', '@', '#',
+    '$', '%', '&', '(', ')',  '{',  '}',  '[', ']', '|'};
+
+// digits and consonants that are never turned into a modifier key
+inline constexpr unsigned char AutoCommitSymList[] =
+    "0123456789bcfghjklmnpqrstvxzBCFGHJKLMNPQRSTVXZ";
+
+// Classes of a Latin-1 character, packed in one UkCharClassMap entry.
+// The low two bits hold its UkCharType.
+enum UkCharClass {
+    ukccTypeMask = 0x03,
+    ukccWordBreak = 0x04,   // in WordBreakSymList
+    ukccAutoCommit = 0x08,  // in AutoCommitSymList
+    ukccVnChar = 0x10,      // has an IsoVnLexiMap entry
+    ukccRebuildable = 0x20, // printable and not a word break
+};
+
+//-------------------------------------------
+constexpr std::array<unsigned char, 256> UkBuildCharClassMap() {
+    std::array<unsigned char, 256> map{};
+    unsigned int c;
+
+    for (c = 0; c <= 32; c++)
+        map[c] = ukcReset;
+    for (c = 33; c < 256; c++)
+        map[c] = ukcNonVn;
+
+    for (c = 'a'; c <= 'z'; c++)
+        map[c] = ukcVn;
+    for (c = 'A'; c <= 'Z'; c++)
+        map[c] = ukcVn;
+    for (const auto &entry : AscVnLexiList)
+        map[entry.asc] = ukcVn;
+
+    map['j'] = ukcNonVn;
+    map['J'] = ukcNonVn;
+    map['f'] = ukcNonVn;
+    map['F'] = ukcNonVn;
+    map['w'] = ukcNonVn;
+    map['W'] = ukcNonVn;
+
+    for (auto wordBreakSym : WordBreakSymList) {
+        map[wordBreakSym] = ukcWordBreak;
+        map[wordBreakSym] |= ukccWordBreak;
+    }
+
+    for (int i = 0; AutoCommitSymList[i]; i++)
+        map[AutoCommitSymList[i]] |= ukccAutoCommit;
+
+    for (c = 0; c < 256; c++) {
+        if (IsoVnLexiMap[c] != vnl_nonVnChar)
+            map[c] |= ukccVnChar;
+        if (c >= 32 && c != 127 && !(map[c] & ukccWordBreak))
+            map[c] |= ukccRebuildable;
+    }
+    return map;
+}
+
+inline constexpr std::array<unsigned char, 256> UkCharClassMap =
+    UkBuildCharClassMap();
+
+inline bool UkHasCharClass(unsigned char c, int charClass) {
+    return UkCharClassMap[c] & charClass;
+}
+
+//-------------------------------------------
+// The event of a key under keyMap. Inline, so that an engine specialised for
+// one input method looks its built-in map up directly.
+//-------------------------------------------
+inline void UkKeyCodeToEvent(const int *keyMap, unsigned int keyCode,
+                             UkKeyEvent &ev) {
+    ev.keyCode = keyCode;
+    if (keyCode == 0) {
+        ev.evType = vneNormal;
+        ev.vnSym = vnl_nonVnChar;
+        ev.chType = ukcWordBreak;
+    } else if (keyCode > 255) {
+        ev.evType = vneNormal;
+        ev.vnSym = IsoToVnLexi(keyCode);
+        ev.chType = (ev.vnSym == vnl_nonVnChar) ? ukcNonVn : ukcVn;
+    } else {
+        ev.chType = (UkCharType)(UkCharClassMap[keyCode] & ukccTypeMask);
+        ev.evType = keyMap[keyCode];
+
+        if (ev.evType >= vneTone0 && ev.evType <= vneTone5) {
+            ev.tone = ev.evType - vneTone0;
+        }
+
+        if (ev.evType >= vneCount) {
+            ev.chType = ukcVn;
+            ev.vnSym = (VnLexiName)(ev.evType - vneCount);
+            ev.evType = vneMapChar;
+        } else {
+            ev.vnSym = IsoToVnLexi(keyCode);
+        }
+    }
+}
+
+inline void UkInputProcessor::keyCodeToEvent(unsigned int keyCode,
+                                             UkKeyEvent &ev) const {
+    UkKeyCodeToEvent(keyMap(), keyCode, ev);
+}
 
 #endif
@@ -10,11 +10,8 @@
 #define MAX_MACRO_KEY_LEN 16
 // #define MAX_MACRO_TEXT_LEN 256
 #define MAX_MACRO_TEXT_LEN 1024
-#define MAX_MACRO_ITEMS 1024
 #define MAX_MACRO_LINE (MAX_MACRO_TEXT_LEN + MAX_MACRO_KEY_LEN)
 
-#define MACRO_MEM_SIZE (1024 * 128) // 128 KB
-
 #define CP_US_ANSI 1252
 
 enum UkInputMethod {
@@ -39,6 +36,9 @@ struct UnikeyOptions {
     int autoNonVnRestore;
 };
 
+// the defaults of UnikeyInputMethod
+void CreateDefaultUnikeyOptions(UnikeyOptions *pOpt);
+
 #define UKOPT_FLAG_ALL 0xFFFFFFFF
 #define UKOPT_FLAG_FREE_STYLE 0x00000001
 // #define UKOPT_FLAG_MANUAL_TONE           0x00000002
@@ -0,0 +1,432 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: LGPL-2.0-or-later
+ */
+
+#include "lexicon.h"
+#include "cachefile.h"
+#include "charset.h"
+#include "vnconv.h"
+#include <algorithm>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+
+using namespace std;
+
+#define MAX_LEXICON_LINE 256
+
+//---------------------------------------------------------------
+// Compiled lexicon cache, written next to the word list as <name>.bin.
+// Layout: header, nodes, words, text, letters. Like the macro cache it
+// stores native ints, see cachefile.h.
+//---------------------------------------------------------------
+#define UKLEXICON_CACHE_MAGIC "UKLEXIC"
+#define UKLEXICON_CACHE_VERSION 1
+
+struct LexiconCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    UkCacheStamp stamp;
+    uint32_t wordCount;
+    uint32_t textSize;
+    uint32_t letterCount;
+};
+
+//---------------------------------------------------------------
+// Letters are keyed by their root: a, a^ and a( are all a, dd is d. So a
+// word is found from the first keys typed for it, before its marks.
+//---------------------------------------------------------------
+static inline int32_t lexiKey(int32_t letter) { return StdVnRootChar[letter]; }
+
+//---------------------------------------------------------------
+// A prefix letter with a mark or a tone only matches a word letter with
+// the same mark or tone.
+//---------------------------------------------------------------
+static inline bool lexiMatch(int32_t typed, int32_t letter) {
+    int32_t typedNoTone = StdVnNoTone[typed];
+    if (typedNoTone != StdVnRootChar[typed] &&
+        typedNoTone != StdVnNoTone[letter])
+        return false;
+    return typed == typedNoTone || typed == letter;
+}
+
+//---------------------------------------------------------------
+UkLexicon::UkLexicon() { resetContent(); }
+
+//---------------------------------------------------------------
+UkLexicon::~UkLexicon() { unmapCache(); }
+
+//---------------------------------------------------------------
+void UkLexicon::resetContent() {
+    unmapCache();
+    m_nodes.clear();
+    m_nodes.shrink_to_fit();
+    m_words.clear();
+    m_words.shrink_to_fit();
+    m_text.clear();
+    m_text.shrink_to_fit();
+    m_letters.clear();
+    m_letters.shrink_to_fit();
+    // an empty lexicon still has its root
+    m_nodes.push_back(UkLexiconNode{0, 0, UINT32_MAX, 0, 0, vnl_nonVnChar});
+    m_nodeCount = 1;
+    m_wordCount = 0;
+}
+
+//---------------------------------------------------------------
+// Returns 1 if the word was added, 0 if it was skipped.
+//---------------------------------------------------------------
+int UkLexicon::addWord(const char *line, uint32_t rank) {
+    StdVnChar chars[MAX_LEXICON_LINE];
+    int inLen = -1; // input is null-terminated
+    int maxOutLen = sizeof(chars);
+    if (VnConvert(CONV_CHARSET_UNIUTF8, CONV_CHARSET_VNSTANDARD,
+                  (UKBYTE *)line, (UKBYTE *)chars, &inLen, &maxOutLen) != 0)
+        return 0;
+
+    size_t letterStart = m_letters.size();
+    int count = maxOutLen / sizeof(StdVnChar);
+    for (int i = 0; i < count && chars[i]; i++) {
+        StdVnChar ch = chars[i];
+        if (ch >= VnStdCharOffset &&
+            ch < VnStdCharOffset + TOTAL_ALPHA_VNCHARS) {
+            // lower case letters are odd
+            m_letters.push_back((ch - VnStdCharOffset) | 1);
+        } else if (ch != ' ' && ch != '-') {
+            m_letters.resize(letterStart);
+            return 0;
+        }
+    }
+    size_t textLen = strlen(line);
+    size_t letterCount = m_letters.size() - letterStart;
+    if (letterCount == 0 || letterCount > UINT16_MAX || textLen > UINT16_MAX) {
+        m_letters.resize(letterStart);
+        return 0;
+    }
+
+    UkLexiconWord word;
+    word.text = m_text.size();
+    word.letters = letterStart;
+    word.rank = rank;
+    word.textLen = textLen;
+    word.letterCount = letterCount;
+    m_text.insert(m_text.end(), line, line + textLen);
+    m_words.push_back(word);
+    m_wordCount++;
+    return 1;
+}
+
+//---------------------------------------------------------------
+// Builds m_nodes level by level from m_words and reorders m_words the way
+// the nodes refer to them.
+//---------------------------------------------------------------
+void UkLexicon::buildTrie() {
+    const int32_t *letters = m_letters.data();
+    auto keyLess = [letters](const UkLexiconWord &a, const UkLexiconWord &b) {
+        int n = min(a.letterCount, b.letterCount);
+        for (int i = 0; i < n; i++) {
+            int32_t ka = lexiKey(letters[a.letters + i]);
+            int32_t kb = lexiKey(letters[b.letters + i]);
+            if (ka != kb)
+                return ka < kb;
+        }
+        if (a.letterCount != b.letterCount)
+            return a.letterCount < b.letterCount;
+        return a.rank < b.rank;
+    };
+    vector<UkLexiconWord> sorted(m_words);
+    sort(sorted.begin(), sorted.end(), keyLess);
+
+    // words of node n are sorted[range[n].first .. range[n].second), all of
+    // them share its first depth[n] letter keys
+    struct Range {
+        size_t first, second;
+        int depth;
+    };
+    vector<Range> ranges;
+    m_nodes.clear();
+    m_words.clear();
+    m_nodes.push_back(UkLexiconNode{0, 0, UINT32_MAX, 0, 0, vnl_nonVnChar});
+    ranges.push_back(Range{0, sorted.size(), 0});
+
+    for (size_t n = 0; n < m_nodes.size(); n++) {
+        Range range = ranges[n];
+        UkLexiconNode &node = m_nodes[n];
+        node.best = UINT32_MAX;
+        for (size_t i = range.first; i < range.second; i++)
+            node.best = min(node.best, sorted[i].rank);
+
+        // the words ending here sort before the longer ones
+        node.firstWord = m_words.size();
+        size_t i = range.first;
+        while (i < range.second && sorted[i].letterCount == range.depth)
+            m_words.push_back(sorted[i++]);
+        node.wordCount = m_words.size() - node.firstWord;
+
+        node.firstChild = m_nodes.size();
+        uint32_t childCount = 0;
+        while (i < range.second) {
+            int32_t key = lexiKey(letters[sorted[i].letters + range.depth]);
+            size_t end = i + 1;
+            while (end < range.second &&
+                   lexiKey(letters[sorted[end].letters + range.depth]) == key)
+                end++;
+            ranges.push_back(Range{i, end, range.depth + 1});
+            m_nodes.push_back(UkLexiconNode{0, 0, UINT32_MAX, 0, 0, key});
+            childCount++;
+            i = end;
+        }
+        // push_back may have moved the node
+        m_nodes[n].childCount = min<uint32_t>(childCount, UINT16_MAX);
+    }
+    m_nodeCount = m_nodes.size();
+    m_nodes.shrink_to_fit();
+    m_words.shrink_to_fit();
+}
+
+//---------------------------------------------------------------
+// Everything step and complete follow without checking: the child and
+// word ranges of the nodes, the text and letter ranges of the words and
+// the letters themselves, which index the char tables. The file may be
+// damaged or not written by us.
+//---------------------------------------------------------------
+static bool validCache(const LexiconCacheHeader &header,
+                       const UkLexiconNode *nodes, const UkLexiconWord *words,
+                       const int32_t *letters) {
+    for (uint32_t n = 0; n < header.nodeCount; n++) {
+        const UkLexiconNode &node = nodes[n];
+        // children come after their parent, level by level
+        if (node.childCount > 0 && node.firstChild <= n)
+            return false;
+        if ((uint64_t)node.firstChild + node.childCount > header.nodeCount ||
+            (uint64_t)node.firstWord + node.wordCount > header.wordCount)
+            return false;
+    }
+    for (uint32_t w = 0; w < header.wordCount; w++) {
+        const UkLexiconWord &word = words[w];
+        if ((uint64_t)word.text + word.textLen > header.textSize ||
+            (uint64_t)word.letters + word.letterCount > header.letterCount)
+            return false;
+    }
+    for (uint32_t i = 0; i < header.letterCount; i++) {
+        if (letters[i] < 0 || letters[i] >= TOTAL_ALPHA_VNCHARS)
+            return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------
+bool UkLexicon::mapCache(const char *cacheName, const struct stat &src) {
+    void *mapping;
+    size_t size;
+    if (!UkMapCacheFile(cacheName, sizeof(LexiconCacheHeader), mapping, size))
+        return false;
+
+    const LexiconCacheHeader *header = (const LexiconCacheHeader *)mapping;
+    size_t expected = sizeof(LexiconCacheHeader) +
+                      (size_t)header->nodeCount * sizeof(UkLexiconNode) +
+                      (size_t)header->wordCount * sizeof(UkLexiconWord) +
+                      header->textSize +
+                      (size_t)header->letterCount * sizeof(int32_t);
+    if (memcmp(header->magic, UKLEXICON_CACHE_MAGIC, sizeof(header->magic)) ||
+        header->version != UKLEXICON_CACHE_VERSION ||
+        !header->stamp.matches(src) || header->nodeCount < 1 || header->textSize % sizeof(int32_t) ||
+        header->nodeCount > INT_MAX || header->wordCount > INT_MAX ||
+        expected != size) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    const char *p = (const char *)mapping + sizeof(LexiconCacheHeader);
+    const UkLexiconNode *nodes = (const UkLexiconNode *)p;
+    p += header->nodeCount * sizeof(UkLexiconNode);
+    const UkLexiconWord *words = (const UkLexiconWord *)p;
+    p += header->wordCount * sizeof(UkLexiconWord);
+    const char *text = p;
+    p += header->textSize;
+    const int32_t *letters = (const int32_t *)p;
+    if (!validCache(*header, nodes, words, letters)) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    m_mapNodes = nodes;
+    m_mapWords = words;
+    m_mapText = text;
+    m_mapLetters = letters;
+
+    m_mapping = mapping;
+    m_mappingSize = size;
+    m_nodeCount = header->nodeCount;
+    m_wordCount = header->wordCount;
+    return true;
+}
+
+//---------------------------------------------------------------
+bool UkLexicon::writeCache(const char *cacheName, const struct stat &src) {
+    LexiconCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, UKLEXICON_CACHE_MAGIC, sizeof(header.magic));
+    header.version = UKLEXICON_CACHE_VERSION;
+    header.nodeCount = m_nodes.size();
+    header.stamp.set(src);
+    header.wordCount = m_words.size();
+    // keep the letters that follow aligned
+    m_text.resize((m_text.size() + 3) & ~(size_t)3);
+    header.textSize = m_text.size();
+    header.letterCount = m_letters.size();
+
+    return UkWriteCacheFile(
+        cacheName, src,
+        {{&header, sizeof(header)},
+         {m_nodes.data(), m_nodes.size() * sizeof(UkLexiconNode)},
+         {m_words.data(), m_words.size() * sizeof(UkLexiconWord)},
+         {m_text.data(), m_text.size()},
+         {m_letters.data(), m_letters.size() * sizeof(int32_t)}});
+}
+
+//---------------------------------------------------------------
+void UkLexicon::unmapCache() {
+    if (!m_mapping)
+        return;
+    munmap(m_mapping, m_mappingSize);
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+    m_mapNodes = nullptr;
+    m_mapWords = nullptr;
+    m_mapText = nullptr;
+    m_mapLetters = nullptr;
+}
+
+//---------------------------------------------------------------
+int UkLexicon::loadFromFile(const char *fname, bool useCache,
+                            const char *cacheName) {
+    struct stat src;
+    string cache;
+    if (useCache && stat(fname, &src) == 0) {
+        cache = cacheName ? cacheName : string(fname) + ".bin";
+        resetContent();
+        if (mapCache(cache.c_str(), src))
+            return 1;
+    }
+
+    FILE *f = fopen(fname, "r");
+    if (f == NULL)
+        return 0;
+
+    resetContent();
+    char line[MAX_LEXICON_LINE];
+    uint32_t rank = 0;
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        // skip the rest of a line that is too long
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+            int c;
+            while ((c = fgetc(f)) != EOF && c != '\n')
+                ;
+            continue;
+        }
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = 0;
+        if (len == 0 || line[0] == '#')
+            continue;
+        addWord(line, rank++);
+    }
+    fclose(f);
+    m_text.shrink_to_fit();
+    m_letters.shrink_to_fit();
+    buildTrie();
+
+    if (!cache.empty() && stat(fname, &src) == 0)
+        writeCache(cache.c_str(), src);
+    return 1;
+}
+
+//---------------------------------------------------------------
+int UkLexicon::step(int node, VnLexiName letter) const {
+    if (node < 0 || node >= m_nodeCount || letter < 0 ||
+        letter >= TOTAL_ALPHA_VNCHARS)
+        return -1;
+    int32_t key = lexiKey(letter);
+    const UkLexiconNode &n = nodes()[node];
+    const UkLexiconNode *first = nodes() + n.firstChild;
+    const UkLexiconNode *last = first + n.childCount;
+    const UkLexiconNode *child =
+        lower_bound(first, last, key,
+                    [](const UkLexiconNode &c, int32_t k) {
+                        return c.letter < k;
+                    });
+    if (child == last || child->letter != key)
+        return -1;
+    return child - nodes();
+}
+
+//---------------------------------------------------------------
+// Best first search: the pending nodes and words are kept in a heap by
+// their best rank, so the first words popped are the best ones. The heap
+// and the number of nodes expanded are bounded, which bounds the time.
+//---------------------------------------------------------------
+int UkLexicon::complete(int node, const VnLexiName *prefix, int prefixLen,
+                        UkLexiconMatch *matches, int maxCount) const {
+    struct Pending {
+        uint32_t rank;
+        int32_t index; // node, or ~word
+    };
+    auto later = [](const Pending &a, const Pending &b) {
+        return a.rank > b.rank;
+    };
+    // room for the children of the first nodes expanded, what is pushed
+    // once it is full is dropped
+    const int MaxPending = 4 * UK_LEXICON_MAX_VISIT;
+    Pending heap[MaxPending];
+    int heapSize = 0;
+    auto push = [&](uint32_t rank, int32_t index) {
+        if (heapSize == MaxPending)
+            return;
+        heap[heapSize++] = Pending{rank, index};
+        push_heap(heap, heap + heapSize, later);
+    };
+
+    if (node < 0 || node >= m_nodeCount)
+        return 0;
+    prefixLen = min(prefixLen, UK_LEXICON_MAX_PREFIX);
+
+    const UkLexiconNode *allNodes = nodes();
+    const UkLexiconWord *allWords = words();
+    int count = 0;
+    int visited = 0;
+    push(allNodes[node].best, node);
+    while (heapSize > 0 && count < maxCount) {
+        pop_heap(heap, heap + heapSize, later);
+        Pending top = heap[--heapSize];
+        if (top.index < 0) {
+            const UkLexiconWord &word = allWords[~top.index];
+            const int32_t *letters = letterMem() + word.letters;
+            bool match = word.letterCount >= prefixLen;
+            for (int i = 0; match && i < prefixLen; i++)
+                match = prefix[i] >= 0 && prefix[i] < TOTAL_ALPHA_VNCHARS &&
+                        lexiMatch(prefix[i], letters[i]);
+            if (match) {
+                matches[count].text = textMem() + word.text;
+                matches[count].textLen = word.textLen;
+                count++;
+            }
+            continue;
+        }
+
+        if (++visited > UK_LEXICON_MAX_VISIT)
+            break;
+        const UkLexiconNode &n = allNodes[top.index];
+        for (uint32_t i = 0; i < n.wordCount; i++)
+            push(allWords[n.firstWord + i].rank, ~(int32_t)(n.firstWord + i));
+        for (uint32_t i = 0; i < n.childCount; i++)
+            push(allNodes[n.firstChild + i].best, n.firstChild + i);
+    }
+    return count;
+}
@@ -0,0 +1,119 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: LGPL-2.0-or-later
+ */
+
+#ifndef __UK_LEXICON_H
+#define __UK_LEXICON_H
+
+#include "vnlexi.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <vector>
+
+// nodes visited by one UkLexicon::complete() call at most, this keeps a
+// query well below a millisecond whatever the size of the word list
+#define UK_LEXICON_MAX_VISIT 512
+// longest word, in letters, a query can be made for
+#define UK_LEXICON_MAX_PREFIX 32
+
+// Trie of the words, keyed by their letters in lower case and without
+// tone. Nodes are stored level by level: the children of a node are
+// consecutive and sorted by letter, and so are the words ending at it,
+// best ranked first. best is the best rank of the words below the node.
+struct UkLexiconNode {
+    uint32_t firstChild;
+    uint32_t firstWord;
+    uint32_t best;
+    uint16_t childCount;
+    uint16_t wordCount;
+    int32_t letter; // VnLexiName, unused for the root
+};
+
+// A word of the list. rank is its line in the list, text is UTF-8 and
+// letters its lower case letters with tones, both in the arenas of the
+// lexicon.
+struct UkLexiconWord {
+    uint32_t text;
+    uint32_t letters;
+    uint32_t rank;
+    uint16_t textLen;
+    uint16_t letterCount;
+};
+
+struct UkLexiconMatch {
+    const char *text; // not null-terminated
+    int textLen;
+};
+
+class UkLexicon {
+public:
+    static const int Root = 0;
+
+    UkLexicon();
+    UkLexicon(const UkLexicon &) = delete;
+    UkLexicon &operator=(const UkLexicon &) = delete;
+    ~UkLexicon();
+
+    // The file is UTF-8, one word or phrase per line, most frequent first.
+    // Empty lines and lines starting with '#' are skipped, and so are words
+    // with letters that are not Vietnamese. With useCache, the compiled
+    // list is kept in cacheName, or fname.bin without one, and mapped
+    // directly as long as fname is not modified.
+    int loadFromFile(const char *fname, bool useCache = false,
+                     const char *cacheName = nullptr);
+    void resetContent();
+    int getCount() const { return m_wordCount; }
+
+    // Walks one letter down from node, the letter is lower case and its
+    // tone is ignored. Returns -1 if no word continues that way.
+    int step(int node, VnLexiName letter) const;
+    // Best ranked words below node, which was reached from the root with
+    // prefix: a prefix letter with a tone only matches words with that
+    // tone at its place. Returns the number of matches written.
+    int complete(int node, const VnLexiName *prefix, int prefixLen,
+                 UkLexiconMatch *matches, int maxCount) const;
+
+protected:
+    int addWord(const char *line, uint32_t rank);
+    void buildTrie();
+    bool mapCache(const char *cacheName, const struct stat &src);
+    bool writeCache(const char *cacheName, const struct stat &src);
+    void unmapCache();
+
+    const UkLexiconNode *nodes() const {
+        return m_mapping ? m_mapNodes : m_nodes.data();
+    }
+    const UkLexiconWord *words() const {
+        return m_mapping ? m_mapWords : m_words.data();
+    }
+    const char *textMem() const {
+        return m_mapping ? m_mapText : m_text.data();
+    }
+    const int32_t *letterMem() const {
+        return m_mapping ? m_mapLetters : m_letters.data();
+    }
+
+    std::vector<UkLexiconNode> m_nodes;
+    std::vector<UkLexiconWord> m_words;
+    std::vector<char> m_text;
+    std::vector<int32_t> m_letters;
+    int m_nodeCount = 0;
+    int m_wordCount = 0;
+
+    // A list mapped from its compiled file: nodes, words, text and letters
+    // one after the other in m_mapping. The text is padded to 4 bytes so
+    // that the letters are aligned. mapCache checks that children follow
+    // their parent and that every range stays in its array before they are
+    // set, since step and complete index them without checking.
+    void *m_mapping = nullptr;
+    size_t m_mappingSize = 0;
+    const UkLexiconNode *m_mapNodes = nullptr;
+    const UkLexiconWord *m_mapWords = nullptr;
+    const char *m_mapText = nullptr;
+    const int32_t *m_mapLetters = nullptr;
+};
+
+#endif
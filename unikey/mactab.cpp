@@ -5,36 +5,60 @@
  */
 
 #include "mactab.h"
+#include "cachefile.h"
 #include "vnconv.h"
+#include <algorithm>
 #include <iostream>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <unordered_map>
 
 using namespace std;
 #define UKMACRO_VERSION_UTF8 1
 
 //---------------------------------------------------------------
-void CMacroTable::init() {
-    m_memSize = MACRO_MEM_SIZE;
-    m_count = 0;
-    m_occupied = 0;
-}
+// Compiled macro cache, written next to the macro file as <name>.bin.
+// Layout: header, MacroDef[count], macro memory, trie nodes, trie edges.
+// It stores native ints, see cachefile.h.
+//---------------------------------------------------------------
+#define UKMACRO_CACHE_MAGIC "UKMACRO"
+#define UKMACRO_CACHE_VERSION 1
+
+struct MacroCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    UkCacheStamp stamp;
+    uint32_t memSize;
+    uint32_t nodeCount;
+    uint32_t edgeCount;
+};
+
+//---------------------------------------------------------------
+void CMacroTable::init() { resetContent(); }
 
 //---------------------------------------------------------------
-char *MacCompareStartMem;
+CMacroTable::CMacroTable() { resetContent(); }
 
+//---------------------------------------------------------------
+CMacroTable::~CMacroTable() { unmapCache(); }
+
+//---------------------------------------------------------------
 #define STD_TO_LOWER(x)                                                        \
     (((x) >= VnStdCharOffset &&                                                \
       (x) < (VnStdCharOffset + TOTAL_ALPHA_VNCHARS) && !((x) & 1))             \
          ? (x + 1)                                                             \
          : (x))
 
-int macCompare(const void *p1, const void *p2) {
-    StdVnChar *s1 =
-        (StdVnChar *)((char *)MacCompareStartMem + ((MacroDef *)p1)->keyOffset);
-    StdVnChar *s2 =
-        (StdVnChar *)((char *)MacCompareStartMem + ((MacroDef *)p2)->keyOffset);
+// Compares the keys of two macros stored in mem, ignoring case
+static int macCompare(const char *mem, const MacroDef &m1,
+                      const MacroDef &m2) {
+    const StdVnChar *s1 = (const StdVnChar *)(mem + m1.keyOffset);
+    const StdVnChar *s2 = (const StdVnChar *)(mem + m2.keyOffset);
 
     int i;
     StdVnChar ls1, ls2;
@@ -59,40 +83,240 @@ int macCompare(const void *p1, const void *p2) {
 }
 
 //---------------------------------------------------------------
-int macKeyCompare(const void *key, const void *ele) {
-    StdVnChar *s1 = (StdVnChar *)key;
-    StdVnChar *s2 = (StdVnChar *)((char *)MacCompareStartMem +
-                                  ((MacroDef *)ele)->keyOffset);
+const StdVnChar *CMacroTable::lookup(StdVnChar *key) {
+    if (m_indexDirty)
+        buildIndex();
+
+    int len;
+    for (len = 0; key[len] != 0; len++)
+        ;
+    int cursor = MacroCursorRoot;
+    for (int i = len - 1; i >= 0 && cursor >= 0; i--)
+        cursor = cursorStep(cursor, key[i]);
+    return cursorText(cursor);
+}
 
-    StdVnChar ls1, ls2;
-    int i;
-    for (i = 0; s1[i] != 0 && s2[i] != 0; i++) {
-        ls1 = STD_TO_LOWER(s1[i]);
-        ls2 = STD_TO_LOWER(s2[i]);
-        if (ls1 > ls2)
-            return 1;
-        if (ls1 < ls2)
-            return -1;
-        /*
-        if (s1[i] > s2[i])
-            return 1;
-        if (s1[i] < s2[i])
-            return -1;
-        */
+//---------------------------------------------------------------
+int CMacroTable::cursorStep(int cursor, StdVnChar ch) const {
+    if (cursor < 0)
+        return -1;
+
+    StdVnChar lch = STD_TO_LOWER(ch);
+    const MacroTrieNode *nodes = trieNodes();
+    const MacroTrieEdge *edges = trieEdges();
+    int lo = nodes[cursor].firstEdge;
+    int end = nodes[cursor + 1].firstEdge;
+    int hi = end;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (edges[mid].ch < lch)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    if (s1[i] == 0)
-        return (s2[i] == 0) ? 0 : -1;
-    return 1;
+    if (lo < end && edges[lo].ch == lch)
+        return edges[lo].child;
+    return -1;
 }
 
 //---------------------------------------------------------------
-const StdVnChar *CMacroTable::lookup(StdVnChar *key) {
-    MacCompareStartMem = m_macroMem;
-    MacroDef *p = (MacroDef *)bsearch(key, m_table, m_count, sizeof(MacroDef),
-                                      macKeyCompare);
-    if (p)
-        return (StdVnChar *)(m_macroMem + p->textOffset);
-    return 0;
+const StdVnChar *CMacroTable::cursorText(int cursor) const {
+    if (cursor < 0)
+        return 0;
+    int offset = trieNodes()[cursor].textOffset;
+    if (offset < 0)
+        return 0;
+    return (StdVnChar *)(macroMem() + offset);
+}
+
+//---------------------------------------------------------------
+void CMacroTable::buildIndex() {
+    m_indexDirty = false;
+    if (m_mapping)
+        return;
+
+    // Insert the reversed keys with a (node << 32 | char) -> child hash
+    // first, then lay the edges out sorted by node and char.
+    unordered_map<uint64_t, int> children;
+    vector<int> text(1, -1);
+    for (int i = 0; i < m_count; i++) {
+        const StdVnChar *key =
+            (const StdVnChar *)(m_macroMem.data() + m_table[i].keyOffset);
+        int len;
+        for (len = 0; key[len] != 0; len++)
+            ;
+
+        int node = MacroCursorRoot;
+        for (int j = len - 1; j >= 0; j--) {
+            uint64_t edge = ((uint64_t)node << 32) | STD_TO_LOWER(key[j]);
+            auto it = children.find(edge);
+            if (it == children.end()) {
+                it = children.emplace(edge, (int)text.size()).first;
+                text.push_back(-1);
+            }
+            node = it->second;
+        }
+        // keep the first definition of a duplicated key
+        if (text[node] < 0)
+            text[node] = m_table[i].textOffset;
+    }
+
+    vector<pair<uint64_t, int>> edges(children.begin(), children.end());
+    sort(edges.begin(), edges.end());
+
+    int nodeCount = (int)text.size();
+    m_trieNodes.resize(nodeCount + 1); // last one is a sentinel
+    m_trieNodes.shrink_to_fit();
+    m_trieEdges.resize(edges.size());
+    m_trieEdges.shrink_to_fit();
+    size_t k = 0;
+    for (int n = 0; n <= nodeCount; n++) {
+        m_trieNodes[n].firstEdge = (int)k;
+        m_trieNodes[n].textOffset = (n < nodeCount) ? text[n] : -1;
+        for (; k < edges.size() && (int)(edges[k].first >> 32) == n; k++) {
+            m_trieEdges[k].ch = (StdVnChar)(edges[k].first & 0xffffffff);
+            m_trieEdges[k].child = edges[k].second;
+        }
+    }
+}
+
+//---------------------------------------------------------------
+// A string of at most maxLen chars, the terminator included, that starts at
+// offset inside mem.
+static bool validCacheString(const char *mem, uint32_t memSize, int offset,
+                             int maxLen) {
+    if (offset < 0 || (uint32_t)offset >= memSize ||
+        offset % sizeof(StdVnChar))
+        return false;
+    const StdVnChar *s = (const StdVnChar *)(mem + offset);
+    size_t avail = (memSize - offset) / sizeof(StdVnChar);
+    for (size_t i = 0; i < avail && i < (size_t)maxLen; i++)
+        if (s[i] == 0)
+            return true;
+    return false;
+}
+
+//---------------------------------------------------------------
+// Everything that lookups and macroMatch follow without checking: the
+// strings of the table and of the trie nodes, and the edge ranges and
+// children of the trie. The file may be damaged or not written by us, a
+// system wide one is used by every session.
+static bool validCache(const MacroCacheHeader &header, const MacroDef *table,
+                       const char *mem, const MacroTrieNode *nodes,
+                       const MacroTrieEdge *edges) {
+    for (uint32_t i = 0; i < header.count; i++) {
+        if (!validCacheString(mem, header.memSize, table[i].keyOffset,
+                              MAX_MACRO_KEY_LEN) ||
+            !validCacheString(mem, header.memSize, table[i].textOffset,
+                              MAX_MACRO_TEXT_LEN))
+            return false;
+    }
+    int last = 0;
+    for (uint32_t n = 0; n < header.nodeCount; n++) {
+        int first = nodes[n].firstEdge;
+        if (first < last || (uint32_t)first > header.edgeCount)
+            return false;
+        last = first;
+        // the sentinel has no text of its own
+        if (n + 1 < header.nodeCount && nodes[n].textOffset != -1 &&
+            !validCacheString(mem, header.memSize, nodes[n].textOffset,
+                              MAX_MACRO_TEXT_LEN))
+            return false;
+    }
+    if ((uint32_t)last != header.edgeCount)
+        return false;
+    // a child is a cursor, and cursors are below the sentinel
+    for (uint32_t e = 0; e < header.edgeCount; e++) {
+        if (edges[e].child <= 0 ||
+            (uint32_t)edges[e].child >= header.nodeCount - 1)
+            return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------
+bool CMacroTable::mapCache(const char *cacheName, const struct stat &src) {
+    void *mapping;
+    size_t size;
+    if (!UkMapCacheFile(cacheName, sizeof(MacroCacheHeader), mapping, size))
+        return false;
+
+    const MacroCacheHeader *header = (const MacroCacheHeader *)mapping;
+    size_t expected = sizeof(MacroCacheHeader) +
+                      (size_t)header->count * sizeof(MacroDef) +
+                      header->memSize +
+                      (size_t)header->nodeCount * sizeof(MacroTrieNode) +
+                      (size_t)header->edgeCount * sizeof(MacroTrieEdge);
+    if (memcmp(header->magic, UKMACRO_CACHE_MAGIC, sizeof(header->magic)) ||
+        header->version != UKMACRO_CACHE_VERSION ||
+        !header->stamp.matches(src) || header->nodeCount < 2 || header->memSize % sizeof(StdVnChar) ||
+        header->count > INT_MAX || header->memSize > INT_MAX ||
+        header->nodeCount > INT_MAX || header->edgeCount > INT_MAX ||
+        expected != size) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    const char *p = (const char *)mapping + sizeof(MacroCacheHeader);
+    const MacroDef *table = (const MacroDef *)p;
+    p += header->count * sizeof(MacroDef);
+    const char *mem = p;
+    p += header->memSize;
+    const MacroTrieNode *nodes = (const MacroTrieNode *)p;
+    p += header->nodeCount * sizeof(MacroTrieNode);
+    const MacroTrieEdge *edges = (const MacroTrieEdge *)p;
+    if (!validCache(*header, table, mem, nodes, edges)) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    m_mapTable = table;
+    m_mapMem = mem;
+    m_mapNodes = nodes;
+    m_mapEdges = edges;
+    m_mapNodeCount = header->nodeCount - 1; // without the sentinel
+
+    m_mapping = mapping;
+    m_mappingSize = size;
+    m_count = header->count;
+    m_occupied = header->memSize;
+    m_indexDirty = false;
+    return true;
+}
+
+//---------------------------------------------------------------
+bool CMacroTable::writeCache(const char *cacheName, const struct stat &src) {
+    MacroCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, UKMACRO_CACHE_MAGIC, sizeof(header.magic));
+    header.version = UKMACRO_CACHE_VERSION;
+    header.count = m_count;
+    header.stamp.set(src);
+    header.memSize = m_occupied;
+    header.nodeCount = m_trieNodes.size();
+    header.edgeCount = m_trieEdges.size();
+
+    return UkWriteCacheFile(
+        cacheName, src,
+        {{&header, sizeof(header)},
+         {m_table.data(), m_count * sizeof(MacroDef)},
+         {m_macroMem.data(), (size_t)m_occupied},
+         {m_trieNodes.data(), m_trieNodes.size() * sizeof(MacroTrieNode)},
+         {m_trieEdges.data(), m_trieEdges.size() * sizeof(MacroTrieEdge)}});
+}
+
+//---------------------------------------------------------------
+void CMacroTable::unmapCache() {
+    if (!m_mapping)
+        return;
+    munmap(m_mapping, m_mappingSize);
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+    m_mapTable = nullptr;
+    m_mapMem = nullptr;
+    m_mapNodes = nullptr;
+    m_mapEdges = nullptr;
+    m_mapNodeCount = 0;
 }
 
 //----------------------------------------------------------------------------
@@ -148,7 +372,16 @@ void CMacroTable::writeHeader(FILE *f) {
 #endif
 }
 //---------------------------------------------------------------
-int CMacroTable::loadFromFile(const char *fname) {
+int CMacroTable::loadFromFile(const char *fname, bool useCache) {
+    struct stat src;
+    string cacheName;
+    if (useCache && stat(fname, &src) == 0) {
+        cacheName = string(fname) + ".bin";
+        resetContent();
+        if (mapCache(cacheName.c_str(), src))
+            return 1;
+    }
+
     FILE *f;
 #if defined(WIN32)
     f = _tfopen(fname, _TEXT("rt"));
@@ -181,12 +414,21 @@ int CMacroTable::loadFromFile(const char *fname) {
             addItem(line, CONV_CHARSET_VIQR);
     }
     fclose(f);
-    MacCompareStartMem = m_macroMem;
-    qsort(m_table, m_count, sizeof(MacroDef), macCompare);
+    m_table.shrink_to_fit();
+    m_macroMem.shrink_to_fit();
+    // stable, macros with the same key keep the order of the file
+    const char *mem = m_macroMem.data();
+    std::stable_sort(m_table.begin(), m_table.begin() + m_count,
+                     [mem](const MacroDef &m1, const MacroDef &m2) {
+                         return macCompare(mem, m1, m2) < 0;
+                     });
+    buildIndex();
     // Convert old version
     if (version != UKMACRO_VERSION_UTF8) {
         writeToFile(fname);
     }
+    if (!cacheName.empty() && stat(fname, &src) == 0)
+        writeCache(cacheName.c_str(), src);
     return 1;
 }
 
@@ -212,7 +454,7 @@ int CMacroTable::writeToFp(FILE *f) {
 
     UKBYTE *p;
     for (int i = 0; i < m_count; i++) {
-        p = (UKBYTE *)m_macroMem + m_table[i].keyOffset;
+        p = (UKBYTE *)macroMem() + table()[i].keyOffset;
         inLen = -1;
         maxOutLen = sizeof(key);
         ret = VnConvert(CONV_CHARSET_VNSTANDARD, CONV_CHARSET_UNIUTF8,
@@ -220,7 +462,7 @@ int CMacroTable::writeToFp(FILE *f) {
         if (ret != 0)
             continue;
 
-        p = (UKBYTE *)m_macroMem + m_table[i].textOffset;
+        p = (UKBYTE *)macroMem() + table()[i].textOffset;
         inLen = -1;
         maxOutLen = sizeof(text);
         ret = VnConvert(CONV_CHARSET_VNSTANDARD, CONV_CHARSET_UNIUTF8, p,
@@ -242,39 +484,54 @@ int CMacroTable::writeToFp(FILE *f) {
 int CMacroTable::addItem(const void *key, const void *text, int charset) {
     int ret;
     int inLen, maxOutLen;
+
+    // a mapped cache is read-only, copy it before changing anything
+    if (m_mapping) {
+        m_table.assign(m_mapTable, m_mapTable + m_count);
+        m_macroMem.assign(m_mapMem, m_mapMem + m_occupied);
+        unmapCache();
+    }
+
     int offset = m_occupied;
-    char *p = m_macroMem + offset;
 
-    if (m_count >= MAX_MACRO_ITEMS)
-        return -1;
+    // make room for the longest possible key and text, the arena is trimmed
+    // back to what the conversion really produced below
+    m_macroMem.resize(offset +
+                      (MAX_MACRO_KEY_LEN + MAX_MACRO_TEXT_LEN) *
+                          sizeof(StdVnChar));
+    char *p = m_macroMem.data() + offset;
 
-    m_table[m_count].keyOffset = offset;
+    MacroDef def;
+    def.keyOffset = offset;
 
     // Convert macro key to VN standard
     inLen = -1; // input is null-terminated
     maxOutLen = MAX_MACRO_KEY_LEN * sizeof(StdVnChar);
-    if (maxOutLen + offset > m_memSize)
-        maxOutLen = m_memSize - offset;
     ret = VnConvert(charset, CONV_CHARSET_VNSTANDARD, (UKBYTE *)key,
                     (UKBYTE *)p, &inLen, &maxOutLen);
-    if (ret != 0)
+    if (ret != 0) {
+        m_macroMem.resize(m_occupied);
         return -1;
+    }
 
     offset += maxOutLen;
     p += maxOutLen;
 
     // convert macro text to VN standard
-    m_table[m_count].textOffset = offset;
+    def.textOffset = offset;
     inLen = -1; // input is null-terminated
     maxOutLen = MAX_MACRO_TEXT_LEN * sizeof(StdVnChar);
-    if (maxOutLen + offset > m_memSize)
-        maxOutLen = m_memSize - offset;
     ret = VnConvert(charset, CONV_CHARSET_VNSTANDARD, (UKBYTE *)text,
                     (UKBYTE *)p, &inLen, &maxOutLen);
-    if (ret != 0)
+    if (ret != 0) {
+        m_macroMem.resize(m_occupied);
         return -1;
+    }
 
     m_occupied = offset + maxOutLen;
+    m_macroMem.resize(m_occupied);
+    m_table.push_back(def);
+    m_indexDirty = true;
     m_count++;
     return (m_count - 1);
 }
@@ -302,18 +559,63 @@ int CMacroTable::addItem(const char *item, int charset) {
 void CMacroTable::resetContent() {
     m_occupied = 0;
     m_count = 0;
+    m_indexDirty = false;
+    unmapCache();
+    // release the memory as well, an unused table should cost nothing
+    vector<MacroDef>().swap(m_table);
+    vector<char>().swap(m_macroMem);
+    vector<MacroTrieEdge>().swap(m_trieEdges);
+    // an empty root and the sentinel
+    m_trieNodes.assign(2, MacroTrieNode{0, -1});
+    m_trieNodes.shrink_to_fit();
 }
 
 //---------------------------------------------------------------
 const StdVnChar *CMacroTable::getKey(int idx) const {
     if (idx < 0 || idx >= m_count)
         return 0;
-    return (StdVnChar *)(m_macroMem + m_table[idx].keyOffset);
+    return (StdVnChar *)(macroMem() + table()[idx].keyOffset);
 }
 
 //---------------------------------------------------------------
 const StdVnChar *CMacroTable::getText(int idx) const {
     if (idx < 0 || idx >= m_count)
         return 0;
-    return (StdVnChar *)(m_macroMem + m_table[idx].textOffset);
+    return (StdVnChar *)(macroMem() + table()[idx].textOffset);
+}
+
+//---------------------------------------------------------------
+CMacroRendering::CMacroRendering(std::shared_ptr<const CMacroTable> table,
+                                 int charset)
+    : m_table(std::move(table)), m_charset(charset) {
+    int count = m_table->cursorCount();
+    m_nodeText.assign(count, -1);
+    StdVnChar text[MAX_MACRO_TEXT_LEN + 1];
+    UKBYTE out[MAX_MACRO_TEXT_LEN * MAX_VN_OUT_BYTES + 16];
+    for (int cursor = 0; cursor < count; cursor++) {
+        const StdVnChar *pText = m_table->cursorText(cursor);
+        if (!pText)
+            continue;
+        int len = 0;
+        while (pText[len] != 0 && len < MAX_MACRO_TEXT_LEN)
+            len++;
+
+        m_nodeText[cursor] = (int)m_spans.size();
+        for (int c = 0; c < MACRO_CASE_COUNT; c++) {
+            for (int i = 0; i < len; i++) {
+                if (c == MacroCaseAllCapital)
+                    text[i] = StdVnToUpper(pText[i]);
+                else if (c == MacroCaseAllSmall)
+                    text[i] = StdVnToLower(pText[i]);
+                else
+                    text[i] = pText[i];
+            }
+            int inLen = len * sizeof(StdVnChar);
+            int outLen = sizeof(out);
+            VnConvert(CONV_CHARSET_VNSTANDARD, m_charset, (UKBYTE *)text, out,
+                      &inLen, &outLen);
+            m_spans.push_back(Span{(int)m_bytes.size(), outLen});
+            m_bytes.insert(m_bytes.end(), out, out + outLen);
+        }
+    }
 }
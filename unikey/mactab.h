@@ -9,6 +9,10 @@
 
 #include "charset.h"
 #include "keycons.h"
+#include <memory>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <vector>
 
 #if defined(_WIN32)
 #if defined(UNIKEYHOOK)
@@ -27,34 +31,145 @@ struct MacroDef {
     int textOffset;
 };
 
+// Key index: a trie of the lower-cased keys, stored reversed. The edges of
+// node n are m_edges[nodes[n].firstEdge .. nodes[n + 1].firstEdge), sorted
+// by ch. textOffset is the text of the key ending at the node, or -1.
+struct MacroTrieNode {
+    int firstEdge;
+    int textOffset;
+};
+
+struct MacroTrieEdge {
+    StdVnChar ch;
+    int child;
+};
+
 #if !defined(WIN32)
 typedef char TCHAR;
 #endif
 
 class DllInterface CMacroTable {
 public:
+    CMacroTable();
+    CMacroTable(const CMacroTable &) = delete;
+    CMacroTable &operator=(const CMacroTable &) = delete;
+    ~CMacroTable();
+
     void init();
-    int loadFromFile(const char *fname);
+    // With useCache, a compiled copy of the table is kept in fname.bin and
+    // mapped directly as long as fname is not modified.
+    int loadFromFile(const char *fname, bool useCache = false);
     int writeToFile(const char *fname);
     int writeToFp(FILE *f);
+    // The first line of a UTF-8 macro file, for writers that stream their
+    // own "key:text" lines after it.
+    static void writeHeader(FILE *f);
 
     const StdVnChar *lookup(StdVnChar *key);
+
+    // Incremental lookup: feed the chars of a candidate key backward, last
+    // char first, starting from MacroCursorRoot. The cursor becomes -1 once
+    // no key ends with the chars fed so far. Case is ignored.
+    // The index is built by loadFromFile, call buildIndex after addItem.
+    static const int MacroCursorRoot = 0;
+    int cursorStep(int cursor, StdVnChar ch) const;
+    const StdVnChar *cursorText(int cursor) const;
+    void buildIndex();
+    // cursors are below this
+    int cursorCount() const {
+        return m_mapping ? m_mapNodeCount : (int)m_trieNodes.size() - 1;
+    }
+
     const StdVnChar *getKey(int idx) const;
     const StdVnChar *getText(int idx) const;
     int getCount() const { return m_count; }
+    // true if the table is the compiled cache file mapped read-only
+    bool isMapped() const { return m_mapping != nullptr; }
     void resetContent();
     int addItem(const char *item, int charset);
     int addItem(const void *key, const void *text, int charset);
 
 protected:
     bool readHeader(FILE *f, int &version);
-    void writeHeader(FILE *f);
+    bool mapCache(const char *cacheName, const struct stat &src);
+    bool writeCache(const char *cacheName, const struct stat &src);
+    void unmapCache();
+
+    const MacroDef *table() const {
+        return m_mapping ? m_mapTable : m_table.data();
+    }
+    const char *macroMem() const {
+        return m_mapping ? m_mapMem : m_macroMem.data();
+    }
+    const MacroTrieNode *trieNodes() const {
+        return m_mapping ? m_mapNodes : m_trieNodes.data();
+    }
+    const MacroTrieEdge *trieEdges() const {
+        return m_mapping ? m_mapEdges : m_trieEdges.data();
+    }
 
-    MacroDef m_table[MAX_MACRO_ITEMS];
-    char m_macroMem[MACRO_MEM_SIZE];
+    // Keys and texts live in one arena that grows with the table and is
+    // released by resetContent, m_table refers to them by offset.
+    std::vector<MacroDef> m_table;
+    std::vector<char> m_macroMem;
+    std::vector<MacroTrieNode> m_trieNodes;
+    std::vector<MacroTrieEdge> m_trieEdges;
+
+    int m_count = 0;
+    int m_occupied = 0;
+    bool m_indexDirty = false;
+
+    // A table mapped from its compiled file: the definitions, the arena,
+    // the nodes and the edges, in that order in m_mapping. m_mapNodeCount
+    // leaves out the sentinel node that closes the edge ranges. mapCache
+    // checks every string offset and edge range before they are set, since
+    // lookups follow them without checking; resetContent unmaps the file.
+    void *m_mapping = nullptr;
+    size_t m_mappingSize = 0;
+    const MacroDef *m_mapTable = nullptr;
+    const char *m_mapMem = nullptr;
+    const MacroTrieNode *m_mapNodes = nullptr;
+    const MacroTrieEdge *m_mapEdges = nullptr;
+    int m_mapNodeCount = 0;
+};
+
+// How UkEngine::macroMatch writes a macro text: as defined, all small or
+// all capitals, following the case of the key typed.
+enum MacroCase { MacroCaseNoChange, MacroCaseAllSmall, MacroCaseAllCapital };
+#define MACRO_CASE_COUNT 3
+
+// The texts of a macro table encoded in one output charset, in each case,
+// so that a macro hit copies bytes instead of converting the text. Built
+// when the table or the output charset changes, and immutable after.
+class DllInterface CMacroRendering {
+public:
+    CMacroRendering(std::shared_ptr<const CMacroTable> table, int charset);
+
+    const CMacroTable *table() const { return m_table.get(); }
+    int charset() const { return m_charset; }
+    // the text of the key at cursor, or null if there is none
+    const unsigned char *text(int cursor, MacroCase macroCase,
+                              int &size) const {
+        if (cursor < 0 || cursor >= (int)m_nodeText.size() ||
+            m_nodeText[cursor] < 0)
+            return 0;
+        const Span &span = m_spans[m_nodeText[cursor] + macroCase];
+        size = span.size;
+        return m_bytes.data() + span.offset;
+    }
+
+protected:
+    struct Span {
+        int offset;
+        int size;
+    };
 
-    int m_count;
-    int m_memSize, m_occupied;
+    std::shared_ptr<const CMacroTable> m_table;
+    int m_charset;
+    // per cursor, the first of its MACRO_CASE_COUNT spans, or -1
+    std::vector<int> m_nodeText;
+    std::vector<Span> m_spans;
+    std::vector<unsigned char> m_bytes;
 };
 
 #endif
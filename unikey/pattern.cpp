@@ -6,6 +6,8 @@
 
 #include "pattern.h"
 
+#include <string.h>
+
 //////////////////////////////////////////////////
 // Pattern matching (based on KPM algorithm)
 //////////////////////////////////////////////////
@@ -50,31 +52,84 @@ int PatternState::foundAtNextChar(char ch) {
     return ret;
 }
 
+//////////////////////////////////////////////////
+// Multi-pattern matching (Aho-Corasick automaton)
+//////////////////////////////////////////////////
+
 //-----------------------------------------------------
 void PatternList::init(char **patterns, int count) {
+    int i, ch;
+    int maxStates = 1;
+    for (i = 0; i < count; i++)
+        maxStates += strlen(patterns[i]);
+
+    delete[] m_next;
+    delete[] m_output;
+    m_next = new StateRow[maxStates];
+    m_output = new int[maxStates];
     m_count = count;
-    delete[] m_patterns;
-    m_patterns = new PatternState[count];
-    for (int i = 0; i < count; i++)
-        m_patterns[i].init(patterns[i]);
+
+    // build the trie, 0 marks a missing edge (the root has no parent)
+    memset(m_next, 0, maxStates * sizeof(StateRow));
+    m_stateCount = 1;
+    m_output[0] = -1;
+    for (i = 0; i < count; i++) {
+        int s = 0;
+        for (unsigned char *p = (unsigned char *)patterns[i]; *p; p++) {
+            if (m_next[s][*p] == 0) {
+                m_output[m_stateCount] = -1;
+                m_next[s][*p] = m_stateCount++;
+            }
+            s = m_next[s][*p];
+        }
+        if (s != 0)
+            m_output[s] = i;
+    }
+
+    // breadth-first over the trie: turn missing edges into the edge of
+    // the failure state, and inherit the failure state's output
+    int *fail = new int[m_stateCount];
+    int *queue = new int[m_stateCount];
+    int head = 0, tail = 0;
+    for (ch = 0; ch < 256; ch++)
+        if (m_next[0][ch]) {
+            fail[m_next[0][ch]] = 0;
+            queue[tail++] = m_next[0][ch];
+        }
+    while (head < tail) {
+        int s = queue[head++];
+        if (m_output[s] < m_output[fail[s]])
+            m_output[s] = m_output[fail[s]];
+        for (ch = 0; ch < 256; ch++) {
+            int t = m_next[s][ch];
+            if (t) {
+                fail[t] = m_next[fail[s]][ch];
+                queue[tail++] = t;
+            } else
+                m_next[s][ch] = m_next[fail[s]][ch];
+        }
+    }
+    delete[] fail;
+    delete[] queue;
+    m_state = 0;
 }
 
 //-----------------------------------------------------
 // return the order number of the pattern that is found.
-// If more than 1 pattern is found, returns any pattern
+// If more than 1 pattern is found, returns the last one
 // Returns -1 if no pattern is found
 //-----------------------------------------------------
 int PatternList::foundAtNextChar(char ch) {
-    int patternFound = -1;
-    for (int i = 0; i < m_count; i++) {
-        if (m_patterns[i].foundAtNextChar(ch))
-            patternFound = i;
-    }
-    return patternFound;
+    return foundAtNextChar(m_state, ch);
 }
 
 //-----------------------------------------------------
-void PatternList::reset() {
-    for (int i = 0; i < m_count; i++)
-        m_patterns[i].reset();
+// Same, with the match state kept by the caller (0 to start)
+//-----------------------------------------------------
+int PatternList::foundAtNextChar(int &state, char ch) const {
+    state = m_next[state][(unsigned char)ch];
+    return m_output[state];
 }
+
+//-----------------------------------------------------
+void PatternList::reset() { m_state = 0; }
@@ -30,22 +30,38 @@ public:
         char ch); // get next input char, returns 1 if pattern is found.
 };
 
+//--------------------------------------------------
+// Matches a set of patterns at once with an Aho-Corasick automaton,
+// compiled into a full transition table so each input char costs one
+// table load regardless of the number of patterns.
+//--------------------------------------------------
 class DllInterface PatternList {
 public:
-    PatternState *m_patterns;
+    typedef unsigned short StateRow[256];
+
+    StateRow *m_next; // m_next[state][ch]: state after reading ch
+    int *m_output;    // last pattern that ends in a state, or -1
+    int m_stateCount;
+    int m_state;
     int m_count;
     void init(char **patterns, int count);
     int foundAtNextChar(char ch);
+    // the automaton is read-only after init, so one list can be matched
+    // by several users at once, each with its own state
+    int foundAtNextChar(int &state, char ch) const;
     void reset();
 
     PatternList() {
         m_count = 0;
-        m_patterns = 0;
+        m_stateCount = 0;
+        m_state = 0;
+        m_next = 0;
+        m_output = 0;
     }
 
     ~PatternList() {
-        if (m_patterns)
-            delete[] m_patterns;
+        delete[] m_next;
+        delete[] m_output;
     }
 };
 
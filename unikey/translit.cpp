@@ -0,0 +1,151 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: LGPL-2.0-or-later
+ */
+
+#include "translit.h"
+#include <algorithm>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// keys given to UkEngine::processKeys at once
+#define TRANSLIT_KEY_BATCH 64
+// smallest piece converted by a thread of its own
+#define TRANSLIT_MIN_CHUNK (256 << 10)
+// how far past the ideal cut to look for a new line
+#define TRANSLIT_LINE_WINDOW 4096
+
+//---------------------------------------------------------------
+UkTranslitSettings::UkTranslitSettings() {
+    memset(&options, 0, sizeof(options));
+    CreateDefaultUnikeyOptions(&options);
+}
+
+//---------------------------------------------------------------
+UkTransliterator::UkTransliterator(const UkTranslitSettings &settings) {
+    SetupUnikeyEngine();
+    m_shared.vietKey = true;
+    m_shared.options = settings.options;
+    m_shared.input.init();
+    m_shared.usrKeyMapLoaded = settings.usrKeyMap != nullptr;
+    if (settings.im == UkUsrIM && settings.usrKeyMap) {
+        memcpy(m_shared.usrKeyMap, settings.usrKeyMap,
+               sizeof(m_shared.usrKeyMap));
+        m_shared.input.setIM(m_shared.usrKeyMap);
+    } else if (settings.im != UkUsrIM)
+        m_shared.input.setIM(settings.im);
+    m_shared.charsetId = CONV_CHARSET_XUTF8;
+    m_shared.macStore = settings.macStore;
+    m_shared.sysMacStore = settings.sysMacStore;
+    m_shared.restoreWords = settings.restoreWords;
+    m_engine.setCtrlInfo(&m_shared);
+}
+
+//---------------------------------------------------------------
+void UkTransliterator::reset() { m_engine.reset(); }
+
+//---------------------------------------------------------------
+static inline bool isTypedKey(unsigned char c) { return c >= 0x20 && c < 0x7F; }
+
+//---------------------------------------------------------------
+// Drops count characters from the end of the UTF-8 text in out
+//---------------------------------------------------------------
+static void eraseUtf8Chars(string &out, int count) {
+    size_t len = out.size();
+    while (count > 0 && len > 0) {
+        len--;
+        if (((unsigned char)out[len] & 0xC0) != 0x80)
+            count--;
+    }
+    out.resize(len);
+}
+
+//---------------------------------------------------------------
+void UkTransliterator::convert(const char *keys, size_t len, string &out) {
+    unsigned int batch[TRANSLIT_KEY_BATCH];
+    size_t pos = 0;
+    while (pos < len) {
+        if (!isTypedKey(keys[pos])) {
+            m_engine.reset();
+            out += keys[pos++];
+            continue;
+        }
+        int count = 0;
+        while (pos < len && count < TRANSLIT_KEY_BATCH &&
+               isTypedKey(keys[pos]))
+            batch[count++] = (unsigned char)keys[pos++];
+
+        for (int taken = 0; taken < count;) {
+            int backs;
+            int outSize = sizeof(m_outBuf);
+            UkOutputType outType;
+            taken += m_engine.processKeys(batch + taken, count - taken, backs,
+                                          m_outBuf, outSize, outType);
+            eraseUtf8Chars(out, backs);
+            out.append((const char *)m_outBuf, outSize);
+        }
+    }
+}
+
+//---------------------------------------------------------------
+// A place at or after pos where a new engine gives the same result as one
+// that went through everything before: right after a new line (the engine
+// is reset there anyway), or else after a space, which ends the word.
+//---------------------------------------------------------------
+static size_t translitSplitPoint(const char *keys, size_t pos, size_t len) {
+    if (pos >= len)
+        return len;
+    size_t end = min(len, pos + TRANSLIT_LINE_WINDOW);
+    const char *nl = (const char *)memchr(keys + pos, '\n', end - pos);
+    if (nl)
+        return nl + 1 - keys;
+    const char *sp = (const char *)memchr(keys + pos, ' ', len - pos);
+    return sp ? sp + 1 - keys : len;
+}
+
+//---------------------------------------------------------------
+void UkTransliterate(const UkTranslitSettings &settings, const char *keys,
+                     size_t len, string &out, unsigned int threads) {
+    if (threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+    threads = min<size_t>(threads, max<size_t>(1, len / TRANSLIT_MIN_CHUNK));
+
+    vector<size_t> cuts;
+    cuts.push_back(0);
+    for (unsigned int i = 1; i < threads; i++) {
+        size_t start = max(cuts.back(), len / threads * i);
+        size_t cut = translitSplitPoint(keys, start, len);
+        if (cut >= len)
+            break;
+        cuts.push_back(cut);
+    }
+    cuts.push_back(len);
+
+    size_t pieces = cuts.size() - 1;
+    vector<string> outs(pieces);
+    vector<thread> workers;
+    for (size_t i = 0; i < pieces; i++) {
+        auto work = [&, i]() {
+            UkTransliterator translit(settings);
+            outs[i].reserve((cuts[i + 1] - cuts[i]) * 5 / 4);
+            translit.convert(keys + cuts[i], cuts[i + 1] - cuts[i], outs[i]);
+        };
+        if (i + 1 < pieces)
+            workers.emplace_back(work);
+        else
+            work();
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    size_t total = out.size();
+    for (auto &piece : outs)
+        total += piece.size();
+    out.reserve(total);
+    for (auto &piece : outs)
+        out += piece;
+}
@@ -0,0 +1,59 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: LGPL-2.0-or-later
+ */
+
+#ifndef __UK_TRANSLIT_H
+#define __UK_TRANSLIT_H
+
+#include "ukengine.h"
+#include <stddef.h>
+#include <memory>
+#include <string>
+
+// Settings of a transliteration, the ones of the input method
+struct UkTranslitSettings {
+    UkTranslitSettings();
+
+    UkInputMethod im = UkTelex;
+    // 256 entries, used with UkUsrIM
+    const int *usrKeyMap = nullptr;
+    UnikeyOptions options; // CreateDefaultUnikeyOptions by default
+    std::shared_ptr<const CMacroTable> macStore;
+    std::shared_ptr<const CMacroTable> sysMacStore;
+    std::shared_ptr<const UkWordSet> restoreWords;
+};
+
+// Turns text typed with a Vietnamese input method, but without one running,
+// into the text the input method would have produced, e.g. "Tieengs Vieetj"
+// into "Tiếng Việt". The keys go through UkEngine exactly as they would from
+// the keyboard.
+class UkTransliterator {
+public:
+    explicit UkTransliterator(const UkTranslitSettings &settings);
+    UkTransliterator(const UkTransliterator &) = delete;
+    UkTransliterator &operator=(const UkTransliterator &) = delete;
+
+    // Appends the UTF-8 text typed with keys to out. Bytes other than
+    // printable ASCII (new lines, tabs, text that is already UTF-8) are
+    // copied as they are and end the word being typed, like a commit.
+    // A word cut at the end of keys continues in the next call.
+    void convert(const char *keys, size_t len, std::string &out);
+    // forget the word being typed
+    void reset();
+
+protected:
+    UkSharedMem m_shared;
+    UkEngine m_engine;
+    unsigned char m_outBuf[1024];
+};
+
+// Same as UkTransliterator::convert of the whole input with a new
+// transliterator, on threads threads (0: one per core). The input is cut
+// into one piece per thread at new lines, or at spaces in long lines, and
+// each piece is converted by its own engine.
+void UkTransliterate(const UkTranslitSettings &settings, const char *keys,
+                     size_t len, std::string &out, unsigned int threads = 0);
+
+#endif
@@ -5,11 +5,13 @@
  */
 
 #include "keycons.h"
+#include <array>
+#include <atomic>
 #include <iostream>
+#include <limits.h>
 #include <mutex>
 #include <stdlib.h>
 #include <string.h>
-#include <unordered_map>
 
 /*
 #if defined(_WIN32)
@@ -35,23 +37,83 @@ using namespace std;
     ((x) >= VnStdCharOffset &&                                                 \
      (x) < (VnStdCharOffset + TOTAL_ALPHA_VNCHARS) && IS_EVEN(x))
 
-bool IsVnVowel[vnl_lastChar];
+//------------------------------------------------
+static constexpr std::array<bool, vnl_lastChar> buildVowelTable() {
+    std::array<bool, vnl_lastChar> isVowel{};
+    for (auto &v : isVowel)
+        v = true;
 
-extern VnLexiName AZLexiUpper[]; // defined in inputproc.cpp
-extern VnLexiName AZLexiLower[];
+    for (unsigned char ch = 'a'; ch <= 'z'; ch++) {
+        if (ch != 'a' && ch != 'e' && ch != 'i' && ch != 'o' && ch != 'u' &&
+            ch != 'y') {
+            isVowel[AZLexiLower[ch - 'a']] = false;
+            isVowel[AZLexiUpper[ch - 'a']] = false;
+        }
+    }
+    isVowel[vnl_dd] = false;
+    isVowel[vnl_DD] = false;
+    return isVowel;
+}
+
+constexpr std::array<bool, vnl_lastChar> IsVnVowel = buildVowelTable();
 
 // see vnconv/data.cpp for explanation of these characters
-unsigned char SpecialWesternChars[] = {
+constexpr unsigned char SpecialWesternChars[] = {
     0x80, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A,
     0x8B, 0x8C, 0x8E, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
     0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9E, 0x9F, 0x00};
 
-StdVnChar IsoStdVnCharMap[256];
+//------------------------------------------------
+static constexpr std::array<StdVnChar, 256> buildIsoStdVnCharMap() {
+    std::array<StdVnChar, 256> map{};
+    int i;
+    VnLexiName lexi;
+
+    for (i = 0; i < 256; i++) {
+        map[i] = i;
+    }
+
+    for (i = 0; SpecialWesternChars[i]; i++) {
+        map[SpecialWesternChars[i]] = (vnl_lastChar + i) + VnStdCharOffset;
+    }
+
+    for (i = 0; i < 256; i++) {
+        if ((lexi = IsoToVnLexi(i)) != vnl_nonVnChar) {
+            map[i] = lexi + VnStdCharOffset;
+        }
+    }
+    return map;
+}
+
+constexpr std::array<StdVnChar, 256> IsoStdVnCharMap = buildIsoStdVnCharMap();
 
 inline StdVnChar IsoToStdVnChar(int keyCode) {
     return (keyCode < 256) ? IsoStdVnCharMap[keyCode] : keyCode;
 }
 
+// UTF-8 encoding of each Vietnamese character, for the XUTF8 output path
+struct Utf8Bytes {
+    unsigned char len;
+    unsigned char b[3];
+};
+Utf8Bytes StdVnUtf8[TOTAL_VNCHARS];
+
+inline void encodeUtf8(UnicodeChar uChar, Utf8Bytes &out) {
+    if (uChar < 0x0080) {
+        out.len = 1;
+        out.b[0] = (unsigned char)uChar;
+    } else if (uChar < 0x0800) {
+        out.len = 2;
+        out.b[0] = 0xC0 | (unsigned char)(uChar >> 6);
+        out.b[1] = 0x80 | (unsigned char)(uChar & 0x003F);
+    } else {
+        out.len = 3;
+        out.b[0] = 0xE0 | (unsigned char)(uChar >> 12);
+        out.b[1] = 0x80 | (unsigned char)((uChar >> 6) & 0x003F);
+        out.b[2] = 0x80 | (unsigned char)(uChar & 0x003F);
+    }
+}
+
 struct VowelSeqInfo {
     int len;
     int complete;
@@ -66,7 +128,7 @@ struct VowelSeqInfo {
     VowelSeq withHook; // hook & bowl
 };
 
-VowelSeqInfo VSeqList[] = {{1,
+constexpr VowelSeqInfo VSeqList[] = {{1,
                             1,
                             1,
                             {vnl_a, vnl_nonVnChar, vnl_nonVnChar},
@@ -703,57 +765,103 @@ struct ConSeqInfo {
     bool suffix;
 };
 
-ConSeqInfo CSeqList[] = {{1, {vnl_b, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {1, {vnl_c, vnl_nonVnChar, vnl_nonVnChar}, true},
-                         {2, {vnl_c, vnl_h, vnl_nonVnChar}, true},
-                         {1, {vnl_d, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {1, {vnl_dd, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {2, {vnl_d, vnl_z, vnl_nonVnChar}, false},
-                         {1, {vnl_g, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {2, {vnl_g, vnl_h, vnl_nonVnChar}, false},
-                         {2, {vnl_g, vnl_i, vnl_nonVnChar}, false},
-                         {3, {vnl_g, vnl_i, vnl_n}, false},
-                         {1, {vnl_h, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {1, {vnl_k, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {2, {vnl_k, vnl_h, vnl_nonVnChar}, false},
-                         {1, {vnl_l, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {1, {vnl_m, vnl_nonVnChar, vnl_nonVnChar}, true},
-                         {1, {vnl_n, vnl_nonVnChar, vnl_nonVnChar}, true},
-                         {2, {vnl_n, vnl_g, vnl_nonVnChar}, true},
-                         {3, {vnl_n, vnl_g, vnl_h}, false},
-                         {2, {vnl_n, vnl_h, vnl_nonVnChar}, true},
-                         {1, {vnl_p, vnl_nonVnChar, vnl_nonVnChar}, true},
-                         {2, {vnl_p, vnl_h, vnl_nonVnChar}, false},
-                         {1, {vnl_q, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {2, {vnl_q, vnl_u, vnl_nonVnChar}, false},
-                         {1, {vnl_r, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {1, {vnl_s, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {1, {vnl_t, vnl_nonVnChar, vnl_nonVnChar}, true},
-                         {2, {vnl_t, vnl_h, vnl_nonVnChar}, false},
-                         {2, {vnl_t, vnl_r, vnl_nonVnChar}, false},
-                         {1, {vnl_v, vnl_nonVnChar, vnl_nonVnChar}, false},
-                         {1, {vnl_x, vnl_nonVnChar, vnl_nonVnChar}, false}};
-
-const int VSeqCount = sizeof(VSeqList) / sizeof(VowelSeqInfo);
-struct VSeqPair {
-    VnLexiName v[3];
-    VowelSeq vs;
+constexpr ConSeqInfo CSeqList[] = {
+    {1, {vnl_b, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {1, {vnl_c, vnl_nonVnChar, vnl_nonVnChar}, true},
+    {2, {vnl_c, vnl_h, vnl_nonVnChar}, true},
+    {1, {vnl_d, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {1, {vnl_dd, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {2, {vnl_d, vnl_z, vnl_nonVnChar}, false},
+    {1, {vnl_g, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {2, {vnl_g, vnl_h, vnl_nonVnChar}, false},
+    {2, {vnl_g, vnl_i, vnl_nonVnChar}, false},
+    {3, {vnl_g, vnl_i, vnl_n}, false},
+    {1, {vnl_h, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {1, {vnl_k, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {2, {vnl_k, vnl_h, vnl_nonVnChar}, false},
+    {1, {vnl_l, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {1, {vnl_m, vnl_nonVnChar, vnl_nonVnChar}, true},
+    {1, {vnl_n, vnl_nonVnChar, vnl_nonVnChar}, true},
+    {2, {vnl_n, vnl_g, vnl_nonVnChar}, true},
+    {3, {vnl_n, vnl_g, vnl_h}, false},
+    {2, {vnl_n, vnl_h, vnl_nonVnChar}, true},
+    {1, {vnl_p, vnl_nonVnChar, vnl_nonVnChar}, true},
+    {2, {vnl_p, vnl_h, vnl_nonVnChar}, false},
+    {1, {vnl_q, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {2, {vnl_q, vnl_u, vnl_nonVnChar}, false},
+    {1, {vnl_r, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {1, {vnl_s, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {1, {vnl_t, vnl_nonVnChar, vnl_nonVnChar}, true},
+    {2, {vnl_t, vnl_h, vnl_nonVnChar}, false},
+    {2, {vnl_t, vnl_r, vnl_nonVnChar}, false},
+    {1, {vnl_v, vnl_nonVnChar, vnl_nonVnChar}, false},
+    {1, {vnl_x, vnl_nonVnChar, vnl_nonVnChar}, false}
 };
-VSeqPair SortedVSeqList[VSeqCount];
 
-const int CSeqCount = sizeof(CSeqList) / sizeof(ConSeqInfo);
-struct CSeqPair {
-    VnLexiName c[3];
-    ConSeq cs;
+constexpr int VSeqCount = sizeof(VSeqList) / sizeof(VowelSeqInfo);
+constexpr int CSeqCount = sizeof(CSeqList) / sizeof(ConSeqInfo);
+
+// Letters that can appear in a vowel/consonant sequence. Each one gets a
+// slot (its position here + 1), slot 0 stands for vnl_nonVnChar, i.e. an
+// unused position in a shorter sequence.
+constexpr VnLexiName VSeqLetters[] = {vnl_a,  vnl_ar, vnl_ab, vnl_e,
+                                  vnl_er, vnl_i,  vnl_o,  vnl_or,
+                                  vnl_oh, vnl_u,  vnl_uh, vnl_y};
+constexpr VnLexiName CSeqLetters[] = {vnl_b, vnl_c, vnl_d, vnl_dd, vnl_g,
+                                  vnl_h, vnl_i, vnl_k, vnl_l,  vnl_m,
+                                  vnl_n, vnl_p, vnl_q, vnl_r,  vnl_s,
+                                  vnl_t, vnl_u, vnl_v, vnl_x,  vnl_z};
+constexpr int VSeqSlotCount = sizeof(VSeqLetters) / sizeof(VnLexiName) + 1;
+constexpr int CSeqSlotCount = sizeof(CSeqLetters) / sizeof(VnLexiName) + 1;
+
+template <int SlotCount> struct SeqLookupTable {
+    // slot of each letter, indexed by VnLexiName + 1, -1 if it has no slot
+    signed char slot[vnl_lastChar + 1];
+    // sequence id indexed by the slots of its 3 letters
+    signed char index[SlotCount][SlotCount][SlotCount];
 };
-CSeqPair SortedCSeqList[CSeqCount];
+
+//------------------------------------------------
+template <int SlotCount, class SeqInfo, int SeqCount, class Letters>
+constexpr SeqLookupTable<SlotCount>
+buildSeqLookup(const VnLexiName (&letters)[SlotCount - 1],
+               const SeqInfo (&list)[SeqCount], Letters seqLetters,
+               signed char nil) {
+    SeqLookupTable<SlotCount> table{};
+    for (auto &slot : table.slot)
+        slot = -1;
+    table.slot[vnl_nonVnChar + 1] = 0;
+    for (int i = 0; i < SlotCount - 1; i++)
+        table.slot[letters[i] + 1] = i + 1;
+
+    for (auto &plane : table.index)
+        for (auto &row : plane)
+            for (auto &id : row)
+                id = nil;
+    for (int i = 0; i < SeqCount; i++) {
+        const VnLexiName *l = seqLetters(list[i]);
+        int s1 = table.slot[l[0] + 1], s2 = table.slot[l[1] + 1],
+            s3 = table.slot[l[2] + 1];
+        table.index[s1][s2][s3] = i;
+    }
+    return table;
+}
+
+constexpr SeqLookupTable<VSeqSlotCount> VSeqLookup = buildSeqLookup<
+    VSeqSlotCount>(
+    VSeqLetters, VSeqList, [](const VowelSeqInfo &info) { return info.v; },
+    vs_nil);
+constexpr SeqLookupTable<CSeqSlotCount> CSeqLookup = buildSeqLookup<
+    CSeqSlotCount>(
+    CSeqLetters, CSeqList, [](const ConSeqInfo &info) { return info.c; },
+    cs_nil);
 
 struct VCPair {
     VowelSeq v;
     ConSeq c;
 };
 
-VCPair VCPairList[] = {{vs_a, cs_c},    {vs_a, cs_ch},   {vs_a, cs_m},
+constexpr VCPair VCPairList[] = {{vs_a, cs_c},    {vs_a, cs_ch},   {vs_a, cs_m},
                        {vs_a, cs_n},    {vs_a, cs_ng},   {vs_a, cs_nh},
                        {vs_a, cs_p},    {vs_a, cs_t},    {vs_ar, cs_c},
                        {vs_ar, cs_m},   {vs_ar, cs_n},   {vs_ar, cs_ng},
@@ -825,93 +933,39 @@ VCPair VCPairList[] = {{vs_a, cs_c},    {vs_a, cs_ch},   {vs_a, cs_m},
 
 };
 
-const int VCPairCount = sizeof(VCPairList) / sizeof(VCPair);
+constexpr int VCPairCount = sizeof(VCPairList) / sizeof(VCPair);
 
 // TODO: auto-complete: e.g. luan -> lua^n
 
-typedef int (UkEngine::*UkKeyProc)(UkKeyEvent &ev);
-
-UkKeyProc UkKeyProcList[vneCount] = {
-    &UkEngine::processRoof,    // vneRoofAll
-    &UkEngine::processRoof,    // vneRoof_a
-    &UkEngine::processRoof,    // vneRoof_e
-    &UkEngine::processRoof,    // vneRoof_o
-    &UkEngine::processHook,    // vneHookAll
-    &UkEngine::processHook,    // vneHook_uo
-    &UkEngine::processHook,    // vneHook_u
-    &UkEngine::processHook,    // vneHook_o
-    &UkEngine::processHook,    // vneBowl
-    &UkEngine::processDd,      // vneDd
-    &UkEngine::processTone,    // vneTone0
-    &UkEngine::processTone,    // vneTone1
-    &UkEngine::processTone,    // vneTone2
-    &UkEngine::processTone,    // vneTone3
-    &UkEngine::processTone,    // vneTone4
-    &UkEngine::processTone,    // vneTone5
-    &UkEngine::processTelexW,  // vne_telex_w
-    &UkEngine::processMapChar, // vneMapChar
-    &UkEngine::processEscChar, // vneEscChar
-    &UkEngine::processAppend   // vneNormal
-};
-
 VowelSeq lookupVSeq(VnLexiName v1, VnLexiName v2 = vnl_nonVnChar,
                     VnLexiName v3 = vnl_nonVnChar);
 ConSeq lookupCSeq(VnLexiName c1, VnLexiName c2 = vnl_nonVnChar,
                   VnLexiName c3 = vnl_nonVnChar);
 
-bool UkEngine::m_classInit = false;
-
-//------------------------------------------------
-int tripleVowelCompare(const void *p1, const void *p2) {
-    VSeqPair *t1 = (VSeqPair *)p1;
-    VSeqPair *t2 = (VSeqPair *)p2;
-
-    for (int i = 0; i < 3; i++) {
-        if (t1->v[i] < t2->v[i])
-            return -1;
-        if (t1->v[i] > t2->v[i])
-            return 1;
-    }
-    return 0;
-}
-
-//------------------------------------------------
-int tripleConCompare(const void *p1, const void *p2) {
-    CSeqPair *t1 = (CSeqPair *)p1;
-    CSeqPair *t2 = (CSeqPair *)p2;
+// Spelling validity of every (c1, v, c2) combination, one bit each.
+// Sequence ids are shifted by one so that cs_nil/vs_nil get index 0.
+// Built at compile time from the rules in checkCVC.
+constexpr int CVCBitCount = (CSeqCount + 1) * (VSeqCount + 1) * (CSeqCount + 1);
 
-    for (int i = 0; i < 3; i++) {
-        if (t1->c[i] < t2->c[i])
-            return -1;
-        if (t1->c[i] > t2->c[i])
-            return 1;
-    }
-    return 0;
+constexpr int cvcBitIndex(ConSeq c1, VowelSeq v, ConSeq c2) {
+    return ((c1 + 1) * (VSeqCount + 1) + (v + 1)) * (CSeqCount + 1) + (c2 + 1);
 }
 
-//------------------------------------------------
-int VCPairCompare(const void *p1, const void *p2) {
-    VCPair *t1 = (VCPair *)p1;
-    VCPair *t2 = (VCPair *)p2;
-
-    if (t1->v < t2->v)
-        return -1;
-    if (t1->v > t2->v)
-        return 1;
+//----------------------------------------------------------
+// The rules below are only evaluated while building ValidCVCBits.
+// vcListed tells whether (v, c) is in VCPairList.
+//----------------------------------------------------------
 
-    if (t1->c < t2->c)
-        return -1;
-    if (t1->c > t2->c)
-        return 1;
-    return 0;
-}
+// k can only go with these vowel sequences
+constexpr VowelSeq KVSeqList[] = {vs_e,   vs_i,    vs_y,  vs_er, vs_eo,
+                                  vs_eu,  vs_eru,  vs_ia, vs_ie, vs_ier,
+                                  vs_ieu, vs_ieru, vs_nil};
 
-//----------------------------------------------------------
-bool isValidCV(ConSeq c, VowelSeq v) {
+static constexpr bool checkCV(ConSeq c, VowelSeq v) {
     if (c == cs_nil || v == vs_nil)
         return true;
 
-    VowelSeqInfo &vInfo = VSeqList[v];
+    const VowelSeqInfo &vInfo = VSeqList[v];
 
     // gi doesn't go with i
     // qu doesn't go with u, uh
@@ -923,13 +977,10 @@ bool isValidCV(ConSeq c, VowelSeq v) {
 
     // k can only go with the following vowel sequences
     if (c == cs_k) {
-        static VowelSeq kVseq[] = {vs_e,   vs_i,    vs_y,  vs_er, vs_eo,
-                                   vs_eu,  vs_eru,  vs_ia, vs_ie, vs_ier,
-                                   vs_ieu, vs_ieru, vs_nil};
         int i;
-        for (i = 0; kVseq[i] != vs_nil && kVseq[i] != v; i++)
+        for (i = 0; KVSeqList[i] != vs_nil && KVSeqList[i] != v; i++)
             ;
-        return (kVseq[i] != vs_nil);
+        return (KVSeqList[i] != vs_nil);
     }
 
     // More checks
@@ -937,40 +988,35 @@ bool isValidCV(ConSeq c, VowelSeq v) {
 }
 
 //----------------------------------------------------------
-bool isValidVC(VowelSeq v, ConSeq c) {
+static constexpr bool checkVC(VowelSeq v, ConSeq c, bool vcListed) {
     if (v == vs_nil || c == cs_nil)
         return true;
 
-    VowelSeqInfo &vInfo = VSeqList[v];
+    const VowelSeqInfo &vInfo = VSeqList[v];
     if (!vInfo.conSuffix)
         return false;
 
-    ConSeqInfo &cInfo = CSeqList[c];
+    const ConSeqInfo &cInfo = CSeqList[c];
     if (!cInfo.suffix)
         return false;
 
-    VCPair p;
-    p.v = v;
-    p.c = c;
-    if (bsearch(&p, VCPairList, VCPairCount, sizeof(VCPair), VCPairCompare))
-        return true;
-
-    return false;
+    return vcListed;
 }
 
 //----------------------------------------------------------
-bool isValidCVC(ConSeq c1, VowelSeq v, ConSeq c2) {
+static constexpr bool checkCVC(ConSeq c1, VowelSeq v, ConSeq c2,
+                               bool vcListed) {
     if (v == vs_nil)
         return (c1 == cs_nil || c2 != cs_nil);
 
     if (c1 == cs_nil)
-        return isValidVC(v, c2);
+        return checkVC(v, c2, vcListed);
 
     if (c2 == cs_nil)
-        return isValidCV(c1, v);
+        return checkCV(c1, v);
 
-    bool okCV = isValidCV(c1, v);
-    bool okVC = isValidVC(v, c2);
+    bool okCV = checkCV(c1, v);
+    bool okVC = checkVC(v, c2, vcListed);
 
     if (okCV && okVC)
         return true;
@@ -990,67 +1036,61 @@ bool isValidCVC(ConSeq c1, VowelSeq v, ConSeq c2) {
     return false;
 }
 
-//------------------------------------------------
-void engineClassInit() {
-    int i, j;
-
-    for (i = 0; i < VSeqCount; i++) {
-        for (j = 0; j < 3; j++)
-            SortedVSeqList[i].v[j] = VSeqList[i].v[j];
-        SortedVSeqList[i].vs = (VowelSeq)i;
-    }
-
-    for (i = 0; i < CSeqCount; i++) {
-        for (j = 0; j < 3; j++)
-            SortedCSeqList[i].c[j] = CSeqList[i].c[j];
-        SortedCSeqList[i].cs = (ConSeq)i;
+//----------------------------------------------------------
+static constexpr std::array<unsigned int, (CVCBitCount + 31) / 32>
+buildValidCVCBits() {
+    std::array<unsigned int, (CVCBitCount + 31) / 32> bits{};
+
+    bool vcListed[VSeqCount][CSeqCount] = {};
+    for (int i = 0; i < VCPairCount; i++)
+        vcListed[VCPairList[i].v][VCPairList[i].c] = true;
+
+    for (int c1 = cs_nil; c1 < CSeqCount; c1++) {
+        for (int v = vs_nil; v < VSeqCount; v++) {
+            for (int c2 = cs_nil; c2 < CSeqCount; c2++) {
+                bool listed = v != vs_nil && c2 != cs_nil && vcListed[v][c2];
+                if (checkCVC((ConSeq)c1, (VowelSeq)v, (ConSeq)c2, listed)) {
+                    int bit = cvcBitIndex((ConSeq)c1, (VowelSeq)v, (ConSeq)c2);
+                    bits[bit >> 5] |= 1u << (bit & 31);
+                }
+            }
+        }
     }
+    return bits;
+}
 
-    qsort(SortedVSeqList, VSeqCount, sizeof(VSeqPair), tripleVowelCompare);
-    qsort(SortedCSeqList, CSeqCount, sizeof(CSeqPair), tripleConCompare);
-    qsort(VCPairList, VCPairCount, sizeof(VCPair), VCPairCompare);
+constexpr std::array<unsigned int, (CVCBitCount + 31) / 32> ValidCVCBits =
+    buildValidCVCBits();
 
-    for (i = 0; i < vnl_lastChar; i++)
-        IsVnVowel[i] = true;
+//----------------------------------------------------------
+inline bool isValidCVC(ConSeq c1, VowelSeq v, ConSeq c2) {
+    int i = cvcBitIndex(c1, v, c2);
+    return (ValidCVCBits[i >> 5] >> (i & 31)) & 1;
+}
 
-    unsigned char ch;
-    for (ch = 'a'; ch <= 'z'; ch++) {
-        if (ch != 'a' && ch != 'e' && ch != 'i' && ch != 'o' && ch != 'u' &&
-            ch != 'y') {
-            IsVnVowel[AZLexiLower[ch - 'a']] = false;
-            IsVnVowel[AZLexiUpper[ch - 'a']] = false;
-        }
-    }
-    IsVnVowel[vnl_dd] = false;
-    IsVnVowel[vnl_DD] = false;
+//----------------------------------------------------------
+inline bool isValidCV(ConSeq c, VowelSeq v) {
+    return v == vs_nil || isValidCVC(c, v, cs_nil);
 }
 
 //------------------------------------------------
 VowelSeq lookupVSeq(VnLexiName v1, VnLexiName v2, VnLexiName v3) {
-    VSeqPair key;
-    key.v[0] = v1;
-    key.v[1] = v2;
-    key.v[2] = v3;
-
-    VSeqPair *pInfo = (VSeqPair *)bsearch(&key, SortedVSeqList, VSeqCount,
-                                          sizeof(VSeqPair), tripleVowelCompare);
-    if (pInfo == 0)
+    int s1 = VSeqLookup.slot[v1 + 1];
+    int s2 = VSeqLookup.slot[v2 + 1];
+    int s3 = VSeqLookup.slot[v3 + 1];
+    if ((s1 | s2 | s3) < 0)
         return vs_nil;
-    return pInfo->vs;
+    return (VowelSeq)VSeqLookup.index[s1][s2][s3];
 }
 
 //------------------------------------------------
 ConSeq lookupCSeq(VnLexiName c1, VnLexiName c2, VnLexiName c3) {
-    CSeqPair key;
-    key.c[0] = c1;
-    key.c[1] = c2;
-    key.c[2] = c3;
-
-    CSeqPair *pInfo = (CSeqPair *)bsearch(&key, SortedCSeqList, CSeqCount,
-                                          sizeof(CSeqPair), tripleConCompare);
-    if (pInfo == 0)
+    int s1 = CSeqLookup.slot[c1 + 1];
+    int s2 = CSeqLookup.slot[c2 + 1];
+    int s3 = CSeqLookup.slot[c3 + 1];
+    if ((s1 | s2 | s3) < 0)
         return cs_nil;
-    return pInfo->cs;
+    return (ConSeq)CSeqLookup.index[s1][s2][s3];
 }
 
 //------------------------------------------------------------------
@@ -1094,7 +1134,7 @@ int UkEngine::processRoof(UkKeyEvent &ev) {
         newVs = VSeqList[vs].withRoof;
     }
 
-    VowelSeqInfo *pInfo;
+    const VowelSeqInfo *pInfo;
 
     if (newVs == vs_nil) {
         if (VSeqList[vs].roofPos == -1)
@@ -1208,7 +1248,7 @@ int UkEngine::processHookWithUO(UkKeyEvent &ev) {
 
     (void)toneRemoved; // fix warning
 
-    VnLexiName *v;
+    const VnLexiName *v;
 
     if (!m_pCtrl->options.freeMarking && m_buffer[m_current].vOffset != 0)
         return processAppend(ev);
@@ -1313,7 +1353,7 @@ int UkEngine::processHookWithUO(UkKeyEvent &ev) {
         break;
     }
 
-    VowelSeqInfo *p = &VSeqList[newVs];
+    const VowelSeqInfo *p = &VSeqList[newVs];
     for (i = 0; i < p->len; i++) { // update sub-sequences
         m_buffer[vStart + i].vseq = p->sub[i];
     }
@@ -1357,8 +1397,8 @@ int UkEngine::processHook(UkKeyEvent &ev) {
     int curTonePos, newTonePos, tone;
     int changePos;
     bool hookRemoved = false;
-    VowelSeqInfo *pInfo;
-    VnLexiName *v;
+    const VowelSeqInfo *pInfo;
+    const VnLexiName *v;
 
     vEnd = m_current - m_buffer[m_current].vOffset;
     vs = m_buffer[vEnd].vseq;
@@ -1497,8 +1537,11 @@ int UkEngine::processHook(UkKeyEvent &ev) {
 }
 
 //----------------------------------------------------------
-int UkEngine::getTonePosition(VowelSeq vs, bool terminated) const {
-    VowelSeqInfo &info = VSeqList[vs];
+// Offset in the vowel sequence of the vowel that takes the tone. terminated
+// is true when no consonant follows the vowels.
+//----------------------------------------------------------
+static int tonePosition(VowelSeq vs, bool terminated, bool modernStyle) {
+    const VowelSeqInfo &info = VSeqList[vs];
     if (info.len == 1)
         return 0;
 
@@ -1514,13 +1557,17 @@ int UkEngine::getTonePosition(VowelSeq vs, bool terminated) const {
     if (info.len == 3)
         return 1;
 
-    if (m_pCtrl->options.modernStyle &&
-        (vs == vs_oa || vs == vs_oe || vs == vs_uy))
+    if (modernStyle && (vs == vs_oa || vs == vs_oe || vs == vs_uy))
         return 1;
 
     return terminated ? 0 : 1;
 }
 
+//----------------------------------------------------------
+int UkEngine::getTonePosition(VowelSeq vs, bool terminated) const {
+    return tonePosition(vs, terminated, m_pCtrl->options.modernStyle);
+}
+
 //----------------------------------------------------------
 int UkEngine::processTone(UkKeyEvent &ev) {
     if (m_current < 0 || !m_pCtrl->vietKey)
@@ -1552,7 +1599,7 @@ int UkEngine::processTone(UkKeyEvent &ev) {
 
     vEnd = m_current - m_buffer[m_current].vOffset;
     vs = m_buffer[vEnd].vseq;
-    VowelSeqInfo &info = VSeqList[vs];
+    const VowelSeqInfo &info = VSeqList[vs];
     if (m_pCtrl->options.spellCheckEnabled && !m_pCtrl->options.freeMarking &&
         !info.complete)
         return processAppend(ev);
@@ -1745,13 +1792,12 @@ int UkEngine::processTelexW(UkKeyEvent &ev) {
         return processAppend(ev);
 
     int ret;
-    static bool usedAsMapChar = false;
     int capsLockOn = 0;
     int shiftPressed = 0;
     if (m_keyCheckFunc)
         m_keyCheckFunc(&shiftPressed, &capsLockOn);
 
-    if (usedAsMapChar) {
+    if (m_usedAsMapChar) {
         ev.evType = vneMapChar;
         ev.vnSym = isupper(ev.keyCode) ? vnl_Uh : vnl_uh;
         if (capsLockOn)
@@ -1761,7 +1807,7 @@ int UkEngine::processTelexW(UkKeyEvent &ev) {
         if (ret == 0) {
             if (m_current >= 0)
                 m_current--;
-            usedAsMapChar = false;
+            m_usedAsMapChar = false;
             ev.evType = vneHookAll;
             return processHook(ev);
         }
@@ -1769,7 +1815,7 @@ int UkEngine::processTelexW(UkKeyEvent &ev) {
     }
 
     ev.evType = vneHookAll;
-    usedAsMapChar = false;
+    m_usedAsMapChar = false;
     ret = processHook(ev);
     if (ret == 0) {
         if (m_current >= 0)
@@ -1779,7 +1825,7 @@ int UkEngine::processTelexW(UkKeyEvent &ev) {
         if (capsLockOn)
             ev.vnSym = changeCase(ev.vnSym);
         ev.chType = ukcVn;
-        usedAsMapChar = true;
+        m_usedAsMapChar = true;
         return processMapChar(ev);
     }
     return ret;
@@ -1843,7 +1889,7 @@ int UkEngine::checkEscapeVIQR(UkKeyEvent &ev) {
         p->vnSym = vnl_nonVnChar;
 
         m_current++;
-        p++;
+        p = &m_buffer[m_current];
         p->form = (ev.chType == ukcWordBreak) ? vnw_empty : vnw_nonVn;
         p->c1Offset = p->c2Offset = p->vOffset = -1;
         p->keyCode = ev.keyCode;
@@ -2284,6 +2330,7 @@ int UkEngine::processEscChar(UkKeyEvent &ev) {
 //----------------------------------------------------------
 void UkEngine::pass(int keyCode) {
     UkKeyEvent ev;
+    m_stateId = -1;
     m_pCtrl->input.keyCodeToEvent(keyCode, ev);
     processAppend(ev);
 }
@@ -2317,7 +2364,79 @@ int UkEngine::processNoSpellCheck(UkKeyEvent &ev) {
 //----------------------------------------------------------
 int UkEngine::process(unsigned int keyCode, int &backs, unsigned char *outBuf,
                       int &outSize, UkOutputType &outType) {
+    if (m_pCtrl->transitions)
+        return processTransition(keyCode, backs, outBuf, outSize, outType);
+    return processRules(keyCode, backs, outBuf, outSize, outType);
+}
+
+//----------------------------------------------------------
+// Run the handler of a key event. A switch rather than a table of member
+// pointers, so that the calls are direct.
+//----------------------------------------------------------
+int UkEngine::processKeyEvent(UkKeyEvent &ev) {
+    switch (ev.evType) {
+    case vneRoofAll:
+    case vneRoof_a:
+    case vneRoof_e:
+    case vneRoof_o:
+        return processRoof(ev);
+    case vneHookAll:
+    case vneHook_uo:
+    case vneHook_u:
+    case vneHook_o:
+    case vneBowl:
+        return processHook(ev);
+    case vneDd:
+        return processDd(ev);
+    case vneTone0:
+    case vneTone1:
+    case vneTone2:
+    case vneTone3:
+    case vneTone4:
+    case vneTone5:
+        return processTone(ev);
+    case vne_telex_w:
+        return processTelexW(ev);
+    case vneMapChar:
+        return processMapChar(ev);
+    case vneEscChar:
+        return processEscChar(ev);
+    default:
+        return processAppend(ev);
+    }
+}
+
+//----------------------------------------------------------
+// What processRulesFor() reads from the settings on every key: the event of
+// a key and the spell check option. UkRuntimeKeys reads them from the shared
+// memory, UkBuiltInKeys has them fixed at compile time.
+//----------------------------------------------------------
+struct UkRuntimeKeys {
+    static void keyEvent(const UkSharedMem &ctrl, unsigned int keyCode,
+                         UkKeyEvent &ev) {
+        ctrl.input.keyCodeToEvent(keyCode, ev);
+    }
+    static bool spellCheck(const UkSharedMem &ctrl) {
+        return ctrl.options.spellCheckEnabled;
+    }
+};
+
+template <UkInputMethod IM, bool SpellCheck>
+struct UkBuiltInKeys {
+    static void keyEvent(const UkSharedMem &, unsigned int keyCode,
+                         UkKeyEvent &ev) {
+        UkKeyCodeToEvent(UkBuiltInKeyMap(IM), keyCode, ev);
+    }
+    static bool spellCheck(const UkSharedMem &) { return SpellCheck; }
+};
+
+//----------------------------------------------------------
+template <class Keys>
+int UkEngine::processRulesFor(unsigned int keyCode, int &backs,
+                              unsigned char *outBuf, int &outSize,
+                              UkOutputType &outType) {
     UkKeyEvent ev;
+    m_stateId = -1;
     prepareBuffer();
     m_backs = 0;
     m_changePos = m_current + 1;
@@ -2329,11 +2448,11 @@ int UkEngine::process(unsigned int keyCode, int &backs, unsigned char *outBuf,
     m_keyRestoring = false;
     m_outType = UkCharOutput;
 
-    m_pCtrl->input.keyCodeToEvent(keyCode, ev);
+    Keys::keyEvent(*m_pCtrl, keyCode, ev);
 
     int ret;
     if (!m_toEscape) {
-        ret = (this->*UkKeyProcList[ev.evType])(ev);
+        ret = processKeyEvent(ev);
     } else {
         m_toEscape = false;
         if (m_current < 0 || ev.evType == vneNormal ||
@@ -2350,7 +2469,7 @@ int UkEngine::process(unsigned int keyCode, int &backs, unsigned char *outBuf,
 
     if (m_pCtrl->vietKey && m_current >= 0 &&
         m_buffer[m_current].form == vnw_nonVn && ev.chType == ukcVn &&
-        (!m_pCtrl->options.spellCheckEnabled || m_singleMode)) {
+        (!Keys::spellCheck(*m_pCtrl) || m_singleMode)) {
 
         // The spell check has failed, but because we are in non-spellcheck
         // mode, we consider the new character as the beginning of a new word
@@ -2369,7 +2488,8 @@ int UkEngine::process(unsigned int keyCode, int &backs, unsigned char *outBuf,
     if (m_current >= 0) {
         ev.chType = m_pCtrl->input.getCharType(ev.keyCode);
         m_keyCurrent++;
-        m_keyStrokes[m_keyCurrent].ev = ev;
+        m_keyStrokes[m_keyCurrent].keyCode = ev.keyCode;
+        m_keyStrokes[m_keyCurrent].chType = ev.chType;
         m_keyStrokes[m_keyCurrent].converted = (ret && !m_keyRestored);
     }
 
@@ -2388,18 +2508,259 @@ int UkEngine::process(unsigned int keyCode, int &backs, unsigned char *outBuf,
 
     return ret;
 }
+
+//----------------------------------------------------------
+int UkEngine::processRules(unsigned int keyCode, int &backs,
+                           unsigned char *outBuf, int &outSize,
+                           UkOutputType &outType) {
+    if (m_pCtrl->keyProc)
+        return (this->*m_pCtrl->keyProc)(keyCode, backs, outBuf, outSize,
+                                         outType);
+    return processRulesFor<UkRuntimeKeys>(keyCode, backs, outBuf, outSize,
+                                          outType);
+}
+
+//----------------------------------------------------------
+template <UkInputMethod IM>
+UkEngineKeyProc UkEngine::builtInKeyProc(bool spellCheck) {
+    return spellCheck ? &UkEngine::processRulesFor<UkBuiltInKeys<IM, true>>
+                      : &UkEngine::processRulesFor<UkBuiltInKeys<IM, false>>;
+}
+
+//----------------------------------------------------------
+UkEngineKeyProc UkEngine::selectKeyProc(const UkSharedMem &ctrl) {
+    bool spellCheck = ctrl.options.spellCheckEnabled;
+    switch (ctrl.input.getIM()) {
+    case UkTelex:
+        return builtInKeyProc<UkTelex>(spellCheck);
+    case UkSimpleTelex:
+        return builtInKeyProc<UkSimpleTelex>(spellCheck);
+    case UkSimpleTelex2:
+        return builtInKeyProc<UkSimpleTelex2>(spellCheck);
+    case UkVni:
+        return builtInKeyProc<UkVni>(spellCheck);
+    case UkViqr:
+        return builtInKeyProc<UkViqr>(spellCheck);
+    case UkMsVi:
+        return builtInKeyProc<UkMsVi>(spellCheck);
+    default:
+        return nullptr;
+    }
+}
+
+//----------------------------------------------------------
+bool UkEngine::sameEntry(const WordInfo &a, const WordInfo &b) {
+    return a.keyCode == b.keyCode && a.vnSym == b.vnSym && a.form == b.form &&
+           a.c1Offset == b.c1Offset && a.vOffset == b.vOffset &&
+           a.c2Offset == b.c2Offset && a.vseq == b.vseq && a.caps == b.caps &&
+           a.tone == b.tone;
+}
+
+//----------------------------------------------------------
+static bool sameKeyStroke(const KeyBufEntry &a, const KeyBufEntry &b) {
+    return a.keyCode == b.keyCode && a.chType == b.chType &&
+           a.converted == b.converted;
+}
+
+//----------------------------------------------------------
+// State of the word in table, -1 if not known.
+//----------------------------------------------------------
+int UkEngine::transitionState(const UkTransitionTable &table) const {
+    if (m_stateId >= 0 && m_stateEpoch == table.epoch())
+        return m_stateId;
+    if (atWordBeginning() &&
+        (m_keyCurrent < 0 || m_keyStrokes[m_keyCurrent].chType == ukcWordBreak))
+        return UkTransitionTable::rootState(m_singleMode, m_toEscape,
+                                            m_usedAsMapChar);
+    return -1;
+}
+
+//----------------------------------------------------------
+// The key with everything else the rules read of the outside, UINT_MAX if
+// it is not cached.
+//----------------------------------------------------------
+unsigned int UkEngine::transitionKey(unsigned int keyCode) const {
+    if (keyCode >= (1u << 24))
+        return UINT_MAX;
+    int capsLockOn = 0;
+    int shiftPressed = 0;
+    if (m_keyCheckFunc)
+        m_keyCheckFunc(&shiftPressed, &capsLockOn);
+    return keyCode | (shiftPressed ? 1u << 24 : 0) |
+           (capsLockOn ? 1u << 25 : 0) | (m_pCtrl->vietKey ? 1u << 26 : 0);
+}
+
+//----------------------------------------------------------
+int UkEngine::processTransition(unsigned int keyCode, int &backs,
+                                unsigned char *outBuf, int &outSize,
+                                UkOutputType &outType) {
+    UkTransitionTable &table = *m_pCtrl->transitions;
+    int state = transitionState(table);
+    unsigned int key = state >= 0 ? transitionKey(keyCode) : UINT_MAX;
+
+    // a short buffer may cut the output
+    if (outSize < MAX_UK_KEY_OUTPUT)
+        key = UINT_MAX;
+
+    prepareBuffer();
+    if (key != UINT_MAX) {
+        const Transition *t = table.find(state, key);
+        if (t) {
+            int start = m_current + 1 - table.count(state);
+            int keyStart = m_keyCurrent + 1 - table.keyCount(state);
+            for (int i = t->first; i < t->count; i++)
+                m_buffer[start + i] = t->buffer[i - t->first];
+            for (int i = t->keyFirst; i < t->keyCount; i++)
+                m_keyStrokes[keyStart + i] = t->keyStrokes[i - t->keyFirst];
+            m_current = start + t->count - 1;
+            m_keyCurrent = keyStart + t->keyCount - 1;
+            m_singleMode = t->singleMode;
+            m_toEscape = t->toEscape;
+            m_usedAsMapChar = t->usedAsMapChar;
+            memcpy(outBuf, t->out, t->outSize);
+            outSize = t->outSize;
+            backs = t->backs;
+            outType = t->outType;
+            m_stateId = t->target;
+            m_stateEpoch = table.epoch();
+            m_pCtrl->stats.transitionHits++;
+            return t->ret;
+        }
+    }
+
+    m_pCtrl->stats.transitionMisses++;
+    WordSnapshot before;
+    if (key == UINT_MAX || !saveWord(before) ||
+        before.count != table.count(state) ||
+        before.keyCount != table.keyCount(state))
+        return processRules(keyCode, backs, outBuf, outSize, outType);
+
+    int start = m_current + 1 - before.count;
+    int keyStart = m_keyCurrent + 1 - before.keyCount;
+    int ret = processRules(keyCode, backs, outBuf, outSize, outType);
+    recordTransition(table, state, key, before, start, keyStart, ret, backs,
+                     outBuf, outSize, outType);
+    return ret;
+}
+
+//----------------------------------------------------------
+// Adds what the key just processed did in state, if all it did was change
+// the word, and not by too much. The engine is then in the state it led to.
+//----------------------------------------------------------
+void UkEngine::recordTransition(UkTransitionTable &table, int state,
+                                unsigned int key, const WordSnapshot &before,
+                                int start, int keyStart, int ret, int backs,
+                                const unsigned char *outBuf, int outSize,
+                                UkOutputType outType) {
+    if (outSize > MAX_UK_TRANSITION_OUTPUT || m_changePos < start)
+        return;
+    // the word must still start where it did, not ended or reset by the key
+    WordSnapshot after;
+    if (!saveWord(after) || after.count == 0 ||
+        after.count != m_current + 1 - start ||
+        after.keyCount != m_keyCurrent + 1 - keyStart)
+        return;
+
+    int first = 0;
+    while (first < before.count && first < after.count &&
+           sameEntry(before.buffer[first], after.buffer[first]))
+        first++;
+    int keyFirst = 0;
+    while (keyFirst < before.keyCount && keyFirst < after.keyCount &&
+           sameKeyStroke(before.keyStrokes[keyFirst],
+                         after.keyStrokes[keyFirst]))
+        keyFirst++;
+    if (after.count - first > MAX_UK_TRANSITION_CHANGE ||
+        after.keyCount - keyFirst > MAX_UK_TRANSITION_KEY_CHANGE)
+        return;
+
+    Transition *t = table.add(state, key);
+    if (!t)
+        return;
+    t->count = after.count;
+    t->keyCount = after.keyCount;
+    t->first = first;
+    t->keyFirst = keyFirst;
+    t->singleMode = m_singleMode;
+    t->toEscape = m_toEscape;
+    t->usedAsMapChar = m_usedAsMapChar;
+    for (int i = first; i < after.count; i++)
+        t->buffer[i - first] = after.buffer[i];
+    for (int i = keyFirst; i < after.keyCount; i++)
+        t->keyStrokes[i - keyFirst] = after.keyStrokes[i];
+    t->ret = ret;
+    t->backs = backs;
+    t->outType = outType;
+    t->outSize = outSize;
+    memcpy(t->out, outBuf, outSize);
+    m_stateId = t->target;
+    m_stateEpoch = table.epoch();
+}
+
+//----------------------------------------------------------
+// Epochs are unique across tables, so that the state an engine got from a
+// destroyed table is not taken for one of the table that replaced it.
+//----------------------------------------------------------
+static std::atomic<unsigned int> transitionEpochs{0};
+
+UkTransitionTable::UkTransitionTable()
+    : m_transitions(std::make_unique<UkEngine::Transition[]>(
+          UK_TRANSITION_CAPACITY)),
+      m_slots(std::make_unique<int[]>(UK_TRANSITION_SLOTS)),
+      m_epoch(++transitionEpochs) {}
+
+//----------------------------------------------------------
+void UkTransitionTable::clear() {
+    memset(m_slots.get(), 0, UK_TRANSITION_SLOTS * sizeof(int));
+    m_count = 0;
+    m_epoch = ++transitionEpochs;
+}
+
+//----------------------------------------------------------
+unsigned int UkTransitionTable::slot(int state, unsigned int key) {
+    unsigned int h = (unsigned int)state * 0x9E3779B1u ^ key * 0x85EBCA77u;
+    return (h ^ (h >> 15)) & (UK_TRANSITION_SLOTS - 1);
+}
+
+//----------------------------------------------------------
+const UkEngine::Transition *UkTransitionTable::find(int state,
+                                                    unsigned int key) const {
+    for (unsigned int i = slot(state, key);;
+         i = (i + 1) & (UK_TRANSITION_SLOTS - 1)) {
+        int index = m_slots[i];
+        if (index == 0)
+            return nullptr;
+        const UkEngine::Transition &t = m_transitions[index - 1];
+        if (t.state == state && t.key == key)
+            return &t;
+    }
+}
+
+//----------------------------------------------------------
+UkEngine::Transition *UkTransitionTable::add(int state, unsigned int key) {
+    if (m_count == UK_TRANSITION_CAPACITY) {
+        clear();
+        return nullptr;
+    }
+    unsigned int i = slot(state, key);
+    while (m_slots[i] != 0)
+        i = (i + 1) & (UK_TRANSITION_SLOTS - 1);
+    UkEngine::Transition &t = m_transitions[m_count];
+    t.state = state;
+    t.key = key;
+    t.target = UK_TRANSITION_ROOTS + m_count;
+    m_slots[i] = ++m_count;
+    return &t;
+}
+
 //----------------------------------------------------------
 void UkEngine::rebuildChar(VnLexiName ch, int &backs, unsigned char *outBuf,
                            int &outSize) {
-    static const std::unordered_map<VnLexiName, UkKeyEvName> map{
-        {vnl_Ar, vneRoof_a}, {vnl_Ab, vneBowl},   {vnl_DD, vneDd},
-        {vnl_Er, vneRoof_e}, {vnl_Or, vneRoof_o}, {vnl_Oh, vneHook_o},
-        {vnl_Uh, vneHook_u}};
-
     if (ch == vnl_nonVnChar) {
         return;
     }
 
+    m_stateId = -1;
     prepareBuffer();
     m_backs = 0;
     m_changePos = m_current + 1;
@@ -2419,16 +2780,38 @@ void UkEngine::rebuildChar(VnLexiName ch, int &backs, unsigned char *outBuf,
 
     // add root char to key strokes
     m_keyCurrent++;
-    m_keyStrokes[m_keyCurrent].ev = ev;
+    m_keyStrokes[m_keyCurrent].keyCode = ev.keyCode;
+    m_keyStrokes[m_keyCurrent].chType = ev.chType;
     m_keyStrokes[m_keyCurrent].converted = true;
 
     // modify vowel
-    auto it =
-        map.find(noToneChar % 2 == 0 ? static_cast<VnLexiName>(noToneChar)
-                                     : static_cast<VnLexiName>(noToneChar - 1));
-    if (it != map.end()) {
-        ev.evType = it->second;
-        (this->*UkKeyProcList[ev.evType])(ev);
+    int modifier = -1;
+    switch (noToneChar & ~1) {
+    case vnl_Ar:
+        modifier = vneRoof_a;
+        break;
+    case vnl_Ab:
+        modifier = vneBowl;
+        break;
+    case vnl_DD:
+        modifier = vneDd;
+        break;
+    case vnl_Er:
+        modifier = vneRoof_e;
+        break;
+    case vnl_Or:
+        modifier = vneRoof_o;
+        break;
+    case vnl_Oh:
+        modifier = vneHook_o;
+        break;
+    case vnl_Uh:
+        modifier = vneHook_u;
+        break;
+    }
+    if (modifier >= 0) {
+        ev.evType = modifier;
+        processKeyEvent(ev);
     }
 
     // tone
@@ -2436,7 +2819,7 @@ void UkEngine::rebuildChar(VnLexiName ch, int &backs, unsigned char *outBuf,
     if (tone >= 1 && tone <= 5) {
         ev.evType = vneTone0 + tone;
         ev.tone = tone;
-        (this->*UkKeyProcList[ev.evType])(ev);
+        processKeyEvent(ev);
     }
 
     backs = m_backs;
@@ -2449,14 +2832,178 @@ void UkEngine::rebuildChar(VnLexiName ch, int &backs, unsigned char *outBuf,
 //  outBuf: buffer to write
 //  outSize: [in] size of buffer in bytes
 //           [out] bytes written to buffer
+//----------------------------------------------------------
+// Output through the charset library, works for any charset. Characters in
+// the charset's output table are copied from it.
+class CharsetOutput {
+public:
+    CharsetOutput(int charsetId, unsigned char *outBuf, int outSize)
+        : m_charset(charsetId, NULL), m_os(outBuf, outSize) {
+        m_charset.get()->startOutput();
+        m_table = m_charset.get()->outputTable();
+    }
+    int putChar(StdVnChar stdChar) {
+        const VnOutBytes *p =
+            m_table ? VnOutTableEntry(m_table, stdChar) : NULL;
+        if (p)
+            return m_os.puts((const char *)p->b, p->len);
+        int bytesWritten;
+        return m_charset.get()->putChar(m_os, stdChar, bytesWritten);
+    }
+    int outBytes() { return m_os.getOutBytes(); }
+
+private:
+    VnConvCharset m_charset;
+    StringBOStream m_os;
+    const VnOutBytes *m_table;
+};
+
+//----------------------------------------------------------
+// XUTF8 output without virtual calls, using precomputed bytes.
+// Behaves like StringBOStream: bytes that don't fit are counted
+// but not written.
+class Utf8Output {
+public:
+    Utf8Output(unsigned char *outBuf, int outSize)
+        : m_buf(outBuf), m_len(outSize), m_out(0) {}
+    int putChar(StdVnChar stdChar) {
+        Utf8Bytes bytes;
+        const Utf8Bytes *p;
+        if (stdChar < VnStdCharOffset) {
+            encodeUtf8((UnicodeChar)stdChar, bytes);
+            p = &bytes;
+        } else if (stdChar < VnStdCharOffset + TOTAL_VNCHARS) {
+            p = &StdVnUtf8[stdChar - VnStdCharOffset];
+        } else {
+            return 1; // not a character we know how to write
+        }
+        if (m_out + p->len <= m_len) {
+            memcpy(m_buf + m_out, p->b, p->len);
+            m_out += p->len;
+            return 1;
+        }
+        for (int i = 0; i < p->len; i++, m_out++) {
+            if (m_out < m_len)
+                m_buf[m_out] = p->b[i];
+        }
+        return 0;
+    }
+    int outBytes() { return m_out; }
+
+private:
+    unsigned char *m_buf;
+    int m_len;
+    int m_out;
+};
+
 //----------------------------------------------------------
 int UkEngine::writeOutput(unsigned char *outBuf, int &outSize) {
+    int ret;
+    if (m_pCtrl->charsetId == CONV_CHARSET_XUTF8) {
+        Utf8Output out(outBuf, outSize);
+        ret = writeOutputTo(out);
+        outSize = out.outBytes();
+    } else {
+        CharsetOutput out(m_pCtrl->charsetId, outBuf, outSize);
+        ret = writeOutputTo(out);
+        outSize = out.outBytes();
+    }
+    return ret;
+}
+
+//----------------------------------------------------------
+// Drops up to count trailing characters, counted the way backspaces are,
+// from outBuf[0..outLen). Returns the number of characters left to drop.
+//----------------------------------------------------------
+static int dropOutputChars(int charsetId, const unsigned char *outBuf,
+                           int &outLen, int count) {
+    if (charsetId == CONV_CHARSET_XUTF8) {
+        while (count > 0 && outLen > 0) {
+            outLen--;
+            if ((outBuf[outLen] & 0xC0) != 0x80)
+                count--;
+        }
+        return count;
+    }
+
+    int unit = (charsetId == CONV_CHARSET_UNICODE ||
+                charsetId == CONV_CHARSET_UNIDECOMPOSED)
+                   ? 2
+                   : 1;
+    int n = outLen / unit;
+    if (n > count)
+        n = count;
+    outLen -= n * unit;
+    return count - n;
+}
+
+//----------------------------------------------------------
+// Processes keys like calling process() for each of them, and merges the
+// results into one edit: erase backs characters before the first key's
+// output, then write outBuf. A key that produces nothing is written as is,
+// the way callers of process() do.
+// Stops before a key when less than MAX_UK_KEY_OUTPUT bytes are left in
+// outBuf, and returns the number of keys processed.
+//----------------------------------------------------------
+int UkEngine::processKeys(const unsigned int *keyCodes, int keyCount,
+                          int &backs, unsigned char *outBuf, int &outSize,
+                          UkOutputType &outType) {
+    int i;
+    int outLen = 0;
+    int keyBacks, keySize;
+    UkOutputType keyType;
+
+    backs = 0;
+    outType = UkCharOutput;
+    for (i = 0; i < keyCount; i++) {
+        keySize = outSize - outLen;
+        if (i > 0 && keySize < MAX_UK_KEY_OUTPUT)
+            break;
+
+        unsigned char *keyBuf = outBuf + outLen;
+        process(keyCodes[i], keyBacks, keyBuf, keySize, keyType);
+        if (keyType == UkKeyOutput)
+            outType = UkKeyOutput;
+
+        if (keySize == 0 && keyBacks == 0) {
+            // the key itself, not its escaped form in e.g. VIQR
+            keySize = outSize - outLen;
+            if (m_pCtrl->charsetId == CONV_CHARSET_XUTF8) {
+                Utf8Output out(keyBuf, keySize);
+                out.putChar(keyCodes[i]);
+                keySize = out.outBytes();
+            } else if (keyCodes[i] < 0x80 &&
+                       m_pCtrl->charsetId != CONV_CHARSET_UNICODE &&
+                       m_pCtrl->charsetId != CONV_CHARSET_UNIDECOMPOSED) {
+                keyBuf[0] = keyCodes[i];
+                keySize = 1;
+            } else {
+                CharsetOutput out(m_pCtrl->charsetId, keyBuf, keySize);
+                out.putChar(IsoToStdVnChar(keyCodes[i]));
+                keySize = out.outBytes();
+            }
+        }
+
+        if (keyBacks > 0) {
+            int kept = outLen;
+            backs += dropOutputChars(m_pCtrl->charsetId, outBuf, kept,
+                                     keyBacks);
+            if (kept < outLen)
+                memmove(outBuf + kept, keyBuf, keySize);
+            outLen = kept;
+        }
+        outLen += keySize;
+    }
+
+    outSize = outLen;
+    return i;
+}
+
+//----------------------------------------------------------
+template <class Output> int UkEngine::writeOutputTo(Output &out) {
     StdVnChar stdChar;
-    int i, bytesWritten;
+    int i;
     int ret = 1;
-    StringBOStream os(outBuf, outSize);
-    VnCharset *pCharset = VnCharsetLibObj.getVnCharset(m_pCtrl->charsetId);
-    pCharset->startOutput();
 
     for (i = m_changePos; i <= m_current; i++) {
         if (m_buffer[i].vnSym != vnl_nonVnChar) {
@@ -2471,10 +3018,9 @@ int UkEngine::writeOutput(unsigned char *outBuf, int &outSize) {
         }
 
         if (stdChar != INVALID_STD_CHAR)
-            ret = pCharset->putChar(os, stdChar, bytesWritten);
+            ret = out.putChar(stdChar);
     }
 
-    outSize = os.getOutBytes();
     return (ret ? 0 : VNCONV_OUT_OF_MEMORY);
 }
 
@@ -2494,9 +3040,12 @@ int UkEngine::getSeqSteps(int first, int last) const {
 
     StringBOStream os(0, 0);
     int i, bytesWritten;
+    int len = 0;
 
-    VnCharset *pCharset = VnCharsetLibObj.getVnCharset(m_pCtrl->charsetId);
+    VnConvCharset charset(m_pCtrl->charsetId, NULL);
+    VnCharset *pCharset = charset.get();
     pCharset->startOutput();
+    const VnOutBytes *table = pCharset->outputTable();
 
     for (i = first; i <= last; i++) {
         if (m_buffer[i].vnSym != vnl_nonVnChar) {
@@ -2510,11 +3059,16 @@ int UkEngine::getSeqSteps(int first, int last) const {
             stdChar = m_buffer[i].keyCode;
         }
 
-        if (stdChar != INVALID_STD_CHAR)
+        if (stdChar == INVALID_STD_CHAR)
+            continue;
+        const VnOutBytes *p = table ? VnOutTableEntry(table, stdChar) : NULL;
+        if (p)
+            len += p->len;
+        else
             pCharset->putChar(os, stdChar, bytesWritten);
     }
 
-    int len = os.getOutBytes();
+    len += os.getOutBytes();
     if (m_pCtrl->charsetId == CONV_CHARSET_UNIDECOMPOSED)
         len = len / 2;
     return len;
@@ -2541,7 +3095,7 @@ void UkEngine::synchKeyStrokeBuffer() {
         // so we also need to move key stroke pointer backward to corresponding
         // word break
         while (m_keyCurrent >= 0 &&
-               m_keyStrokes[m_keyCurrent].ev.chType != ukcWordBreak) {
+               m_keyStrokes[m_keyCurrent].chType != ukcWordBreak) {
             m_keyCurrent--;
         }
     }
@@ -2551,6 +3105,7 @@ void UkEngine::synchKeyStrokeBuffer() {
 int UkEngine::processBackspace(int &backs, unsigned char *outBuf, int &outSize,
                                UkOutputType &outType) {
     outType = UkCharOutput;
+    m_stateId = -1;
     if (!m_pCtrl->vietKey || m_current < 0) {
         backs = 0;
         outSize = 0;
@@ -2608,6 +3163,7 @@ int UkEngine::processBackspace(int &backs, unsigned char *outBuf, int &outSize,
 
 //------------------------------------------------
 void UkEngine::reset() {
+    m_stateId = -1;
     m_current = -1;
     m_keyCurrent = -1;
     m_singleMode = false;
@@ -2617,12 +3173,54 @@ void UkEngine::reset() {
 //------------------------------------------------
 void UkEngine::resetKeyBuf() { m_keyCurrent = -1; }
 
+//------------------------------------------------
+bool UkEngine::saveWord(WordSnapshot &snap) const {
+    int start = m_current;
+    while (start >= 0 && m_buffer[start].form != vnw_empty)
+        start--;
+    start++;
+
+    int keyStart = m_keyCurrent;
+    while (keyStart >= 0 &&
+           m_keyStrokes[keyStart].chType != ukcWordBreak)
+        keyStart--;
+    keyStart++;
+
+    int count = m_current + 1 - start;
+    int keyCount = m_keyCurrent + 1 - keyStart;
+    if (count > MAX_UK_SNAPSHOT_WORD || keyCount > MAX_UK_SNAPSHOT_WORD)
+        return false;
+
+    // offsets in WordInfo are relative, the entries can be moved as they are
+    snap.count = count;
+    snap.keyCount = keyCount;
+    snap.singleMode = m_singleMode;
+    snap.toEscape = m_toEscape;
+    snap.usedAsMapChar = m_usedAsMapChar;
+    for (int i = 0; i < count; i++)
+        snap.buffer[i] = m_buffer[start + i];
+    for (int i = 0; i < keyCount; i++)
+        snap.keyStrokes[i] = m_keyStrokes[keyStart + i];
+    return true;
+}
+
+//------------------------------------------------
+void UkEngine::restoreWord(const WordSnapshot &snap) {
+    m_stateId = -1;
+    for (int i = 0; i < snap.count; i++)
+        m_buffer[i] = snap.buffer[i];
+    for (int i = 0; i < snap.keyCount; i++)
+        m_keyStrokes[i] = snap.keyStrokes[i];
+    m_current = snap.count - 1;
+    m_keyCurrent = snap.keyCount - 1;
+    m_singleMode = snap.singleMode;
+    m_toEscape = snap.toEscape;
+    m_usedAsMapChar = snap.usedAsMapChar;
+}
+
 //------------------------------------------------
 UkEngine::UkEngine() {
-    if (!m_classInit) {
-        engineClassInit();
-        m_classInit = true;
-    }
+    SetupUnikeyEngine();
     m_pCtrl = 0;
     m_bufSize = MAX_UK_ENGINE;
     m_keyBufSize = MAX_UK_ENGINE;
@@ -2633,6 +3231,9 @@ UkEngine::UkEngine() {
     m_reverted = false;
     m_toEscape = false;
     m_keyRestored = false;
+    m_usedAsMapChar = false;
+    m_stateId = -1;
+    m_stateEpoch = 0;
 }
 
 //----------------------------------------------------
@@ -2647,28 +3248,29 @@ void UkEngine::prepareBuffer() {
         for (rid = m_current / 2;
              m_buffer[rid].form != vnw_empty && rid < m_current; rid++)
             ;
-        if (rid == m_current) {
-            m_current = -1;
-        } else {
+        // A run without a word break in the second half can't be a
+        // Vietnamese word: cut it instead of forgetting it, so that it isn't
+        // taken for the beginning of a new word.
+        if (rid == m_current && m_buffer[rid].form != vnw_empty)
+            rid = m_current / 2;
+        else
             rid++;
-            memmove(m_buffer, m_buffer + rid,
-                    (m_current - rid + 1) * sizeof(WordInfo));
-            m_current -= rid;
-        }
+        m_pCtrl->stats.bufferCompactions++;
+        m_buffer.dropFront(rid);
+        m_current -= rid;
     }
 
     // prepare key stroke buffer
     if (m_keyCurrent > 0 && m_keyCurrent + 1 >= m_keyBufSize) {
         // Get rid of at least half of the current entries
         rid = m_keyCurrent / 2;
-        memmove(m_keyStrokes, m_keyStrokes + rid,
-                (m_keyCurrent - rid + 1) * sizeof(m_keyStrokes[0]));
+        m_pCtrl->stats.keyBufferCompactions++;
+        m_keyStrokes.dropFront(rid);
         m_keyCurrent -= rid;
     }
 }
 
 #define ENTER_CHAR 13
-enum VnCaseType { VnCaseNoChange, VnCaseAllCapital, VnCaseAllSmall };
 
 //----------------------------------------------------
 int UkEngine::macroMatch(UkKeyEvent &ev) {
@@ -2682,101 +3284,122 @@ int UkEngine::macroMatch(UkKeyEvent &ev) {
 
     const StdVnChar *pMacText = NULL;
     StdVnChar key[MAX_MACRO_KEY_LEN + 1];
-    StdVnChar *pKeyStart;
-
-    // Use static macro text so we can gain a bit of performance
-    // by avoiding memory allocation each time this function is called
-    static StdVnChar macroText[MAX_MACRO_TEXT_LEN + 1];
+    StdVnChar *pKeyStart = key;
 
     int i, j;
 
-    i = m_current;
-    while (i >= 0 && (m_current - i + 1) < MAX_MACRO_KEY_LEN) {
-        while (i >= 0 && m_buffer[i].form != vnw_empty &&
-               (m_current - i + 1) < MAX_MACRO_KEY_LEN)
-            i--;
-        if (i >= 0 && m_buffer[i].form != vnw_empty)
-            return 0;
-
-        if (i >= 0) {
-            if (m_buffer[i].vnSym != vnl_nonVnChar) {
-                key[0] = m_buffer[i].vnSym + VnStdCharOffset;
-                if (m_buffer[i].caps)
-                    key[0]--;
-                key[0] += m_buffer[i].tone * 2;
-            } else
-                key[0] = m_buffer[i].keyCode;
-        }
+    auto stdChar = [this](int pos) -> StdVnChar {
+        const WordInfo &entry = m_buffer[pos];
+        if (entry.vnSym == vnl_nonVnChar)
+            return entry.keyCode;
+        StdVnChar ch = entry.vnSym + VnStdCharOffset;
+        if (entry.caps)
+            ch--;
+        return ch + entry.tone * 2;
+    };
 
-        for (j = i + 1; j <= m_current; j++) {
-            if (m_buffer[j].vnSym != vnl_nonVnChar) {
-                key[j - i] = m_buffer[j].vnSym + VnStdCharOffset;
-                if (m_buffer[j].caps)
-                    key[j - i]--;
-                key[j - i] += m_buffer[j].tone * 2;
-            } else
-                key[j - i] = m_buffer[j].keyCode;
+    // A macro key starts at the beginning of the buffer, at a word break, or
+    // right after one. Feed the buffer backward into the macro cursor and
+    // check each of those positions on the way, the nearest one first. The
+    // user's table comes first, the system one only has the keys it lacks.
+    const CMacroTable *layers[] = {m_pCtrl->macStore.get(),
+                                   m_pCtrl->sysMacStore.get()};
+    if (!layers[0] && !layers[1])
+        return 0;
+    const CMacroTable *pTable = NULL;
+    int cursor = CMacroTable::MacroCursorRoot;
+    int start = m_current + 1;
+    for (const CMacroTable *layer : layers) {
+        if (!layer)
+            continue;
+        cursor = CMacroTable::MacroCursorRoot;
+        start = m_current + 1;
+        if (m_current < 0 || m_buffer[m_current].form == vnw_empty)
+            pMacText = layer->cursorText(cursor);
+
+        while (!pMacText && start > 0 &&
+               m_current - start + 2 < MAX_MACRO_KEY_LEN) {
+            start--;
+            cursor = layer->cursorStep(cursor, stdChar(start));
+            if (cursor < 0)
+                break;
+            if (start == 0 || m_buffer[start].form == vnw_empty ||
+                m_buffer[start - 1].form == vnw_empty)
+                pMacText = layer->cursorText(cursor);
         }
-        key[m_current - i + 1] = 0;
-        // search macro table
-        pMacText = m_pCtrl->macStore.lookup(key + 1);
         if (pMacText) {
-            i++; // mark the position where change is needed
-            pKeyStart = key + 1;
+            pTable = layer;
             break;
         }
-        if (i >= 0) {
-            pMacText = m_pCtrl->macStore.lookup(key);
-            if (pMacText) {
-                pKeyStart = key;
-                break;
-            }
-        }
-        i--;
     }
 
-    if (!pMacText) {
+    if (!pTable) {
+        m_pCtrl->stats.macroMisses++;
         return 0;
     }
+    m_pCtrl->stats.macroHits++;
+
+    for (j = start; j <= m_current; j++)
+        key[j - start] = stdChar(j);
+    key[m_current - start + 1] = 0;
 
-    markChange(i);
+    markChange(start);
 
     // determine the form of macro replacements: ALL CAPITALS, First Character
     // Capital, or no change
-    VnCaseType macroCase;
+    MacroCase macroCase;
     if (IS_STD_VN_LOWER(*pKeyStart)) {
-        macroCase = VnCaseAllSmall;
+        macroCase = MacroCaseAllSmall;
     } else if (IS_STD_VN_UPPER(*pKeyStart)) {
-        macroCase = VnCaseAllCapital;
+        macroCase = MacroCaseAllCapital;
         for (i = 1; pKeyStart[i]; i++) {
             if (IS_STD_VN_LOWER(pKeyStart[i])) {
-                macroCase = VnCaseNoChange;
+                macroCase = MacroCaseNoChange;
             }
         }
     } else
-        macroCase = VnCaseNoChange;
-
-    // Convert case of macro text according to macroCase
-    int charCount = 0;
-    while (pMacText[charCount] != 0)
-        charCount++;
-
-    for (i = 0; i < charCount; i++) {
-        if (macroCase == VnCaseAllCapital)
-            macroText[i] = StdVnToUpper(pMacText[i]);
-        else if (macroCase == VnCaseAllSmall)
-            macroText[i] = StdVnToLower(pMacText[i]);
-        else
-            macroText[i] = pMacText[i];
-    }
+        macroCase = MacroCaseNoChange;
 
-    // Convert to target output charset
     int outSize;
-    int maxOutSize = *m_pOutSize;
-    int inLen = charCount * sizeof(StdVnChar);
-    VnConvert(CONV_CHARSET_VNSTANDARD, m_pCtrl->charsetId, (UKBYTE *)macroText,
-              (UKBYTE *)m_pOutBuf, &inLen, &maxOutSize);
-    outSize = maxOutSize;
+    int maxOutSize;
+    int inLen;
+    // Pre-rendered for this table and charset, unless the table was put in
+    // the shared memory directly
+    const CMacroRendering *rendering = pTable == m_pCtrl->macStore.get()
+                                           ? m_pCtrl->macRendering.get()
+                                           : m_pCtrl->sysMacRendering.get();
+    const unsigned char *rendered = NULL;
+    if (rendering && rendering->table() == pTable &&
+        rendering->charset() == m_pCtrl->charsetId)
+        rendered = rendering->text(cursor, macroCase, outSize);
+
+    if (rendered && outSize <= *m_pOutSize) {
+        memcpy(m_pOutBuf, rendered, outSize);
+    } else {
+        // Convert case of macro text according to macroCase. On the stack,
+        // not static, so that engines in different threads don't share it
+        StdVnChar macroText[MAX_MACRO_TEXT_LEN + 1];
+        int charCount = 0;
+        while (pMacText[charCount] != 0)
+            charCount++;
+
+        for (i = 0; i < charCount; i++) {
+            if (macroCase == MacroCaseAllCapital)
+                macroText[i] = StdVnToUpper(pMacText[i]);
+            else if (macroCase == MacroCaseAllSmall)
+                macroText[i] = StdVnToLower(pMacText[i]);
+            else
+                macroText[i] = pMacText[i];
+        }
+
+        // Convert to target output charset
+        maxOutSize = *m_pOutSize;
+        inLen = charCount * sizeof(StdVnChar);
+        VnConvert(CONV_CHARSET_VNSTANDARD, m_pCtrl->charsetId,
+                  (UKBYTE *)macroText, (UKBYTE *)m_pOutBuf, &inLen,
+                  &maxOutSize);
+        outSize = maxOutSize;
+    }
 
     // write the last input character
     StdVnChar vnChar;
@@ -2804,6 +3427,7 @@ int UkEngine::macroMatch(UkKeyEvent &ev) {
 int UkEngine::restoreKeyStrokes(int &backs, unsigned char *outBuf, int &outSize,
                                 UkOutputType &outType) {
     outType = UkKeyOutput;
+    m_stateId = -1;
     if (!lastWordHasVnMark()) {
         backs = 0;
         outSize = 0;
@@ -2816,7 +3440,7 @@ int UkEngine::restoreKeyStrokes(int &backs, unsigned char *outBuf, int &outSize,
     int keyStart;
     bool converted = false;
     for (keyStart = m_keyCurrent;
-         keyStart >= 0 && m_keyStrokes[keyStart].ev.chType != ukcWordBreak;
+         keyStart >= 0 && m_keyStrokes[keyStart].chType != ukcWordBreak;
          keyStart--) {
         if (m_keyStrokes[keyStart].converted) {
             converted = true;
@@ -2844,9 +3468,9 @@ int UkEngine::restoreKeyStrokes(int &backs, unsigned char *outBuf, int &outSize,
     m_keyRestoring = true;
     for (i = keyStart, count = 0; i <= m_keyCurrent; i++) {
         if (count < outSize) {
-            outBuf[count++] = (unsigned char)m_keyStrokes[i].ev.keyCode;
+            outBuf[count++] = (unsigned char)m_keyStrokes[i].keyCode;
         }
-        m_pCtrl->input.keyCodeToSymbol(m_keyStrokes[i].ev.keyCode, ev);
+        m_pCtrl->input.keyCodeToSymbol(m_keyStrokes[i].keyCode, ev);
         m_keyStrokes[i].converted = false;
         processAppend(ev);
     }
@@ -2857,29 +3481,18 @@ int UkEngine::restoreKeyStrokes(int &backs, unsigned char *outBuf, int &outSize,
 }
 
 //--------------------------------------------------
-void UkEngine::setSingleMode() { m_singleMode = true; }
+void UkEngine::setSingleMode() {
+    m_stateId = -1;
+    m_singleMode = true;
+}
 
+//--------------------------------------------------
+// The lookup tables are constexpr, only the UTF-8 forms of UnicodeTable
+// (which lives with the conversion library) are computed here.
 //--------------------------------------------------
 static void SetupUnikeyEngineOnce() {
-    SetupInputClassifierTable();
-    int i;
-    VnLexiName lexi;
-
-    // Calculate IsoStdVnCharMap
-    for (i = 0; i < 256; i++) {
-        IsoStdVnCharMap[i] = i;
-    }
-
-    for (i = 0; SpecialWesternChars[i]; i++) {
-        IsoStdVnCharMap[SpecialWesternChars[i]] =
-            (vnl_lastChar + i) + VnStdCharOffset;
-    }
-
-    for (i = 0; i < 256; i++) {
-        if ((lexi = IsoToVnLexi(i)) != vnl_nonVnChar) {
-            IsoStdVnCharMap[i] = lexi + VnStdCharOffset;
-        }
-    }
+    for (int i = 0; i < TOTAL_VNCHARS; i++)
+        encodeUtf8(UnicodeTable[i], StdVnUtf8[i]);
 }
 
 std::once_flag setupFlag;
@@ -2891,6 +3504,25 @@ bool UkEngine::atWordBeginning() const {
     return (m_current < 0 || m_buffer[m_current].form == vnw_empty);
 }
 
+//--------------------------------------------------
+int UkEngine::getCurrentWord(VnLexiName *letters, int size) const {
+    int start = m_current;
+    while (start >= 0 && m_buffer[start].form != vnw_empty)
+        start--;
+    start++;
+
+    int count = m_current + 1 - start;
+    if (count > size)
+        return -1;
+    for (int i = 0; i < count; i++) {
+        const WordInfo &entry = m_buffer[start + i];
+        letters[i] = (entry.vnSym == vnl_nonVnChar)
+                         ? vnl_nonVnChar
+                         : (VnLexiName)(entry.vnSym + entry.tone * 2);
+    }
+    return count;
+}
+
 //--------------------------------------------------
 // Check for macro first, if there's a match, expand macro. If not:
 // Spell-check, if is valid Vietnamese, return normally, if not:
@@ -2917,7 +3549,8 @@ int UkEngine::processWordEnd(UkKeyEvent &ev) {
     }
 
     int outSize = 0;
-    if (m_pCtrl->options.autoNonVnRestore && lastWordIsNonVn()) {
+    if (m_pCtrl->options.autoNonVnRestore &&
+        (lastWordIsNonVn() || lastWordIsRestoreWord())) {
         outSize = *m_pOutSize;
         if (restoreKeyStrokes(m_backs, m_pOutBuf, outSize, m_outType)) {
             m_keyRestored = true;
@@ -2983,6 +3616,29 @@ bool UkEngine::lastWordIsNonVn() const {
     return false;
 }
 
+//---------------------------------------------------------------------------
+// Test if the keys typed for the last word are one of the restore words.
+// Most words are rejected by the bloom filter of the set after one hash.
+//---------------------------------------------------------------------------
+bool UkEngine::lastWordIsRestoreWord() const {
+    const UkWordSet *words = m_pCtrl->restoreWords.get();
+    if (!words || m_current < 0 || m_buffer[m_current].form == vnw_empty)
+        return false;
+
+    char word[UK_WORDSET_MAX_WORD];
+    int len = 0;
+    int i = m_keyCurrent;
+    while (i >= 0 && m_keyStrokes[i].chType != ukcWordBreak)
+        i--;
+    for (i++; i <= m_keyCurrent; i++) {
+        unsigned int keyCode = m_keyStrokes[i].keyCode;
+        if (len == UK_WORDSET_MAX_WORD || keyCode >= 0x80)
+            return false;
+        word[len++] = keyCode;
+    }
+    return words->contains(word, len);
+}
+
 //---------------------------------------------------------------------------
 // Test if last word has a Vietnamese mark, that is tones, decorators
 //---------------------------------------------------------------------------
@@ -3000,3 +3656,170 @@ bool UkEngine::lastWordHasVnMark() const {
     }
     return false;
 }
+
+//---------------------------------------------------------------------------
+// Spell check of existing text, with the same tables as the engine
+//---------------------------------------------------------------------------
+bool UkCheckSyllable(const VnLexiName *letters, int count, bool modernStyle,
+                     UkSyllable &result) {
+    result.valid = false;
+    result.tone = 0;
+    result.tonePos = result.normTonePos = -1;
+    if (count <= 0 || count > MAX_UK_SYLLABLE)
+        return false;
+
+    // without tone, the padding makes the lookups below simpler
+    VnLexiName base[MAX_UK_SYLLABLE + 3];
+    for (int i = 0; i < count; i++) {
+        VnLexiName ch = vnToLower(letters[i]);
+        if (ch == vnl_nonVnChar)
+            return false;
+        base[i] = (VnLexiName)StdVnNoTone[ch];
+        int tone = (ch - base[i]) / 2;
+        if (tone) {
+            if (result.tone)
+                return false;
+            result.tone = tone;
+            result.tonePos = i;
+        }
+    }
+    for (int i = count; i < count + 3; i++)
+        base[i] = vnl_nonVnChar;
+    result.normTonePos = result.tonePos;
+
+    int vStart = 0;
+    while (vStart < count && !IsVnVowel[base[vStart]])
+        vStart++;
+    // like the engine, u after q, and i after g and before a vowel, belong
+    // to the consonant
+    if (vStart == 1 &&
+        ((base[0] == vnl_q && base[1] == vnl_u) ||
+         (base[0] == vnl_g && base[1] == vnl_i && base[2] != vnl_nonVnChar &&
+          IsVnVowel[base[2]])))
+        vStart = 2;
+    int vEnd = vStart;
+    while (vEnd < count && IsVnVowel[base[vEnd]])
+        vEnd++;
+    int vLen = vEnd - vStart;
+    int c2Len = count - vEnd;
+    if (vStart > 3 || vLen == 0 || vLen > 3 || c2Len > 3)
+        return false;
+
+    VnLexiName seq[3][3];
+    for (int i = 0; i < 3; i++) {
+        seq[0][i] = i < vStart ? base[i] : vnl_nonVnChar;
+        seq[1][i] = i < vLen ? base[vStart + i] : vnl_nonVnChar;
+        seq[2][i] = i < c2Len ? base[vEnd + i] : vnl_nonVnChar;
+    }
+    ConSeq c1 = cs_nil;
+    if (vStart > 0) {
+        c1 = lookupCSeq(seq[0][0], seq[0][1], seq[0][2]);
+        if (c1 == cs_nil)
+            return false;
+    }
+    VowelSeq v = lookupVSeq(seq[1][0], seq[1][1], seq[1][2]);
+    if (v == vs_nil || !VSeqList[v].complete)
+        return false;
+    ConSeq c2 = cs_nil;
+    if (c2Len > 0) {
+        c2 = lookupCSeq(seq[2][0], seq[2][1], seq[2][2]);
+        if (c2 == cs_nil)
+            return false;
+    }
+    if (!isValidCVC(c1, v, c2))
+        return false;
+    // c, ch, p, t suffixes don't allow ` ? ~
+    if ((c2 == cs_c || c2 == cs_ch || c2 == cs_p || c2 == cs_t) &&
+        (result.tone == 2 || result.tone == 3 || result.tone == 4))
+        return false;
+
+    if (result.tone)
+        result.normTonePos =
+            vStart + tonePosition(v, c2 == cs_nil, modernStyle);
+    result.valid = true;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Splits the input into runs of letters, next(pos) returns the letter at pos
+// (vnl_nonVnChar for anything else) and moves pos past it.
+//---------------------------------------------------------------------------
+template <class Next>
+static int checkSyllables(int len, bool modernStyle, UkSyllable *out,
+                          int maxCount, Next next) {
+    VnLexiName letters[MAX_UK_SYLLABLE];
+    int count = 0;
+    int pos = 0;
+    while (pos < len && count < maxCount) {
+        int start = pos;
+        VnLexiName ch = next(pos);
+        if (ch == vnl_nonVnChar)
+            continue;
+        int letterCount = 0;
+        int end;
+        do {
+            // a longer word is invalid anyway, only its length matters
+            if (letterCount < MAX_UK_SYLLABLE)
+                letters[letterCount] = ch;
+            letterCount++;
+            end = pos;
+        } while (pos < len && (ch = next(pos)) != vnl_nonVnChar);
+
+        UkSyllable &syllable = out[count++];
+        syllable.start = start;
+        syllable.len = end - start;
+        UkCheckSyllable(letters, letterCount, modernStyle, syllable);
+    }
+    return count;
+}
+
+//---------------------------------------------------------------------------
+int UkCheckSyllables(const StdVnChar *text, int len, bool modernStyle,
+                     UkSyllable *out, int maxCount) {
+    return checkSyllables(len, modernStyle, out, maxCount, [text](int &pos) {
+        StdVnChar ch = text[pos++];
+        if (ch < 0x80)
+            return IsoToVnLexi(ch);
+        if (ch >= VnStdCharOffset &&
+            ch < VnStdCharOffset + TOTAL_ALPHA_VNCHARS)
+            return (VnLexiName)(ch - VnStdCharOffset);
+        return vnl_nonVnChar;
+    });
+}
+
+//---------------------------------------------------------------------------
+// Every Vietnamese letter is in the BMP, so in at most 3 bytes of UTF-8.
+//---------------------------------------------------------------------------
+int UkCheckSyllablesUtf8(const char *text, int len, bool modernStyle,
+                         UkSyllable *out, int maxCount) {
+    const VnCodeMap &uniMap = VnCharsetLibObj.unicodeMap();
+    const unsigned char *p = (const unsigned char *)text;
+    return checkSyllables(len, modernStyle, out, maxCount,
+                          [p, len, &uniMap](int &pos) {
+        unsigned int c = p[pos++];
+        if (c < 0x80)
+            return IsoToVnLexi(c);
+        int follow;
+        if ((c & 0xE0) == 0xC0) {
+            c &= 0x1F;
+            follow = 1;
+        } else if ((c & 0xF0) == 0xE0) {
+            c &= 0x0F;
+            follow = 2;
+        } else {
+            // 4 byte sequences and stray bytes, one at a time
+            return vnl_nonVnChar;
+        }
+        if (pos + follow > len)
+            return vnl_nonVnChar;
+        for (int i = 0; i < follow; i++) {
+            if ((p[pos + i] & 0xC0) != 0x80)
+                return vnl_nonVnChar;
+            c = (c << 6) | (p[pos + i] & 0x3F);
+        }
+        pos += follow;
+        int idx = uniMap.lookup(c);
+        return (idx >= 0 && idx < TOTAL_ALPHA_VNCHARS) ? (VnLexiName)idx
+                                                        : vnl_nonVnChar;
+    });
+}
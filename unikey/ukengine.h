@@ -11,9 +11,33 @@
 #include "inputproc.h"
 #include "mactab.h"
 #include "vnlexi.h"
+#include "wordset.h"
 #include <functional>
+#include <memory>
 
-// This is a shared object among processes, do not put any pointer in it
+// Counters updated by all engines of one input method
+struct UkEngineStats {
+    unsigned long macroHits = 0;
+    unsigned long macroMisses = 0;
+    // times prepareBuffer() dropped old symbols / old key strokes
+    unsigned long bufferCompactions = 0;
+    unsigned long keyBufferCompactions = 0;
+    // keys taken from the transition table, and keys processed while it is
+    // on
+    unsigned long transitionHits = 0;
+    unsigned long transitionMisses = 0;
+};
+
+class UkTransitionTable;
+class UkEngine;
+
+// UkEngine key handler specialised for one input method, see
+// UkEngine::selectKeyProc()
+typedef int (UkEngine::*UkEngineKeyProc)(unsigned int keyCode, int &backs,
+                                          unsigned char *outBuf, int &outSize,
+                                          UkOutputType &outType);
+
+// State shared by all input contexts of one input method
 struct UkSharedMem {
     // states
     bool vietKey;
@@ -24,34 +48,107 @@ struct UkSharedMem {
     int usrKeyMap[256];
     int charsetId;
 
-    CMacroTable macStore;
+    // Immutable snapshot, replaced as a whole when macros are reloaded.
+    // Null if no macro is loaded.
+    std::shared_ptr<const CMacroTable> macStore;
+    // The texts of macStore in charsetId, null if not rendered. macroMatch
+    // converts the text itself when it belongs to another table or charset.
+    std::shared_ptr<const CMacroRendering> macRendering;
+    // Macros of the whole system under the ones of macStore, usually mapped
+    // from a compiled file that all sessions share. Null if none.
+    std::shared_ptr<const CMacroTable> sysMacStore;
+    std::shared_ptr<const CMacroRendering> sysMacRendering;
+    // Words restored as typed at word end, like the ones that fail spell
+    // check, when autoNonVnRestore is on. Null if none is loaded.
+    std::shared_ptr<const UkWordSet> restoreWords;
+    // Keys the engines have processed, replayed when they come again in the
+    // same word state. Null unless enabled, must be cleared whenever one of
+    // the settings above changes.
+    std::unique_ptr<UkTransitionTable> transitions;
+    // Picked by UkEngine::selectKeyProc() for the settings above, and picked
+    // again whenever one of them changes. Null runs the generic handler.
+    UkEngineKeyProc keyProc = nullptr;
+
+    UkEngineStats stats;
 };
 
 #define MAX_UK_ENGINE 128
+// longest word UkEngine::saveWord() can capture
+#define MAX_UK_SNAPSHOT_WORD 32
+// room left in the output buffer for processKeys to take one more key
+#define MAX_UK_KEY_OUTPUT 256
+// most one call writes: the longest macro text and the key that ended it,
+// in the charset with the longest characters
+#define MAX_UK_OUTPUT ((MAX_MACRO_TEXT_LEN + 1) * MAX_VN_OUT_BYTES)
+// most a cached key may change of the word: entries, key strokes and output
+// bytes. Keys that do more are always processed.
+#define MAX_UK_TRANSITION_CHANGE 4
+#define MAX_UK_TRANSITION_KEY_CHANGE 2
+#define MAX_UK_TRANSITION_OUTPUT 48
 
-enum VnWordForm { vnw_nonVn, vnw_empty, vnw_c, vnw_v, vnw_cv, vnw_vc, vnw_cvc };
+enum VnWordForm : signed char {
+    vnw_nonVn,
+    vnw_empty,
+    vnw_c,
+    vnw_v,
+    vnw_cv,
+    vnw_vc,
+    vnw_cvc
+};
 
 typedef std::function<void(int *pShiftPressed, int *pCapslockOn)>
     CheckKeyboardCaseCb;
 
+// Only what is read back of a key stroke, the rest of the event is derived
+// from keyCode again when the key strokes are restored. 8 bytes instead of
+// a whole UkKeyEvent.
 struct KeyBufEntry {
-    UkKeyEvent ev;
+    unsigned int keyCode;
+    UkCharType chType;
     bool converted;
 };
 
+// Fixed size history indexed from its oldest entry, so that forgetting
+// old entries only moves the start instead of the data.
+template <class T, int N>
+class UkRing {
+    static_assert((N & (N - 1)) == 0, "UkRing size must be a power of 2");
+
+public:
+    T &operator[](int i) { return m_data[(m_start + i) & (N - 1)]; }
+    const T &operator[](int i) const { return m_data[(m_start + i) & (N - 1)]; }
+    // forget the n oldest entries
+    void dropFront(int n) { m_start = (m_start + n) & (N - 1); }
+
+private:
+    T m_data[N];
+    int m_start = 0;
+};
+
 class UkEngine {
 public:
     UkEngine();
-    void setCtrlInfo(UkSharedMem *p) { m_pCtrl = p; }
+    void setCtrlInfo(UkSharedMem *p) {
+        m_pCtrl = p;
+        m_stateId = -1;
+    }
 
     void setCheckKbCaseFunc(CheckKeyboardCaseCb pFunc) {
         m_keyCheckFunc = pFunc;
     }
 
     bool atWordBeginning() const;
+    // lower case letters of the word being typed, with their tones, and
+    // vnl_nonVnChar for other symbols. Returns their count, or -1 if there
+    // are more than size.
+    int getCurrentWord(VnLexiName *letters, int size) const;
 
     int process(unsigned int keyCode, int &backs, unsigned char *outBuf,
                 int &outSize, UkOutputType &outType);
+    // process several keys, merging their output into one edit
+    int processKeys(const unsigned int *keyCodes, int keyCount, int &backs,
+                    unsigned char *outBuf, int &outSize,
+                    UkOutputType &outType);
     // just pass through without filtering
     void pass(int keyCode);
     // rebuild preedit from surrounding char
@@ -66,6 +163,11 @@ public:
     int restoreKeyStrokes(int &backs, unsigned char *outBuf, int &outSize,
                           UkOutputType &outType);
 
+    // The key handler for the input method and options of ctrl: the rules
+    // compiled for its built-in key map and spell check setting, or null for
+    // a user key map.
+    static UkEngineKeyProc selectKeyProc(const UkSharedMem &ctrl);
+
     // following methods must be public just to enable the use of pointers to
     // them they should not be called from outside.
     int processTone(UkKeyEvent &ev);
@@ -80,7 +182,6 @@ public:
     int processEscChar(UkKeyEvent &ev);
 
 protected:
-    static bool m_classInit;
     CheckKeyboardCaseCb m_keyCheckFunc;
     UkSharedMem *m_pCtrl;
 
@@ -92,9 +193,15 @@ protected:
 
     int m_keyBufSize;
     // unsigned int m_keyStrokes[MAX_UK_ENGINE];
-    KeyBufEntry m_keyStrokes[MAX_UK_ENGINE];
+    UkRing<KeyBufEntry, MAX_UK_ENGINE> m_keyStrokes;
     int m_keyCurrent;
     bool m_toEscape;
+    // the last Telex w was taken as u+, not as a hook
+    bool m_usedAsMapChar;
+    // state of the word in the transition table, valid while m_stateEpoch
+    // is the table's epoch; -1 when unknown
+    int m_stateId;
+    unsigned int m_stateEpoch;
 
     // variables valid in one session
     unsigned char *m_pOutBuf;
@@ -105,10 +212,19 @@ protected:
     bool m_keyRestoring;
     UkOutputType m_outType;
 
+    // 16 bytes, four to a cache line: the backward scans over the last word
+    // (getSeqSteps, macroMatch, lastWordIsNonVn...) read a few lines of the
+    // ring rather than one per entry or two.
     struct WordInfo {
+        unsigned int keyCode;
+        // canonical symbol, after caps, tone are removed
+        // for non-Vn, vnSym == -1
+        VnLexiName vnSym;
+
         // info for word ending at this position
         VnWordForm form;
-        int c1Offset, vOffset, c2Offset;
+        // at most a syllable back
+        signed char c1Offset, vOffset, c2Offset;
 
         union {
             VowelSeq vseq;
@@ -116,20 +232,80 @@ protected:
         };
 
         // info for current symbol
-        int caps, tone;
-        // canonical symbol, after caps, tone are removed
-        // for non-Vn, vnSym == -1
-        VnLexiName vnSym;
-        int keyCode;
+        signed char caps, tone;
     };
 
-    WordInfo m_buffer[MAX_UK_ENGINE];
+    UkRing<WordInfo, MAX_UK_ENGINE> m_buffer;
+
+public:
+    // The word being typed: its buffer entries and the key strokes that
+    // produced them. Restoring it gives the state the engine was in when it
+    // was saved, as if the word had been typed right after reset().
+    struct WordSnapshot {
+        int count = 0;
+        int keyCount = 0;
+        int singleMode = 0;
+        bool toEscape = false;
+        bool usedAsMapChar = false;
+        WordInfo buffer[MAX_UK_SNAPSHOT_WORD];
+        KeyBufEntry keyStrokes[MAX_UK_SNAPSHOT_WORD];
+    };
+
+    // false if the word is longer than MAX_UK_SNAPSHOT_WORD
+    bool saveWord(WordSnapshot &snap) const;
+    void restoreWord(const WordSnapshot &snap);
+
+    // What one key did in one state of the word, see UkTransitionTable.
+    struct Transition {
+        int state;
+        unsigned int key;
+        // state of the word after the key
+        int target;
+        // the word after the key: its length, and its entries and key
+        // strokes from first and keyFirst on, the ones before are unchanged
+        unsigned char count, keyCount, first, keyFirst;
+        int singleMode;
+        bool toEscape, usedAsMapChar;
+        WordInfo buffer[MAX_UK_TRANSITION_CHANGE];
+        KeyBufEntry keyStrokes[MAX_UK_TRANSITION_KEY_CHANGE];
+        // what process() gave back
+        int ret;
+        int backs;
+        UkOutputType outType;
+        int outSize;
+        unsigned char out[MAX_UK_TRANSITION_OUTPUT];
+    };
+
+protected:
+    int processRules(unsigned int keyCode, int &backs, unsigned char *outBuf,
+                     int &outSize, UkOutputType &outType);
+    // processRules() with the key map and the options read on every key
+    // taken from Keys, see UkRuntimeKeys in ukengine.cpp
+    template <class Keys>
+    int processRulesFor(unsigned int keyCode, int &backs,
+                        unsigned char *outBuf, int &outSize,
+                        UkOutputType &outType);
+    template <UkInputMethod IM>
+    static UkEngineKeyProc builtInKeyProc(bool spellCheck);
+    int processKeyEvent(UkKeyEvent &ev);
+    int processTransition(unsigned int keyCode, int &backs,
+                          unsigned char *outBuf, int &outSize,
+                          UkOutputType &outType);
+    int transitionState(const UkTransitionTable &table) const;
+    unsigned int transitionKey(unsigned int keyCode) const;
+    void recordTransition(UkTransitionTable &table, int state,
+                          unsigned int key, const WordSnapshot &before,
+                          int start, int keyStart, int ret, int backs,
+                          const unsigned char *outBuf, int outSize,
+                          UkOutputType outType);
+    static bool sameEntry(const WordInfo &a, const WordInfo &b);
 
     int processHookWithUO(UkKeyEvent &ev);
     int macroMatch(UkKeyEvent &ev);
     void markChange(int pos);
     void prepareBuffer(); // make sure we have a least 10 entries available
     int writeOutput(unsigned char *outBuf, int &outSize);
+    template <class Output> int writeOutputTo(Output &out);
     // int getSeqLength(int first, int last);
     int getSeqSteps(int first, int last) const;
     int getTonePosition(VowelSeq vs, bool terminated) const;
@@ -140,8 +316,103 @@ protected:
     void synchKeyStrokeBuffer();
     bool lastWordHasVnMark() const;
     bool lastWordIsNonVn() const;
+    bool lastWordIsRestoreWord() const;
+};
+
+// Transition table of the keys in each state of the word, filled as the
+// engines process them: the first time a key comes in some state, the rules
+// run and the table records the state it led to, what changed in the word
+// and the output. When the same key comes again in that state, the engine
+// only copies the change and the output instead of running the rules, a
+// hash lookup and a few entries of copying whatever the word.
+//
+// A state is a key sequence typed from the start of a word, the table is
+// a trie of the words typed. An engine only knows its state while it has
+// been in the table since the start of its word: backspace, key restore,
+// rebuild from surrounding text and the keys that end a word leave it
+// unknown until the next word starts.
+//
+// Fixed size and allocated at once. When it is full, it is cleared, which
+// makes the state of every engine unknown.
+#define UK_TRANSITION_ROOTS 8
+#define UK_TRANSITION_CAPACITY 8192
+#define UK_TRANSITION_SLOTS (2 * UK_TRANSITION_CAPACITY)
+
+class UkTransitionTable {
+public:
+    UkTransitionTable();
+    UkTransitionTable(const UkTransitionTable &) = delete;
+    UkTransitionTable &operator=(const UkTransitionTable &) = delete;
+
+    void clear();
+    // changes on each clear()
+    unsigned int epoch() const { return m_epoch; }
+    int size() const { return m_count; }
+
+    // state of an empty word, one for each combination of the engine flags
+    static int rootState(int singleMode, bool toEscape, bool usedAsMapChar) {
+        return (singleMode ? 1 : 0) | (toEscape ? 2 : 0) |
+               (usedAsMapChar ? 4 : 0);
+    }
+    // length of the word in state, in entries and in key strokes
+    int count(int state) const {
+        return state < UK_TRANSITION_ROOTS
+                   ? 0
+                   : m_transitions[state - UK_TRANSITION_ROOTS].count;
+    }
+    int keyCount(int state) const {
+        return state < UK_TRANSITION_ROOTS
+                   ? 0
+                   : m_transitions[state - UK_TRANSITION_ROOTS].keyCount;
+    }
+
+    const UkEngine::Transition *find(int state, unsigned int key) const;
+    // a new transition from state on key, with its target set; null if the
+    // table was full, it is cleared then
+    UkEngine::Transition *add(int state, unsigned int key);
+
+private:
+    static unsigned int slot(int state, unsigned int key);
+
+    std::unique_ptr<UkEngine::Transition[]> m_transitions;
+    // 1 + index in m_transitions, 0 for an empty slot
+    std::unique_ptr<int[]> m_slots;
+    int m_count = 0;
+    unsigned int m_epoch;
 };
 
 void SetupUnikeyEngine();
 
+// longest word UkCheckSyllable() can find valid, in letters (nghiêng)
+#define MAX_UK_SYLLABLE 7
+
+// Spelling of one word of existing text, checked with the rules the engine
+// applies while typing.
+struct UkSyllable {
+    // the word in the input: in StdVnChars or in bytes for UTF-8
+    int start;
+    int len;
+    bool valid;
+    // 0 for none, 1 to 5 for sắc, huyền, hỏi, ngã, nặng
+    unsigned char tone;
+    // letter of the word the tone is on, and the letter the tone rules put
+    // it on, -1 without a tone. Both are the same for an invalid word.
+    signed char tonePos;
+    signed char normTonePos;
+};
+
+// Checks a word given as letters in lower case with their tones, the way
+// UkEngine::getCurrentWord() returns them. False if the word is not a
+// Vietnamese syllable, or has more than one tone, or a tone its final
+// consonant does not allow.
+bool UkCheckSyllable(const VnLexiName *letters, int count, bool modernStyle,
+                     UkSyllable &result);
+// Checks every word of text, a word being a run of letters. Stops when out
+// is full and returns the number of words written, the next call can go on
+// from the end of the last one. Neither allocates nor takes a lock.
+int UkCheckSyllables(const StdVnChar *text, int len, bool modernStyle,
+                     UkSyllable *out, int maxCount);
+int UkCheckSyllablesUtf8(const char *text, int len, bool modernStyle,
+                         UkSyllable *out, int maxCount);
+
 #endif
@@ -7,8 +7,9 @@
 #include "unikeyinputcontext.h"
 #include "ukengine.h"
 #include "usrkeymap.h"
+#include <algorithm>
+#include <climits>
 #include <ctype.h>
-#include <iostream>
 #include <memory.h>
 #include <stdio.h>
 
@@ -29,12 +30,12 @@ UnikeyInputMethod::UnikeyInputMethod()
     : sharedMem_(std::make_unique<UkSharedMem>()) {
     SetupUnikeyEngine();
     sharedMem_->input.init();
-    sharedMem_->macStore.init();
     sharedMem_->vietKey = true;
     sharedMem_->usrKeyMapLoaded = false;
+    // before the settings below pick the key handler
+    CreateDefaultUnikeyOptions(&sharedMem_->options);
     setInputMethod(UkTelex);
     setOutputCharset(CONV_CHARSET_XUTF8);
-    CreateDefaultUnikeyOptions(&sharedMem_->options);
 }
 
 //--------------------------------------------
@@ -46,12 +47,14 @@ void UnikeyInputMethod::setInputMethod(UkInputMethod im) {
         // cout << "Switched to user mode\n"; //DEBUG
         sharedMem_->input.setIM(sharedMem_->usrKeyMap);
     }
+    settingsChanged();
     emit<Reset>();
     // cout << "IM changed to: " << im << endl; //DEBUG
 }
 
 void UnikeyInputMethod::setOutputCharset(int charset) {
     sharedMem_->charsetId = charset;
+    settingsChanged();
     emit<Reset>();
 }
 
@@ -64,6 +67,95 @@ void UnikeyInputMethod::setOptions(UnikeyOptions *pOpt) {
     sharedMem_->options.alwaysMacro = pOpt->alwaysMacro;
     sharedMem_->options.spellCheckEnabled = pOpt->spellCheckEnabled;
     sharedMem_->options.autoNonVnRestore = pOpt->autoNonVnRestore;
+    settingsChanged();
+}
+
+//--------------------------------------------
+void UnikeyInputMethod::setTransitionCache(bool enable) {
+    if (enable == (sharedMem_->transitions != nullptr))
+        return;
+    if (enable)
+        sharedMem_->transitions = std::make_unique<UkTransitionTable>();
+    else
+        sharedMem_->transitions.reset();
+}
+
+//--------------------------------------------
+void UnikeyInputMethod::setMacroRendering(
+    std::shared_ptr<const CMacroRendering> rendering) {
+    if (!rendering)
+        return;
+    if (rendering->table() == sharedMem_->macStore.get())
+        sharedMem_->macRendering = std::move(rendering);
+    else if (rendering->table() == sharedMem_->sysMacStore.get())
+        sharedMem_->sysMacRendering = std::move(rendering);
+}
+
+//--------------------------------------------
+// Render the macro texts again only if the table or the charset changed.
+void UnikeyInputMethod::renderMacros() {
+    auto render = [this](const std::shared_ptr<const CMacroTable> &table,
+                         std::shared_ptr<const CMacroRendering> &rendering) {
+        if (!table) {
+            rendering.reset();
+        } else if (!rendering || rendering->table() != table.get() ||
+                   rendering->charset() != sharedMem_->charsetId) {
+            rendering = std::make_shared<CMacroRendering>(
+                table, sharedMem_->charsetId);
+        }
+    };
+    render(sharedMem_->macStore, sharedMem_->macRendering);
+    render(sharedMem_->sysMacStore, sharedMem_->sysMacRendering);
+}
+
+//--------------------------------------------
+// The saved states, the cached transitions and the key handler were made
+// for the old settings. A macro rendering for another charset stays until
+// replaced, macroMatch does not use it.
+void UnikeyInputMethod::settingsChanged() {
+    generation_++;
+    sharedMem_->keyProc = UkEngine::selectKeyProc(*sharedMem_);
+    if (sharedMem_->transitions)
+        sharedMem_->transitions->clear();
+}
+
+//--------------------------------------------
+// Keep a few released slots around, so that switching focus between contexts
+// does not hit the allocator on every key.
+#define MAX_POOLED_ENGINE_SLOTS 8
+
+std::unique_ptr<UkEngineSlot> UnikeyInputMethod::acquireEngineSlot() {
+    std::unique_ptr<UkEngineSlot> slot;
+    if (!slotPool_.empty()) {
+        slot = std::move(slotPool_.back());
+        slotPool_.pop_back();
+    } else {
+        slot = std::make_unique<UkEngineSlot>();
+        slot->engine.setCtrlInfo(sharedMem_.get());
+    }
+    activeSlots_++;
+    return slot;
+}
+
+//--------------------------------------------
+void UnikeyInputMethod::releaseEngineSlot(std::unique_ptr<UkEngineSlot> slot) {
+    if (!slot)
+        return;
+    activeSlots_--;
+    if (slotPool_.size() >= MAX_POOLED_ENGINE_SLOTS)
+        return;
+    slot->engine.reset();
+    slot->engine.setCheckKbCaseFunc(nullptr);
+    slotPool_.push_back(std::move(slot));
+}
+
+//--------------------------------------------
+UnikeyMemoryStats UnikeyInputMethod::memoryStats() const {
+    UnikeyMemoryStats stats;
+    stats.activeSlots = activeSlots_;
+    stats.pooledSlots = slotPool_.size();
+    stats.bytes = (stats.activeSlots + stats.pooledSlots) * sizeof(UkEngineSlot);
+    return stats;
 }
 
 //--------------------------------------------
@@ -75,59 +167,112 @@ void UnikeyInputContext::setCapsState(int shiftPressed, int CapsLockOn) {
 }
 
 //--------------------------------------------
-UnikeyInputContext::UnikeyInputContext(UnikeyInputMethod *im) {
-    conn_ =
-        im->connect<UnikeyInputMethod::Reset>([this]() { engine_.reset(); });
-    engine_.setCtrlInfo(im->sharedMem());
-    engine_.setCheckKbCaseFunc([this](int *pShiftPressed, int *pCapsLockOn) {
+UnikeyInputContext::UnikeyInputContext(UnikeyInputMethod *im) : im_(im) {
+    conn_ = im->connect<UnikeyInputMethod::Reset>([this]() { resetBuf(); });
+}
+
+//--------------------------------------------
+UnikeyInputContext::~UnikeyInputContext() {
+    im_->releaseEngineSlot(std::move(slot_));
+}
+
+//--------------------------------------------
+UkEngine &UnikeyInputContext::engine() {
+    if (!slot_) {
+        slot_ = im_->acquireEngineSlot();
+        attachCapsState(slot_->engine);
+    }
+    return slot_->engine;
+}
+
+//--------------------------------------------
+void UnikeyInputContext::attachCapsState(UkEngine &eng) {
+    eng.setCheckKbCaseFunc([this](int *pShiftPressed, int *pCapsLockOn) {
         *pShiftPressed = shiftPressed_;
         *pCapsLockOn = capsLockOn_;
     });
 }
 
 //--------------------------------------------
-UnikeyInputContext::~UnikeyInputContext() {}
+void UnikeyInputContext::filter(unsigned int ch) {
+    UkEngine &eng = engine();
+    bufChars_ = sizeof(slot_->buf);
+    eng.process(ch, backspaces_, slot_->buf, bufChars_, output_);
+}
 
-#include <iostream>
 //--------------------------------------------
-void UnikeyInputContext::filter(unsigned int ch) {
-    bufChars_ = sizeof(buf_);
-    engine_.process(ch, backspaces_, buf_, bufChars_, output_);
-    if (ch != 0) {
-        std::cerr << "[uic::filter] ch=" << ch << " backs=" << backspaces_ << " bufChars=" << bufChars_ << " buf=\"" << (bufChars_ > 0 ? std::string((char*)buf_, bufChars_) : "") << "\"" << std::endl;
-    }
+size_t UnikeyInputContext::filterKeys(const unsigned int *keys, size_t count) {
+    UkEngine &eng = engine();
+    bufChars_ = sizeof(slot_->buf);
+    int keyCount = std::min<size_t>(count, INT_MAX);
+    return eng.processKeys(keys, keyCount, backspaces_, slot_->buf, bufChars_,
+                           output_);
 }
 
 //--------------------------------------------
 void UnikeyInputContext::putChar(unsigned int ch) {
-    engine_.pass(ch);
+    engine().pass(ch);
     bufChars_ = 0;
     backspaces_ = 0;
 }
 
 //--------------------------------------------
 void UnikeyInputContext::rebuildChar(VnLexiName ch) {
-    bufChars_ = sizeof(buf_);
-    engine_.rebuildChar(ch, backspaces_, buf_, bufChars_);
+    UkEngine &eng = engine();
+    bufChars_ = sizeof(slot_->buf);
+    eng.rebuildChar(ch, backspaces_, slot_->buf, bufChars_);
 }
 
 //--------------------------------------------
-void UnikeyInputContext::resetBuf() { engine_.reset(); }
+// A reset engine carries no state, so give it back to the pool.
+void UnikeyInputContext::resetBuf() {
+    im_->releaseEngineSlot(std::move(slot_));
+    backspaces_ = 0;
+    bufChars_ = 0;
+}
 
 //--------------------------------------------
 void UnikeyInputContext::backspacePress() {
-    bufChars_ = sizeof(buf_);
-    engine_.processBackspace(backspaces_, buf_, bufChars_, output_);
+    UkEngine &eng = engine();
+    bufChars_ = sizeof(slot_->buf);
+    eng.processBackspace(backspaces_, slot_->buf, bufChars_, output_);
     //  printf("Backspaces: %d\n",UnikeyBackspaces);
 }
 
 //--------------------------------------------
 void UnikeyInputContext::restoreKeyStrokes() {
-    bufChars_ = sizeof(buf_);
-    engine_.restoreKeyStrokes(backspaces_, buf_, bufChars_, output_);
-    std::cerr << "[uic::restoreKeyStrokes] backs=" << backspaces_ << " bufChars=" << bufChars_ << " buf=\"" << (bufChars_ > 0 ? std::string((char*)buf_, bufChars_) : "") << "\"" << std::endl;
+    UkEngine &eng = engine();
+    bufChars_ = sizeof(slot_->buf);
+    eng.restoreKeyStrokes(backspaces_, slot_->buf, bufChars_, output_);
 }
 
 bool UnikeyInputContext::isAtWordBeginning() const {
-    return engine_.atWordBeginning();
+    return !slot_ || slot_->engine.atWordBeginning();
+}
+
+//--------------------------------------------
+int UnikeyInputContext::currentWord(VnLexiName *letters, int size) const {
+    return slot_ ? slot_->engine.getCurrentWord(letters, size) : 0;
+}
+
+//--------------------------------------------
+bool UnikeyInputContext::saveState(UkEngineState &state) const {
+    if (!slot_ || !slot_->engine.saveWord(state.word))
+        return false;
+    state.shiftPressed = shiftPressed_;
+    state.capsLockOn = capsLockOn_;
+    state.generation = im_->generation();
+    return true;
+}
+
+//--------------------------------------------
+bool UnikeyInputContext::restoreState(const UkEngineState &state) {
+    if (state.generation != im_->generation() ||
+        state.shiftPressed != shiftPressed_ ||
+        state.capsLockOn != capsLockOn_)
+        return false;
+    engine().restoreWord(state.word);
+    backspaces_ = 0;
+    bufChars_ = 0;
+    return true;
 }
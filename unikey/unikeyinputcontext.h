@@ -9,8 +9,44 @@
 
 #include "keycons.h"
 #include "ukengine.h"
+#include <cstddef>
+#include <cstdint>
 #include <fcitx-utils/connectableobject.h>
 #include <memory>
+#include <vector>
+
+// Engine state of one input context. It is only needed while the user is
+// typing in that context, so it is taken from UnikeyInputMethod on the first
+// key and handed back when the context is reset.
+struct UkEngineSlot {
+    UkEngine engine;
+    // what the engine writes, large enough for any single call
+    unsigned char buf[MAX_UK_OUTPUT];
+};
+
+// Output of the last call on a UnikeyInputContext: erase backspaces
+// characters before the cursor, then insert data[0..size). It points into
+// the context's engine slot, and is only valid until the next call.
+struct UkOutputSpan {
+    const unsigned char *data;
+    int size;
+    int backspaces;
+};
+
+// Engine state saved by UnikeyInputContext::saveState(). It is only valid
+// for the settings it was saved with.
+struct UkEngineState {
+    UkEngine::WordSnapshot word;
+    int shiftPressed = 0;
+    int capsLockOn = 0;
+    uint64_t generation = 0;
+};
+
+struct UnikeyMemoryStats {
+    size_t activeSlots; // held by input contexts
+    size_t pooledSlots; // released, kept for reuse
+    size_t bytes;       // memory used by both of the above
+};
 
 class UnikeyInputMethod : public fcitx::ConnectableObject {
 public:
@@ -27,16 +63,76 @@ public:
 
     //--------------------------------------------
     int loadMacroTable(const char *fileName) {
-        return sharedMem_->macStore.loadFromFile(fileName);
+        auto table = std::make_shared<CMacroTable>();
+        if (!table->loadFromFile(fileName, true))
+            return 0;
+        setMacroTable(std::move(table));
+        return 1;
+    }
+    // replace the macro table, e.g. with one loaded in another thread, with
+    // its texts rendered for the output charset if given. Without a
+    // rendering of the table for the current charset, a hit converts the
+    // text instead.
+    void setMacroTable(
+        std::shared_ptr<const CMacroTable> table,
+        std::shared_ptr<const CMacroRendering> rendering = nullptr) {
+        sharedMem_->macStore = std::move(table);
+        sharedMem_->macRendering = std::move(rendering);
+        settingsChanged();
+    }
+    // the system table under the one of setMacroTable, null for none
+    void setSystemMacroTable(
+        std::shared_ptr<const CMacroTable> table,
+        std::shared_ptr<const CMacroRendering> rendering = nullptr) {
+        sharedMem_->sysMacStore = std::move(table);
+        sharedMem_->sysMacRendering = std::move(rendering);
+        settingsChanged();
+    }
+    // use rendering for the table it was made from, if that is still one of
+    // the macro tables, e.g. after the charset changed
+    void setMacroRendering(std::shared_ptr<const CMacroRendering> rendering);
+    // render the texts of both tables for the current charset now, where
+    // needed. This takes a while on a large table: the addon builds the
+    // CMacroRendering on its worker and hands it over instead.
+    void renderMacros();
+    // drop all macros, the system ones too, and free the memory used by them
+    void unloadMacroTable() {
+        sharedMem_->macStore.reset();
+        sharedMem_->sysMacStore.reset();
+        sharedMem_->macRendering.reset();
+        sharedMem_->sysMacRendering.reset();
+        settingsChanged();
+    }
+    // words left as typed at word end, null for none
+    void setRestoreWords(std::shared_ptr<const UkWordSet> words) {
+        sharedMem_->restoreWords = std::move(words);
+        settingsChanged();
     }
 
+    // replay keys already processed in the same word state from a table
+    // instead of running the rules again, see UkTransitionTable
+    void setTransitionCache(bool enable);
+
     UkSharedMem *sharedMem() { return sharedMem_.get(); }
 
+    // changes whenever a setting that affects key processing changes
+    uint64_t generation() const { return generation_; }
+
+    // engine state pool shared by contexts of this input method
+    std::unique_ptr<UkEngineSlot> acquireEngineSlot();
+    void releaseEngineSlot(std::unique_ptr<UkEngineSlot> slot);
+    UnikeyMemoryStats memoryStats() const;
+
     FCITX_DECLARE_SIGNAL(UnikeyInputMethod, Reset, void());
 
 private:
+    void settingsChanged();
+
     FCITX_DEFINE_SIGNAL(UnikeyInputMethod, Reset);
     std::unique_ptr<UkSharedMem> sharedMem_;
+    std::vector<std::unique_ptr<UkEngineSlot>> slotPool_;
+    size_t activeSlots_ = 0;
+    uint64_t generation_ = 0;
 };
 
 class UnikeyInputContext {
@@ -50,6 +146,10 @@ public:
 
     // main handler, call every time a character input is received
     void filter(unsigned int ch);
+    // filter a run of keys at once, backspaces() and buf() then hold their
+    // merged result. Returns the number of keys taken, the rest need
+    // another call once that result is applied.
+    size_t filterKeys(const unsigned int *keys, size_t count);
     void putChar(unsigned int ch); // put new char without filtering
 
     // call to rebuild preedit from surrounding char
@@ -66,19 +166,34 @@ public:
     void restoreKeyStrokes();
 
     bool isAtWordBeginning() const;
+    // see UkEngine::getCurrentWord
+    int currentWord(VnLexiName *letters, int size) const;
+
+    // copy the state of the current word out, returns false if there is
+    // none (reset) or the word is too long to be saved
+    bool saveState(UkEngineState &state) const;
+    // put a saved state back, returns false (and changes nothing) if the
+    // settings or the caps state differ from when it was saved
+    bool restoreState(const UkEngineState &state);
 
     int backspaces() const { return backspaces_; }
     int bufChars() const { return bufChars_; }
-    const unsigned char *buf() const { return buf_; }
+    const unsigned char *buf() const { return slot_ ? slot_->buf : nullptr; }
+    UkOutputSpan output() const { return {buf(), bufChars_, backspaces_}; }
 
 private:
+    UkEngine &engine();
+    void attachCapsState(UkEngine &eng);
+
     fcitx::ScopedConnection conn_;
 
-    unsigned char buf_[1024];
+    // must outlive this context
+    UnikeyInputMethod *im_;
+    // null until the first key, and again after each reset
+    std::unique_ptr<UkEngineSlot> slot_;
     int backspaces_ = 0;
-    int bufChars_;
+    int bufChars_ = 0;
     UkOutputType output_;
-    UkEngine engine_;
 
     int capsLockOn_ = 0;
     int shiftPressed_ = 0;
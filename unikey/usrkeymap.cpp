@@ -5,15 +5,20 @@
  */
 
 #include "usrkeymap.h"
+#include "cachefile.h"
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <fcitx-utils/fdstreambuf.h>
 #include <fcitx-utils/log.h>
 #include <fcitx-utils/misc.h>
 #include <fcitx-utils/stringutils.h>
 #include <istream>
 #include <string>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <vector>
 
 namespace {
@@ -48,6 +53,47 @@ constexpr UkEventLabelPair UkEvLabelList[] = {
 
 constexpr auto UkEvLabelCount = FCITX_ARRAY_SIZE(UkEvLabelList);
 
+//-------------------------------------------
+// Compiled keymap, written next to the keymap file as <name>.bin.
+// Layout: header, int32_t keyMap[256]. Like the macro cache, it stores
+// native ints, see cachefile.h.
+//-------------------------------------------
+constexpr char UkKeyMapCacheMagic[8] = "UKKEYMP";
+constexpr uint32_t UkKeyMapCacheVersion = 1;
+
+struct UkKeyMapCache {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    UkCacheStamp stamp;
+    int32_t keyMap[256];
+};
+
+// One read of the whole file, which must be exactly one valid cache.
+bool readKeyMapCache(const char *cacheName, const struct stat &src,
+                     int keyMap[256]) {
+    int fd = open(cacheName, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    UkKeyMapCache cache;
+    char extra;
+    struct iovec iov[2] = {{&cache, sizeof(cache)}, {&extra, 1}};
+    ssize_t n = readv(fd, iov, 2);
+    close(fd);
+    if (n != (ssize_t)sizeof(cache) ||
+        memcmp(cache.magic, UkKeyMapCacheMagic, sizeof(cache.magic)) ||
+        cache.version != UkKeyMapCacheVersion || cache.count != 256 ||
+        !cache.stamp.matches(src))
+        return false;
+    for (int c = 0; c < 256; c++) {
+        if (cache.keyMap[c] < 0 || cache.keyMap[c] >= vneCount + vnl_lastChar)
+            return false;
+    }
+    for (int c = 0; c < 256; c++)
+        keyMap[c] = cache.keyMap[c];
+    return true;
+}
+
 //-------------------------------------------
 void initKeyMap(int keyMap[256]) {
     unsigned int c;
@@ -98,9 +144,14 @@ static bool parseNameValue(std::string_view line, std::string_view *name,
 
 //-----------------------------------------------------
 DllExport void UkLoadKeyMap(int fd, int keyMap[256]) {
-    std::vector<UkKeyMapping> orderMap = UkLoadKeyOrderMap(fd);
+    UkBuildKeyMap(UkLoadKeyOrderMap(fd), keyMap);
+}
+
+//-----------------------------------------------------
+DllExport void UkBuildKeyMap(const std::vector<UkKeyMapping> &pMap,
+                             int keyMap[256]) {
     initKeyMap(keyMap);
-    for (const auto &item : orderMap) {
+    for (const auto &item : pMap) {
         keyMap[item.key] = item.action;
         if (item.action < vneCount) {
             keyMap[tolower(item.key)] = item.action;
@@ -108,6 +159,45 @@ DllExport void UkLoadKeyMap(int fd, int keyMap[256]) {
     }
 }
 
+//-----------------------------------------------------
+DllExport bool UkLoadKeyMapFile(const char *fname, int keyMap[256],
+                                bool useCache) {
+    std::string cacheName;
+    struct stat src;
+    if (useCache && stat(fname, &src) == 0) {
+        cacheName = std::string(fname) + ".bin";
+        if (readKeyMapCache(cacheName.c_str(), src, keyMap))
+            return true;
+    }
+
+    int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    UkLoadKeyMap(fd, keyMap);
+    // stat the file read, it may have been replaced since the first stat
+    bool fresh = !cacheName.empty() && fstat(fd, &src) == 0;
+    close(fd);
+    if (fresh)
+        UkWriteKeyMapCache(cacheName.c_str(), src, keyMap);
+    return true;
+}
+
+//-----------------------------------------------------
+DllExport bool UkWriteKeyMapCache(const char *cacheName,
+                                  const struct stat &src,
+                                  const int keyMap[256]) {
+    UkKeyMapCache cache;
+    memset(&cache, 0, sizeof(cache));
+    memcpy(cache.magic, UkKeyMapCacheMagic, sizeof(cache.magic));
+    cache.version = UkKeyMapCacheVersion;
+    cache.count = 256;
+    cache.stamp.set(src);
+    for (int c = 0; c < 256; c++)
+        cache.keyMap[c] = keyMap[c];
+
+    return UkWriteCacheFile(cacheName, src, {{&cache, sizeof(cache)}});
+}
+
 //------------------------------------------------------------------
 DllExport std::vector<UkKeyMapping> UkLoadKeyOrderMap(int fd) {
     size_t lineCount = 0;
@@ -9,9 +9,23 @@
 
 #include "inputproc.h"
 #include <cstdio>
+#include <sys/stat.h>
 #include <vector>
 
 DllInterface void UkLoadKeyMap(int fd, int keyMap[256]);
+// The 256 entry map of the key mappings of a keymap file.
+DllInterface void UkBuildKeyMap(const std::vector<UkKeyMapping> &pMap,
+                                int keyMap[256]);
+// Like UkLoadKeyMap of the file fname. With useCache, the map is read from
+// the compiled copy in fname.bin as long as fname is not modified, and the
+// copy is written again when it is stale. False if fname cannot be read.
+DllInterface bool UkLoadKeyMapFile(const char *fname, int keyMap[256],
+                                   bool useCache = false);
+// Compiled copy of the map built from the keymap file src was stat'ed from,
+// e.g. written by the keymap editor next to the file it saved.
+DllInterface bool UkWriteKeyMapCache(const char *cacheName,
+                                     const struct stat &src,
+                                     const int keyMap[256]);
 DllInterface std::vector<UkKeyMapping> UkLoadKeyOrderMap(int fd);
 DllInterface void UkStoreKeyOrderMap(FILE *f,
                                      const std::vector<UkKeyMapping> &pMap);
@@ -67,6 +67,11 @@ DllInterface int VnConvert(int inCharset, int outCharset, UKBYTE *input,
 DllInterface int VnFileConvert(int inCharset, int outCharset,
                                const char *inFile, const char *outFile);
 
+// Table-driven conversion of one block of a larger input, see blockconv.cpp
+DllInterface int VnConvertBlock(int inCharset, int outCharset,
+                                const UKBYTE *input, UKBYTE *output,
+                                int *pInLen, int *pMaxOutLen, int final);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -102,6 +107,29 @@ struct _VnConvOptions {
     int smartViqr;
 };
 
+// VnConvert and VnConvertBlock with the options given per call instead of
+// the ones of VnConvSetOptions. They don't modify any shared state, so they
+// can be called from several threads at once.
+DllInterface int VnConvertWithOptions(int inCharset, int outCharset,
+                                      const VnConvOptions *pOptions,
+                                      UKBYTE *input, UKBYTE *output,
+                                      int *pInLen, int *pMaxOutLen);
+DllInterface int VnConvertBlockWithOptions(int inCharset, int outCharset,
+                                           const VnConvOptions *pOptions,
+                                           const UKBYTE *input, UKBYTE *output,
+                                           int *pInLen, int *pMaxOutLen,
+                                           int final);
+
+// charset names accepted by VnConvCharsetId, sorted by name
+extern const CharsetNameId CharsetIdMap[];
+extern const int CharsetCount;
+
+// case-insensitive lookup in CharsetIdMap, -1 if not found
+DllInterface int VnConvCharsetId(const char *name);
+
+// threads used to convert one file, 0 (default) for one per core
+DllInterface void VnConvSetFileThreads(int threads);
+
 DllInterface void VnConvSetOptions(VnConvOptions *pOptions);
 DllInterface void VnConvGetOptions(VnConvOptions *pOptions);
 DllInterface void VnConvResetOptions(VnConvOptions *pOptions);
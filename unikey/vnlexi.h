@@ -7,7 +7,7 @@
 #ifndef __VN_LEXI_H
 #define __VN_LEXI_H
 
-enum VnLexiName {
+enum VnLexiName : short {
     vnl_nonVnChar = -1,
     vnl_A,
     vnl_a,
@@ -199,7 +199,7 @@ enum VnLexiName {
     vnl_lastChar,
 };
 
-enum VowelSeq {
+enum VowelSeq : signed char {
     vs_nil = -1,
     vs_a,
     vs_ar,
@@ -273,7 +273,7 @@ enum VowelSeq {
     vs_yeru
 };
 
-enum ConSeq {
+enum ConSeq : signed char {
     cs_nil = -1,
     cs_b,
     cs_c,
@@ -0,0 +1,208 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: LGPL-2.0-or-later
+ */
+
+#include "wordset.h"
+#include "cachefile.h"
+#include <algorithm>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+
+using namespace std;
+
+// bloom filter bits per word and probes per query, about 0.5% of the words
+// not in the set get past the filter
+#define WORDSET_BITS_PER_WORD 12
+#define WORDSET_PROBES 6
+
+//---------------------------------------------------------------
+// Compiled word set cache, written next to the word file as <name>.bin.
+// Layout: header, bloom filter, hashes, see cachefile.h.
+//---------------------------------------------------------------
+#define UKWORDSET_CACHE_MAGIC "UKWORDS"
+#define UKWORDSET_CACHE_VERSION 1
+
+struct WordSetCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    UkCacheStamp stamp;
+    uint32_t bloomBits;
+    uint32_t reserved;
+};
+
+//---------------------------------------------------------------
+UkWordSet::UkWordSet() { resetContent(); }
+
+//---------------------------------------------------------------
+UkWordSet::~UkWordSet() { unmapCache(); }
+
+//---------------------------------------------------------------
+void UkWordSet::resetContent() {
+    unmapCache();
+    m_bloom.clear();
+    m_bloom.shrink_to_fit();
+    m_hashes.clear();
+    m_hashes.shrink_to_fit();
+    m_count = 0;
+    m_bloomBits = 0;
+}
+
+//---------------------------------------------------------------
+// FNV-1a of the lower case word, mixed so that all bits depend on it.
+//---------------------------------------------------------------
+uint64_t UkWordSet::hashWord(const char *word, int len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)tolower((unsigned char)word[i]);
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+//---------------------------------------------------------------
+void UkWordSet::build(vector<uint64_t> &hashes) {
+    sort(hashes.begin(), hashes.end());
+    hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+    hashes.shrink_to_fit();
+    m_hashes.swap(hashes);
+    m_count = m_hashes.size();
+
+    m_bloomBits = 64;
+    while (m_bloomBits < (uint64_t)m_count * WORDSET_BITS_PER_WORD &&
+           m_bloomBits < (1U << 31))
+        m_bloomBits <<= 1;
+    m_bloom.assign(m_bloomBits / 64, 0);
+    for (uint64_t h : m_hashes) {
+        uint64_t step = (h >> 32) | 1;
+        for (int i = 0; i < WORDSET_PROBES; i++) {
+            uint32_t bit = (h + i * step) & (m_bloomBits - 1);
+            m_bloom[bit / 64] |= (uint64_t)1 << (bit % 64);
+        }
+    }
+}
+
+//---------------------------------------------------------------
+bool UkWordSet::contains(const char *word, int len) const {
+    if (m_count == 0 || len <= 0 || len > UK_WORDSET_MAX_WORD)
+        return false;
+    uint64_t h = hashWord(word, len);
+    uint64_t step = (h >> 32) | 1;
+    const uint64_t *filter = bloom();
+    for (int i = 0; i < WORDSET_PROBES; i++) {
+        uint32_t bit = (h + i * step) & (m_bloomBits - 1);
+        if (!(filter[bit / 64] & ((uint64_t)1 << (bit % 64))))
+            return false;
+    }
+    return binary_search(hashes(), hashes() + m_count, h);
+}
+
+//---------------------------------------------------------------
+bool UkWordSet::mapCache(const char *cacheName, const struct stat &src) {
+    void *mapping;
+    size_t size;
+    if (!UkMapCacheFile(cacheName, sizeof(WordSetCacheHeader), mapping, size))
+        return false;
+
+    const WordSetCacheHeader *header = (const WordSetCacheHeader *)mapping;
+    size_t expected = sizeof(WordSetCacheHeader) + header->bloomBits / 8 +
+                      (size_t)header->count * sizeof(uint64_t);
+    if (memcmp(header->magic, UKWORDSET_CACHE_MAGIC, sizeof(header->magic)) ||
+        header->version != UKWORDSET_CACHE_VERSION ||
+        !header->stamp.matches(src) || header->bloomBits < 64 ||
+        (header->bloomBits & (header->bloomBits - 1)) ||
+        expected != size) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    const char *p = (const char *)mapping + sizeof(WordSetCacheHeader);
+    m_mapBloom = (const uint64_t *)p;
+    p += header->bloomBits / 8;
+    m_mapHashes = (const uint64_t *)p;
+
+    m_mapping = mapping;
+    m_mappingSize = size;
+    m_count = header->count;
+    m_bloomBits = header->bloomBits;
+    return true;
+}
+
+//---------------------------------------------------------------
+bool UkWordSet::writeCache(const char *cacheName, const struct stat &src) {
+    WordSetCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, UKWORDSET_CACHE_MAGIC, sizeof(header.magic));
+    header.version = UKWORDSET_CACHE_VERSION;
+    header.count = m_count;
+    header.stamp.set(src);
+    header.bloomBits = m_bloomBits;
+
+    return UkWriteCacheFile(
+        cacheName, src,
+        {{&header, sizeof(header)},
+         {m_bloom.data(), m_bloom.size() * sizeof(uint64_t)},
+         {m_hashes.data(), m_hashes.size() * sizeof(uint64_t)}});
+}
+
+//---------------------------------------------------------------
+void UkWordSet::unmapCache() {
+    if (!m_mapping)
+        return;
+    munmap(m_mapping, m_mappingSize);
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+    m_mapBloom = nullptr;
+    m_mapHashes = nullptr;
+}
+
+//---------------------------------------------------------------
+int UkWordSet::loadFromFile(const char *fname, bool useCache,
+                            const char *cacheName) {
+    struct stat src;
+    string cache;
+    if (useCache && stat(fname, &src) == 0) {
+        cache = cacheName ? cacheName : string(fname) + ".bin";
+        resetContent();
+        if (mapCache(cache.c_str(), src))
+            return 1;
+    }
+
+    FILE *f = fopen(fname, "r");
+    if (f == NULL)
+        return 0;
+
+    resetContent();
+    vector<uint64_t> words;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        // skip the rest of a line that is too long
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+            int c;
+            while ((c = fgetc(f)) != EOF && c != '\n')
+                ;
+            continue;
+        }
+        while (len > 0 && isspace((unsigned char)line[len - 1]))
+            line[--len] = 0;
+        if (len == 0 || line[0] == '#' || len > UK_WORDSET_MAX_WORD)
+            continue;
+        words.push_back(hashWord(line, len));
+    }
+    fclose(f);
+    build(words);
+
+    if (!cache.empty() && stat(fname, &src) == 0)
+        writeCache(cache.c_str(), src);
+    return 1;
+}
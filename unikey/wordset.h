@@ -0,0 +1,71 @@
+/*
+ * SPDX-FileCopyrightText: 2026
+ *
+ * SPDX-License-Identifier: LGPL-2.0-or-later
+ */
+
+#ifndef __UK_WORDSET_H
+#define __UK_WORDSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <vector>
+
+// longest word kept, longer ones are never found
+#define UK_WORDSET_MAX_WORD 32
+
+// Set of ASCII words, e.g. English and technical words the engine should
+// leave as typed. A query first probes a bloom filter, so a word that is
+// not in the set (nearly all Vietnamese words) costs a hash and a few bit
+// tests, and only the others are looked up in the sorted hashes of the
+// words.
+class UkWordSet {
+public:
+    UkWordSet();
+    UkWordSet(const UkWordSet &) = delete;
+    UkWordSet &operator=(const UkWordSet &) = delete;
+    ~UkWordSet();
+
+    // The file has one word per line, lines starting with '#' are
+    // skipped. Case is ignored. With useCache, the compiled set is kept in
+    // cacheName, or fname.bin without one, and mapped directly as long as
+    // fname is not modified.
+    int loadFromFile(const char *fname, bool useCache = false,
+                     const char *cacheName = nullptr);
+    void resetContent();
+    int getCount() const { return m_count; }
+
+    // word is not null-terminated, case is ignored
+    bool contains(const char *word, int len) const;
+
+protected:
+    static uint64_t hashWord(const char *word, int len);
+    void build(std::vector<uint64_t> &hashes);
+    bool mapCache(const char *cacheName, const struct stat &src);
+    bool writeCache(const char *cacheName, const struct stat &src);
+    void unmapCache();
+
+    const uint64_t *bloom() const {
+        return m_mapping ? m_mapBloom : m_bloom.data();
+    }
+    const uint64_t *hashes() const {
+        return m_mapping ? m_mapHashes : m_hashes.data();
+    }
+
+    std::vector<uint64_t> m_bloom;
+    std::vector<uint64_t> m_hashes; // sorted, no duplicates
+    int m_count = 0;
+    uint32_t m_bloomBits = 0; // a power of 2
+
+    // A set mapped from its compiled file: the m_bloomBits / 64 words of
+    // the filter, then the m_count sorted hashes, in m_mapping. The size of
+    // the file must match both counts, and no content of them can make a
+    // query read outside the mapping.
+    void *m_mapping = nullptr;
+    size_t m_mappingSize = 0;
+    const uint64_t *m_mapBloom = nullptr;
+    const uint64_t *m_mapHashes = nullptr;
+};
+
+#endif